@@ -1,101 +1,429 @@
 #include <assert.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "HashMap.h"
 
-// We fix the number of hash buckets for simplicity.
-#define N_BUCKETS 8
+// Open addressing with Robin Hood hashing and backward-shift deletion.
+// Every slot stores the full hash of its key, so a probe compares keys only on a hash match.
+// Probe distances live in a separate array of metadata bytes, so a lookup usually reads one
+// cache line of metadata and a single slot.
+//
+// Every table also has a small Bloom filter - one 64-bit word per eight slots, two bits of it
+// per key, both in the same word. A lookup of a missing key usually stops at that single word
+// instead of probing a cluster of slots. Removal cannot clear bits, so they only go stale: the
+// filter is rebuilt with the table on every resize, and in place once removals since the last
+// rebuild reach half the capacity.
+//
+// Resizing is incremental: when the table has to grow or shrink, the old table is kept next to
+// the new one and every following modification moves MIGRATE_STEP of its slots over. Lookups
+// check both tables, so no single insert pays for rehashing the whole map.
+//
+// Lookups never write to the map. With a deferred free function set (hmap_set_deferred_free)
+// they may even race with a modification: every block they can reach (tables, keys) is then
+// released only through that function, reads are bounded by the capacity stored in the table
+// itself and key comparison never reads past the stored key, so the worst such a lookup can
+// return is a wrong answer, which the caller has to detect on its own.
 
-typedef struct Pair Pair;
+#define MIN_CAPACITY 8
+#define MIGRATE_STEP 8
+#define FILTER_SLOTS_PER_WORD 8 // Must not exceed MIN_CAPACITY.
 
-struct Pair {
+// Metadata byte values. Otherwise the byte is the probe distance plus one, saturated at
+// META_SATURATED - the exact distance can always be recomputed from the stored hash.
+#define META_EMPTY 0
+#define META_SATURATED 0xFE
+#define META_TOMBSTONE 0xFF // An entry moved out of (or removed from) the table being migrated.
+
+#define NOT_FOUND SIZE_MAX
+
+typedef struct Slot Slot;
+
+struct Slot {
+    uint32_t hash;
+    uint32_t length;
     char* key;
     void* value;
-    Pair* next; // Next item in a single-linked list.
+};
+
+typedef struct Table Table;
+
+struct Table {
+    size_t capacity; // Power of two.
+    size_t size;
+    size_t stale; // Keys removed since the filter was last rebuilt.
+    uint8_t* meta;
+    Slot* slots;
+    uint64_t* filter; // capacity / FILTER_SLOTS_PER_WORD words.
 };
 
 struct HashMap {
-    Pair* buckets[N_BUCKETS]; // Linked lists of key-value pairs.
+    Table* table; // Table receiving all insertions, NULL until the first one.
+    Table* old; // Table being migrated into `table`, or NULL.
+    size_t migrated; // Slots of `old` below this index were already moved.
     size_t size; // total number of entries in children.
+    size_t header; // Bytes reserved for the deferred free function in front of each block.
 };
 
-static unsigned int get_hash(const char* key);
+static size_t deferred_header_size = 0;
+static void (*deferred_free)(void* block) = NULL;
+
+static uint32_t get_hash(const char* key, size_t length);
+
+void hmap_set_deferred_free(size_t header_size, void (*free_block)(void* block))
+{
+    deferred_header_size = free_block ? header_size : 0;
+    deferred_free = free_block;
+}
+
+static void* block_alloc(HashMap* map, size_t size)
+{
+    char* block = malloc(map->header + size);
+    return block ? block + map->header : NULL;
+}
+
+// Free a block no lookup can reach any more.
+static void block_free(HashMap* map, void* ptr)
+{
+    free((char*)ptr - map->header);
+}
+
+// Free a block which a concurrent lookup may still be reading.
+static void block_release(HashMap* map, void* ptr)
+{
+    if (map->header)
+        deferred_free((char*)ptr - map->header);
+    else
+        free(ptr);
+}
+
+static char* key_copy(HashMap* map, const char* key, size_t length)
+{
+    char* copy = block_alloc(map, length + 1);
+    if (copy) {
+        memcpy(copy, key, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+static inline size_t filter_words(size_t capacity)
+{
+    return capacity / FILTER_SLOTS_PER_WORD;
+}
+
+static Table* table_new(HashMap* map, size_t capacity)
+{
+    // Slots, filter and metadata share the allocation with the header.
+    size_t filter_size = filter_words(capacity) * sizeof(uint64_t);
+    Table* table = block_alloc(map, sizeof(Table) + capacity * sizeof(Slot) + filter_size + capacity);
+    if (!table)
+        return NULL;
+    table->capacity = capacity;
+    table->size = 0;
+    table->stale = 0;
+    table->slots = (Slot*)(table + 1);
+    table->filter = (uint64_t*)(table->slots + capacity);
+    table->meta = (uint8_t*)(table->filter + filter_words(capacity));
+    memset(table->filter, 0, filter_size);
+    memset(table->meta, META_EMPTY, capacity);
+    return table;
+}
+
+static void table_free(HashMap* map, Table* table)
+{
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (table->meta[i] != META_EMPTY && table->meta[i] != META_TOMBSTONE)
+            block_free(map, table->slots[i].key);
+    }
+    block_free(map, table);
+}
+
+static inline bool is_live(uint8_t meta)
+{
+    return meta != META_EMPTY && meta != META_TOMBSTONE;
+}
+
+static inline size_t home_of(const Table* table, uint32_t hash)
+{
+    return hash & (table->capacity - 1);
+}
+
+static inline size_t meta_distance(const Table* table, size_t i, uint8_t meta)
+{
+    if (meta < META_SATURATED)
+        return meta - 1;
+    return (i - home_of(table, table->slots[i].hash)) & (table->capacity - 1);
+}
+
+static inline size_t distance_at(const Table* table, size_t i)
+{
+    assert(is_live(table->meta[i]));
+    return meta_distance(table, i, table->meta[i]);
+}
+
+static inline uint8_t encode_distance(size_t distance)
+{
+    return distance + 1 < META_SATURATED ? distance + 1 : META_SATURATED;
+}
+
+// The low bits of the hash choose the home slot, so the filter word is chosen by a remix of the
+// whole hash and the two bits come from its top twelve bits.
+static inline uint64_t* filter_word(const Table* table, uint32_t hash)
+{
+    return &table->filter[(hash * 0x9E3779B1u >> 12) & (filter_words(table->capacity) - 1)];
+}
+
+static inline uint64_t filter_bits(uint32_t hash)
+{
+    return (uint64_t)1 << (hash >> 20 & 63) | (uint64_t)1 << (hash >> 26);
+}
+
+static inline bool filter_may_contain(const Table* table, uint32_t hash)
+{
+    uint64_t bits = filter_bits(hash);
+    return (*filter_word(table, hash) & bits) == bits;
+}
+
+static size_t table_find(const Table* table, uint32_t hash, const char* key, size_t length)
+{
+    if (!table || !filter_may_contain(table, hash))
+        return NOT_FOUND;
+    size_t mask = table->capacity - 1;
+    size_t i = home_of(table, hash);
+    for (size_t distance = 0; distance < table->capacity; ++distance, i = (i + 1) & mask) {
+        uint8_t meta = table->meta[i];
+        if (meta == META_EMPTY)
+            return NOT_FOUND;
+        if (meta == META_TOMBSTONE)
+            continue;
+        // Robin Hood invariant: our key would have displaced any entry closer to its home.
+        if (meta_distance(table, i, meta) < distance)
+            return NOT_FOUND;
+        const Slot* slot = &table->slots[i];
+        // strncmp stops at the end of the stored key even if a racing writer tore the slot.
+        if (slot->hash == hash && slot->length == length && strncmp(key, slot->key, length) == 0)
+            return i;
+    }
+    return NOT_FOUND;
+}
+
+// Insert an entry known not to be present. The table must have a free slot and no tombstones.
+static void table_insert(Table* table, Slot slot)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = home_of(table, slot.hash);
+    size_t distance = 0;
+    *filter_word(table, slot.hash) |= filter_bits(slot.hash);
+    while (true) {
+        uint8_t meta = table->meta[i];
+        assert(meta != META_TOMBSTONE);
+        if (meta == META_EMPTY) {
+            table->meta[i] = encode_distance(distance);
+            table->slots[i] = slot;
+            table->size++;
+            return;
+        }
+        size_t current = distance_at(table, i);
+        if (current < distance) {
+            // Take the slot from the richer entry and carry it further.
+            Slot displaced = table->slots[i];
+            table->slots[i] = slot;
+            table->meta[i] = encode_distance(distance);
+            slot = displaced;
+            distance = current;
+        }
+        i = (i + 1) & mask;
+        distance++;
+    }
+}
+
+// Remove the entry at `i`, shifting the following entries of its cluster one slot back.
+static void table_remove_at(Table* table, size_t i)
+{
+    size_t mask = table->capacity - 1;
+    size_t next = (i + 1) & mask;
+    while (is_live(table->meta[next]) && distance_at(table, next) > 0) {
+        table->meta[i] = encode_distance(distance_at(table, next) - 1);
+        table->slots[i] = table->slots[next];
+        i = next;
+        next = (next + 1) & mask;
+    }
+    table->meta[i] = META_EMPTY;
+    table->size--;
+}
+
+// Drop the bits of removed keys. A lookup racing with this may miss a present key.
+static void filter_rebuild(Table* table)
+{
+    memset(table->filter, 0, filter_words(table->capacity) * sizeof(uint64_t));
+    for (size_t i = 0; i < table->capacity; ++i) {
+        if (is_live(table->meta[i]))
+            *filter_word(table, table->slots[i].hash) |= filter_bits(table->slots[i].hash);
+    }
+    table->stale = 0;
+}
+
+// Move up to `steps` slots of the old table into the current one.
+static void migrate(HashMap* map, size_t steps)
+{
+    Table* old = map->old;
+    if (!old)
+        return;
+    for (; steps > 0 && map->migrated < old->capacity; --steps, ++map->migrated) {
+        size_t i = map->migrated;
+        if (is_live(old->meta[i])) {
+            table_insert(map->table, old->slots[i]);
+            old->meta[i] = META_TOMBSTONE;
+            old->size--;
+        }
+    }
+    if (map->migrated == old->capacity) {
+        assert(old->size == 0);
+        map->old = NULL;
+        block_release(map, old);
+    }
+}
+
+static void start_resize(HashMap* map, size_t capacity)
+{
+    migrate(map, SIZE_MAX); // Finish the previous resize first.
+    Table* table = table_new(map, capacity);
+    if (!table)
+        return; // Keep the current table; it still has room (or can at least be probed).
+    map->old = map->table;
+    map->table = table;
+    map->migrated = 0;
+}
 
 HashMap* hmap_new()
 {
     HashMap* map = malloc(sizeof(HashMap));
     if (!map)
         return NULL;
-    memset(map, 0, sizeof(HashMap));
+    map->header = deferred_header_size;
+    // Most maps (those of leaf folders) stay empty - the table is allocated on the first insert.
+    map->table = NULL;
+    map->old = NULL;
+    map->migrated = 0;
+    map->size = 0;
     return map;
 }
 
 void hmap_free(HashMap* map)
 {
-    for (int h = 0; h < N_BUCKETS; ++h) {
-        for (Pair* p = map->buckets[h]; p;) {
-            Pair* q = p;
-            p = p->next;
-            free(q->key);
-            free(q);
-        }
-    }
+    if (map->old)
+        table_free(map, map->old);
+    if (map->table)
+        table_free(map, map->table);
     free(map);
 }
 
-static Pair* hmap_find(HashMap* map, int h, const char* key)
+void* hmap_get_prehashed(HashMap* map, const char* key, size_t length, uint32_t hash)
 {
-    for (Pair* p = map->buckets[h]; p; p = p->next) {
-        if (strcmp(key, p->key) == 0)
-            return p;
-    }
+    // Each table pointer is read once - a racing modification may replace it in the meantime.
+    Table* table = map->table;
+    size_t i = table_find(table, hash, key, length);
+    if (i != NOT_FOUND)
+        return table->slots[i].value;
+    Table* old = map->old;
+    i = table_find(old, hash, key, length);
+    if (i != NOT_FOUND)
+        return old->slots[i].value;
     return NULL;
 }
 
 void* hmap_get(HashMap* map, const char* key)
 {
-    int h = get_hash(key);
-    Pair* p = hmap_find(map, h, key);
-    if (p)
-        return p->value;
-    else
-        return NULL;
+    size_t length = strlen(key);
+    return hmap_get_prehashed(map, key, length, get_hash(key, length));
+}
+
+uint32_t hmap_hash(const char* key, size_t length)
+{
+    return get_hash(key, length);
 }
 
 bool hmap_insert(HashMap* map, const char* key, void* value)
 {
     if (!value)
         return false;
-    int h = get_hash(key);
-    Pair* p = hmap_find(map, h, key);
-    if (p)
+    size_t length = strlen(key);
+    uint32_t hash = get_hash(key, length);
+    if (table_find(map->table, hash, key, length) != NOT_FOUND)
         return false; // Already exists.
-    Pair* new_p = malloc(sizeof(Pair));
-    new_p->key = strdup(key);
-    new_p->value = value;
-    new_p->next = map->buckets[h];
-    map->buckets[h] = new_p;
+    if (map->old && table_find(map->old, hash, key, length) != NOT_FOUND)
+        return false;
+
+    if (!map->table) {
+        map->table = table_new(map, MIN_CAPACITY);
+        if (!map->table)
+            return false;
+    }
+
+    // Keep the load factor of the current table at most 7/8.
+    if ((map->size + 1) * 8 > map->table->capacity * 7)
+        start_resize(map, map->table->capacity * 2);
+    else
+        migrate(map, MIGRATE_STEP);
+    if (map->table->size == map->table->capacity)
+        return false; // Could not grow.
+
+    Slot slot = { hash, length, key_copy(map, key, length), value };
+    if (!slot.key)
+        return false;
+    table_insert(map->table, slot);
     map->size++;
     return true;
 }
 
+bool hmap_reserve(HashMap* map, size_t count)
+{
+    if (count == 0)
+        return true;
+    size_t capacity = MIN_CAPACITY;
+    while (count * 8 > capacity * 7)
+        capacity *= 2;
+    if (!map->table) {
+        map->table = table_new(map, capacity);
+        return map->table != NULL;
+    }
+    if (map->table->capacity < capacity) {
+        start_resize(map, capacity);
+        migrate(map, SIZE_MAX);
+    }
+    return map->table->capacity >= capacity;
+}
+
 bool hmap_remove(HashMap* map, const char* key)
 {
-    int h = get_hash(key);
-    Pair** pp = &(map->buckets[h]);
-    while (*pp) {
-        Pair* p = *pp;
-        if (strcmp(key, p->key) == 0) {
-            *pp = p->next;
-            free(p->key);
-            free(p);
-            map->size--;
-            return true;
-        }
-        pp = &(p->next);
+    size_t length = strlen(key);
+    uint32_t hash = get_hash(key, length);
+    size_t i = table_find(map->table, hash, key, length);
+    if (i != NOT_FOUND) {
+        char* removed_key = map->table->slots[i].key;
+        table_remove_at(map->table, i);
+        block_release(map, removed_key);
+        if (++map->table->stale * 2 >= map->table->capacity)
+            filter_rebuild(map->table);
+    } else {
+        if (!map->old)
+            return false;
+        i = table_find(map->old, hash, key, length);
+        if (i == NOT_FOUND)
+            return false;
+        map->old->meta[i] = META_TOMBSTONE;
+        map->old->size--;
+        block_release(map, map->old->slots[i].key);
     }
-    return false;
+    map->size--;
+
+    if (!map->old && map->table->capacity > MIN_CAPACITY && map->size * 8 < map->table->capacity)
+        start_resize(map, map->table->capacity / 2);
+    else
+        migrate(map, MIGRATE_STEP);
+    return true;
 }
 
 size_t hmap_size(HashMap* map)
@@ -105,30 +433,41 @@ size_t hmap_size(HashMap* map)
 
 HashMapIterator hmap_iterator(HashMap* map)
 {
-    HashMapIterator it = { 0, map->buckets[0] };
+    HashMapIterator it = { map->old ? 0 : 1, 0 };
     return it;
 }
 
 bool hmap_next(HashMap* map, HashMapIterator* it, const char** key, void** value)
 {
-    Pair* p = it->pair;
-    while (!p && it->bucket < N_BUCKETS - 1) {
-        p = map->buckets[++it->bucket];
+    while (it->table <= 1) {
+        Table* table = it->table == 0 ? map->old : map->table;
+        while (table && it->slot < table->capacity) {
+            size_t i = it->slot++;
+            if (is_live(table->meta[i])) {
+                *key = table->slots[i].key;
+                *value = table->slots[i].value;
+                return true;
+            }
+        }
+        it->table++;
+        it->slot = 0;
     }
-    if (!p)
-        return false;
-    *key = p->key;
-    *value = p->value;
-    it->pair = p->next;
-    return true;
+    return false;
 }
 
-static unsigned int get_hash(const char* key)
+// FNV-1a followed by the MurmurHash3 finalizer, so that the low bits used for the home slot
+// depend on the whole key.
+static uint32_t get_hash(const char* key, size_t length)
 {
-    unsigned int hash = 17;
-    while (*key) {
-        hash = (hash << 3) + hash + *key;
-        ++key;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; ++i) {
+        hash ^= (unsigned char)key[i];
+        hash *= 16777619u;
     }
-    return hash % N_BUCKETS;
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <stdbool.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 // A structure representing a mapping from keys to values.
@@ -17,16 +18,38 @@ void hmap_free(HashMap* map);
 // Get the value stored under `key`, or NULL if not present.
 void* hmap_get(HashMap* map, const char* key);
 
+// Return the hash of the first `length` characters of `key`, as used by the map.
+uint32_t hmap_hash(const char* key, size_t length);
+
+// Like `hmap_get`, but the key is given by its first `length` characters (it does not
+// have to be null-terminated) together with its `hmap_hash`, so callers that look up
+// the same name repeatedly (or already know its length) do not rehash it.
+void* hmap_get_prehashed(HashMap* map, const char* key, size_t length, uint32_t hash);
+
 // Insert a `value` under `key` and return true,
 // or do nothing and return false if `key` already exists in the children.
 // `value` must not be NULL.
 // (The caller can free `key` at any time - the children internally uses a copy of it).
 bool hmap_insert(HashMap* map, const char* key, void* value);
 
+// Make room for `count` elements in total, so that inserting up to that many does not grow the
+// map. Return false on allocation failure (the map stays usable).
+bool hmap_reserve(HashMap* map, size_t count);
+
 // Remove the value under `key` and return true (the value is not free'd),
 // or do nothing and return false if `key` was not present.
 bool hmap_remove(HashMap* map, const char* key);
 
+// By default memory released by hmap_insert/hmap_remove (replaced tables, copies of removed
+// keys) is freed at once. A program which lets lock-free readers call `hmap_get_prehashed`
+// concurrently with modifications can instead route it through `free_block`, which must free
+// the block only when no such reader can be looking at it any more. Every block allocated by
+// maps created afterwards starts with `header_size` bytes reserved for `free_block`'s use;
+// `free_block` gets a pointer to that header (the block itself is what `malloc` returned).
+// Memory freed by hmap_free does not go through `free_block`.
+// Passing NULL restores the default for maps created afterwards.
+void hmap_set_deferred_free(size_t header_size, void (*free_block)(void* block));
+
 // Return the number of elements in the children.
 size_t hmap_size(HashMap* map);
 
@@ -52,6 +75,6 @@ HashMapIterator hmap_iterator(HashMap* map);
 bool hmap_next(HashMap* map, HashMapIterator* it, const char** key, void** value);
 
 struct HashMapIterator {
-    int bucket;
-    void* pair;
+    int table; // Which of the internal tables the iterator is in.
+    size_t slot; // Next slot of that table to look at.
 };
@@ -0,0 +1,156 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "HashMap.h"
+
+// The original chained implementation of HashMap.h. Tree uses HashMap.c; this one is kept only
+// as the baseline for the hash map microbenchmark (src/bench/hashmap.c).
+
+// We fix the number of hash buckets for simplicity.
+#define N_BUCKETS 8
+
+typedef struct Pair Pair;
+
+struct Pair {
+    char* key;
+    void* value;
+    Pair* next; // Next item in a single-linked list.
+};
+
+struct HashMap {
+    Pair* buckets[N_BUCKETS]; // Linked lists of key-value pairs.
+    size_t size; // total number of entries in children.
+};
+
+static unsigned int get_hash(const char* key, size_t length);
+
+HashMap* hmap_new()
+{
+    HashMap* map = malloc(sizeof(HashMap));
+    if (!map)
+        return NULL;
+    memset(map, 0, sizeof(HashMap));
+    return map;
+}
+
+void hmap_free(HashMap* map)
+{
+    for (int h = 0; h < N_BUCKETS; ++h) {
+        for (Pair* p = map->buckets[h]; p;) {
+            Pair* q = p;
+            p = p->next;
+            free(q->key);
+            free(q);
+        }
+    }
+    free(map);
+}
+
+static Pair* hmap_find(HashMap* map, int h, const char* key, size_t length)
+{
+    for (Pair* p = map->buckets[h]; p; p = p->next) {
+        if (strncmp(key, p->key, length) == 0 && p->key[length] == '\0')
+            return p;
+    }
+    return NULL;
+}
+
+void* hmap_get_prehashed(HashMap* map, const char* key, size_t length, uint32_t hash)
+{
+    Pair* p = hmap_find(map, hash, key, length);
+    if (p)
+        return p->value;
+    else
+        return NULL;
+}
+
+void* hmap_get(HashMap* map, const char* key)
+{
+    size_t length = strlen(key);
+    return hmap_get_prehashed(map, key, length, get_hash(key, length));
+}
+
+uint32_t hmap_hash(const char* key, size_t length)
+{
+    return get_hash(key, length);
+}
+
+bool hmap_insert(HashMap* map, const char* key, void* value)
+{
+    if (!value)
+        return false;
+    int h = get_hash(key, strlen(key));
+    Pair* p = hmap_find(map, h, key, strlen(key));
+    if (p)
+        return false; // Already exists.
+    Pair* new_p = malloc(sizeof(Pair));
+    new_p->key = strdup(key);
+    new_p->value = value;
+    new_p->next = map->buckets[h];
+    map->buckets[h] = new_p;
+    map->size++;
+    return true;
+}
+
+// The number of buckets is fixed, so there is nothing to make room for.
+bool hmap_reserve(HashMap* map, size_t count)
+{
+    (void)map;
+    (void)count;
+    return true;
+}
+
+bool hmap_remove(HashMap* map, const char* key)
+{
+    int h = get_hash(key, strlen(key));
+    Pair** pp = &(map->buckets[h]);
+    while (*pp) {
+        Pair* p = *pp;
+        if (strcmp(key, p->key) == 0) {
+            *pp = p->next;
+            free(p->key);
+            free(p);
+            map->size--;
+            return true;
+        }
+        pp = &(p->next);
+    }
+    return false;
+}
+
+size_t hmap_size(HashMap* map)
+{
+    return map->size;
+}
+
+// The iterator's `slot` field holds a pointer to the next Pair.
+HashMapIterator hmap_iterator(HashMap* map)
+{
+    HashMapIterator it = { 0, (uintptr_t)map->buckets[0] };
+    return it;
+}
+
+bool hmap_next(HashMap* map, HashMapIterator* it, const char** key, void** value)
+{
+    Pair* p = (Pair*)it->slot;
+    while (!p && it->table < N_BUCKETS - 1) {
+        p = map->buckets[++it->table];
+    }
+    if (!p)
+        return false;
+    *key = p->key;
+    *value = p->value;
+    it->slot = (uintptr_t)p->next;
+    return true;
+}
+
+static unsigned int get_hash(const char* key, size_t length)
+{
+    unsigned int hash = 17;
+    for (size_t i = 0; i < length; ++i) {
+        hash = (hash << 3) + hash + key[i];
+    }
+    return hash % N_BUCKETS;
+}
@@ -0,0 +1,631 @@
+#include "SharedTree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "path_utils.h"
+
+// Layout of the segment: the header, then blocks handed out by the allocator - nodes and arrays of
+// their children. The allocator has a free list for each block size (powers of two), and takes
+// new blocks from the end of the used part of the segment. Blocks are never returned to the end
+// and never split or merged, which keeps the allocator a few instructions long; a tree that once
+// had many folders keeps their blocks for new ones.
+//
+// Lists run without the mutex, like optimistic readers in Tree.c: a modification makes the
+// sequence number odd while it changes anything (including freeing and reusing blocks), so a
+// reader who sees the same even number before and after it read something knows it read a
+// consistent state. Until that check a reader may see garbage - offsets of freed or reused
+// blocks, counts of a half-done modification - so every offset it follows is checked to lie in
+// the segment, and the names it copies out are checked one at a time.
+
+#define MAGIC "PWFSSHM1"
+#define MAGIC_LENGTH 8
+
+#define OPTIMISTIC_ATTEMPTS 3
+#define MIN_BLOCK 16 // the smallest block, and the alignment of every block
+#define CLASSES 48 // block sizes: MIN_BLOCK << k for k < CLASSES
+#define MIN_CHILDREN 4
+
+// Moving a folder into its own subtree - the same code as tree_move returns.
+#define ESRCSUBTRGT -1
+
+typedef uint64_t Offset; // from the start of the segment, 0 for none
+
+typedef struct Header {
+    char magic[MAGIC_LENGTH]; // written last by shared_tree_new
+    uint64_t size;
+    pthread_mutex_t mutex; // all modifications
+    _Atomic uint64_t sequence; // odd while a modification is in progress
+    Offset root;
+    Offset top; // everything from here to the end of the segment is free
+    Offset free_blocks[CLASSES]; // and so are these lists, linked by the first Offset of each block
+} Header;
+
+#define HEADER_SIZE ((sizeof(Header) + MIN_BLOCK - 1) / MIN_BLOCK * MIN_BLOCK)
+
+typedef struct Node {
+    Offset children; // array of `capacity` offsets, the first `count` of them sorted by name
+    uint32_t count;
+    uint32_t capacity;
+    uint8_t name_length;
+    char name[]; // terminated by '\0'
+} Node;
+
+struct SharedTree {
+    char *base; // where this process mapped the segment
+    size_t size;
+    Header *header;
+};
+
+static size_t node_size(size_t name_length) {
+    return offsetof(Node, name) + name_length + 1;
+}
+
+static Node *node_at(const SharedTree *tree, Offset offset) {
+    return (Node *) (tree->base + offset);
+}
+
+static Offset *children_at(const SharedTree *tree, Offset offset) {
+    return (Offset *) (tree->base + offset);
+}
+
+// Whether `offset` may be the start of a block of `bytes` bytes. Always true under the mutex.
+static bool in_segment(const SharedTree *tree, Offset offset, size_t bytes) {
+    return offset >= HEADER_SIZE && offset % MIN_BLOCK == 0 && offset <= tree->size && bytes <= tree->size - offset;
+}
+
+static void lock(SharedTree *tree) {
+    int err;
+    if ((err = pthread_mutex_lock(&tree->header->mutex)) != 0) {
+        if (err == EOWNERDEAD || err == ENOTRECOVERABLE) {
+            fatal("shared tree left inconsistent by a process which died modifying it");
+        }
+        syserr("mutex lock failed");
+    }
+}
+
+static void unlock(SharedTree *tree) {
+    int err;
+    if ((err = pthread_mutex_unlock(&tree->header->mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+static void modification_begin(SharedTree *tree) {
+    uint64_t sequence = atomic_load_explicit(&tree->header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&tree->header->sequence, sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
+
+static void modification_end(SharedTree *tree) {
+    uint64_t sequence = atomic_load_explicit(&tree->header->sequence, memory_order_relaxed);
+    atomic_store_explicit(&tree->header->sequence, sequence + 1, memory_order_release);
+}
+
+// Return false if a modification is in progress.
+static bool read_begin(const SharedTree *tree, uint64_t *sequence) {
+    *sequence = atomic_load_explicit(&tree->header->sequence, memory_order_acquire);
+    return *sequence % 2 == 0;
+}
+
+// Whether everything read since read_begin returned `sequence` is consistent.
+static bool read_valid(const SharedTree *tree, uint64_t sequence) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&tree->header->sequence, memory_order_relaxed) == sequence;
+}
+
+static int block_class(size_t bytes) {
+    int k = 0;
+    while (((size_t) MIN_BLOCK << k) < bytes) {
+        k++;
+    }
+    return k;
+}
+
+// Return a block of at least `bytes` bytes, or 0 if the segment is full. Called in a modification.
+static Offset block_alloc(SharedTree *tree, size_t bytes) {
+    Header *header = tree->header;
+    int k = block_class(bytes);
+    Offset block = header->free_blocks[k];
+    if (block) {
+        header->free_blocks[k] = *children_at(tree, block);
+        return block;
+    }
+    size_t block_size = (size_t) MIN_BLOCK << k;
+    if (block_size > header->size - header->top) {
+        return 0;
+    }
+    block = header->top;
+    header->top += block_size;
+    return block;
+}
+
+// Free a block allocated with the same `bytes`. Called in a modification.
+static void block_free(SharedTree *tree, Offset block, size_t bytes) {
+    int k = block_class(bytes);
+    *children_at(tree, block) = tree->header->free_blocks[k];
+    tree->header->free_blocks[k] = block;
+}
+
+// Compare a name with the name of the node at `offset`. A node out of the segment compares equal - only an
+// optimistic reader can see it, and it fails its final check anyway.
+static int compare_name(const SharedTree *tree, const char *name, size_t length, Offset offset) {
+    if (!in_segment(tree, offset, sizeof(Node))) {
+        return 0;
+    }
+    const Node *node = node_at(tree, offset);
+    size_t node_length = node->name_length;
+    if (!in_segment(tree, offset, node_size(node_length))) {
+        return 0;
+    }
+    int result = memcmp(name, node->name, length < node_length ? length : node_length);
+    return result ? result : (length > node_length) - (length < node_length);
+}
+
+// Return the child `name` (of `length` characters) of the node at `parent`, or 0 if there is none. Store in *index
+// its position among the children, or the position it would be inserted at.
+static Offset find_child(const SharedTree *tree, Offset parent, const char *name, size_t length, uint32_t *index) {
+    *index = 0;
+    if (!in_segment(tree, parent, sizeof(Node))) {
+        return 0;
+    }
+    const Node *node = node_at(tree, parent);
+    uint32_t count = node->count;
+    Offset children = node->children;
+    if (count == 0 || !in_segment(tree, children, (size_t) count * sizeof(Offset))) {
+        return 0;
+    }
+    const Offset *array = children_at(tree, children);
+    uint32_t low = 0, high = count;
+    while (low < high) {
+        uint32_t middle = low + (high - low) / 2;
+        Offset child = array[middle];
+        int result = compare_name(tree, name, length, child);
+        if (result == 0) {
+            *index = middle;
+            return child;
+        }
+        if (result < 0) {
+            high = middle;
+        }
+        else {
+            low = middle + 1;
+        }
+    }
+    *index = low;
+    return 0;
+}
+
+// Return the folder given by the first `depth` components of `path`, or 0 if there is none.
+static Offset find_node(const SharedTree *tree, const Path *path, size_t depth) {
+    Offset node = tree->header->root;
+    for (size_t i = 0; i < depth && node; i++) {
+        uint32_t index;
+        node = find_child(tree, node, path_component(path, i), path->lengths[i], &index);
+    }
+    return node;
+}
+
+// Write the names of the children of the node at `offset`, comma-separated, to a new string. An optimistic reader
+// passes the number from read_begin, and gets NULL if the tree changed meanwhile.
+static char *make_listing(const SharedTree *tree, Offset offset, const uint64_t *sequence) {
+    if (!in_segment(tree, offset, sizeof(Node))) {
+        return NULL;
+    }
+    const Node *node = node_at(tree, offset);
+    uint32_t count = node->count;
+    Offset children = node->children;
+    if (count > 0 && !in_segment(tree, children, (size_t) count * sizeof(Offset))) {
+        return NULL;
+    }
+    // From here on the count is known to be right, so the listing never grows past what it should be.
+    if (sequence && !read_valid(tree, *sequence)) {
+        return NULL;
+    }
+
+    size_t capacity = (size_t) count * 8 + 1, length = 0;
+    char *result = malloc(capacity);
+    if (!result) {
+        fatal("shared tree allocation failed");
+    }
+    const Offset *array = children_at(tree, children);
+    for (uint32_t i = 0; i < count; i++) {
+        Offset child = array[i];
+        if (!in_segment(tree, child, sizeof(Node))) {
+            free(result);
+            return NULL;
+        }
+        const Node *child_node = node_at(tree, child);
+        size_t name_length = child_node->name_length;
+        if (!in_segment(tree, child, node_size(name_length))) {
+            free(result);
+            return NULL;
+        }
+        if (length + name_length + 2 > capacity) {
+            capacity = 2 * (length + name_length + 2);
+            char *resized = realloc(result, capacity);
+            if (!resized) {
+                fatal("shared tree allocation failed");
+            }
+            result = resized;
+        }
+        if (i > 0) {
+            result[length++] = ',';
+        }
+        memcpy(result + length, child_node->name, name_length);
+        length += name_length;
+        if (sequence && !read_valid(tree, *sequence)) {
+            free(result);
+            return NULL;
+        }
+    }
+    result[length] = '\0';
+    return result;
+}
+
+// Make room for one more child of the node at `parent`. Return false if the segment is full.
+static bool reserve_child(SharedTree *tree, Offset parent) {
+    Node *node = node_at(tree, parent);
+    if (node->count < node->capacity) {
+        return true;
+    }
+    uint32_t capacity = node->capacity ? 2 * node->capacity : MIN_CHILDREN;
+    Offset children = block_alloc(tree, (size_t) capacity * sizeof(Offset));
+    if (!children) {
+        return false;
+    }
+    if (node->children) {
+        memcpy(children_at(tree, children), children_at(tree, node->children), node->count * sizeof(Offset));
+        block_free(tree, node->children, (size_t) node->capacity * sizeof(Offset));
+    }
+    node->children = children;
+    node->capacity = capacity;
+    return true;
+}
+
+// Give back the memory of children a node no longer has: all of it, or half if at most a quarter is used.
+static void shrink_children(SharedTree *tree, Offset parent) {
+    Node *node = node_at(tree, parent);
+    if (!node->children) {
+        return;
+    }
+    if (node->count > 0 && (node->capacity <= MIN_CHILDREN || node->count > node->capacity / 4)) {
+        return;
+    }
+    uint32_t capacity = node->count > 0 ? node->capacity / 2 : 0;
+    Offset children = capacity ? block_alloc(tree, (size_t) capacity * sizeof(Offset)) : 0;
+    if (capacity && !children) {
+        return;
+    }
+    if (children) {
+        memcpy(children_at(tree, children), children_at(tree, node->children), node->count * sizeof(Offset));
+    }
+    block_free(tree, node->children, (size_t) node->capacity * sizeof(Offset));
+    node->children = children;
+    node->capacity = capacity;
+}
+
+static void insert_child(SharedTree *tree, Offset parent, uint32_t index, Offset child) {
+    Node *node = node_at(tree, parent);
+    Offset *array = children_at(tree, node->children);
+    memmove(array + index + 1, array + index, (node->count - index) * sizeof(Offset));
+    array[index] = child;
+    node->count++;
+}
+
+static void remove_child(SharedTree *tree, Offset parent, uint32_t index) {
+    Node *node = node_at(tree, parent);
+    Offset *array = children_at(tree, node->children);
+    memmove(array + index, array + index + 1, (node->count - index - 1) * sizeof(Offset));
+    node->count--;
+}
+
+static void init_node(SharedTree *tree, Offset offset, const char *name, size_t length) {
+    Node *node = node_at(tree, offset);
+    node->children = 0;
+    node->count = node->capacity = 0;
+    node->name_length = length;
+    memcpy(node->name, name, length);
+    node->name[length] = '\0';
+}
+
+static SharedTree *attach(int fd, size_t size, int *err) {
+    void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    *err = base == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    SharedTree *tree = malloc(sizeof(SharedTree));
+    if (!tree) {
+        fatal("shared tree allocation failed");
+    }
+    tree->base = base;
+    tree->size = size;
+    tree->header = base;
+    return tree;
+}
+
+SharedTree *shared_tree_new(const char *name, size_t size, int *err) {
+    if (size < HEADER_SIZE + MIN_BLOCK * 2) {
+        *err = EINVAL;
+        return NULL;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        *err = errno;
+        return NULL;
+    }
+    if (ftruncate(fd, size) != 0) {
+        *err = errno;
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    SharedTree *tree = attach(fd, size, err);
+    if (!tree) {
+        shm_unlink(name);
+        return NULL;
+    }
+
+    Header *header = tree->header;
+    header->size = size;
+    pthread_mutexattr_t attr;
+    if ((*err = pthread_mutexattr_init(&attr)) != 0 ||
+        (*err = pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED)) != 0 ||
+        (*err = pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST)) != 0 ||
+        (*err = pthread_mutex_init(&header->mutex, &attr)) != 0) {
+        syserr("mutex init failed");
+    }
+    pthread_mutexattr_destroy(&attr);
+    atomic_init(&header->sequence, 0);
+    header->top = HEADER_SIZE;
+    memset(header->free_blocks, 0, sizeof(header->free_blocks));
+    header->root = block_alloc(tree, node_size(0));
+    init_node(tree, header->root, "", 0);
+
+    atomic_thread_fence(memory_order_release);
+    memcpy(header->magic, MAGIC, MAGIC_LENGTH);
+    *err = 0;
+    return tree;
+}
+
+SharedTree *shared_tree_open(const char *name, int *err) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        *err = errno;
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        *err = errno;
+        close(fd);
+        return NULL;
+    }
+    if (st.st_size < (off_t) HEADER_SIZE) {
+        *err = EINVAL;
+        close(fd);
+        return NULL;
+    }
+    SharedTree *tree = attach(fd, st.st_size, err);
+    if (!tree) {
+        return NULL;
+    }
+    bool valid = !memcmp(tree->header->magic, MAGIC, MAGIC_LENGTH);
+    atomic_thread_fence(memory_order_acquire);
+    if (!valid || tree->header->size != tree->size) {
+        shared_tree_close(tree);
+        *err = EINVAL;
+        return NULL;
+    }
+    return tree;
+}
+
+void shared_tree_close(SharedTree *tree) {
+    munmap(tree->base, tree->size);
+    free(tree);
+}
+
+int shared_tree_unlink(const char *name) {
+    return shm_unlink(name) == 0 ? 0 : errno;
+}
+
+char *shared_tree_list(SharedTree *tree, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return NULL;
+    }
+    for (int attempt = 0; attempt < OPTIMISTIC_ATTEMPTS; attempt++) {
+        uint64_t sequence;
+        if (!read_begin(tree, &sequence)) {
+            continue;
+        }
+        Offset node = find_node(tree, &parsed, parsed.depth);
+        if (!node) {
+            if (read_valid(tree, sequence)) {
+                return NULL;
+            }
+            continue;
+        }
+        char *result = make_listing(tree, node, &sequence);
+        if (result) {
+            return result;
+        }
+    }
+
+    lock(tree);
+    Offset node = find_node(tree, &parsed, parsed.depth);
+    char *result = node ? make_listing(tree, node, NULL) : NULL;
+    unlock(tree);
+    return result;
+}
+
+int shared_tree_create(SharedTree *tree, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return EINVAL;
+    }
+    if (parsed.depth == 0) {
+        return EEXIST;
+    }
+    size_t last = parsed.depth - 1;
+    const char *name = path_component(&parsed, last);
+    size_t length = parsed.lengths[last];
+
+    lock(tree);
+    int err = 0;
+    uint32_t index;
+    Offset parent = find_node(tree, &parsed, last);
+    if (!parent) {
+        err = ENOENT;
+    }
+    else if (find_child(tree, parent, name, length, &index)) {
+        err = EEXIST;
+    }
+    else {
+        modification_begin(tree);
+        Offset node = block_alloc(tree, node_size(length));
+        if (node && reserve_child(tree, parent)) {
+            init_node(tree, node, name, length);
+            insert_child(tree, parent, index, node);
+        }
+        else {
+            if (node) {
+                block_free(tree, node, node_size(length));
+            }
+            err = ENOSPC;
+        }
+        modification_end(tree);
+    }
+    unlock(tree);
+    return err;
+}
+
+int shared_tree_remove(SharedTree *tree, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return EINVAL;
+    }
+    if (parsed.depth == 0) {
+        return EBUSY;
+    }
+    size_t last = parsed.depth - 1;
+
+    lock(tree);
+    int err = 0;
+    uint32_t index;
+    Offset parent = find_node(tree, &parsed, last);
+    Offset node = parent ? find_child(tree, parent, path_component(&parsed, last), parsed.lengths[last], &index) : 0;
+    if (!node) {
+        err = ENOENT;
+    }
+    else if (node_at(tree, node)->count > 0) {
+        err = ENOTEMPTY;
+    }
+    else {
+        modification_begin(tree);
+        remove_child(tree, parent, index);
+        shrink_children(tree, parent);
+        Node *removed = node_at(tree, node);
+        if (removed->children) {
+            block_free(tree, removed->children, (size_t) removed->capacity * sizeof(Offset));
+        }
+        block_free(tree, node, node_size(removed->name_length));
+        modification_end(tree);
+    }
+    unlock(tree);
+    return err;
+}
+
+// Move the node at `source` (child number `source_index` of `source_parent`) to `target_parent` under the name
+// `name`, which `target_parent` does not have yet. Called in a modification.
+static int move_node(SharedTree *tree, Offset source_parent, uint32_t source_index, Offset source,
+                     Offset target_parent, const char *name, size_t length) {
+    Node *node = node_at(tree, source);
+    size_t source_length = node->name_length;
+    bool renamed = length != source_length || memcmp(name, node->name, length) != 0;
+    // A new name needs a new node; everything that can fail comes before the tree changes.
+    Offset moved = renamed ? block_alloc(tree, node_size(length)) : source;
+    if (!moved) {
+        return ENOSPC;
+    }
+    if (!reserve_child(tree, target_parent)) {
+        if (renamed) {
+            block_free(tree, moved, node_size(length));
+        }
+        return ENOSPC;
+    }
+
+    if (renamed) {
+        init_node(tree, moved, name, length);
+        Node *moved_node = node_at(tree, moved);
+        moved_node->children = node->children;
+        moved_node->count = node->count;
+        moved_node->capacity = node->capacity;
+    }
+    remove_child(tree, source_parent, source_index);
+    uint32_t target_index;
+    find_child(tree, target_parent, name, length, &target_index);
+    insert_child(tree, target_parent, target_index, moved);
+    shrink_children(tree, source_parent);
+    if (renamed) {
+        block_free(tree, source, node_size(source_length));
+    }
+    return 0;
+}
+
+int shared_tree_move(SharedTree *tree, const char *source, const char *target) {
+    Path source_path, target_path;
+    if (!parse_path(source, &source_path) || !parse_path(target, &target_path)) {
+        return EINVAL;
+    }
+    if (source_path.depth == 0) {
+        return EBUSY;
+    }
+    if (target_path.depth == 0) {
+        return EEXIST;
+    }
+    if (is_proper_ancestor(&source_path, &target_path)) {
+        return ESRCSUBTRGT;
+    }
+    size_t source_last = source_path.depth - 1, target_last = target_path.depth - 1;
+    const char *target_name = path_component(&target_path, target_last);
+    size_t target_length = target_path.lengths[target_last];
+
+    lock(tree);
+    int err = 0;
+    uint32_t source_index, target_index;
+    Offset source_parent = find_node(tree, &source_path, source_last);
+    Offset node = source_parent ? find_child(tree, source_parent, path_component(&source_path, source_last),
+                                             source_path.lengths[source_last], &source_index) : 0;
+    Offset target_parent = node ? find_node(tree, &target_path, target_last) : 0;
+    if (!node) {
+        err = ENOENT;
+    }
+    else if (!strcmp(source, target)) {
+        err = 0;
+    }
+    else if (!target_parent) {
+        err = ENOENT;
+    }
+    else if (find_child(tree, target_parent, target_name, target_length, &target_index)) {
+        err = EEXIST;
+    }
+    else {
+        modification_begin(tree);
+        err = move_node(tree, source_parent, source_index, node, target_parent, target_name, target_length);
+        modification_end(tree);
+    }
+    unlock(tree);
+    return err;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+
+// A tree of folders kept in a named shared memory segment (shm_open), so several processes can
+// attach to the same tree and run the basic operations directly, without a server. It has the
+// semantics and results of the Tree.h functions of the same names.
+//
+// The segment holds no pointers - nodes refer to each other by offsets from its start, so every
+// process may map it at a different address. Memory for nodes comes from an allocator inside
+// the segment. Modifications are serialized by a process-shared mutex in the segment; lists are
+// optimistic and never write to the segment, so readers in many processes do not slow each
+// other down (a list retried a few times because of modifications takes the mutex instead).
+//
+// A process that dies in the middle of a modification leaves the tree inconsistent - every later
+// modification in any process then ends the program. The segment has a fixed size; operations
+// needing more memory fail with ENOSPC.
+typedef struct SharedTree SharedTree;
+
+// Create a segment of `size` bytes named `name` (as for shm_open, e.g. "/tree") with an empty
+// tree and attach to it. Return NULL and store an errno code in *err on failure (EEXIST if the
+// segment exists already).
+SharedTree *shared_tree_new(const char *name, size_t size, int *err);
+
+// Attach to the tree in an existing segment, created by shared_tree_new (which has to have
+// returned). Return NULL and store an errno code in *err on failure (EINVAL if the segment does
+// not hold a tree).
+SharedTree *shared_tree_open(const char *name, int *err);
+
+// Detach from the tree. The segment stays until it is unlinked.
+void shared_tree_close(SharedTree *tree);
+
+// Remove the name of a segment; it is freed once all processes detach. Return 0 or an errno code.
+int shared_tree_unlink(const char *name);
+
+char *shared_tree_list(SharedTree *tree, const char *path);
+
+int shared_tree_create(SharedTree *tree, const char *path);
+
+int shared_tree_remove(SharedTree *tree, const char *path);
+
+int shared_tree_move(SharedTree *tree, const char *source, const char *target);
@@ -0,0 +1,241 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SortedSet.h"
+
+// Skip list with promotion probability 1/4. The list also keeps the total length of its keys,
+// so sset_join knows the size of the result up front and copies every key exactly once.
+
+#define MAX_LEVEL 16 // Enough for 4^16 keys.
+
+typedef struct Entry Entry;
+
+struct Entry {
+    uint32_t length;
+    uint32_t levels;
+    char* key; // Points into the same allocation, right after `next`.
+    Entry* next[]; // `levels` forward pointers.
+};
+
+struct SortedSet {
+    Entry* head[MAX_LEVEL];
+    size_t size;
+    size_t keys_length; // Sum of lengths of all keys.
+    uint32_t levels; // Number of levels in use.
+    uint32_t seed; // State of the level generator.
+};
+
+SortedSet* sset_new(void)
+{
+    SortedSet* set = malloc(sizeof(SortedSet));
+    if (!set)
+        return NULL;
+    for (int i = 0; i < MAX_LEVEL; ++i)
+        set->head[i] = NULL;
+    set->size = 0;
+    set->keys_length = 0;
+    set->levels = 1;
+    set->seed = (uint32_t)(uintptr_t)set | 1;
+    return set;
+}
+
+void sset_free(SortedSet* set)
+{
+    Entry* entry = set->head[0];
+    while (entry) {
+        Entry* next = entry->next[0];
+        free(entry);
+        entry = next;
+    }
+    free(set);
+}
+
+static int compare(const char* a, size_t a_length, const char* b, size_t b_length)
+{
+    int result = memcmp(a, b, a_length < b_length ? a_length : b_length);
+    if (result)
+        return result;
+    return (a_length > b_length) - (a_length < b_length);
+}
+
+static uint32_t random_levels(SortedSet* set)
+{
+    // xorshift32
+    uint32_t x = set->seed;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    set->seed = x;
+
+    uint32_t levels = 1;
+    while (levels < MAX_LEVEL && (x & 3) == 0) {
+        levels++;
+        x >>= 2;
+    }
+    return levels;
+}
+
+// Fill `prev` with the link pointing at the first entry not less than the key on every level.
+// Return that entry on the lowest level (or NULL).
+static Entry* find(SortedSet* set, const char* key, size_t length, Entry** prev[MAX_LEVEL])
+{
+    Entry** links = set->head;
+    for (int level = set->levels - 1; level >= 0; --level) {
+        while (links[level] && compare(links[level]->key, links[level]->length, key, length) < 0)
+            links = links[level]->next;
+        prev[level] = &links[level];
+    }
+    return *prev[0];
+}
+
+// Like `find`, but for keys given in increasing order: `owners[level]` is the entry (NULL for the
+// head) whose link on that level was found for the previous key. On every level the search starts
+// from it if it is ahead of the entry reached from the level above, so a run of close keys costs
+// little more than walking the list once. Updates `owners` for the next key.
+static Entry* find_from(SortedSet* set, const char* key, size_t length, Entry* owners[MAX_LEVEL],
+    Entry** prev[MAX_LEVEL])
+{
+    Entry* owner = NULL;
+    for (int level = set->levels - 1; level >= 0; --level) {
+        Entry* hint = owners[level];
+        if (hint && (!owner || compare(hint->key, hint->length, owner->key, owner->length) > 0))
+            owner = hint;
+        Entry** links = owner ? owner->next : set->head;
+        while (links[level] && compare(links[level]->key, links[level]->length, key, length) < 0) {
+            owner = links[level];
+            links = owner->next;
+        }
+        owners[level] = owner;
+        prev[level] = &links[level];
+    }
+    return *prev[0];
+}
+
+// Link a new entry in front of the entries `prev` points at. Return it, or NULL if allocation fails.
+static Entry* link_new(SortedSet* set, const char* key, size_t length, Entry** prev[MAX_LEVEL])
+{
+    uint32_t levels = random_levels(set);
+    Entry* entry = malloc(sizeof(Entry) + levels * sizeof(Entry*) + length + 1);
+    if (!entry)
+        return NULL;
+    entry->length = length;
+    entry->levels = levels;
+    entry->key = (char*)(entry->next + levels);
+    memcpy(entry->key, key, length);
+    entry->key[length] = '\0';
+
+    for (uint32_t level = set->levels; level < levels; ++level)
+        prev[level] = &set->head[level];
+    if (levels > set->levels)
+        set->levels = levels;
+
+    for (uint32_t level = 0; level < levels; ++level) {
+        entry->next[level] = *prev[level];
+        *prev[level] = entry;
+    }
+    set->size++;
+    set->keys_length += length;
+    return entry;
+}
+
+bool sset_insert(SortedSet* set, const char* key, size_t length)
+{
+    Entry** prev[MAX_LEVEL];
+    Entry* found = find(set, key, length, prev);
+    if (found && compare(found->key, found->length, key, length) == 0)
+        return false;
+    return link_new(set, key, length, prev) != NULL;
+}
+
+size_t sset_insert_sorted(SortedSet* set, const SortedSetKey* keys, size_t count)
+{
+    Entry* owners[MAX_LEVEL] = { NULL };
+    size_t inserted = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Entry** prev[MAX_LEVEL];
+        Entry* found = find_from(set, keys[i].key, keys[i].length, owners, prev);
+        if (found && compare(found->key, found->length, keys[i].key, keys[i].length) == 0)
+            continue;
+        Entry* entry = link_new(set, keys[i].key, keys[i].length, prev);
+        if (!entry)
+            continue;
+        // The new entry precedes every following key, so the next search can start from it.
+        for (uint32_t level = 0; level < entry->levels; ++level)
+            owners[level] = entry;
+        inserted++;
+    }
+    return inserted;
+}
+
+static void unlink_entry(SortedSet* set, Entry* entry, Entry** prev[MAX_LEVEL])
+{
+    for (uint32_t level = 0; level < entry->levels; ++level) {
+        assert(*prev[level] == entry);
+        *prev[level] = entry->next[level];
+    }
+    while (set->levels > 1 && !set->head[set->levels - 1])
+        set->levels--;
+
+    set->size--;
+    set->keys_length -= entry->length;
+    free(entry);
+}
+
+bool sset_remove(SortedSet* set, const char* key, size_t length)
+{
+    Entry** prev[MAX_LEVEL];
+    Entry* entry = find(set, key, length, prev);
+    if (!entry || compare(entry->key, entry->length, key, length) != 0)
+        return false;
+    unlink_entry(set, entry, prev);
+    return true;
+}
+
+size_t sset_remove_sorted(SortedSet* set, const SortedSetKey* keys, size_t count)
+{
+    // Owners always precede the removed entry, so they stay valid.
+    Entry* owners[MAX_LEVEL] = { NULL };
+    size_t removed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        Entry** prev[MAX_LEVEL];
+        Entry* entry = find_from(set, keys[i].key, keys[i].length, owners, prev);
+        if (!entry || compare(entry->key, entry->length, keys[i].key, keys[i].length) != 0)
+            continue;
+        unlink_entry(set, entry, prev);
+        removed++;
+    }
+    return removed;
+}
+
+size_t sset_size(SortedSet* set)
+{
+    return set->size;
+}
+
+size_t sset_joined_length(SortedSet* set)
+{
+    return set->keys_length + (set->size ? set->size - 1 : 0);
+}
+
+void sset_join_into(SortedSet* set, char separator, char* buffer)
+{
+    char* position = buffer;
+    for (Entry* entry = set->head[0]; entry; entry = entry->next[0]) {
+        if (position != buffer)
+            *position++ = separator;
+        memcpy(position, entry->key, entry->length);
+        position += entry->length;
+    }
+    assert(position == buffer + sset_joined_length(set));
+    *position = '\0';
+}
+
+char* sset_join(SortedSet* set, char separator)
+{
+    char* result = malloc(sset_joined_length(set) + 1);
+    if (result)
+        sset_join_into(set, separator, result);
+    return result;
+}
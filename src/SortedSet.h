@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// A set of strings kept in lexicographic order (a skip list), so that all of them can be
+// written out sorted in a single linear pass.
+// Not thread-safe - the caller synchronizes modifications with readers.
+typedef struct SortedSet SortedSet;
+
+// Create a new, empty set.
+SortedSet* sset_new(void);
+
+// Clear the set and free its memory.
+void sset_free(SortedSet* set);
+
+// Insert a copy of `key` (of `length` characters, not necessarily null-terminated).
+// Return true if it was inserted, false if it was already present (or on allocation failure).
+bool sset_insert(SortedSet* set, const char* key, size_t length);
+
+// Remove `key`. Return true if it was removed, false if it was not present.
+bool sset_remove(SortedSet* set, const char* key, size_t length);
+
+// A key of `length` characters, not necessarily null-terminated.
+typedef struct SortedSetKey {
+    const char* key;
+    size_t length;
+} SortedSetKey;
+
+// Insert (remove) each of `count` keys given in increasing order, as sset_insert (sset_remove)
+// would. Each search starts where the previous one ended, so a run of keys costs about one walk
+// over the part of the list it spans. Return the number of keys inserted (removed).
+size_t sset_insert_sorted(SortedSet* set, const SortedSetKey* keys, size_t count);
+
+size_t sset_remove_sorted(SortedSet* set, const SortedSetKey* keys, size_t count);
+
+// Return the number of keys in the set.
+size_t sset_size(SortedSet* set);
+
+// Return the length (excluding the terminating null character) of the string built by
+// sset_join: the total length of the keys plus a separator between every two of them.
+size_t sset_joined_length(SortedSet* set);
+
+// Write all keys, sorted, separated by `separator` and null-terminated, to `buffer`, which must
+// have room for sset_joined_length(set) + 1 characters.
+void sset_join_into(SortedSet* set, char separator, char* buffer);
+
+// Return a string containing all keys, sorted, separated by `separator`.
+// An empty set yields an empty string. The caller should free the result.
+char* sset_join(SortedSet* set, char separator);
@@ -1,40 +1,85 @@
 #include <errno.h>
+#include <stddef.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 
 #include "Tree.h"
 #include "HashMap.h"
+#include "SortedSet.h"
 #include "path_utils.h"
 #include "string.h"
 #include "err.h"
+#include "reclaim.h"
+#include "slab.h"
+#include "parking.h"
+#include "dcache.h"
+#include "journal.h"
+#include "dump.h"
 #include <pthread.h>
 #include <assert.h>
+#include <time.h>
 
 // kod błędu zwracany w operacji tree_move w przypadku, gdy miałoby być wykonane przeniesienie folderu do folderu
 // w jego poddrzewie
 #define ESRCSUBTRGT -1
 
-#define READER_BEGIN 1
-#define WRITER_BEGIN 2
+// wewnętrzny kod próby operacji, której ścieżka zmieniła się w trakcie (przez przeniesienie) - próba jest powtarzana,
+// więc nigdy nie jest zwracany na zewnątrz
+#define ESTALEPATH -2
 
 #define WRITER_ENTERS 0
 #define READER_ENTERS 1
-#define MOVER_ENTERS 2
+
+// tyle razy tree_list próbuje przejść ścieżkę optymistycznie, zanim użyje zwykłego protokołu
+// (0 wyłącza ścieżkę optymistyczną - do porównań w benchmarkach)
+#ifndef OPTIMISTIC_ATTEMPTS
+#define OPTIMISTIC_ATTEMPTS 3
+#endif
+
+// po tylu próbach unieważnionych przez przeniesienia operacja wstrzymuje rozpoczynanie nowych przeniesień
+#define STALE_ATTEMPTS 2
+
+// tyle wątków (razem z wołającym) buduje kopię poddrzewa w tree_copy (1 wyłącza wątki pomocnicze - do porównań
+// w benchmarkach)
+#ifndef COPY_THREADS
+#define COPY_THREADS 4
+#endif
+
+// tree_copy uruchamia wątki pomocnicze, gdy tyle folderów czeka na skopiowanie swoich dzieci
+#define COPY_PARALLEL_FOLDERS 256
+
+// tyle wątków (razem z wołającym) buduje drzewo w tree_load
+#ifndef LOAD_THREADS
+#define LOAD_THREADS 4
+#endif
+
+// tree_load oddaje innym wątkom poddrzewa, których zapis ma co najmniej tyle bajtów, a wątki pomocnicze uruchamia,
+// gdy tyle takich poddrzew czeka na wczytanie
+#define LOAD_TASK_BYTES 4096
+#define LOAD_PARALLEL_TASKS 2
+
+// co tyle milisekund wątek punktów kontrolnych sprawdza, o ile urósł dziennik
+#define CHECKPOINT_POLL_MS 100
 
 /**
  * Opis synchronizacji:
- * Sprowadzamy problem do lekko zmodyfikowanego problemu czytelników i pisarzy. Modyfikacja polega na tym, że wprowadzamy
- * nowy typ wątku - mover - jest on wołany dopiero, gdy w poddrzewie nie ma żadnych pisarzy i czytelników. Liczba
- * aktywnych wątków w poddrzewie jest zliczana w zmiennej w każdym wierzchołku. Po skończeniu wykonywania operacji
- * idziemy w górę drzewa do korzenia zmniejszając w każdym wierzchołku liczbę aktywnych wątków w poddrzewie. Jeśli
- * licznik osiąga wartość zero i jakiś mover czeka, to go budzimy.
+ * Sprowadzamy problem do problemu czytelników i pisarzy w każdym wierzchołku. Wszystkie operacje przechodzą po drzewie
+ * jako czytelnik w aktualnym wierzchołku i jego rodzicu (jeśli istnieje). Przechodząc do syna aktualnego wierzchołka,
+ * wychodzimy z czytelni w jego rodzicu.
  *
- * Wszystkie operacje przechodzą po drzewie jako czytelnik w aktualnym wierzchołku i jego rodzicu (jeśli istnieje).
- * Przechodząc do syna aktualnego wierzchołka, wychodzimy z czytelni w jego rodzicu.
+ * Wierzchołki nie mają własnych muteksów ani zmiennych warunkowych - cały stan czytelni (liczniki czytelników
+ * i pisarzy, czekających i who_enters) jest spakowany w jedno słowo wierzchołka, a czekające wątki parkują w jednym
+ * z globalnych kubełków parking.h, wybieranym na podstawie adresu wierzchołka. Muteks kubełka chroni słowa wszystkich
+ * wierzchołków, które do niego trafiają. Prawie wszystkie wierzchołki są przez większość czasu bezczynne, więc w ten
+ * sposób nie płacimy za ich synchronizację pamięcią.
  *
  * Tree_list:
  * Przechodzimy po drzewie jak wyżej w poszukiwaniu odpowiedniego wierzchołka, gdy go znajdziemy to jesteśmy jako
  * czytelnik w nim i zaprzestajemy bycie czytelnikiem w rodzicu. Sczytujemy dzieci i je wypisujemy, a następnie wychodzimy
- * z czytelni.
+ * z czytelni. Nazwy dzieci są trzymane posortowane (SortedSet.h, aktualizowany razem z hash-mapą), więc wypisanie ich
+ * to jedno przejście bez sortowania. Gotowy napis jest dodatkowo zapamiętywany w wierzchołku (budujemy go przy pierwszym
+ * tree_list po zmianie, a każda zmiana dzieci - dokonywana jako pisarz - go wyrzuca), więc kolejne listowania
+ * niezmienionego folderu to tylko kopia pamięci.
  *
  * Tree_insert:
  * Przechodzimy po drzewie w poszukiwaniu wierzchołka, do którego chcemy dodać nowy wierzchołek. Ustawiamy się w nim jako
@@ -47,670 +92,4448 @@
  * Tree_move:
  * Najpierw znajdujemy LCA ojców source i target. Zajmujemy je jako pisarz w celu wyeliminowania potencjalnych
  * deadlocków, np. sytuacji, w której wykonujemy współbieżnie Tree_move(a, b), Tree_move(b, a).
- * Następnie przechodzimy do ojca source jako pisarz, następnie do ojca target jako pisarz, zwalniamy czytelnię LCA,
- * i czekamy jako mover na wierzchołku source. Gdy zostanie on obudzony, wykonujemy przeniesienie z source do target i
- * zwalniamy czytelnie source, ojca source i ojca target.
+ * Następnie przechodzimy do ojca source jako pisarz, następnie do ojca target jako pisarz i zwalniamy czytelnię LCA.
+ * Przeniesienie potrzebuje wyłączności tylko w obu ojcach - na samo source ani na operacje w jego poddrzewie nie czeka.
+ *
+ * Zmiana nazwy (tree_move w obrębie jednego folderu):
+ * Gdy source i target mają wspólnego ojca, wystarczy zejść do niego raz, zająć go jako pisarz i przepiąć wpis w jego
+ * hash-mapie. Zmiana nazwy nie zmienia żadnego wskaźnika na rodzica, więc nie może utworzyć cyklu i nie potrzebuje
+ * muteksu przeniesień - zmiany nazw w różnych folderach wykonują się w pełni równolegle.
+ *
+ * Przeniesienia a ścieżki operacji w toku:
+ * Operacja, która zeszła już poniżej ojca source, może dalej działać w przenoszonym poddrzewie, ale ścieżka, po której
+ * przyszła, przestaje być aktualna. Dlatego każda operacja, trzymając już blokady we wszystkich wierzchołkach, których
+ * dotyczy jej wynik (także wtedy, gdy wynikiem jest brak składowej), sprawdza, czy jej ścieżka jest nadal aktualna
+ * (path_is_valid): czy od początku próby nie przeniesiono żadnego wierzchołka na drodze od niej do korzenia. Każde
+ * przeniesienie dostaje kolejny numer (liczony w wersji struktury drzewa) i zapisuje go w przenoszonym wierzchołku
+ * (moved_at) przed zmianą wskaźnika na rodzica. Jeśli ścieżka jest aktualna, to w chwili sprawdzenia operacja mogłaby
+ * się wykonać atomowo - od tej chwili wierzchołki, w których działa, są chronione jej blokadami, a jej skutki da się
+ * zobaczyć tylko przez te blokady. W przeciwnym razie operacja niczego jeszcze nie zmieniła, więc zwalnia blokady
+ * i próbuje od nowa. Samo przeniesienie sprawdza swoje ścieżki i się wykonuje pod muteksem przeniesień drzewa, więc
+ * przeniesienia są między sobą uporządkowane, a żadne nie może ustawić source pod targetem, który chwilę wcześniej
+ * został przeniesiony do poddrzewa source. Żeby żadna operacja nie była unieważniana w nieskończoność, po
+ * STALE_ATTEMPTS nieudanych próbach wstrzymuje ona rozpoczynanie nowych przeniesień (te w toku mogą ją unieważnić
+ * jeszcze tylko skończenie wiele razy). Zmiana nazwy też zmienia ścieżki w poddrzewie, więc również dostaje numer
+ * i zapisuje go w moved_at - zwiększa wersję struktury od razu o 2 (bez muteksu, parzystość się nie zmienia), będąc
+ * już pisarzem w ojcu, więc każdy, kto odczyta nowy numer, zajrzy do ojca dopiero po zmianie.
+ *
+ * Uchwyty folderów:
+ * Tree_open_dir znajduje folder jak tree_list i, będąc w nim czytelnikiem, zwiększa jego licznik referencji - usunięty
+ * wierzchołek jest zwalniany dopiero, gdy licznik spadnie do zera. Operacje *_at działają jak zwykłe, tylko zaczynają
+ * od folderu uchwytu zamiast od korzenia (Attempt.dir), a ścieżkę sprawdzają tylko do niego. Uchwyt trzyma wskaźnik
+ * na wierzchołek, więc przeniesienie folderu niczego w nim nie zmienia. Usunięcie folderu jest widoczne dla operacji,
+ * gdy zablokuje ona jego wierzchołek - wcześniej nie mogło się zdarzyć, bo operacja w jego poddrzewie blokuje
+ * niepusty folder.
+ *
+ * Optymistyczny tree_list:
+ * Każdy wierzchołek ma licznik wersji (seqlock) - pisarz zwiększa go przed i po każdej zmianie swojej hash-mapy, więc
+ * nieparzysta wersja oznacza zmianę w toku. Usunięty wierzchołek zostaje z nieparzystą wersją na zawsze. Drzewo ma
+ * dodatkowo wersję struktury zmienianą przez tree_move (przeniesienie zmienia ścieżki wszystkich wierzchołków
+ * w poddrzewie, czego nie widać w wersjach wierzchołków na ścieżce) - liczy ona przeniesienia w toku i rozpoczęte.
+ * Tree_list najpierw schodzi po ścieżce bez żadnych blokad: odczytuje wersję wierzchołka, szuka w nim dziecka, odczytuje
+ * wersję dziecka i sprawdza, że wersja wierzchołka się nie zmieniła. W docelowym wierzchołku wchodzi do czytelni (bez
+ * czekania - jeśli czytelnia jest zajęta przez pisarza, to jest to konflikt) i sprawdza, że ani wersja wierzchołka,
+ * ani wersja struktury się nie zmieniły. Wtedy ścieżka prowadziła do tego wierzchołka w chwili sprawdzenia:
+ * bez przeniesień wierzchołek na ścieżce może zniknąć tylko przez usunięcie, a to wymaga wcześniejszego usunięcia
+ * całego poddrzewa, w tym docelowego wierzchołka (którego wersja by się zmieniła). Od tej chwili do końca czytania
+ * zawartość jest chroniona czytelnią, więc operacja jest atomowa. Przy konflikcie próbujemy ponownie, a po
+ * OPTIMISTIC_ATTEMPTS próbach wracamy do zwykłego protokołu.
+ * Czytelnik bez blokad może czytać pamięć, którą pisarz właśnie zwalnia (usunięte wierzchołki, stare tablice i klucze
+ * hash-map), dlatego te są zwalniane z opóźnieniem przez reclaim.h. To samo chroni wierzchołki oglądane przy
+ * sprawdzaniu ścieżki.
+ *
+ * Pamięć podręczna ścieżek (dcache.h):
+ * Operacje od korzenia na długich ścieżkach zapamiętują, do którego wierzchołka prowadził prefiks ścieżki (od głębokości
+ * DCACHE_MIN_DEPTH), razem z numerem generacji wierzchołka i znacznikiem - liczbą rozpoczętych przeniesień, przy której
+ * prefiks na pewno do niego prowadził. Kolejna operacja na ścieżce o tym prefiksie zaczyna schodzenie od wierzchołka
+ * wpisu, a jej próba zaczyna się od znacznika wpisu zamiast od bieżącej liczby przeniesień - path_is_valid sprawdza
+ * wtedy także prefiks (aż do korzenia), a jeśli ten się zmienił, usuwa wpis. Wpis nie trzyma wierzchołka, więc ten mógł
+ * zostać usunięty, a nawet użyty ponownie: wierzchołki pochodzą ze slab.h, ich pamięć nie wraca do systemu, a stan
+ * czytelni i numer generacji (zwiększany przy każdym ponownym użyciu) przeżywają zwolnienie. Operacja zajmuje czytelnię
+ * w wierzchołku wpisu i dopiero wtedy sprawdza, że nie jest usunięty i ma zapamiętaną generację.
+ *
+ * Transakcje:
+ * Transakcja zmienia tylko dzieci ojców ścieżek swoich operacji i usuwa (puste) foldery. Ścieżki operacji cofamy
+ * o przeniesienia wcześniejszych operacji transakcji - tak dostajemy wierzchołki, w których trzeba być pisarzem
+ * ("kotwice"). Kotwice zajmujemy w porządku preorder, razem z punktami rozgałęzienia między nimi, co uogólnia
+ * blokowanie LCA w tree_move: punkt rozgałęzienia trzymamy, dopóki nie zajmiemy wszystkich kotwic pod nim, a zejścia
+ * do kolejnych kotwic zaczynają się od najgłębszego trzymanego przodka. Potem, jak tree_move, pod muteksem przeniesień
+ * sprawdzamy ścieżki, zwalniamy punkty rozgałęzienia, które nie są kotwicami, i wykonujemy operacje po kolei, zapisując,
+ * jak je wycofać. Jeśli któraś się nie powiedzie, wycofujemy wykonane w odwrotnej kolejności. Zmiany widać tylko przez
+ * zajęte przez nas blokady, a wersja struktury jest nieparzysta przez całe wykonanie, więc optymistyczni czytelnicy
+ * też nie zobaczą stanu pośredniego. Usunięte foldery zwalniamy dopiero po zatwierdzeniu.
+ *
+ * Migawki:
+ * Migawka to kolejny numer w drzewie. Każda operacja, która zmienia dzieci wierzchołków, odczytuje bieżący numer
+ * migawki, trzymając już blokady we wszystkich wierzchołkach, które zmieni (modification_begin). Kolejne zmiany
+ * wierzchołka są uporządkowane jego blokadą, więc mają niemalejące numery, a operacja, która widziała skutki innej,
+ * ma numer nie mniejszy od niej. Migawka e zawiera dokładnie operacje o numerach mniejszych od e - tree_snapshot
+ * zwiększa numer i czeka (reclaim_synchronize), aż skończą się wszystkie sekcje krytyczne trwające w tej chwili,
+ * w tym operacje, które odczytały poprzedni numer. Niczego nie kopiuje, więc jej koszt nie zależy od rozmiaru drzewa.
+ * Wierzchołek pamięta numer ostatniej zmiany swoich dzieci (preserved). Operacja o numerze s, która jako pierwsza
+ * zmienia dzieci wierzchołka po migawce e (preserved < e <= s), najpierw dodaje na początek listy kopii wierzchołka
+ * niezmienną kopię jego dzieci (posortowane nazwy i wierzchołki) z numerem s - to jego stan we wszystkich migawkach
+ * z przedziału (preserved, s]. Kopia trzyma referencje do dzieci i do samego wierzchołka, więc wszystko, co widać
+ * w migawce, żyje tak długo jak ona. Czytając wierzchołek w migawce e, bierzemy najstarszą kopię o numerze >= e,
+ * a jeśli jej nie ma - bieżące dzieci, czytane optymistycznie jak w list_optimistic (kopia jest dodawana, zanim
+ * wersja wierzchołka stanie się nieparzysta). Usunięty wierzchołek bez takiej kopii był w migawce pusty. Czytanie
+ * migawki nie zajmuje więc żadnej czytelni. Kopie są dodawane i usuwane pod muteksem migawek drzewa - zwolnienie
+ * migawki usuwa kopie o numerach mniejszych od najstarszej pozostałej migawki (przez reclaim.h, bo czytelnicy mogą
+ * je jeszcze oglądać).
+ *
+ * Usuwanie poddrzewa:
+ * Tree_remove_recursive odpina folder od ojca jak zmiana nazwy: jako pisarz w ojcu usuwa wpis z jego hash-mapy
+ * i zapisuje w odpinanym folderze nowy numer przeniesienia, więc operacje w toku w jego poddrzewie, które nie
+ * sprawdziły jeszcze swoich ścieżek, uznają je za nieaktualne i spróbują od nowa (nie znajdując już folderu). Samego
+ * poddrzewa przy tym nie blokuje, więc odpięcie nie zależy od jego rozmiaru i nie czeka na operacje w nim. Dopiero
+ * potem, nie trzymając blokady w ojcu, przechodzi poddrzewo i każdy wierzchołek oznacza jako usunięty (jako pisarz
+ * w nim, zachowując najpierw jego dzieci dla migawek, które widzą go jeszcze w drzewie). Na koniec, poza sekcją
+ * krytyczną reclaim.h i bez żadnych blokad, czeka (reclaim_synchronize), aż nikt nie może już oglądać poddrzewa,
+ * i sam je zwalnia - korzeń zwalnia dzieci, te swoje dzieci itd. Koszt zależny od rozmiaru poddrzewa ponosi więc
+ * wołający, a nie inne operacje.
+ *
+ * Kopiowanie poddrzewa:
+ * Tree_copy robi migawkę i buduje z niej kopię poddrzewa source z boku drzewa - jej wierzchołków nikt poza nią nie
+ * widzi, więc nie potrzebują blokad, a kopiowanie nie wstrzymuje żadnej operacji. Foldery, którym trzeba jeszcze
+ * skopiować dzieci, czekają na wspólnym stosie - gdy jest ich dużo, kopię budują też wątki pomocnicze. Gotową kopię
+ * dodajemy do ojca target tak jak nowy folder w tree_create. Kopia odpowiada więc stanowi source z chwili zrobienia
+ * migawki (także wtedy, gdy target leży w poddrzewie source).
+ *
+ * Dziennik:
+ * Tree_journal_open dołącza do drzewa dziennik (journal.h), do którego każda udana zmiana drzewa dopisuje rekord:
+ * rodzaj operacji, numer uchwytu, od którego liczone są jej ścieżki (0 dla korzenia), i same ścieżki. Odtworzenie
+ * wykonuje rekordy po kolei na nowym drzewie, więc ich kolejność musi być zgodna z kolejnością zmian. Dlatego operacja
+ * sprawdza ścieżkę (path_is_valid), wykonuje zmianę i dopisuje rekord pod jednym muteksem dziennika, a przeniesienia,
+ * zmiany nazw i odpięcia poddrzewa pod nim zmieniają też wersję struktury - rekord operacji, która sprawdziła ścieżkę
+ * przed przeniesieniem, jest w dzienniku przed rekordem przeniesienia. Pod muteksem dziennika nie czekamy na blokady
+ * wierzchołków (ich właściciel mógłby czekać na ten muteks) - usuwane dziecko zajmujemy przed sprawdzeniem ścieżki.
+ * Muteksy zajmujemy w kolejności: muteks przeniesień, muteks dziennika, muteks migawek. Dopisanie rekordu to tylko kopia
+ * do bufora - na zapisanie go na dysk operacja czeka na samym końcu, już bez blokad i poza sekcją krytyczną reclaim.h
+ * (journal_sync), a przy grupowym zatwierdzaniu jeden fdatasync obejmuje rekordy wszystkich operacji, które w tym czasie
+ * skończyły zmiany. Rekord tree_copy zawiera całą zbudowaną kopię zamiast ścieżki source - kopia odpowiada migawce
+ * sprzed dodania jej do drzewa.
+ *
+ * Zrzut i wczytywanie:
+ * Tree_dump zapisuje do pliku (dump.h) migawkę całego drzewa w porządku preorder - każdy folder jako liczbę dzieci
+ * i ich nazwy (posortowane, z pominięciem prefiksu wspólnego z poprzednią), więc zmiany drzewa trwają w tym czasie
+ * normalnie. Zapis dzieci każdego folderu poprzedza jego rozmiar w bajtach, więc tree_load, czytając zmapowany plik,
+ * może przekazać zapis dużego poddrzewa innemu wątkowi bez czytania go - drzewo budują z boku wątki ze wspólnego
+ * stosu zadań, jak kopię w tree_copy, a hash-mapy od razu dostają docelowy rozmiar. Gotowe dzieci korzenia
+ * dodajemy do pustego korzenia drzewa jako pisarz w nim.
+ *
+ * Punkty kontrolne:
+ * Punkt kontrolny to zrzut z pozycją dziennika, od której trzeba go odtwarzać na wczytanym drzewie. Pozycję
+ * odczytujemy i migawkę dodajemy pod muteksem dziennika - operacja sprawdza ścieżkę, odczytuje numer migawki
+ * (modification_begin), wykonuje zmianę i dopisuje rekord pod tym samym muteksem, więc migawka zawiera dokładnie
+ * operacje z rekordami przed pozycją. Tylko na ten moment punkt kontrolny wstrzymuje zmiany drzewa - zapisuje migawkę
+ * jak tree_dump, gdy operacje trwają. Zapisuje też uchwyty otwarte pod muteksem (ich numery i ścieżki w migawce),
+ * bo późniejsze rekordy mogą się do nich odwoływać. Zrzut zastępuje poprzedni dopiero, gdy dziennik jest na dysku aż
+ * do jego pozycji, a dopiero potem dziennik zapisuje ją w nagłówku jako swój nowy początek i oddaje miejsce przed nią
+ * (journal_truncate) - po awarii w dowolnej chwili jest zrzut i wszystkie rekordy po jego pozycji. Wątek punktów
+ * kontrolnych robi je, gdy dziennik urośnie o zadaną liczbę bajtów.
  *
  */
 
 
 typedef struct Node Node;
+typedef struct NodeCopy NodeCopy;
+
+// Zapamiętany wynik tree_list dla wierzchołka.
+typedef struct {
+    size_t length;
+    char data[];
+} Listing;
 
 struct Node {
     HashMap *children;
-    Node *parent;
-
-    pthread_mutex_t mutex;
-    pthread_cond_t writers;
-    pthread_cond_t readers;
-    pthread_cond_t movers;
-    int readers_count, readers_wait, writers_count, writers_wait, movers_count, movers_wait, count_in_subtree, who_enters;
+    SortedSet *names; // nazwy dzieci w kolejności leksykograficznej - dla tree_list (NULL, dopóki nie ma dzieci)
+    _Atomic(Listing *) listing; // NULL, jeśli dzieci zmieniły się od ostatniego tree_list
+    _Atomic(Node *) parent; // zmieniany tylko przez tree_move, odczytywany też bez blokad przy sprawdzaniu ścieżki
+    _Atomic uint64_t moved_at; // numer ostatniego przeniesienia tego wierzchołka (0, jeśli nie był przenoszony)
+    atomic_bool removed; // ustawiane przez tree_remove (jako pisarz w wierzchołku)
+    atomic_int references; // otwarte uchwyty tree_open_dir i jedna referencja drzewa, oddawana po usunięciu
+    _Atomic uint64_t generation; // zwiększany przy każdym użyciu pamięci wierzchołka na nowy folder (dla dcache.h)
+    Slab *slab;
+
+    // Stan czytelni (LockState, spakowany) - zamiast własnego muteksu i zmiennych warunkowych wierzchołek korzysta
+    // z kubełka parking.h wybranego na podstawie swojego adresu.
+    _Atomic uint64_t lock;
+
+    _Atomic uint64_t version;
+    Retired retired;
+
+    _Atomic(NodeCopy *) copies; // stany dzieci zachowane dla migawek, od najnowszego (opis na początku pliku)
+    uint64_t preserved; // numer migawki operacji, która ostatnio zmieniła dzieci (zmieniany przez pisarza)
 };
 
+// Stan czytelni wierzchołka. W wierzchołku jest trzymany spakowany w jednym słowie (Node.lock), które zmieniamy tylko
+// pod muteksem kubełka parking.h odpowiadającego wierzchołkowi.
+typedef struct {
+    unsigned readers_count, readers_wait, writers_count, writers_wait, who_enters;
+} LockState;
+
+#define LOCK_READERS_COUNT_SHIFT 0
+#define LOCK_READERS_WAIT_SHIFT 16
+#define LOCK_WRITERS_WAIT_SHIFT 32
+#define LOCK_WRITERS_COUNT_SHIFT 48
+#define LOCK_WHO_ENTERS_SHIFT 49
+
+#define LOCK_FIELD(word, shift, bits) ((unsigned) (((word) >> (shift)) & (((uint64_t) 1 << (bits)) - 1)))
+
+LockState lock_unpack(uint64_t word) {
+    LockState lock = {
+        .readers_count = LOCK_FIELD(word, LOCK_READERS_COUNT_SHIFT, 16),
+        .readers_wait = LOCK_FIELD(word, LOCK_READERS_WAIT_SHIFT, 16),
+        .writers_wait = LOCK_FIELD(word, LOCK_WRITERS_WAIT_SHIFT, 16),
+        .writers_count = LOCK_FIELD(word, LOCK_WRITERS_COUNT_SHIFT, 1),
+        .who_enters = LOCK_FIELD(word, LOCK_WHO_ENTERS_SHIFT, 1),
+    };
+    return lock;
+}
+
+uint64_t lock_pack(const LockState *lock) {
+    assert(lock->readers_count < (1 << 16) && lock->readers_wait < (1 << 16) && lock->writers_wait < (1 << 16));
+    assert(lock->writers_count <= 1 && lock->who_enters <= READER_ENTERS);
+    return (uint64_t) lock->readers_count << LOCK_READERS_COUNT_SHIFT
+           | (uint64_t) lock->readers_wait << LOCK_READERS_WAIT_SHIFT
+           | (uint64_t) lock->writers_wait << LOCK_WRITERS_WAIT_SHIFT
+           | (uint64_t) lock->writers_count << LOCK_WRITERS_COUNT_SHIFT
+           | (uint64_t) lock->who_enters << LOCK_WHO_ENTERS_SHIFT;
+}
+
+LockState lock_load(Node *node) {
+    return lock_unpack(atomic_load(&node->lock));
+}
+
+void lock_store(Node *node, const LockState *lock) {
+    atomic_store(&node->lock, lock_pack(lock));
+}
+
+// Statystyki zliczane w tree_list są rozłożone na kilka linii cache (wątek wybiera swoją raz), żeby samo zliczanie
+// nie wprowadzało wspólnego punktu dla wszystkich czytelników.
+#define STATS_STRIPES 8
+#define CACHE_LINE 64
+
+typedef struct {
+    atomic_size_t listing_hits;
+    atomic_size_t listing_misses;
+    atomic_size_t dentry_hits;
+    atomic_size_t dentry_misses;
+    atomic_size_t dentry_invalidations;
+    char padding[CACHE_LINE - 5 * sizeof(atomic_size_t)];
+} StatsStripe;
+
 struct Tree {
     Node *root;
+    Slab *nodes;
+    _Atomic uint64_t structure_version;
+    pthread_mutex_t move_mutex; // sprawdzenie ścieżek i wykonanie przeniesienia
+    atomic_int starving; // liczba operacji, które wstrzymują rozpoczynanie nowych przeniesień
+    DentryCache *dentries; // wierzchołki na głębokich prefiksach ścieżek od korzenia (opis na początku pliku)
+    StatsStripe *stats;
+
+    _Atomic uint64_t snapshot_epoch; // numer ostatniej migawki (opis na początku pliku)
+    pthread_mutex_t snapshot_mutex; // lista migawek, listy kopii wierzchołków i lista wszystkich kopii
+    TreeSnapshot *snapshots;
+    atomic_size_t snapshots_live;
+    NodeCopy *copies_first, *copies_last; // w kolejności dodawania
+    atomic_size_t copies_count;
+    atomic_size_t copies_bytes;
+
+    Journal *journal; // NULL, jeśli drzewo nie ma dziennika (opis na początku pliku)
+    uint32_t dir_ids; // ostatni numer nadany uchwytowi w dzienniku, chroniony jego muteksem
+    TreeDir *dirs; // otwarte uchwyty z numerami w dzienniku, chronione jego muteksem
+
+    // Punkty kontrolne (opis na początku pliku). Muteks jest zajęty przez cały punkt kontrolny i chroni stan wątku
+    // punktów kontrolnych.
+    pthread_mutex_t checkpoint_mutex;
+    pthread_cond_t checkpoint_wakeup;
+    pthread_t checkpointer;
+    bool checkpointing; // czy działa wątek punktów kontrolnych
+    bool checkpoint_stop;
+    char *checkpoint_path;
+    uint64_t checkpoint_threshold; // wątek robi punkt kontrolny, gdy dziennik urośnie o tyle bajtów
+    uint64_t checkpoint_position; // pozycja dziennika zapisana w ostatnim punkcie kontrolnym
+    atomic_size_t checkpoints;
+    atomic_size_t checkpoint_failures;
+    atomic_size_t checkpoint_bytes;
+    atomic_size_t checkpoint_nanoseconds;
+    atomic_size_t checkpoint_stall_nanoseconds;
 };
 
-Node *node_new() {
-    Node *node = malloc(sizeof(Node));
-    node->children = hmap_new();
+struct TreeSnapshot {
+    Tree *tree;
+    uint64_t epoch;
+    TreeSnapshot *prev, *next;
+};
 
-    int err;
-    if ((err = pthread_mutex_init(&node->mutex, 0)) != 0) {
-        syserr(err, "mutex init failed");
+// Dziecko w zachowanym (lub odczytanym na potrzeby migawki) stanie dzieci wierzchołka.
+typedef struct {
+    const char *name;
+    Node *child;
+} ChildEntry;
+
+// Niezmienna kopia dzieci wierzchołka - jego stan w migawkach o numerach z przedziału (poprzednia zmiana, epoch].
+struct NodeCopy {
+    Retired retired;
+    _Atomic(NodeCopy *) older; // poprzednia kopia tego samego wierzchołka
+    NodeCopy *registry_prev, *registry_next; // lista wszystkich kopii drzewa
+    Node *node;
+    uint64_t epoch;
+    size_t size; // w bajtach, razem z nazwami
+    size_t count;
+    ChildEntry entries[]; // posortowane po nazwie, a za nimi nazwy
+};
+
+// Numer migawki bieżącej operacji wątku (ustawiany przez modification_begin) - z niego korzystają node_new
+// i children_write_begin.
+static _Thread_local struct {
+    Tree *tree;
+    uint64_t epoch;
+    bool preserve; // czy w chwili odczytu numeru istniała jakaś migawka
+} modification;
+
+void modification_begin(Tree *tree) {
+    modification.tree = tree;
+    modification.epoch = atomic_load(&tree->snapshot_epoch);
+    // Migawka jest dodawana do listy, zanim dostanie numer, więc kto widzi jej numer, widzi też ją.
+    modification.preserve = atomic_load(&tree->snapshots_live) > 0;
+}
+
+static _Thread_local int stats_stripe = -1;
+static atomic_int next_stats_stripe = 0;
+
+StatsStripe *get_stats_stripe(Tree *tree) {
+    if (stats_stripe < 0) {
+        stats_stripe = atomic_fetch_add(&next_stats_stripe, 1) % STATS_STRIPES;
+    }
+    return &tree->stats[stats_stripe];
+}
+
+// Dziennik (opis na początku pliku).
+
+// Rodzaj rekordu dziennika - jego pierwszy bajt. Za nim jest numer uchwytu (varint) i dane zależne od rodzaju,
+// w tym ścieżki zakończone '\0'.
+typedef enum {
+    RECORD_CREATE, // ścieżka
+    RECORD_REMOVE, // ścieżka
+    RECORD_MOVE, // source i target
+    RECORD_REMOVE_RECURSIVE, // ścieżka
+    RECORD_COPY, // target i kopia poddrzewa (journal_encode_subtree)
+    RECORD_TRANSACTION, // liczba operacji i każda z nich: rodzaj (TransactionKind) i ścieżki
+    RECORD_OPEN_DIR, // ścieżka od korzenia, a numer jest numerem nowego uchwytu
+    RECORD_CLOSE_DIR,
+} RecordKind;
+
+#define VARINT_MAX_LENGTH 10
+
+// Dziennik bieżącej operacji wątku.
+static _Thread_local struct {
+    uint32_t dir; // numer uchwytu operacji *_at (0 dla korzenia)
+    const char *data; // dane rekordu przygotowane przed operacją (kopia poddrzewa, operacje transakcji)
+    size_t data_length;
+    uint64_t position; // koniec ostatniego rekordu wątku - na jego zapisanie na dysk operacja czeka na końcu
+} journaled;
+
+void journal_begin(Tree *tree) {
+    if (tree->journal) {
+        journal_lock(tree->journal);
+    }
+}
+
+void journal_end(Tree *tree) {
+    if (tree->journal) {
+        journal_unlock(tree->journal);
+    }
+}
+
+size_t encode_varint(uint64_t value, char *result) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        result[length++] = (char) ((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    result[length++] = (char) value;
+    return length;
+}
+
+// Dopisuje rekord do dziennika (jeśli drzewo go ma). Wołający jest w sekcji journal_begin. Części równe NULL pomija.
+void journal_record(Tree *tree, RecordKind kind, uint32_t dir, const char *path, const char *target, const char *data,
+                    size_t length) {
+    if (!tree->journal) {
+        return;
+    }
+    char header[1 + VARINT_MAX_LENGTH];
+    header[0] = (char) kind;
+    JournalPart parts[4] = {{.data = header, .length = 1 + encode_varint(dir, header + 1)}};
+    size_t count = 1;
+    if (path) {
+        parts[count++] = (JournalPart) {.data = path, .length = strlen(path) + 1};
     }
-    if ((err = pthread_cond_init(&node->readers, 0)) != 0) {
-        syserr(err, "cond readers init failed");
+    if (target) {
+        parts[count++] = (JournalPart) {.data = target, .length = strlen(target) + 1};
     }
-    if ((err = pthread_cond_init(&node->writers, 0)) != 0) {
-        syserr(err, "cond writers init failed");
+    if (data) {
+        parts[count++] = (JournalPart) {.data = data, .length = length};
+    }
+    journaled.position = journal_append(tree->journal, parts, count);
+}
+
+// Czeka, aż rekordy bieżącej operacji wątku będą na dysku. Wołający nie trzyma blokad i jest poza sekcją krytyczną
+// reclaim.h - przy grupowym zatwierdzaniu w tym czasie inne operacje dopisują swoje rekordy.
+void journal_sync(Tree *tree) {
+    if (journaled.position > 0) {
+        journal_wait(tree->journal, journaled.position);
+        journaled.position = 0;
     }
-    if ((err = pthread_cond_init(&node->movers, 0)) != 0) {
-        syserr(err, "cond writers init failed");
+}
+
+// Bufor, w którym składamy dłuższe dane rekordu.
+typedef struct {
+    char *data;
+    size_t length;
+    size_t capacity;
+} RecordBuffer;
+
+void record_put(RecordBuffer *buffer, const void *data, size_t length) {
+    if (buffer->length + length > buffer->capacity) {
+        buffer->capacity = 2 * (buffer->length + length);
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) {
+            fatal("journal record allocation failed");
+        }
     }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void record_put_varint(RecordBuffer *buffer, uint64_t value) {
+    char encoded[VARINT_MAX_LENGTH];
+    record_put(buffer, encoded, encode_varint(value, encoded));
+}
+
+void record_put_string(RecordBuffer *buffer, const char *string) {
+    record_put(buffer, string, strlen(string) + 1);
+}
+
+
+// Stan, który przeżywa zwolnienie wierzchołka: wpis dcache.h może wskazywać na zwolniony (lub użyty ponownie)
+// wierzchołek, a jego użytkownik zajmuje w nim czytelnię, zanim sprawdzi removed i generation.
+void node_construct(void *object) {
+    Node *node = object;
+    LockState lock = {.who_enters = READER_ENTERS};
+    atomic_init(&node->lock, lock_pack(&lock));
+    atomic_init(&node->generation, 0);
+    atomic_init(&node->removed, true);
+    atomic_init(&node->version, 1);
+}
 
-    node->readers_count = 0;
-    node->writers_count = 0;
-    node->readers_wait = 0;
-    node->writers_wait = 0;
-    node->who_enters = READER_ENTERS;
-    node->movers_count = 0;
-    node->movers_wait = 0;
-    node->count_in_subtree = 0;
+Node *node_new(Slab *slab) {
+    Node *node = slab_alloc(slab);
+    // Nowa generacja musi być widoczna, zanim removed przestanie być ustawione.
+    atomic_fetch_add(&node->generation, 1);
+    atomic_store(&node->removed, false);
+    atomic_store(&node->version, 0);
+    node->slab = slab;
+    node->children = hmap_new();
+    node->names = NULL;
+    atomic_init(&node->listing, NULL);
+    atomic_init(&node->parent, NULL);
+    atomic_init(&node->moved_at, 0);
+    atomic_init(&node->references, 1);
+    atomic_init(&node->copies, NULL);
+    node->preserved = modification.epoch;
 
     return node;
 }
 
+// liczba usuniętych wierzchołków czekających na zwolnienie (we wszystkich drzewach)
+static atomic_size_t retired_nodes_pending = 0;
+
+void node_unreference(Node *node);
+
 void node_destroy(Node *node) {
-    assert(node->count_in_subtree == 0);
-    assert(node->readers_count == 0 && node->readers_wait == 0);
-    assert((node->writers_count == 0 || node->writers_count == 1) && node->writers_wait == 0);
-    assert(node->movers_count == 0 && node->movers_wait == 0);
+#ifndef NDEBUG
+    // Czytelnię usuniętego wierzchołka może jeszcze na chwilę zająć ktoś, kto trafił do niego przez dcache.h.
+    if (!atomic_load(&node->removed)) {
+        LockState lock = lock_load(node);
+        assert(lock.readers_count == 0 && lock.readers_wait == 0);
+        assert(lock.writers_wait == 0);
+    }
+#endif
 
+    // Kopie trzymają referencję do wierzchołka, więc już ich nie ma.
+    assert(!atomic_load(&node->copies));
+    bool removed = atomic_load(&node->removed);
+
+    // Dzieci mogą być jeszcze w kopiach dla migawek - wtedy zwolni je ostatnia z nich.
     const char *key = NULL;
     void *value = NULL;
     HashMapIterator it = hmap_iterator(node->children);
     while (hmap_next(node->children, &it, &key, &value)) {
-        node_destroy((Node *) value);
+        node_unreference((Node *) value);
     }
     hmap_free(node->children);
-
-    int err;
-    if ((err = pthread_cond_destroy(&node->readers)) != 0) {
-        syserr(err, "cond readers destroy failed");
-    }
-    if ((err = pthread_cond_destroy(&node->writers)) != 0) {
-        syserr(err, "cond writers destroy failed");
-    }
-    if ((err = pthread_mutex_destroy(&node->mutex)) != 0) {
-        syserr(err, "mutex destroy failed");
-    }
-    if ((err = pthread_cond_destroy(&node->movers)) != 0) {
-        syserr(err, "cond movers destroy failed");
+    if (node->names) {
+        sset_free(node->names);
     }
+    free(atomic_load(&node->listing));
 
-    free(node);
+    slab_free(node->slab, node);
+    if (removed) {
+        atomic_fetch_sub(&retired_nodes_pending, 1);
+    }
 }
 
+// Usunięty wierzchołek zwalniamy, gdy nikt nie może go już oglądać bez blokad, nie ma do niego otwartych uchwytów
+// i nie ma go w żadnej kopii dla migawek.
+void node_unreference(Node *node) {
+    if (atomic_fetch_sub(&node->references, 1) == 1) {
+        node_destroy(node);
+    }
+}
 
+void node_destroy_retired(Retired *retired) {
+    node_unreference((Node *) ((char *) retired - offsetof(Node, retired)));
+}
 
-void increase_counter(Node *node) {
-    int err;
+void node_retire(Node *node) {
+    atomic_fetch_add(&retired_nodes_pending, 1);
+    node->retired.destroy = node_destroy_retired;
+    reclaim_retire(&node->retired);
+}
 
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
-    }
 
-    node->count_in_subtree++;
+void version_write_begin(_Atomic uint64_t *version) {
+    uint64_t previous = atomic_fetch_add(version, 1);
+    assert(previous % 2 == 0);
+    (void) previous;
+}
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
-    }
+void version_write_end(_Atomic uint64_t *version) {
+    uint64_t previous = atomic_fetch_add(version, 1);
+    assert(previous % 2 == 1);
+    (void) previous;
 }
 
+// Przeniesienia są wykonywane pod muteksem przeniesień drzewa, więc wersja struktury jest zwykłym seqlockiem. Liczba
+// rozpoczętych przeniesień (numer ostatniego z nich) to połowa wersji zaokrąglona w górę.
+uint64_t structure_moves(uint64_t version) {
+    return (version + 1) / 2;
+}
 
-void decrease_counter(Node *node) {
-    int err;
+bool version_is_being_written(uint64_t version) {
+    return version % 2 == 1;
+}
 
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
-    }
+// Czy wersja odczytana przed optymistycznymi odczytami jest nadal aktualna.
+bool version_validate(_Atomic uint64_t *version, uint64_t expected) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(version, memory_order_relaxed) == expected;
+}
 
-    node->count_in_subtree--;
-    assert(node->count_in_subtree >= 0);
 
-    if (node->count_in_subtree == 0 && node->movers_wait > 0) {
-        node->who_enters = MOVER_ENTERS;
-        if ((err = pthread_cond_broadcast(&node->movers)) != 0) {
-            syserr(err, "cond movers broadcast failed");
-        }
+void snapshot_lock(Tree *tree) {
+    int err;
+    if ((err = pthread_mutex_lock(&tree->snapshot_mutex)) != 0) {
+        syserr("mutex lock failed");
     }
+}
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
+void snapshot_unlock(Tree *tree) {
+    int err;
+    if ((err = pthread_mutex_unlock(&tree->snapshot_mutex)) != 0) {
+        syserr("mutex unlock failed");
     }
 }
 
-
-void decrease_counter_until(Node *node, Node *first_node, bool with_first) {
-    if (node == NULL || first_node == NULL) {
-        return;
+// Wołający jest pisarzem w wierzchołku.
+NodeCopy *node_copy_new(Node *node, uint64_t epoch) {
+    size_t count = hmap_size(node->children);
+    size_t length = count ? sset_joined_length(node->names) : 0;
+    size_t size = sizeof(NodeCopy) + count * sizeof(ChildEntry) + length + 1;
+    NodeCopy *copy = malloc(size);
+    if (!copy) {
+        fatal("snapshot copy allocation failed");
     }
-
-    Node *parent;
-    while (node != first_node) {
-        parent = node->parent;
-        decrease_counter(node);
-        node = parent;
+    atomic_init(&copy->older, NULL);
+    copy->node = node;
+    copy->epoch = epoch;
+    copy->size = size;
+    copy->count = count;
+
+    char *name = (char *) (copy->entries + count);
+    if (count) {
+        sset_join_into(node->names, '\0', name);
     }
-    if (with_first) {
-        decrease_counter(node);
+    for (size_t i = 0; i < count; i++) {
+        Node *child = hmap_get(node->children, name);
+        atomic_fetch_add(&child->references, 1);
+        copy->entries[i] = (ChildEntry) {.name = name, .child = child};
+        name += strlen(name) + 1;
     }
+    atomic_fetch_add(&node->references, 1);
+    return copy;
 }
 
+void node_copy_destroy(Retired *retired) {
+    NodeCopy *copy = (NodeCopy *) ((char *) retired - offsetof(NodeCopy, retired));
+    for (size_t i = 0; i < copy->count; i++) {
+        node_unreference(copy->entries[i].child);
+    }
+    node_unreference(copy->node);
+    free(copy);
+}
 
-void reader_beginning_protocol(Node *node) {
-    int err;
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
+// Czy któraś migawka potrzebuje stanu dzieci wierzchołka sprzed zmiany o numerze epoch, jeśli poprzednia zmiana
+// miała numer preserved. Wołający trzyma muteks migawek.
+bool snapshot_needs_copy(Tree *tree, uint64_t preserved, uint64_t epoch) {
+    for (TreeSnapshot *snapshot = tree->snapshots; snapshot; snapshot = snapshot->next) {
+        if (snapshot->epoch > preserved && snapshot->epoch <= epoch) {
+            return true;
+        }
     }
+    return false;
+}
 
-    if (node->who_enters != READER_ENTERS) {
-        node->readers_wait++;
-        while (node->who_enters != READER_ENTERS) {
-            if ((err = pthread_cond_wait(&node->readers, &node->mutex)) != 0) {
-                syserr(err, "cond readers wait failed");
+// Zachowuje dzieci wierzchołka dla migawek, które ich potrzebują - wołający jest pisarzem w wierzchołku i zaraz je
+// zmieni (opis na początku pliku).
+void node_preserve(Node *node) {
+    Tree *tree = modification.tree;
+    uint64_t epoch = modification.epoch;
+    if (node->preserved >= epoch) {
+        return;
+    }
+    if (modification.preserve) {
+        snapshot_lock(tree);
+        if (snapshot_needs_copy(tree, node->preserved, epoch)) {
+            NodeCopy *copy = node_copy_new(node, epoch);
+            atomic_store(&copy->older, atomic_load(&node->copies));
+            copy->registry_prev = tree->copies_last;
+            copy->registry_next = NULL;
+            if (tree->copies_last) {
+                tree->copies_last->registry_next = copy;
             }
+            else {
+                tree->copies_first = copy;
+            }
+            tree->copies_last = copy;
+            atomic_fetch_add(&tree->copies_count, 1);
+            atomic_fetch_add(&tree->copies_bytes, copy->size);
+            atomic_store(&node->copies, copy);
         }
-        node->readers_wait--;
+        snapshot_unlock(tree);
     }
-    assert(node->who_enters == READER_ENTERS);
+    node->preserved = epoch;
+}
+
+// Początek zmiany dzieci wierzchołka przez pisarza. Operacja wywołała już modification_begin.
+void children_write_begin(Node *node) {
+    node_preserve(node);
+    version_write_begin(&node->version);
+}
 
-    if (node->readers_wait == 0 && node->writers_wait > 0) {
-        node->who_enters = WRITER_ENTERS;
+// Usuwa kopie, których nie potrzebuje już żadna migawka. Wołający trzyma muteks migawek.
+void snapshot_prune(Tree *tree) {
+    uint64_t oldest = UINT64_MAX;
+    for (TreeSnapshot *snapshot = tree->snapshots; snapshot; snapshot = snapshot->next) {
+        if (snapshot->epoch < oldest) {
+            oldest = snapshot->epoch;
+        }
     }
 
-    node->readers_count++;
-    assert(node->readers_count >= 0 && node->writers_count == 0);
+    NodeCopy *next;
+    for (NodeCopy *copy = tree->copies_first; copy; copy = next) {
+        next = copy->registry_next;
+        if (copy->epoch >= oldest) {
+            continue;
+        }
+        // Kopie wierzchołka są dodawane z rosnącymi numerami, więc starsze zostały już usunięte - to ostatnia kopia
+        // na liście wierzchołka.
+        _Atomic(NodeCopy *) *link = &copy->node->copies;
+        while (atomic_load(link) != copy) {
+            link = &atomic_load(link)->older;
+        }
+        assert(!atomic_load(&copy->older));
+        atomic_store(link, NULL);
+
+        if (copy->registry_prev) {
+            copy->registry_prev->registry_next = copy->registry_next;
+        }
+        else {
+            tree->copies_first = copy->registry_next;
+        }
+        if (copy->registry_next) {
+            copy->registry_next->registry_prev = copy->registry_prev;
+        }
+        else {
+            tree->copies_last = copy->registry_prev;
+        }
+        atomic_fetch_sub(&tree->copies_count, 1);
+        atomic_fetch_sub(&tree->copies_bytes, copy->size);
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
+        copy->retired.destroy = node_copy_destroy;
+        reclaim_retire(&copy->retired);
     }
 }
 
-void reader_ending_protocol(Node *node, Node *first_node, bool with_first) {
-    int err;
 
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
+void reader_beginning_protocol(Node *node) {
+    ParkingBucket *bucket = parking_lock(node);
+    LockState lock = lock_load(node);
+
+    if (lock.who_enters != READER_ENTERS) {
+        lock.readers_wait++;
+        lock_store(node, &lock);
+        do {
+            parking_wait(bucket);
+            lock = lock_load(node);
+        } while (lock.who_enters != READER_ENTERS);
+        lock.readers_wait--;
     }
+    assert(lock.who_enters == READER_ENTERS);
 
-    node->readers_count--;
-    assert(node->readers_count >= 0 && node->writers_count == 0 && node->movers_count == 0);
-
-    if (node->readers_count == 0 && node->writers_wait > 0) {
-        node->who_enters = WRITER_ENTERS;
-        if ((err = pthread_cond_broadcast(&node->writers)) != 0) {
-            syserr(err, "cond writers broadcast failed");
-        }
+    if (lock.readers_wait == 0 && lock.writers_wait > 0) {
+        lock.who_enters = WRITER_ENTERS;
     }
 
-    if (first_node != NULL) {
-        node->count_in_subtree--;
-        assert(node->count_in_subtree >= 0);
-        if (node->count_in_subtree == 0 && node->movers_wait > 0) {
-            node->who_enters = MOVER_ENTERS;
-            if ((err = pthread_cond_broadcast(&node->movers)) != 0) {
-                syserr(err, "cond movers broadcast failed");
-            }
+    lock.readers_count++;
+    assert(lock.writers_count == 0);
+    lock_store(node, &lock);
+
+    parking_unlock(bucket);
+}
+
+// Jak reader_beginning_protocol, ale zamiast czekać zwraca false.
+bool reader_try_beginning_protocol(Node *node) {
+    ParkingBucket *bucket = parking_lock(node);
+    LockState lock = lock_load(node);
+
+    bool entered = lock.who_enters == READER_ENTERS;
+    if (entered) {
+        if (lock.readers_wait == 0 && lock.writers_wait > 0) {
+            lock.who_enters = WRITER_ENTERS;
         }
-    }
-    decrease_counter_until(node->parent, first_node, with_first);
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
+        lock.readers_count++;
+        assert(lock.writers_count == 0);
+        lock_store(node, &lock);
     }
+
+    parking_unlock(bucket);
+    return entered;
 }
 
+void reader_ending_protocol(Node *node) {
+    ParkingBucket *bucket = parking_lock(node);
+    LockState lock = lock_load(node);
 
-void writer_beginning_protocol(Node *node) {
-    int err;
+    assert(lock.readers_count > 0 && lock.writers_count == 0);
+    lock.readers_count--;
 
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
+    bool wake = lock.readers_count == 0 && lock.writers_wait > 0;
+    if (wake) {
+        lock.who_enters = WRITER_ENTERS;
+    }
+    lock_store(node, &lock);
+    if (wake) {
+        parking_wake_all(bucket);
     }
 
-    node->who_enters = WRITER_ENTERS;
+    parking_unlock(bucket);
+}
 
-    if (node->readers_count + node->writers_count + node->movers_count > 0) {
-        node->writers_wait++;
-        while (node->readers_count + node->writers_count + node->movers_count > 0 || node->who_enters != WRITER_ENTERS) {
-            if ((err = pthread_cond_wait(&node->writers, &node->mutex)) != 0) {
-                syserr(err, "cond writers wait failed");
-            }
-        }
-        node->writers_wait--;
+
+void writer_beginning_protocol(Node *node) {
+    ParkingBucket *bucket = parking_lock(node);
+    LockState lock = lock_load(node);
+
+    lock.who_enters = WRITER_ENTERS;
+
+    if (lock.readers_count + lock.writers_count > 0) {
+        lock.writers_wait++;
+        lock_store(node, &lock);
+        do {
+            parking_wait(bucket);
+            lock = lock_load(node);
+        } while (lock.readers_count + lock.writers_count > 0 || lock.who_enters != WRITER_ENTERS);
+        lock.writers_wait--;
     }
-    assert(node->who_enters == WRITER_ENTERS);
+    assert(lock.who_enters == WRITER_ENTERS);
 
-    node->writers_count++;
-    assert(node->readers_count == 0 && node->writers_count == 1 && node->movers_count == 0);
+    lock.writers_count++;
+    assert(lock.readers_count == 0 && lock.writers_count == 1);
+    lock_store(node, &lock);
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
-    }
+    parking_unlock(bucket);
 }
 
-void writer_ending_protocol(Node *node, Node *first_node, bool with_first) {
-    int err;
+void writer_ending_protocol(Node *node) {
+    ParkingBucket *bucket = parking_lock(node);
+    LockState lock = lock_load(node);
 
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
-    }
+    assert(lock.writers_count == 1 && lock.readers_count == 0);
+    lock.writers_count--;
 
-    node->writers_count--;
-    assert(node->writers_count == 0 && node->readers_count == 0 && node->movers_count == 0);
-    if (node->readers_wait > 0) {
-        node->who_enters = READER_ENTERS;
-        if ((err = pthread_cond_broadcast(&node->readers)) != 0) {
-            syserr(err, "cond readers broadcast failed");
-        }
+    bool wake = true;
+    if (lock.readers_wait > 0) {
+        lock.who_enters = READER_ENTERS;
     }
-    else if (node->writers_wait > 0) {
-        node->who_enters = WRITER_ENTERS;
-        if ((err = pthread_cond_broadcast(&node->writers)) != 0) {
-            syserr(err, "cond writers broadcast failed");
-        }
+    else if (lock.writers_wait > 0) {
+        lock.who_enters = WRITER_ENTERS;
     }
     else {
-        node->who_enters = READER_ENTERS;
+        lock.who_enters = READER_ENTERS;
+        wake = false;
     }
-
-    if (first_node != NULL) {
-        node->count_in_subtree--;
-        assert(node->count_in_subtree >= 0);
-        if (node->count_in_subtree == 0 && node->movers_wait > 0) {
-            node->who_enters = MOVER_ENTERS;
-            if ((err = pthread_cond_broadcast(&node->movers)) != 0) {
-                syserr(err, "cond movers broadcast failed");
-            }
-        }
+    lock_store(node, &lock);
+    if (wake) {
+        parking_wake_all(bucket);
     }
-    decrease_counter_until(node->parent, first_node, with_first);
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
-    }
+    parking_unlock(bucket);
 }
 
 
-void mover_beginning_protocol(Node *node) {
-    int err;
-
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
-    }
+// Próba operacji: folder, od którego liczymy ścieżki (korzeń albo folder uchwytu), i liczba rozpoczętych przeniesień
+// odczytana na początku próby, przed zejściem z niego. Próba od korzenia może zacząć schodzenie od wierzchołka
+// z dcache.h (start na głębokości start_depth) - wtedy moves to znacznik wpisu, a begun to liczba odczytana teraz.
+typedef struct {
+    Node *dir;
+    uint64_t moves;
+    uint64_t begun;
+    Node *start;
+    size_t start_depth;
+    DentryEntry *entry; // NULL, jeśli próba zaczyna od dir
+    bool cached; // czy zapamiętywać w dcache.h prefiksy, przez które przechodzi
+} Attempt;
+
+Attempt attempt_begin(Tree *tree, Node *dir) {
+    uint64_t moves = structure_moves(atomic_load(&tree->structure_version));
+    return (Attempt) {.dir = dir, .moves = moves, .begun = moves, .start = dir, .start_depth = 0, .entry = NULL,
+                      .cached = false};
+}
 
-    node->who_enters = MOVER_ENTERS;
+DentryEntry *dentry_lookup(Tree *tree, const Path *path, size_t max_depth) {
+    DentryEntry *entry = dcache_lookup(tree->dentries, path, max_depth);
+    StatsStripe *stats = get_stats_stripe(tree);
+    atomic_fetch_add_explicit(entry ? &stats->dentry_hits : &stats->dentry_misses, 1, memory_order_relaxed);
+    return entry;
+}
 
-    if (node->count_in_subtree > 0) {
-        node->movers_wait++;
-        while (node->count_in_subtree > 0 || node->who_enters != MOVER_ENTERS) {
-            if ((err = pthread_cond_wait(&node->movers, &node->mutex)) != 0) {
-                syserr(err, "cond movers wait failed");
-            }
-        }
-        node->movers_wait--;
+void dentry_invalidate(Tree *tree, DentryEntry *entry) {
+    if (dcache_invalidate(tree->dentries, entry)) {
+        atomic_fetch_add_explicit(&get_stats_stripe(tree)->dentry_invalidations, 1, memory_order_relaxed);
     }
-    assert(node->who_enters == MOVER_ENTERS);
+}
 
-    node->movers_count++;
-    assert(node->readers_count == 0 && node->writers_count == 0 && node->count_in_subtree == 0 && node->movers_count == 1);
+// Próba operacji, której wynik dotyczy wierzchołka na głębokości end ścieżki path - zaczyna od najgłębszego
+// zapamiętanego przodka tego wierzchołka, jeśli liczymy od korzenia.
+Attempt attempt_begin_at(Tree *tree, Node *dir, const Path *path, size_t end) {
+    Attempt attempt = attempt_begin(tree, dir);
+    if (dir != tree->root || end <= DCACHE_MIN_DEPTH) {
+        return attempt;
+    }
 
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
+    attempt.cached = true;
+    DentryEntry *entry = dentry_lookup(tree, path, end - 1);
+    if (entry) {
+        attempt.entry = entry;
+        attempt.start = entry->node;
+        attempt.start_depth = entry->depth;
+        attempt.moves = atomic_load(&entry->stamp);
     }
+    return attempt;
 }
 
+// Czy wierzchołek z wpisu dcache.h, w którym wołający właśnie zajął czytelnię, jest tym samym folderem, który
+// zapamiętano (a nie usuniętym albo użytym ponownie na inny). Kolejność odczytów jest odwrotna do node_new.
+bool start_is_valid(const Attempt *attempt) {
+    return !atomic_load(&attempt->start->removed) &&
+           atomic_load(&attempt->start->generation) == attempt->entry->generation;
+}
 
-
-void mover_ending_protocol(Node *node, Node *first_node, bool with_first) {
-    int err;
-
-    if ((err = pthread_mutex_lock(&node->mutex)) != 0) {
-        syserr(err, "mutex lock failed");
+// Czy ścieżka, po której doszliśmy do node, nadal do niego prowadzi. Wołający trzyma blokadę w node. Wystarczy
+// sprawdzić, że od początku próby nie przeniesiono ani node, ani żadnego z jego obecnych przodków poniżej folderu
+// próby - najniższy przeniesiony wierzchołek ścieżki, po której szliśmy, byłby obecnym przodkiem node. Przeniesienie
+// samego folderu próby (lub jego przodków) nie szkodzi - ścieżki są liczone od niego. Przeniesienie zapisuje moved_at
+// przed zmianą wskaźnika na rodzica, więc kto zobaczy nowego rodzica, zobaczy też nowy numer.
+// Usunięty folder uchwytu unieważnia każdą próbę - wołający zwraca wtedy ENOENT zamiast ją powtarzać.
+// Próba zaczęta od wpisu dcache.h sprawdza w ten sam sposób także prefiks ścieżki z wpisu (moves to znacznik wpisu -
+// do tej chwili prefiks prowadził do wierzchołka wpisu). Nieaktualny wpis jest usuwany, a aktualny dostaje nowszy
+// znacznik, żeby kolejne próby znów mogły skorzystać z szybkiej ścieżki.
+bool path_is_valid(Tree *tree, const Attempt *attempt, Node *node) {
+    if (atomic_load(&attempt->dir->removed)) {
+        return false;
     }
-
-    node->movers_count--;
-    assert(node->movers_count >= 0 && node->writers_count == 0 && node->readers_count == 0);
-    assert(node->writers_wait == 0 && node->readers_wait == 0 && node->movers_wait == 0);
-
-    node->who_enters = READER_ENTERS;
-
-    if (first_node != NULL) {
-        node->count_in_subtree--;
-        assert(node->count_in_subtree >= 0);
-        if (node->count_in_subtree == 0 && node->movers_wait > 0) {
-            node->who_enters = MOVER_ENTERS;
-            if ((err = pthread_cond_broadcast(&node->movers)) != 0) {
-                syserr(err, "cond movers broadcast failed");
+    if (structure_moves(atomic_load(&tree->structure_version)) == attempt->moves) {
+        return true;
+    }
+    while (node != attempt->dir) {
+        Node *parent = node->parent;
+        if (atomic_load(&node->moved_at) > attempt->moves) {
+            if (attempt->entry) {
+                dentry_invalidate(tree, attempt->entry);
             }
+            return false;
         }
+        node = parent;
     }
-    decrease_counter_until(node->parent, first_node, with_first);
-
-    if ((err = pthread_mutex_unlock(&node->mutex)) != 0) {
-        syserr(err, "mutex unlock failed");
+    if (attempt->entry) {
+        dcache_restamp(attempt->entry, attempt->begun);
     }
+    return true;
 }
 
+// Wołane po każdej próbie unieważnionej przez przeniesienie; attempts to liczba dotychczasowych prób operacji.
+void attempt_stale(Tree *tree, int *attempts) {
+    if (++*attempts == STALE_ATTEMPTS) {
+        atomic_fetch_add(&tree->starving, 1);
+    }
+}
 
-Node *get_node_real(Node *node, Node *first_node, const char *path, int type, bool lock_first) {
-    if (lock_first || first_node != node) {
-        increase_counter(node);
+void attempts_finished(Tree *tree, int attempts) {
+    if (attempts >= STALE_ATTEMPTS && atomic_fetch_sub(&tree->starving, 1) == 1) {
+        ParkingBucket *bucket = parking_lock(&tree->starving);
+        parking_wake_all(bucket);
+        parking_unlock(bucket);
     }
+}
 
-    if (!strcmp(path, "/")) {
-        return node;
+// Nowe przeniesienie czeka, aż nie będzie operacji, które wstrzymały przeniesienia.
+void wait_for_starving(Tree *tree) {
+    if (atomic_load(&tree->starving) == 0) {
+        return;
+    }
+    ParkingBucket *bucket = parking_lock(&tree->starving);
+    while (atomic_load(&tree->starving) > 0) {
+        parking_wait(bucket);
     }
+    parking_unlock(bucket);
+}
+
 
-    if (lock_first || first_node != node) {
-        if (type == READER_BEGIN) {
+// Schodzi od node po składowych path o indeksach [begin, end) jako czytelnik, trzymając blokadę w aktualnym
+// wierzchołku i jego rodzicu. Zwraca końcowy wierzchołek (bez blokady w nim) - wołający jest wtedy czytelnikiem w jego
+// rodzicu, chyba że rodzicem jest node, a lock_first == false (wtedy node jest już zablokowany przez wołającego
+// i get_node go nie dotyka).
+// Jeśli składowej brakuje, zwalnia swoje blokady i zwraca NULL. Brak składowej jest wynikiem tylko wtedy, gdy ścieżka
+// była w chwili sprawdzenia aktualna - w przeciwnym razie ustawia *stale.
+// Jeśli próba zaczyna od wpisu dcache.h, node jest wierzchołkiem wpisu (a lock_first == true). W próbie, która
+// zapamiętuje prefiksy, get_node zapamiętuje rodzica zwracanego wierzchołka - jest w nim czytelnikiem.
+Node *get_node(Tree *tree, const Attempt *attempt, Node *node, const Path *path, size_t begin, size_t end,
+               bool lock_first, bool *stale) {
+    Node *first_node = node;
+    Node *parent = NULL;
+    *stale = false;
+
+    for (size_t index = begin; index < end; index++) {
+        bool own_lock = lock_first || node != first_node;
+        if (own_lock) {
             reader_beginning_protocol(node);
         }
-        else if (type == WRITER_BEGIN) {
-            writer_beginning_protocol(node);
-        }
-    }
-
-    if (node != first_node && (lock_first || first_node != node->parent)) {
-        if (type == READER_BEGIN) {
-            reader_ending_protocol(node->parent, NULL, 0);
+        if (node != first_node && (lock_first || node->parent != first_node)) {
+            reader_ending_protocol(node->parent);
         }
-        else if (type == WRITER_BEGIN) {
-            writer_ending_protocol(node->parent, NULL, 0);
+        if (node == attempt->start && attempt->entry && !start_is_valid(attempt)) {
+            dentry_invalidate(tree, attempt->entry);
+            reader_ending_protocol(node);
+            *stale = true;
+            return NULL;
         }
-    }
-
-    char *next_node_name = malloc(sizeof(char) * (MAX_FOLDER_NAME_LENGTH + 1));
-    const char *new_path = split_path(path, next_node_name);
-
-    Node *next_node = hmap_get(node->children, next_node_name);
-    free(next_node_name);
 
-    if (!next_node) {
-        if (lock_first || first_node != node) {
-            if (type == READER_BEGIN) {
-                reader_ending_protocol(node, first_node, lock_first);
-            }
-            else if (type == WRITER_BEGIN) {
-                writer_ending_protocol(node, first_node, lock_first);
+        Node *next_node = hmap_get_prehashed(node->children, path_component(path, index), path->lengths[index],
+                                             path->hashes[index]);
+        if (!next_node) {
+            *stale = !path_is_valid(tree, attempt, node);
+            if (own_lock) {
+                reader_ending_protocol(node);
             }
+            return NULL;
         }
-
-        return NULL;
+        parent = node;
+        node = next_node;
     }
 
-    Node *result_node = get_node_real(next_node, first_node, new_path, type, lock_first);
-    return result_node;
+    if (attempt->cached && end - 1 >= DCACHE_MIN_DEPTH && end - 1 > attempt->start_depth) {
+        dcache_insert(tree->dentries, path, end - 1, parent, atomic_load(&parent->generation), attempt->moves);
+    }
+    return node;
 }
 
-Node *get_node(Node *node, const char *path, int type, bool lock_first) {
-    Node *result_node = get_node_real(node, node, path, type, lock_first);
-    return result_node;
+// Wołający jest pisarzem w wierzchołku, więc nikt nie czyta zapamiętanego wyniku.
+void invalidate_listing(Node *node) {
+    free(atomic_exchange(&node->listing, NULL));
 }
 
-int add_child(Node *parent, Node *child, const char *child_name) {
-    if (hmap_get(parent->children, child_name)) {
-        return EEXIST;
-    }
-
+void add_child(Node *parent, Node *child, const char *child_name) {
+    children_write_begin(parent);
     hmap_insert(parent->children, child_name, child);
+    if (!parent->names) {
+        parent->names = sset_new();
+    }
+    sset_insert(parent->names, child_name, strlen(child_name));
+    invalidate_listing(parent);
+    version_write_end(&parent->version);
     child->parent = parent;
-
-    return 0;
 }
 
 
-int remove_child(Node *parent, const char *child_name) {
+// Zajmuje dziecko jako pisarz i zwraca je, jeśli jest puste. W przeciwnym razie zwraca NULL i ustawia *err.
+Node *lock_child_to_remove(Node *parent, const char *child_name, int *err) {
     Node *node = hmap_get(parent->children, child_name);
 
     if (!node) {
-        return ENOENT;
+        *err = ENOENT;
+        return NULL;
     }
 
     writer_beginning_protocol(node);
 
     if (hmap_size(node->children)) {
-        writer_ending_protocol(node, NULL, 0);
-        return ENOTEMPTY;
+        writer_ending_protocol(node);
+        *err = ENOTEMPTY;
+        return NULL;
     }
+    return node;
+}
 
+// Wołający jest pisarzem w ojcu i w node (zwróconym przez lock_child_to_remove) i zapisuje właśnie wersję ojca.
+// Nazwę z parent->names usuwa wołający.
+void detach_child(Node *parent, Node *node, const char *child_name) {
     hmap_remove(parent->children, child_name);
-    node_destroy(node);
 
-    return 0;
+    // Optymistyczni czytelnicy mogą jeszcze oglądać wierzchołek - nieparzysta wersja na zawsze odrzuci ich odczyty,
+    // a pamięć zwolnimy (już poza blokadą pisarza), gdy wszyscy wyjdą ze swoich sekcji krytycznych i zostaną
+    // zamknięte uchwyty wierzchołka. Operacje z uchwytu zobaczą removed, trzymając blokadę w wierzchołku - dlatego ją
+    // zwalniamy.
+    atomic_store(&node->removed, true);
+    version_write_begin(&node->version);
+    writer_ending_protocol(node);
+    node_retire(node);
+}
+
+// Usuwa dziecko zajęte przez lock_child_to_remove.
+void remove_child(Node *parent, Node *node, const char *child_name) {
+    children_write_begin(parent);
+    detach_child(parent, node, child_name);
+    sset_remove(parent->names, child_name, strlen(child_name));
+    invalidate_listing(parent);
+    version_write_end(&parent->version);
 }
 
-char *get_children_names(Node *node) {
-    return make_map_contents_string(node->children);
+// Wołający jest czytelnikiem w wierzchołku. Czytelników może być wielu naraz - wynik budujemy bez blokad, a jeśli ktoś
+// zapamiętał go przed nami, używamy jego wersji.
+char *get_children_names(Tree *tree, Node *node) {
+    Listing *listing = atomic_load(&node->listing);
+    if (listing) {
+        atomic_fetch_add_explicit(&get_stats_stripe(tree)->listing_hits, 1, memory_order_relaxed);
+    }
+    else {
+        atomic_fetch_add_explicit(&get_stats_stripe(tree)->listing_misses, 1, memory_order_relaxed);
+
+        size_t length = node->names ? sset_joined_length(node->names) : 0;
+        listing = malloc(sizeof(Listing) + length + 1);
+        if (!listing) {
+            return NULL;
+        }
+        listing->length = length;
+        if (node->names) {
+            sset_join_into(node->names, ',', listing->data);
+        }
+        else {
+            listing->data[0] = '\0';
+        }
+
+        Listing *expected = NULL;
+        if (!atomic_compare_exchange_strong(&node->listing, &expected, listing)) {
+            free(listing);
+            listing = expected;
+        }
+    }
+
+    char *result = malloc(listing->length + 1);
+    if (result) {
+        memcpy(result, listing->data, listing->length + 1);
+    }
+    return result;
 }
 
 Tree *tree_new() {
+    // Tablice i klucze hash-map zwalniane przy modyfikacjach mogą być jeszcze czytane przez optymistycznych czytelników.
+    hmap_set_deferred_free(sizeof(Retired), reclaim_free_block);
+
     Tree *tree = malloc(sizeof(Tree));
-    tree->root = node_new();
-    tree->root->parent = NULL;
+    tree->nodes = slab_new(sizeof(Node), node_construct, NULL);
+    tree->root = node_new(tree->nodes);
+    tree->root->preserved = 0;
+    atomic_init(&tree->structure_version, 0);
+    int err;
+    if ((err = pthread_mutex_init(&tree->move_mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    atomic_init(&tree->snapshot_epoch, 0);
+    if ((err = pthread_mutex_init(&tree->snapshot_mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    tree->snapshots = NULL;
+    atomic_init(&tree->snapshots_live, 0);
+    tree->copies_first = tree->copies_last = NULL;
+    atomic_init(&tree->copies_count, 0);
+    atomic_init(&tree->copies_bytes, 0);
+    atomic_init(&tree->starving, 0);
+    tree->journal = NULL;
+    tree->dir_ids = 0;
+    tree->dirs = NULL;
+    if ((err = pthread_mutex_init(&tree->checkpoint_mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    pthread_condattr_t attr;
+    if ((err = pthread_condattr_init(&attr)) != 0 || (err = pthread_condattr_setclock(&attr, CLOCK_MONOTONIC)) != 0
+        || (err = pthread_cond_init(&tree->checkpoint_wakeup, &attr)) != 0
+        || (err = pthread_condattr_destroy(&attr)) != 0) {
+        syserr("cond init failed");
+    }
+    tree->checkpointing = false;
+    tree->checkpoint_stop = false;
+    tree->checkpoint_path = NULL;
+    tree->checkpoint_threshold = 0;
+    tree->checkpoint_position = 0;
+    atomic_init(&tree->checkpoints, 0);
+    atomic_init(&tree->checkpoint_failures, 0);
+    atomic_init(&tree->checkpoint_bytes, 0);
+    atomic_init(&tree->checkpoint_nanoseconds, 0);
+    atomic_init(&tree->checkpoint_stall_nanoseconds, 0);
+    tree->dentries = dcache_new();
+    tree->stats = aligned_alloc(CACHE_LINE, sizeof(StatsStripe) * STATS_STRIPES);
+    if (!tree->stats) {
+        fatal("stats allocation failed");
+    }
+    for (int i = 0; i < STATS_STRIPES; i++) {
+        atomic_init(&tree->stats[i].listing_hits, 0);
+        atomic_init(&tree->stats[i].listing_misses, 0);
+        atomic_init(&tree->stats[i].dentry_hits, 0);
+        atomic_init(&tree->stats[i].dentry_misses, 0);
+        atomic_init(&tree->stats[i].dentry_invalidations, 0);
+    }
     return tree;
 }
 
+void checkpointer_stop(Tree *tree);
+
 void tree_free(Tree *tree) {
-    assert(tree->root->count_in_subtree == 0);
-    node_destroy(tree->root);
+    assert(atomic_load(&tree->starving) == 0);
+    // Zwolnienie ostatniej migawki usunęło wszystkie kopie.
+    assert(!tree->snapshots && !tree->copies_first);
+    if (tree->checkpointing) {
+        checkpointer_stop(tree);
+    }
+    if (tree->journal) {
+        journal_close(tree->journal);
+    }
+    dcache_free(tree->dentries);
+    // Wierzchołki z kopii czekających jeszcze w reclaim.h zwolni ostatnia z nich.
+    node_unreference(tree->root);
+    // Usunięte wierzchołki czekające w reclaim.h trzymają slab, dopóki nie zostaną zwolnione.
+    slab_destroy(tree->nodes);
+    int err;
+    if ((err = pthread_mutex_destroy(&tree->move_mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    if ((err = pthread_mutex_destroy(&tree->snapshot_mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    if ((err = pthread_mutex_destroy(&tree->checkpoint_mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    if ((err = pthread_cond_destroy(&tree->checkpoint_wakeup)) != 0) {
+        syserr("cond destroy failed");
+    }
+    free(tree->stats);
     free(tree);
+    reclaim_collect();
 }
 
-char *tree_list(Tree *tree, const char *path) {
-    if (!is_path_valid(path)) {
-        return NULL;
+// Optymistyczne tree_list (opis na początku pliku). Zwraca false w przypadku konfliktu z pisarzem.
+bool list_optimistic(Tree *tree, Node *dir, const Path *path, char **result) {
+    uint64_t structure = atomic_load(&tree->structure_version);
+    if (version_is_being_written(structure)) {
+        return false;
     }
 
-    Node *node = get_node(tree->root, path, READER_BEGIN, true);
-    if (!node) {
-        return NULL;
+    // Wpis dcache.h wystarczy, jeśli od jego znacznika nie zaczęło się żadne przeniesienie - koniec sprawdza, że
+    // nie zaczęło się też w trakcie.
+    bool cached = dir == tree->root && path->depth > DCACHE_MIN_DEPTH;
+    DentryEntry *entry = cached ? dcache_lookup(tree->dentries, path, path->depth - 1) : NULL;
+    if (entry && atomic_load(&entry->stamp) != structure_moves(structure)) {
+        entry = NULL;
     }
-
-    reader_beginning_protocol(node);
-    if (node->parent) {
-        reader_ending_protocol(node->parent, NULL, 0);
+    if (cached) {
+        StatsStripe *stats = get_stats_stripe(tree);
+        atomic_fetch_add_explicit(entry ? &stats->dentry_hits : &stats->dentry_misses, 1, memory_order_relaxed);
     }
 
-    char *result = get_children_names(node);
-
-    reader_ending_protocol(node, tree->root, true);
+    Node *node = entry ? entry->node : dir;
+    size_t begin = entry ? entry->depth : 0;
+    uint64_t version = atomic_load(&node->version);
+    if (version_is_being_written(version)) {
+        return false;
+    }
+    // Wersja wierzchołka usuniętego albo jeszcze nieużytego jest nieparzysta, więc jeśli teraz jest to zapamiętany
+    // folder, to odczytana wersja jest jego wersją, a sekcja krytyczna reclaim.h nie pozwoli użyć go ponownie.
+    if (entry && (atomic_load(&node->removed) || atomic_load(&node->generation) != entry->generation)) {
+        dentry_invalidate(tree, entry);
+        return false;
+    }
 
-    return result;
-}
+    Node *parent = NULL;
+    for (size_t i = begin; i < path->depth; i++) {
+        Node *child = hmap_get_prehashed(node->children, path_component(path, i), path->lengths[i],
+                                         path->hashes[i]);
+        if (!child) {
+            if (!version_validate(&node->version, version) || !version_validate(&tree->structure_version, structure)) {
+                return false;
+            }
+            *result = NULL;
+            return true;
+        }
 
-int tree_create(Tree *tree, const char *path) {
-    if (!is_path_valid(path)) {
-        return EINVAL;
+        uint64_t child_version = atomic_load(&child->version);
+        if (version_is_being_written(child_version) || !version_validate(&node->version, version)) {
+            return false;
+        }
+        parent = node;
+        node = child;
+        version = child_version;
     }
-    if (!strcmp(path, "/")) {
-        return EEXIST;
+
+    if (!reader_try_beginning_protocol(node)) {
+        return false;
     }
 
-    char new_node_name[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_parent = make_path_to_parent(path, new_node_name);
+    bool valid = atomic_load(&node->version) == version && atomic_load(&tree->structure_version) == structure;
+    if (valid) {
+        *result = get_children_names(tree, node);
+    }
 
-    Node *parent = get_node(tree->root, path_to_parent, READER_BEGIN, true);
-    if (!parent) {
-        free(path_to_parent);
-        return ENOENT;
+    reader_ending_protocol(node);
+    if (valid && cached && path->depth - 1 > begin) {
+        dcache_insert(tree->dentries, path, path->depth - 1, parent, atomic_load(&parent->generation),
+                      structure_moves(structure));
     }
+    return valid;
+}
 
-    writer_beginning_protocol(parent);
-    if (parent->parent) {
-        reader_ending_protocol(parent->parent, NULL, 0);
+// Próba tree_list zwykłym protokołem. Zwraca false, jeśli ścieżka zmieniła się w jej trakcie.
+bool list_attempt(Tree *tree, Node *dir, const Path *path, char **result) {
+    Attempt attempt = attempt_begin_at(tree, dir, path, path->depth);
+    bool stale;
+    Node *node = get_node(tree, &attempt, attempt.start, path, attempt.start_depth, path->depth, true, &stale);
+    if (!node) {
+        *result = NULL;
+        return !stale;
     }
 
-    Node *new_node = node_new();
-    new_node->parent = parent;
-    int err = add_child(parent, new_node, new_node_name);
-    if (err != 0) {
-        node_destroy(new_node);
+    reader_beginning_protocol(node);
+    if (node != dir) {
+        reader_ending_protocol(node->parent);
     }
 
-    writer_ending_protocol(parent, tree->root, true);
+    bool valid = path_is_valid(tree, &attempt, node);
+    if (valid) {
+        *result = get_children_names(tree, node);
+    }
 
-    free(path_to_parent);
-    return err;
+    reader_ending_protocol(node);
+    return valid;
 }
 
+char *tree_list_real(Tree *tree, Node *dir, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return NULL;
+    }
 
-int tree_remove(Tree *tree, const char *path) {
-    if (!is_path_valid(path)) {
+    for (int attempt = 0; attempt < OPTIMISTIC_ATTEMPTS; attempt++) {
+        char *result;
+        if (list_optimistic(tree, dir, &parsed, &result)) {
+            return result;
+        }
+    }
+
+    char *result;
+    int attempts = 0;
+    while (!list_attempt(tree, dir, &parsed, &result)) {
+        if (atomic_load(&dir->removed)) {
+            result = NULL;
+            break;
+        }
+        attempt_stale(tree, &attempts);
+    }
+    attempts_finished(tree, attempts);
+    return result;
+}
+
+// Dodaje pod ścieżką node (zbudowane z boku poddrzewo) albo, jeśli node == NULL, nowy pusty folder.
+int create_attempt(Tree *tree, Node *dir, const Path *parsed, const char *new_node_name, Node *node) {
+    size_t name_index = parsed->depth - 1;
+    Attempt attempt = attempt_begin_at(tree, dir, parsed, name_index);
+
+    bool stale;
+    Node *parent = get_node(tree, &attempt, attempt.start, parsed, attempt.start_depth, name_index, true, &stale);
+    if (!parent) {
+        return stale ? ESTALEPATH : ENOENT;
+    }
+
+    writer_beginning_protocol(parent);
+    if (parent != dir) {
+        reader_ending_protocol(parent->parent);
+    }
+
+    int err = ESTALEPATH;
+    journal_begin(tree);
+    // Sprawdzamy istnienie przed utworzeniem wierzchołka, żeby nieudane tree_create nic nie alokowało.
+    if (path_is_valid(tree, &attempt, parent)) {
+        modification_begin(tree);
+        err = EEXIST;
+        if (!hmap_get_prehashed(parent->children, path_component(parsed, name_index), parsed->lengths[name_index],
+                                parsed->hashes[name_index])) {
+            add_child(parent, node ? node : node_new(tree->nodes), new_node_name);
+            journal_record(tree, node ? RECORD_COPY : RECORD_CREATE, journaled.dir, parsed->path, NULL,
+                           node ? journaled.data : NULL, journaled.data_length);
+            err = 0;
+        }
+    }
+    journal_end(tree);
+
+    writer_ending_protocol(parent);
+
+    return err;
+}
+
+int create_node_real(Tree *tree, Node *dir, const Path *parsed, Node *node) {
+    char new_node_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_path_component(parsed, parsed->depth - 1, new_node_name);
+
+    int err;
+    int attempts = 0;
+    while ((err = create_attempt(tree, dir, parsed, new_node_name, node)) == ESTALEPATH) {
+        if (atomic_load(&dir->removed)) {
+            err = ENOENT;
+            break;
+        }
+        attempt_stale(tree, &attempts);
+    }
+    attempts_finished(tree, attempts);
+    return err;
+}
+
+int tree_create_real(Tree *tree, Node *dir, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return EINVAL;
+    }
+    if (parsed.depth == 0) {
+        return EEXIST;
+    }
+    return create_node_real(tree, dir, &parsed, NULL);
+}
+
+
+int remove_attempt(Tree *tree, Node *dir, const Path *parsed, const char *child_name) {
+    Attempt attempt = attempt_begin_at(tree, dir, parsed, parsed->depth - 1);
+
+    bool stale;
+    Node *parent = get_node(tree, &attempt, attempt.start, parsed, attempt.start_depth, parsed->depth - 1, true,
+                            &stale);
+    if (!parent) {
+        return stale ? ESTALEPATH : ENOENT;
+    }
+
+    writer_beginning_protocol(parent);
+    if (parent != dir) {
+        reader_ending_protocol(parent->parent);
+    }
+
+    // Dziecko zajmujemy przed sprawdzeniem ścieżki - pod muteksem dziennika nie można czekać na blokadę.
+    int err;
+    Node *node = lock_child_to_remove(parent, child_name, &err);
+    journal_begin(tree);
+    if (!path_is_valid(tree, &attempt, parent)) {
+        err = ESTALEPATH;
+        if (node) {
+            writer_ending_protocol(node);
+        }
+    }
+    else if (node) {
+        modification_begin(tree);
+        remove_child(parent, node, child_name);
+        journal_record(tree, RECORD_REMOVE, journaled.dir, parsed->path, NULL, NULL, 0);
+        err = 0;
+    }
+    journal_end(tree);
+
+    writer_ending_protocol(parent);
+
+    return err;
+}
+
+int tree_remove_real(Tree *tree, Node *dir, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
         return EINVAL;
     }
-    if (!strcmp(path, "/")) {
+    if (parsed.depth == 0) {
         return EBUSY;
     }
 
     char child_name[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_parent = make_path_to_parent(path, child_name);
+    copy_path_component(&parsed, parsed.depth - 1, child_name);
+
+    int err;
+    int attempts = 0;
+    while ((err = remove_attempt(tree, dir, &parsed, child_name)) == ESTALEPATH) {
+        if (atomic_load(&dir->removed)) {
+            err = ENOENT;
+            break;
+        }
+        attempt_stale(tree, &attempts);
+    }
+    attempts_finished(tree, attempts);
+    return err;
+}
+
+// Usuwanie poddrzewa (opis na początku pliku).
+
+// Próba odpięcia folderu razem z poddrzewem od ojca. Odpięty folder zwraca w *detached.
+int detach_attempt(Tree *tree, Node *dir, const Path *parsed, const char *child_name, Node **detached) {
+    size_t index = parsed->depth - 1;
+    Attempt attempt = attempt_begin_at(tree, dir, parsed, index);
 
-    Node *parent = get_node(tree->root, path_to_parent, READER_BEGIN, true);
+    bool stale;
+    Node *parent = get_node(tree, &attempt, attempt.start, parsed, attempt.start_depth, index, true, &stale);
     if (!parent) {
-        free(path_to_parent);
-        return ENOENT;
+        return stale ? ESTALEPATH : ENOENT;
     }
 
     writer_beginning_protocol(parent);
-    if (parent->parent) {
-        reader_ending_protocol(parent->parent, NULL, 0);
+    if (parent != dir) {
+        reader_ending_protocol(parent->parent);
     }
 
-    int err = remove_child(parent, child_name);
-    free(path_to_parent);
+    int err = ESTALEPATH;
+    journal_begin(tree);
+    if (path_is_valid(tree, &attempt, parent)) {
+        modification_begin(tree);
+        Node *node = hmap_get_prehashed(parent->children, path_component(parsed, index), parsed->lengths[index],
+                                        parsed->hashes[index]);
+        err = ENOENT;
+        if (node) {
+            children_write_begin(parent);
+            // Jak przy zmianie nazwy: nowy numer przeniesienia w odpinanym folderze unieważnia ścieżki operacji
+            // w toku w jego poddrzewie, a kto go odczyta, zajrzy do ojca dopiero po zmianie.
+            uint64_t structure = atomic_fetch_add(&tree->structure_version, 2) + 2;
+            atomic_store(&node->moved_at, structure_moves(structure));
+
+            hmap_remove(parent->children, child_name);
+            sset_remove(parent->names, child_name, strlen(child_name));
+            invalidate_listing(parent);
+            version_write_end(&parent->version);
+            journal_record(tree, RECORD_REMOVE_RECURSIVE, journaled.dir, parsed->path, NULL, NULL, 0);
+            *detached = node;
+            err = 0;
+        }
+    }
+    journal_end(tree);
 
-    writer_ending_protocol(parent, tree->root, true);
+    writer_ending_protocol(parent);
 
     return err;
 }
 
-int tree_move(Tree *tree, const char *source, const char *target) {
-    if (!is_path_valid(source) || !is_path_valid(target)) {
+// Oznacza jako usunięte wszystkie wierzchołki odpiętego poddrzewa, od góry, każdy jako pisarz - czekając na operacje,
+// które sprawdziły swoje ścieżki przed odpięciem i jeszcze działają. Późniejsze próby w poddrzewie są już
+// nieaktualne, więc nikt nie zmieni dzieci wierzchołka, który minęliśmy, ani nie usunie wierzchołka ze stosu - żaden
+// nie trafił jeszcze do reclaim.h, więc stos nie potrzebuje sekcji krytycznej. Sekcję zajmuje tylko zmiana jednego
+// wierzchołka (migawka czeka na operacje, które odczytały poprzedni numer), więc przejście nie wstrzymuje zwalniania
+// pamięci w innych wątkach. Potem czekamy, aż skończą się sekcje, które mogły jeszcze oglądać poddrzewo, i zwalniamy
+// jego korzeń - usunięty wierzchołek zwalnia swoje dzieci (node_destroy). Wołający nie jest w sekcji krytycznej
+// i nie trzyma żadnej blokady, więc cały koszt ponosi on, a nie cudze operacje.
+void free_subtree(Tree *tree, Node *node) {
+    size_t capacity = 64;
+    size_t count = 0;
+    Node **stack = malloc(capacity * sizeof(Node *));
+    if (!stack) {
+        fatal("subtree stack allocation failed");
+    }
+    stack[count++] = node;
+
+    size_t removed = 0;
+    while (count > 0) {
+        Node *current = stack[--count];
+        writer_beginning_protocol(current);
+        reclaim_enter();
+        // Numer migawki odczytany teraz, a nie przy odpięciu - wierzchołek mogły zmienić operacje o większym numerze.
+        modification_begin(tree);
+        children_write_begin(current);
+        atomic_store(&current->removed, true);
+
+        const char *key = NULL;
+        void *value = NULL;
+        HashMapIterator it = hmap_iterator(current->children);
+        while (hmap_next(current->children, &it, &key, &value)) {
+            if (count == capacity) {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(Node *));
+                if (!stack) {
+                    fatal("subtree stack allocation failed");
+                }
+            }
+            stack[count++] = value;
+        }
+        writer_ending_protocol(current);
+        reclaim_leave();
+        removed++;
+    }
+    free(stack);
+
+    atomic_fetch_add(&retired_nodes_pending, removed);
+    reclaim_synchronize();
+    node_unreference(node);
+}
+
+// Odpina folder; jego poddrzewo trzeba potem zwolnić (free_subtree) po wyjściu z sekcji krytycznej.
+int tree_remove_recursive_real(Tree *tree, Node *dir, const char *path, Node **detached) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
         return EINVAL;
     }
-    if (!strcmp(source, "/")) {
+    if (parsed.depth == 0) {
         return EBUSY;
     }
-    if (!strcmp(target, "/")) {
-        return EEXIST;
+
+    char child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_path_component(&parsed, parsed.depth - 1, child_name);
+
+    // Odpięcie unieważnia ścieżki jak przeniesienie, więc czeka na operacje, które wstrzymały przeniesienia.
+    int err;
+    int attempts = 0;
+    do {
+        if (attempts < STALE_ATTEMPTS) {
+            wait_for_starving(tree);
+        }
+        err = detach_attempt(tree, dir, &parsed, child_name, detached);
+        if (err == ESTALEPATH) {
+            if (atomic_load(&dir->removed)) {
+                err = ENOENT;
+                break;
+            }
+            attempt_stale(tree, &attempts);
+        }
+    } while (err == ESTALEPATH);
+    attempts_finished(tree, attempts);
+    return err;
+}
+
+int rename_attempt(Tree *tree, Node *dir, const Path *source_path, const Path *target_path,
+                   const char *source_child_name, const char *target_child_name) {
+    Attempt attempt = attempt_begin(tree, dir);
+    size_t index = source_path->depth - 1;
+
+    bool stale;
+    Node *parent = get_node(tree, &attempt, dir, source_path, 0, index, true, &stale);
+    if (!parent) {
+        return stale ? ESTALEPATH : ENOENT;
     }
 
-    if (is_substring(source, target)) {
-        return ESRCSUBTRGT;
+    writer_beginning_protocol(parent);
+    if (parent != dir) {
+        reader_ending_protocol(parent->parent);
+    }
+
+    int err = ESTALEPATH;
+    journal_begin(tree);
+    if (path_is_valid(tree, &attempt, parent)) {
+        modification_begin(tree);
+        Node *node = hmap_get_prehashed(parent->children, path_component(source_path, index),
+                                        source_path->lengths[index], source_path->hashes[index]);
+        err = ENOENT;
+        if (node) {
+            err = EEXIST;
+            if (!hmap_get_prehashed(parent->children, path_component(target_path, index),
+                                    target_path->lengths[index], target_path->hashes[index])) {
+                children_write_begin(parent);
+                // Nowy numer przeniesienia ustawiamy, gdy wersja ojca jest już nieparzysta (opis na początku pliku).
+                uint64_t structure = atomic_fetch_add(&tree->structure_version, 2) + 2;
+                atomic_store(&node->moved_at, structure_moves(structure));
+
+                hmap_remove(parent->children, source_child_name);
+                hmap_insert(parent->children, target_child_name, node);
+                sset_remove(parent->names, source_child_name, strlen(source_child_name));
+                sset_insert(parent->names, target_child_name, strlen(target_child_name));
+                invalidate_listing(parent);
+                version_write_end(&parent->version);
+                journal_record(tree, RECORD_MOVE, journaled.dir, source_path->path, target_path->path, NULL, 0);
+                err = 0;
+            }
+        }
+    }
+    journal_end(tree);
+
+    writer_ending_protocol(parent);
+
+    return err;
+}
+
+// Zwalnia blokady pisarza trzymane przez tree_move w LCA i ojcach source i target. LCA jest już zwolnione, jeśli jest
+// różne od obu ojców.
+void move_release(Node *lca_node, Node *source_parent_node, Node *target_parent_node) {
+    if (source_parent_node != lca_node) {
+        writer_ending_protocol(source_parent_node);
+    }
+    if (target_parent_node != lca_node && target_parent_node != source_parent_node) {
+        writer_ending_protocol(target_parent_node);
     }
+    if (source_parent_node == lca_node || target_parent_node == lca_node) {
+        writer_ending_protocol(lca_node);
+    }
+}
 
-    char *path_to_lca = make_path_to_lca(source, target);
-    size_t diff = strlen(path_to_lca) - 1;
+int move_attempt(Tree *tree, Node *dir, const Path *source_path, const Path *target_path, bool same) {
+    Attempt attempt = attempt_begin(tree, dir);
+    size_t lca_depth = path_lca_depth(source_path, target_path);
 
-    Node *lca_node = get_node(tree->root, path_to_lca, READER_BEGIN, true);
+    bool stale;
+    Node *lca_node = get_node(tree, &attempt, dir, source_path, 0, lca_depth, true, &stale);
     if (!lca_node) {
-        free(path_to_lca);
-        return ENOENT;
+        return stale ? ESTALEPATH : ENOENT;
     }
 
     writer_beginning_protocol(lca_node);
-    if (lca_node->parent) {
-        reader_ending_protocol(lca_node->parent, NULL, 0);
+    if (lca_node != dir) {
+        reader_ending_protocol(lca_node->parent);
     }
 
+    size_t source_index = source_path->depth - 1;
     char source_child_name[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_source_parent = make_path_to_parent(source + diff, source_child_name);
+    copy_path_component(source_path, source_index, source_child_name);
 
-    Node *source_parent_node = get_node(lca_node, path_to_source_parent, READER_BEGIN, false);
+    Node *source_parent_node = get_node(tree, &attempt, lca_node, source_path, lca_depth, source_index, false,
+                                        &stale);
     if (!source_parent_node) {
-        writer_ending_protocol(lca_node, tree->root, true);
-
-        free(path_to_lca);
-        free(path_to_source_parent);
+        writer_ending_protocol(lca_node);
 
-        return ENOENT;
+        return stale ? ESTALEPATH : ENOENT;
     }
 
     if (source_parent_node != lca_node) {
         writer_beginning_protocol(source_parent_node);
-        if (source_parent_node->parent && source_parent_node->parent != lca_node) {
-            reader_ending_protocol(source_parent_node->parent, NULL, 0);
+        if (source_parent_node->parent != lca_node) {
+            reader_ending_protocol(source_parent_node->parent);
         }
     }
 
-    Node *source_node = (Node *)hmap_get(source_parent_node->children, source_child_name);
-    if (!source_node) {
+    Node *source_node = (Node *)hmap_get_prehashed(source_parent_node->children,
+                                                   path_component(source_path, source_index),
+                                                   source_path->lengths[source_index],
+                                                   source_path->hashes[source_index]);
+    if (!source_node || same) {
+        int err = !path_is_valid(tree, &attempt, source_parent_node) ? ESTALEPATH : source_node ? 0 : ENOENT;
         if (source_parent_node != lca_node) {
-            writer_ending_protocol(source_parent_node, lca_node, false);
+            writer_ending_protocol(source_parent_node);
         }
-        writer_ending_protocol(lca_node, tree->root, true);
-
-        free(path_to_lca);
-        free(path_to_source_parent);
+        writer_ending_protocol(lca_node);
 
-        return ENOENT;
+        return err;
     }
 
+    size_t target_index = target_path->depth - 1;
+    char target_child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_path_component(target_path, target_index, target_child_name);
 
-    if (!strcmp(source, target)) {
+    Node *target_parent_node = get_node(tree, &attempt, lca_node, target_path, lca_depth, target_index, false,
+                                        &stale);
+    if (!target_parent_node) {
         if (source_parent_node != lca_node) {
-            writer_ending_protocol(source_parent_node, lca_node, false);
+            writer_ending_protocol(source_parent_node);
         }
+        writer_ending_protocol(lca_node);
+
+        return stale ? ESTALEPATH : ENOENT;
+    }
 
-        writer_ending_protocol(lca_node, tree->root, true);
+    if (target_parent_node != lca_node) {
+        writer_beginning_protocol(target_parent_node);
+        if (target_parent_node->parent != lca_node) {
+            reader_ending_protocol(target_parent_node->parent);
+        }
+    }
 
-        free(path_to_lca);
-        free(path_to_source_parent);
+    if (source_parent_node != lca_node && target_parent_node != lca_node) {
+        writer_ending_protocol(lca_node);
+    }
 
-        return 0;
+    // Obie ścieżki sprawdzamy i przeniesienie wykonujemy pod muteksem przeniesień - w międzyczasie żadne inne
+    // przeniesienie nie zmieni struktury drzewa.
+    int err;
+    if ((err = pthread_mutex_lock(&tree->move_mutex)) != 0) {
+        syserr("mutex lock failed");
     }
+    journal_begin(tree);
 
-    char target_child_name[MAX_FOLDER_NAME_LENGTH + 1];
-    char *path_to_target_parent = make_path_to_parent(target + diff, target_child_name);
+    if (!path_is_valid(tree, &attempt, source_parent_node) || !path_is_valid(tree, &attempt, target_parent_node)) {
+        err = ESTALEPATH;
+    }
+    else if (hmap_get_prehashed(target_parent_node->children, path_component(target_path, target_index),
+                                target_path->lengths[target_index], target_path->hashes[target_index])) {
+        err = EEXIST;
+    }
+    else {
+        // Przeniesienie zmienia ścieżki całego poddrzewa - unieważniamy optymistycznych czytelników.
+        // Wersji samego przenoszonego wierzchołka nie ruszamy - nie blokujemy go, więc mogą ją właśnie zmieniać
+        // operacje w jego wnętrzu.
+        modification_begin(tree);
+        version_write_begin(&tree->structure_version);
+        atomic_store(&source_node->moved_at, structure_moves(atomic_load(&tree->structure_version)));
 
-    Node *target_parent_node;
-    target_parent_node = get_node(lca_node, path_to_target_parent, READER_BEGIN, false);
+        add_child(target_parent_node, source_node, target_child_name);
 
-    if (!target_parent_node) {
-        if (source_parent_node != lca_node) {
-            writer_ending_protocol(source_parent_node, lca_node, false);
-        }
+        children_write_begin(source_parent_node);
+        hmap_remove(source_parent_node->children, source_child_name);
+        sset_remove(source_parent_node->names, source_child_name, strlen(source_child_name));
+        invalidate_listing(source_parent_node);
+        version_write_end(&source_parent_node->version);
 
-        writer_ending_protocol(lca_node, tree->root, true);
+        version_write_end(&tree->structure_version);
+        journal_record(tree, RECORD_MOVE, journaled.dir, source_path->path, target_path->path, NULL, 0);
+        err = 0;
+    }
 
-        free(path_to_lca);
-        free(path_to_source_parent);
-        free(path_to_target_parent);
+    journal_end(tree);
+    int unlock_err;
+    if ((unlock_err = pthread_mutex_unlock(&tree->move_mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
 
-        return ENOENT;
+    move_release(lca_node, source_parent_node, target_parent_node);
+
+    return err;
+}
+
+int tree_move_real(Tree *tree, Node *dir, const char *source, const char *target) {
+    Path source_path, target_path;
+    if (!parse_path(source, &source_path) || !parse_path(target, &target_path)) {
+        return EINVAL;
+    }
+    if (source_path.depth == 0) {
+        return EBUSY;
+    }
+    if (target_path.depth == 0) {
+        return EEXIST;
     }
 
+    if (is_proper_ancestor(&source_path, &target_path)) {
+        return ESRCSUBTRGT;
+    }
 
-    if (target_parent_node != lca_node) {
-        writer_beginning_protocol(target_parent_node);
-        if (target_parent_node->parent && target_parent_node->parent != lca_node) {
-            reader_ending_protocol(target_parent_node->parent, NULL, 0);
+    bool same = !strcmp(source, target);
+    bool rename = !same && source_path.depth == target_path.depth &&
+                  path_lca_depth(&source_path, &target_path) == source_path.depth - 1;
+    char source_child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    char target_child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    if (rename) {
+        copy_path_component(&source_path, source_path.depth - 1, source_child_name);
+        copy_path_component(&target_path, target_path.depth - 1, target_child_name);
+    }
+
+    int err;
+    int attempts = 0;
+    do {
+        if (attempts < STALE_ATTEMPTS) {
+            wait_for_starving(tree);
+        }
+        err = rename ? rename_attempt(tree, dir, &source_path, &target_path, source_child_name, target_child_name)
+                     : move_attempt(tree, dir, &source_path, &target_path, same);
+        if (err == ESTALEPATH) {
+            if (atomic_load(&dir->removed)) {
+                err = ENOENT;
+                break;
+            }
+            attempt_stale(tree, &attempts);
         }
+    } while (err == ESTALEPATH);
+    attempts_finished(tree, attempts);
+    return err;
+}
+
+// Długość ścieżki ojca (z końcowym '/') poprawnej ścieżki różnej od "/".
+size_t parent_path_length(const char *path) {
+    size_t length = strlen(path) - 1;
+    while (path[length - 1] != '/') {
+        length--;
     }
+    return length;
+}
 
-    if (source_parent_node != lca_node && target_parent_node != lca_node) {
-        writer_ending_protocol(lca_node, NULL, false);
+// Operacje wsadowe: ścieżki sortujemy (stabilnie) po ścieżce ojca, a każdą grupę ścieżek o wspólnym ojcu obsługujemy
+// jedną próbą - jedno zejście do ojca, jedna blokada w nim i wszystkie zmiany jego hash-mapy pod nią.
+typedef enum {
+    BATCH_CREATE,
+    BATCH_REMOVE,
+    BATCH_LIST,
+} BatchKind;
+
+typedef struct {
+    const char *path;
+    size_t index; // pozycja ścieżki w tablicy wołającego
+    size_t parent_length; // długość ścieżki ojca (z końcowym '/')
+    Node *child; // tree_remove_batch: dziecko zajęte przed sprawdzeniem ścieżki albo NULL, jeśli wynikiem jest error
+    int error;
+} BatchItem;
+
+int compare_batch_parents(const BatchItem *a, const BatchItem *b) {
+    size_t length = a->parent_length < b->parent_length ? a->parent_length : b->parent_length;
+    int result = memcmp(a->path, b->path, length);
+    if (result == 0 && a->parent_length != b->parent_length) {
+        result = a->parent_length < b->parent_length ? -1 : 1;
     }
+    return result;
+}
+
+// W obrębie grupy sortujemy po nazwie (żeby wstawiać je do SortedSet jednym przejściem), a równe nazwy w kolejności
+// wołającego - wyniki są takie same jak przy obsłudze w kolejności wołającego.
+int compare_batch_names(const BatchItem *a, const BatchItem *b) {
+    // '/' na końcu nazwy jest mniejszy od każdej litery, więc porządek jest taki jak w SortedSet.
+    int result = strcmp(a->path + a->parent_length, b->path + b->parent_length);
+    return result ? result : (a->index > b->index) - (a->index < b->index);
+}
 
-    mover_beginning_protocol(source_node);
+int compare_batch_items(const void *a, const void *b) {
+    const BatchItem *x = a, *y = b;
+    int result = compare_batch_parents(x, y);
+    return result ? result : compare_batch_names(x, y);
+}
 
-    int err = add_child(target_parent_node, source_node, target_child_name);
+// Usuwamy od najgłębszych ojców (folder przed jego ojcem).
+int compare_batch_items_reversed(const void *a, const void *b) {
+    const BatchItem *x = a, *y = b;
+    int result = compare_batch_parents(y, x);
+    return result ? result : compare_batch_names(x, y);
+}
 
-    if (!err) {
-        hmap_remove(source_parent_node->children, source_child_name);
+// Próba obsłużenia grupy ścieżek o ojcu parent_path. Wyniki zapisuje dopiero wtedy, gdy próba jest ważna. Wszystkie
+// zmiany dzieci ojca robi w jednym zapisie jego wersji, a nazwy dodaje do (usuwa z) SortedSet jednym przejściem.
+// Kopiuje nazwę folderu ścieżki z grupy i zwraca jej długość.
+size_t batch_child_name(const BatchItem *item, char *child_name) {
+    const char *name = item->path + item->parent_length;
+    size_t length = strlen(name) - 1;
+    memcpy(child_name, name, length);
+    child_name[length] = '\0';
+    return length;
+}
+
+// Zajmuje dzieci usuwane przez grupę przed sprawdzeniem ścieżki - pod muteksem dziennika nie można czekać na blokady.
+// Równe nazwy są obok siebie: dziecko usunie pierwsza z nich, a kolejne dostaną jej błąd albo ENOENT.
+void batch_lock_children(Node *parent, BatchItem *items, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        char child_name[MAX_FOLDER_NAME_LENGTH + 1];
+        batch_child_name(&items[i], child_name);
+        if (i > 0 && !strcmp(items[i - 1].path + items[i - 1].parent_length, items[i].path + items[i].parent_length)) {
+            items[i].child = NULL;
+            items[i].error = items[i - 1].child ? ENOENT : items[i - 1].error;
+            continue;
+        }
+        items[i].child = lock_child_to_remove(parent, child_name, &items[i].error);
     }
+}
 
-    mover_ending_protocol(source_node, NULL, false);
+int batch_attempt(Tree *tree, Node *dir, BatchKind kind, const Path *parent_path, BatchItem *items,
+                  size_t count, int *errors, char **results, SortedSetKey *names) {
+    Attempt attempt = attempt_begin_at(tree, dir, parent_path, parent_path->depth);
 
-    if (source_parent_node == lca_node) {
-        if (source_parent_node != target_parent_node) {
-            writer_ending_protocol(target_parent_node, lca_node, false);
+    bool stale;
+    Node *parent = get_node(tree, &attempt, attempt.start, parent_path, attempt.start_depth, parent_path->depth,
+                            true, &stale);
+    if (!parent) {
+        if (stale) {
+            return ESTALEPATH;
+        }
+        for (size_t i = 0; i < count; i++) {
+            if (kind == BATCH_LIST) {
+                results[items[i].index] = NULL;
+            }
+            else {
+                errors[items[i].index] = ENOENT;
+            }
         }
-        writer_ending_protocol(source_parent_node, tree->root, true);
+        return 0;
+    }
+
+    if (kind == BATCH_LIST) {
+        reader_beginning_protocol(parent);
     }
     else {
-        if (source_parent_node != target_parent_node) {
-            writer_ending_protocol(source_parent_node, lca_node, false);
+        writer_beginning_protocol(parent);
+    }
+    if (parent != dir) {
+        reader_ending_protocol(parent->parent);
+    }
+
+    if (kind == BATCH_REMOVE) {
+        batch_lock_children(parent, items, count);
+    }
+
+    int err = ESTALEPATH;
+    if (kind != BATCH_LIST) {
+        journal_begin(tree);
+    }
+    if (!path_is_valid(tree, &attempt, parent)) {
+        for (size_t i = 0; kind == BATCH_REMOVE && i < count; i++) {
+            if (items[i].child) {
+                writer_ending_protocol(items[i].child);
+            }
         }
-        writer_ending_protocol(target_parent_node, tree->root, true);
     }
+    else {
+        modification_begin(tree);
+        err = 0;
+        size_t changed = 0;
+        for (size_t i = 0; i < count; i++) {
+            const char *name = items[i].path + items[i].parent_length;
+            char child_name[MAX_FOLDER_NAME_LENGTH + 1];
+            size_t length = batch_child_name(&items[i], child_name);
+
+            if (kind == BATCH_CREATE) {
+                bool exists = hmap_get_prehashed(parent->children, child_name, length, hmap_hash(child_name, length));
+                errors[items[i].index] = exists ? EEXIST : 0;
+                if (exists) {
+                    continue;
+                }
+                if (changed == 0) {
+                    children_write_begin(parent);
+                }
+                Node *child = node_new(tree->nodes);
+                hmap_insert(parent->children, child_name, child);
+                child->parent = parent;
+                names[changed++] = (SortedSetKey) {.key = name, .length = length};
+                journal_record(tree, RECORD_CREATE, journaled.dir, items[i].path, NULL, NULL, 0);
+            }
+            else if (kind == BATCH_REMOVE) {
+                errors[items[i].index] = items[i].child ? 0 : items[i].error;
+                if (!items[i].child) {
+                    continue;
+                }
+                if (changed == 0) {
+                    children_write_begin(parent);
+                }
+                detach_child(parent, items[i].child, child_name);
+                names[changed++] = (SortedSetKey) {.key = name, .length = length};
+                journal_record(tree, RECORD_REMOVE, journaled.dir, items[i].path, NULL, NULL, 0);
+            }
+            else {
+                // Dziecka nie przeniesie ani nie usunie nikt, kto nie jest pisarzem w ojcu.
+                Node *child = hmap_get_prehashed(parent->children, child_name, length, hmap_hash(child_name, length));
+                results[items[i].index] = NULL;
+                if (child) {
+                    reader_beginning_protocol(child);
+                    results[items[i].index] = get_children_names(tree, child);
+                    reader_ending_protocol(child);
+                }
+            }
+        }
 
-    free(path_to_lca);
-    free(path_to_source_parent);
-    free(path_to_target_parent);
+        if (changed > 0) {
+            if (kind == BATCH_CREATE) {
+                if (!parent->names) {
+                    parent->names = sset_new();
+                }
+                sset_insert_sorted(parent->names, names, changed);
+            }
+            else {
+                sset_remove_sorted(parent->names, names, changed);
+            }
+            invalidate_listing(parent);
+            version_write_end(&parent->version);
+        }
+    }
+    if (kind != BATCH_LIST) {
+        journal_end(tree);
+    }
 
+    if (kind == BATCH_LIST) {
+        reader_ending_protocol(parent);
+    }
+    else {
+        writer_ending_protocol(parent);
+    }
     return err;
-}
\ No newline at end of file
+}
+
+void tree_batch_real(Tree *tree, Node *dir, BatchKind kind, const char *const *paths, size_t count, int *errors,
+                     char **results) {
+    BatchItem *items = malloc(count * sizeof(BatchItem));
+    SortedSetKey *names = malloc(count * sizeof(SortedSetKey));
+    if (count && (!items || !names)) {
+        fatal("batch allocation failed");
+    }
+    size_t valid = 0;
+    for (size_t i = 0; i < count; i++) {
+        bool root = strcmp(paths[i], "/") == 0;
+        if (root || !is_path_valid(paths[i])) {
+            // "/" nie ma ojca - obsługujemy go jak pojedynczą operację.
+            if (kind == BATCH_LIST) {
+                results[i] = NULL;
+                if (root) {
+                    reclaim_enter();
+                    results[i] = tree_list_real(tree, dir, paths[i]);
+                    reclaim_leave();
+                }
+            }
+            else {
+                errors[i] = !root ? EINVAL : kind == BATCH_CREATE ? EEXIST : EBUSY;
+            }
+            continue;
+        }
+        items[valid++] = (BatchItem) {.path = paths[i], .index = i, .parent_length = parent_path_length(paths[i])};
+    }
+    qsort(items, valid, sizeof(BatchItem), kind == BATCH_REMOVE ? compare_batch_items_reversed : compare_batch_items);
+
+    for (size_t begin = 0, end; begin < valid; begin = end) {
+        end = begin + 1;
+        while (end < valid && compare_batch_parents(&items[begin], &items[end]) == 0) {
+            end++;
+        }
+
+        char parent[MAX_PATH_LENGTH + 1];
+        memcpy(parent, items[begin].path, items[begin].parent_length);
+        parent[items[begin].parent_length] = '\0';
+        Path parent_path;
+        parse_path(parent, &parent_path);
+
+        // Sekcja krytyczna na grupę, a nie na cały wsad, żeby długi wsad nie wstrzymywał zwalniania pamięci.
+        reclaim_enter();
+        int attempts = 0;
+        while (batch_attempt(tree, dir, kind, &parent_path, items + begin, end - begin, errors, results, names) ==
+               ESTALEPATH) {
+            attempt_stale(tree, &attempts);
+        }
+        attempts_finished(tree, attempts);
+        reclaim_leave();
+    }
+    journal_sync(tree);
+    free(items);
+    free(names);
+}
+
+// Transakcje (opis na początku pliku).
+typedef enum {
+    TRANSACTION_CREATE,
+    TRANSACTION_REMOVE,
+    TRANSACTION_MOVE,
+} TransactionKind;
+
+typedef struct {
+    TransactionKind kind;
+    char *path; // dla przeniesienia source
+    char *target; // tylko dla przeniesienia
+} TransactionOp;
+
+struct TreeTransaction {
+    TransactionOp *ops;
+    size_t count;
+    size_t capacity;
+};
+
+// Wierzchołek, którego dotyczy transakcja. Na początku tablicy są posortowane kotwice - ojcowie ścieżek operacji,
+// usuwane foldery i punkty rozgałęzienia między nimi - a za nimi foldery utworzone przez transakcję.
+typedef struct {
+    char *path; // ścieżka po dotychczas wykonanych operacjach transakcji
+    size_t length;
+    size_t depth;
+    Node *node; // NULL, jeśli ścieżki nie było w chwili blokowania
+    bool needed; // kotwica jest ojcem ścieżki operacji albo usuwanym folderem, a nie tylko punktem rozgałęzienia
+    bool keep; // blokada jest trzymana do końca transakcji, a nie tylko do zablokowania wszystkich kotwic
+    bool locked;
+    bool alive; // czy operacje transakcji mogą z niego korzystać (nie został przez nie usunięty)
+} TransactionNode;
+
+typedef struct {
+    TransactionNode *nodes;
+    size_t count;
+    size_t anchors;
+    size_t capacity;
+} TransactionNodes;
+
+// Wpis dziennika wykonanych operacji - pozwala je wycofać.
+typedef struct {
+    const TransactionOp *op;
+    Node *parent; // dla przeniesienia ojciec source
+    Node *target_parent;
+    Node *node; // NULL dla przeniesienia folderu na to samo miejsce
+    size_t index; // pozycja tworzonego lub usuwanego folderu w TransactionNodes
+} TransactionUndo;
+
+// Kopiuje ostatnią składową ścieżki, która zaczyna się za ścieżką ojca długości parent_length.
+void copy_last_component(const char *path, size_t parent_length, char *component) {
+    size_t length = strlen(path) - 1 - parent_length;
+    memcpy(component, path + parent_length, length);
+    component[length] = '\0';
+}
+
+bool path_has_prefix(const char *path, const char *prefix, size_t prefix_length) {
+    return strncmp(path, prefix, prefix_length) == 0;
+}
+
+// Długość ścieżki najgłębszego wspólnego przodka (folderu, a nie ojca) ścieżek a i b.
+size_t common_path_length(const char *a, const char *b) {
+    size_t length = 0;
+    for (size_t i = 0; a[i] && a[i] == b[i]; i++) {
+        if (a[i] == '/') {
+            length = i + 1;
+        }
+    }
+    return length;
+}
+
+char *copy_path_prefix(const char *path, size_t length) {
+    char *result = malloc(length + 1);
+    if (!result) {
+        fatal("transaction allocation failed");
+    }
+    memcpy(result, path, length);
+    result[length] = '\0';
+    return result;
+}
+
+// Zamienia w path prefiks długości prefix_length na replacement.
+char *replace_path_prefix(const char *path, size_t prefix_length, const char *replacement) {
+    size_t replacement_length = strlen(replacement);
+    size_t rest = strlen(path) - prefix_length;
+    char *result = malloc(replacement_length + rest + 1);
+    if (!result) {
+        fatal("transaction allocation failed");
+    }
+    memcpy(result, replacement, replacement_length);
+    memcpy(result + replacement_length, path + prefix_length, rest + 1);
+    return result;
+}
+
+size_t transaction_node_add(TransactionNodes *nodes, char *path, bool needed) {
+    if (nodes->count == nodes->capacity) {
+        nodes->capacity = nodes->capacity ? 2 * nodes->capacity : 16;
+        nodes->nodes = realloc(nodes->nodes, nodes->capacity * sizeof(TransactionNode));
+        if (!nodes->nodes) {
+            fatal("transaction allocation failed");
+        }
+    }
+    size_t depth = 0;
+    for (const char *c = path + 1; *c; c++) {
+        depth += *c == '/';
+    }
+    nodes->nodes[nodes->count] = (TransactionNode) {.path = path, .length = strlen(path), .depth = depth,
+                                                    .needed = needed};
+    return nodes->count++;
+}
+
+int compare_transaction_nodes(const void *a, const void *b) {
+    return strcmp(((const TransactionNode *) a)->path, ((const TransactionNode *) b)->path);
+}
+
+void transaction_sort_unique(TransactionNodes *nodes) {
+    qsort(nodes->nodes, nodes->count, sizeof(TransactionNode), compare_transaction_nodes);
+    size_t unique = 0;
+    for (size_t i = 0; i < nodes->count; i++) {
+        if (unique > 0 && strcmp(nodes->nodes[unique - 1].path, nodes->nodes[i].path) == 0) {
+            nodes->nodes[unique - 1].needed |= nodes->nodes[i].needed;
+            free(nodes->nodes[i].path);
+        }
+        else {
+            nodes->nodes[unique++] = nodes->nodes[i];
+        }
+    }
+    nodes->count = unique;
+}
+
+// Porządkuje kotwice w kolejności preorder ('/' jest mniejszy od każdej litery, więc to zwykły porządek napisów)
+// i dodaje do nich punkty rozgałęzienia. LCA kolejnych kotwic w tym porządku to LCA wszystkich par kotwic, więc
+// pierwsza kotwica jest przodkiem wszystkich pozostałych.
+void transaction_sort_anchors(TransactionNodes *nodes) {
+    transaction_sort_unique(nodes);
+    size_t count = nodes->count;
+    for (size_t i = 0; i + 1 < count; i++) {
+        const char *path = nodes->nodes[i].path;
+        transaction_node_add(nodes, copy_path_prefix(path, common_path_length(path, nodes->nodes[i + 1].path)),
+                             false);
+    }
+    transaction_sort_unique(nodes);
+    nodes->anchors = nodes->count;
+}
+
+// Dodaje kotwicę dla ścieżki [path, path + length) widzianej przez operację index - jej położenie na początku
+// transakcji, czyli po cofnięciu wcześniejszych przeniesień.
+void transaction_add_anchor(TransactionNodes *nodes, const TransactionOp *ops, size_t index, const char *path,
+                            size_t length) {
+    char *origin = copy_path_prefix(path, length);
+    for (size_t i = index; i-- > 0;) {
+        if (ops[i].kind != TRANSACTION_MOVE) {
+            continue;
+        }
+        size_t target_length = strlen(ops[i].target);
+        if (path_has_prefix(origin, ops[i].target, target_length)) {
+            char *moved = origin;
+            origin = replace_path_prefix(moved, target_length, ops[i].path);
+            free(moved);
+        }
+    }
+    transaction_node_add(nodes, origin, true);
+}
+
+// Błąd operacji, który nie zależy od stanu drzewa - sprawdzany jak w pojedynczych operacjach.
+int transaction_check(const TransactionOp *op) {
+    Path path, target;
+    if (!parse_path(op->path, &path)) {
+        return EINVAL;
+    }
+    switch (op->kind) {
+        case TRANSACTION_CREATE:
+            return path.depth == 0 ? EEXIST : 0;
+        case TRANSACTION_REMOVE:
+            return path.depth == 0 ? EBUSY : 0;
+        default:
+            if (!parse_path(op->target, &target)) {
+                return EINVAL;
+            }
+            if (path.depth == 0) {
+                return EBUSY;
+            }
+            if (target.depth == 0) {
+                return EEXIST;
+            }
+            return is_proper_ancestor(&path, &target) ? ESRCSUBTRGT : 0;
+    }
+}
+
+void transaction_unlock(TransactionNodes *nodes) {
+    for (size_t i = 0; i < nodes->count; i++) {
+        if (nodes->nodes[i].locked) {
+            writer_ending_protocol(nodes->nodes[i].node);
+            nodes->nodes[i].locked = false;
+        }
+    }
+}
+
+// Zajmuje kotwice jako pisarz w kolejności preorder - każdą schodząc od najgłębszej zajętej już kotwicy, która jest
+// jej przodkiem (pierwszą od korzenia). Jak w tree_move: trzymamy blokadę w punkcie rozgałęzienia, dopóki nie
+// zajmiemy wszystkiego pod nim, więc schodząc nie mijamy niczyich blokad poniżej naszych. Dwa zejścia tej samej
+// transakcji nigdy nie dzielą wierzchołka, którego nie trzyma.
+// Brak kotwicy jest wynikiem, jeśli nic go nie może zmienić do końca transakcji, czyli ojciec kotwicy też jest
+// kotwicą (zablokowaną albo trwale brakującą). W przeciwnym razie dodaje ojca do kotwic, zwalnia wszystko i zwraca
+// false (z *stale == false). Zwraca też false, gdy któraś ścieżka okazała się nieaktualna.
+bool transaction_lock(Tree *tree, const Attempt *attempt, TransactionNodes *nodes, bool *stale) {
+    size_t count = nodes->anchors;
+    for (size_t i = 0; i < count; i++) {
+        TransactionNode *anchor = &nodes->nodes[i];
+        anchor->node = NULL;
+        anchor->keep = anchor->needed;
+        anchor->locked = anchor->alive = false;
+    }
+
+    *stale = false;
+    bool complete = true;
+    for (size_t i = 0; i < count; i++) {
+        size_t holder = SIZE_MAX;
+        for (size_t j = 0; j < i; j++) {
+            TransactionNode *ancestor = &nodes->nodes[j];
+            if (ancestor->locked && path_has_prefix(nodes->nodes[i].path, ancestor->path, ancestor->length)) {
+                holder = j;
+            }
+        }
+
+        Path path;
+        bool parsed = parse_path(nodes->nodes[i].path, &path);
+        Node *node = NULL;
+        if (parsed && (i == 0 || holder != SIZE_MAX)) {
+            if (holder == SIZE_MAX) {
+                node = get_node(tree, attempt, tree->root, &path, 0, path.depth, true, stale);
+                if (node) {
+                    writer_beginning_protocol(node);
+                    if (node != tree->root) {
+                        reader_ending_protocol(node->parent);
+                    }
+                }
+            }
+            else {
+                Node *first = nodes->nodes[holder].node;
+                node = get_node(tree, attempt, first, &path, nodes->nodes[holder].depth, path.depth, false, stale);
+                if (node) {
+                    writer_beginning_protocol(node);
+                    if (node->parent != first) {
+                        reader_ending_protocol(node->parent);
+                    }
+                }
+            }
+            if (*stale) {
+                transaction_unlock(nodes);
+                return false;
+            }
+        }
+
+        TransactionNode *anchor = &nodes->nodes[i];
+        anchor->node = node;
+        anchor->locked = anchor->alive = node != NULL;
+        // Ścieżka, która się nie mieści w MAX_PATH_LENGTH, nie może istnieć.
+        if (!node && parsed && path.depth > 0) {
+            size_t parent_length = parent_path_length(anchor->path);
+            size_t parent = SIZE_MAX;
+            for (size_t j = 0; j < i; j++) {
+                if (nodes->nodes[j].length == parent_length &&
+                    path_has_prefix(anchor->path, nodes->nodes[j].path, parent_length)) {
+                    parent = j;
+                }
+            }
+            if (parent != SIZE_MAX) {
+                nodes->nodes[parent].keep = true;
+            }
+            else {
+                complete = false;
+                transaction_node_add(nodes, copy_path_prefix(nodes->nodes[i].path, parent_length), false);
+            }
+        }
+    }
+
+    if (!complete) {
+        transaction_unlock(nodes);
+        transaction_sort_anchors(nodes);
+    }
+    return complete;
+}
+
+// Zablokowany (lub utworzony przez transakcję) wierzchołek o ścieżce [path, path + length) - po dotychczas
+// wykonanych operacjach transakcji. Innych wierzchołków transakcja nie potrzebuje: każda ścieżka, z której korzysta
+// operacja, ma kotwicę w swoim położeniu z początku transakcji.
+Node *transaction_find(TransactionNodes *nodes, const char *path, size_t length, size_t *index) {
+    for (size_t i = nodes->count; i-- > 0;) {
+        TransactionNode *node = &nodes->nodes[i];
+        if (node->alive && node->length == length && memcmp(node->path, path, length) == 0) {
+            if (index) {
+                *index = i;
+            }
+            return node->node;
+        }
+    }
+    return NULL;
+}
+
+// Zmienia ścieżki wierzchołków transakcji w poddrzewie przeniesionego folderu.
+void transaction_rename(TransactionNodes *nodes, const char *source, const char *target) {
+    size_t source_length = strlen(source);
+    for (size_t i = 0; i < nodes->count; i++) {
+        TransactionNode *node = &nodes->nodes[i];
+        if (path_has_prefix(node->path, source, source_length)) {
+            char *renamed = replace_path_prefix(node->path, source_length, target);
+            free(node->path);
+            node->path = renamed;
+            node->length = strlen(renamed);
+        }
+    }
+}
+
+// Wołający jest pisarzem w ojcu. Zmiana nie dotyczy wersji struktury - o tę dba wołający.
+void unlink_child(Node *parent, const char *child_name) {
+    children_write_begin(parent);
+    hmap_remove(parent->children, child_name);
+    sset_remove(parent->names, child_name, strlen(child_name));
+    invalidate_listing(parent);
+    version_write_end(&parent->version);
+}
+
+// Wykonuje operację na wierzchołkach zablokowanych przez transakcję i zapisuje, jak ją wycofać.
+int transaction_apply(Tree *tree, const TransactionOp *op, TransactionNodes *nodes, TransactionUndo *undo) {
+    size_t parent_length = parent_path_length(op->path);
+    Node *parent = transaction_find(nodes, op->path, parent_length, NULL);
+    char child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_last_component(op->path, parent_length, child_name);
+    Node *child = parent ? hmap_get(parent->children, child_name) : NULL;
+    *undo = (TransactionUndo) {.op = op, .parent = parent, .node = child};
+
+    if (op->kind == TRANSACTION_CREATE) {
+        if (!parent) {
+            return ENOENT;
+        }
+        if (child) {
+            return EEXIST;
+        }
+        undo->node = node_new(tree->nodes);
+        add_child(parent, undo->node, child_name);
+        undo->index = transaction_node_add(nodes, copy_path_prefix(op->path, strlen(op->path)), false);
+        nodes->nodes[undo->index].node = undo->node;
+        nodes->nodes[undo->index].alive = true;
+        return 0;
+    }
+
+    if (!child) {
+        return ENOENT;
+    }
+
+    if (op->kind == TRANSACTION_REMOVE) {
+        Node *node = transaction_find(nodes, op->path, strlen(op->path), &undo->index);
+        assert(node == child);
+        (void) node;
+        if (hmap_size(child->children)) {
+            return ENOTEMPTY;
+        }
+        unlink_child(parent, child_name);
+        nodes->nodes[undo->index].alive = false;
+        return 0;
+    }
+
+    if (!strcmp(op->path, op->target)) {
+        undo->node = NULL;
+        return 0;
+    }
+    size_t target_parent_length = parent_path_length(op->target);
+    Node *target_parent = transaction_find(nodes, op->target, target_parent_length, NULL);
+    if (!target_parent) {
+        return ENOENT;
+    }
+    char target_child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_last_component(op->target, target_parent_length, target_child_name);
+    if (hmap_get(target_parent->children, target_child_name)) {
+        return EEXIST;
+    }
+
+    atomic_store(&child->moved_at, structure_moves(atomic_load(&tree->structure_version)));
+    add_child(target_parent, child, target_child_name);
+    unlink_child(parent, child_name);
+    transaction_rename(nodes, op->path, op->target);
+    undo->target_parent = target_parent;
+    return 0;
+}
+
+void transaction_undo(TransactionNodes *nodes, const TransactionUndo *undo) {
+    const TransactionOp *op = undo->op;
+    char child_name[MAX_FOLDER_NAME_LENGTH + 1];
+    copy_last_component(op->path, parent_path_length(op->path), child_name);
+
+    if (op->kind == TRANSACTION_CREATE) {
+        // Nowy wierzchołek mógł zobaczyć optymistyczny czytelnik - zwalniamy go jak usunięty.
+        unlink_child(undo->parent, child_name);
+        nodes->nodes[undo->index].alive = false;
+        atomic_store(&undo->node->removed, true);
+        version_write_begin(&undo->node->version);
+        node_retire(undo->node);
+    }
+    else if (op->kind == TRANSACTION_REMOVE) {
+        add_child(undo->parent, undo->node, child_name);
+        nodes->nodes[undo->index].alive = true;
+    }
+    else if (undo->node) {
+        char target_child_name[MAX_FOLDER_NAME_LENGTH + 1];
+        copy_last_component(op->target, parent_path_length(op->target), target_child_name);
+        unlink_child(undo->target_parent, target_child_name);
+        add_child(undo->parent, undo->node, child_name);
+        transaction_rename(nodes, op->target, op->path);
+    }
+}
+
+// Próba transakcji z operacjami [0, count) (wszystkie poprawne), po których następuje operacja z błędem
+// final_error (0, jeśli count to liczba wszystkich operacji).
+int transaction_attempt(Tree *tree, const TransactionOp *ops, size_t count, int final_error,
+                        TransactionNodes *nodes, TransactionUndo *undo, size_t *failed) {
+    Attempt attempt = attempt_begin(tree, tree->root);
+    bool stale;
+    while (!transaction_lock(tree, &attempt, nodes, &stale)) {
+        if (stale) {
+            return ESTALEPATH;
+        }
+    }
+
+    int err;
+    if ((err = pthread_mutex_lock(&tree->move_mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+    journal_begin(tree);
+    for (size_t i = 0; i < nodes->anchors; i++) {
+        if (nodes->nodes[i].locked && !path_is_valid(tree, &attempt, nodes->nodes[i].node)) {
+            journal_end(tree);
+            if ((err = pthread_mutex_unlock(&tree->move_mutex)) != 0) {
+                syserr("mutex unlock failed");
+            }
+            transaction_unlock(nodes);
+            return ESTALEPATH;
+        }
+    }
+    for (size_t i = 0; i < nodes->anchors; i++) {
+        if (nodes->nodes[i].locked && !nodes->nodes[i].keep) {
+            writer_ending_protocol(nodes->nodes[i].node);
+            nodes->nodes[i].locked = nodes->nodes[i].alive = false;
+        }
+    }
+
+    // Wersja struktury jest nieparzysta przez całą transakcję - optymistyczni czytelnicy nie zobaczą stanu pośredniego.
+    modification_begin(tree);
+    version_write_begin(&tree->structure_version);
+    size_t done = 0;
+    while (done < count && (err = transaction_apply(tree, &ops[done], nodes, &undo[done])) == 0) {
+        done++;
+    }
+    if (done == count) {
+        err = final_error;
+    }
+    if (err) {
+        *failed = done;
+        while (done > 0) {
+            transaction_undo(nodes, &undo[--done]);
+        }
+    }
+    else {
+        journal_record(tree, RECORD_TRANSACTION, 0, NULL, NULL, journaled.data, journaled.data_length);
+    }
+    version_write_end(&tree->structure_version);
+    journal_end(tree);
+
+    int unlock_err;
+    if ((unlock_err = pthread_mutex_unlock(&tree->move_mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+
+    // Usunięte foldery zwalniamy jak detach_child, jeszcze jako pisarz w ich ojcach.
+    for (size_t i = 0; i < done; i++) {
+        if (ops[i].kind == TRANSACTION_REMOVE) {
+            TransactionNode *removed = &nodes->nodes[undo[i].index];
+            atomic_store(&removed->node->removed, true);
+            version_write_begin(&removed->node->version);
+            if (removed->locked) {
+                writer_ending_protocol(removed->node);
+                removed->locked = false;
+            }
+            node_retire(removed->node);
+        }
+    }
+    transaction_unlock(nodes);
+
+    for (size_t i = nodes->anchors; i < nodes->count; i++) {
+        free(nodes->nodes[i].path);
+    }
+    nodes->count = nodes->anchors;
+    return err;
+}
+
+int tree_transaction_commit_real(Tree *tree, const TreeTransaction *transaction, size_t *failed) {
+    const TransactionOp *ops = transaction->ops;
+    size_t count = 0;
+    int final_error = 0;
+    while (count < transaction->count && (final_error = transaction_check(&ops[count])) == 0) {
+        count++;
+    }
+    if (count == 0) {
+        *failed = 0;
+        return final_error;
+    }
+
+    TransactionNodes nodes = {.nodes = NULL, .count = 0, .anchors = 0, .capacity = 0};
+    for (size_t i = 0; i < count; i++) {
+        const char *path = ops[i].path;
+        transaction_add_anchor(&nodes, ops, i, path, parent_path_length(path));
+        if (ops[i].kind == TRANSACTION_REMOVE) {
+            transaction_add_anchor(&nodes, ops, i, path, strlen(path));
+        }
+        else if (ops[i].kind == TRANSACTION_MOVE) {
+            transaction_add_anchor(&nodes, ops, i, ops[i].target, parent_path_length(ops[i].target));
+        }
+    }
+    transaction_sort_anchors(&nodes);
+
+    TransactionUndo *undo = malloc(count * sizeof(TransactionUndo));
+    if (!undo) {
+        fatal("transaction allocation failed");
+    }
+
+    // Rekord dziennika składamy przed próbami, a dopisujemy tylko wtedy, gdy wszystkie operacje się powiodą.
+    RecordBuffer record = {.data = NULL, .length = 0, .capacity = 0};
+    if (tree->journal && final_error == 0) {
+        record_put_varint(&record, count);
+        for (size_t i = 0; i < count; i++) {
+            char kind = (char) ops[i].kind;
+            record_put(&record, &kind, 1);
+            record_put_string(&record, ops[i].path);
+            if (ops[i].kind == TRANSACTION_MOVE) {
+                record_put_string(&record, ops[i].target);
+            }
+        }
+        journaled.data = record.data;
+        journaled.data_length = record.length;
+    }
+
+    int err;
+    int attempts = 0;
+    do {
+        if (attempts < STALE_ATTEMPTS) {
+            wait_for_starving(tree);
+        }
+        err = transaction_attempt(tree, ops, count, final_error, &nodes, undo, failed);
+        if (err == ESTALEPATH) {
+            attempt_stale(tree, &attempts);
+        }
+    } while (err == ESTALEPATH);
+    attempts_finished(tree, attempts);
+    journaled.data = NULL;
+    free(record.data);
+
+    for (size_t i = 0; i < nodes.count; i++) {
+        free(nodes.nodes[i].path);
+    }
+    free(nodes.nodes);
+    free(undo);
+    return err;
+}
+
+// Migawki (opis na początku pliku).
+
+// Stan dzieci wierzchołka w migawce.
+typedef struct {
+    size_t count;
+    ChildEntry *entries; // posortowane po nazwie
+    char *names; // nazwy z entries, jeśli odczytaliśmy bieżące dzieci (NULL dla kopii)
+    NodeCopy *copy; // kopia, do której należą entries, albo NULL
+} SnapshotFolder;
+
+// Najstarsza kopia dzieci wierzchołka o numerze >= epoch - jego stan w migawce epoch - albo NULL, jeśli tym stanem
+// są bieżące dzieci. Kopii potrzebnych migawce nikt nie usunie, dopóki ona istnieje.
+NodeCopy *snapshot_copy_of(Node *node, uint64_t epoch) {
+    NodeCopy *found = NULL;
+    for (NodeCopy *copy = atomic_load(&node->copies); copy && copy->epoch >= epoch; copy = atomic_load(&copy->older)) {
+        found = copy;
+    }
+    return found;
+}
+
+int compare_child_entries(const void *a, const void *b) {
+    return strcmp(((const ChildEntry *) a)->name, ((const ChildEntry *) b)->name);
+}
+
+// Optymistycznie odczytuje bieżące dzieci wierzchołka, którego wersja była równa version. Nazwy kopiujemy przed
+// sprawdzeniem wersji - potem pisarz może je zwolnić. Zwraca false w przypadku konfliktu z pisarzem.
+bool snapshot_read_live(Node *node, uint64_t version, SnapshotFolder *folder) {
+    size_t capacity = hmap_size(node->children) + 1;
+    ChildEntry *entries = malloc(capacity * sizeof(ChildEntry));
+    if (!entries) {
+        fatal("snapshot allocation failed");
+    }
+    size_t count = 0;
+    size_t length = 0;
+    const char *key = NULL;
+    void *value = NULL;
+    HashMapIterator it = hmap_iterator(node->children);
+    while (hmap_next(node->children, &it, &key, &value)) {
+        if (count == capacity) {
+            capacity *= 2;
+            entries = realloc(entries, capacity * sizeof(ChildEntry));
+            if (!entries) {
+                fatal("snapshot allocation failed");
+            }
+        }
+        entries[count++] = (ChildEntry) {.name = key, .child = value};
+        length += strnlen(key, MAX_FOLDER_NAME_LENGTH) + 1;
+    }
+
+    char *names = malloc(length + 1);
+    if (!names) {
+        fatal("snapshot allocation failed");
+    }
+    size_t used = 0;
+    bool valid = true;
+    for (size_t i = 0; i < count && valid; i++) {
+        size_t name_length = strnlen(entries[i].name, MAX_FOLDER_NAME_LENGTH);
+        valid = used + name_length + 1 <= length;
+        if (valid) {
+            memcpy(names + used, entries[i].name, name_length);
+            names[used + name_length] = '\0';
+            entries[i].name = names + used;
+            used += name_length + 1;
+        }
+    }
+    if (!valid || !version_validate(&node->version, version)) {
+        free(entries);
+        free(names);
+        return false;
+    }
+
+    qsort(entries, count, sizeof(ChildEntry), compare_child_entries);
+    *folder = (SnapshotFolder) {.count = count, .entries = entries, .names = names, .copy = NULL};
+    return true;
+}
+
+// Stan dzieci wierzchołka w migawce epoch. Wołający jest w sekcji krytycznej reclaim.h, ale wynik (i wierzchołki
+// w nim) może oglądać także po jej końcu - dopóki istnieje migawka.
+void snapshot_read(Node *node, uint64_t epoch, SnapshotFolder *folder) {
+    while (true) {
+        uint64_t version = atomic_load(&node->version);
+        bool removed = atomic_load(&node->removed);
+        NodeCopy *copy = snapshot_copy_of(node, epoch);
+        if (copy) {
+            *folder = (SnapshotFolder) {.count = copy->count, .entries = copy->entries, .names = NULL, .copy = copy};
+            return;
+        }
+        if (removed) {
+            *folder = (SnapshotFolder) {.count = 0, .entries = NULL, .names = NULL, .copy = NULL};
+            return;
+        }
+        // Pisarz, który zmienia dzieci wierzchołka widocznego w migawce, najpierw zachowuje je w kopii, więc kolejna
+        // próba ją znajdzie.
+        if (!version_is_being_written(version) && snapshot_read_live(node, version, folder)) {
+            return;
+        }
+    }
+}
+
+void snapshot_folder_release(SnapshotFolder *folder) {
+    if (!folder->copy) {
+        free(folder->entries);
+        free(folder->names);
+    }
+}
+
+// Dziecko wierzchołka o nazwie z indeksem index w ścieżce, w migawce epoch. Jak snapshot_read, ale bez odczytywania
+// wszystkich dzieci.
+Node *snapshot_child(Node *node, uint64_t epoch, const Path *path, size_t index) {
+    const char *name = path_component(path, index);
+    size_t length = path->lengths[index];
+    while (true) {
+        uint64_t version = atomic_load(&node->version);
+        bool removed = atomic_load(&node->removed);
+        NodeCopy *copy = snapshot_copy_of(node, epoch);
+        if (copy) {
+            size_t begin = 0, end = copy->count;
+            while (begin < end) {
+                size_t middle = begin + (end - begin) / 2;
+                const char *other = copy->entries[middle].name;
+                int result = strncmp(name, other, length);
+                if (result == 0 && other[length] != '\0') {
+                    result = -1;
+                }
+                if (result == 0) {
+                    return copy->entries[middle].child;
+                }
+                if (result < 0) {
+                    end = middle;
+                }
+                else {
+                    begin = middle + 1;
+                }
+            }
+            return NULL;
+        }
+        if (removed) {
+            return NULL;
+        }
+        if (!version_is_being_written(version)) {
+            Node *child = hmap_get_prehashed(node->children, name, length, path->hashes[index]);
+            if (version_validate(&node->version, version)) {
+                return child;
+            }
+        }
+    }
+}
+
+// Wierzchołek na ścieżce w migawce albo NULL. Sekcja krytyczna na każdy wierzchołek - wierzchołki widoczne
+// w migawce żyją tak długo jak ona.
+Node *snapshot_find(TreeSnapshot *snapshot, const Path *path) {
+    Node *node = snapshot->tree->root;
+    for (size_t i = 0; i < path->depth && node; i++) {
+        reclaim_enter();
+        node = snapshot_child(node, snapshot->epoch, path, i);
+        reclaim_leave();
+    }
+    return node;
+}
+
+typedef struct {
+    uint64_t epoch;
+    char *path; // ścieżka bieżącego wierzchołka
+    size_t capacity;
+    void (*visit)(const char *path, void *arg);
+    void *arg;
+    TreeSnapshotStats *stats;
+} SnapshotWalk;
+
+// Odwiedza wierzchołek o ścieżce walk->path (długości length) i jego poddrzewo w kolejności preorder. Przeniesienia
+// mogą tworzyć ścieżki dłuższe niż MAX_PATH_LENGTH, więc bufor ścieżki rośnie w razie potrzeby.
+void snapshot_walk(SnapshotWalk *walk, Node *node, size_t length) {
+    if (walk->visit) {
+        walk->visit(walk->path, walk->arg);
+    }
+
+    SnapshotFolder folder;
+    reclaim_enter();
+    snapshot_read(node, walk->epoch, &folder);
+    reclaim_leave();
+    if (walk->stats) {
+        walk->stats->folders++;
+        if (folder.copy) {
+            walk->stats->copied++;
+            walk->stats->copy_bytes += folder.copy->size;
+        }
+        else {
+            walk->stats->shared++;
+        }
+    }
+
+    for (size_t i = 0; i < folder.count; i++) {
+        size_t name_length = strlen(folder.entries[i].name);
+        size_t child_length = length + name_length + 1;
+        if (child_length + 1 > walk->capacity) {
+            walk->capacity = 2 * (child_length + 1);
+            walk->path = realloc(walk->path, walk->capacity);
+            if (!walk->path) {
+                fatal("snapshot allocation failed");
+            }
+        }
+        memcpy(walk->path + length, folder.entries[i].name, name_length);
+        walk->path[child_length - 1] = '/';
+        walk->path[child_length] = '\0';
+        snapshot_walk(walk, folder.entries[i].child, child_length);
+    }
+    snapshot_folder_release(&folder);
+}
+
+void snapshot_walk_from(TreeSnapshot *snapshot, Node *node, const char *path, SnapshotWalk *walk) {
+    size_t length = strlen(path);
+    walk->epoch = snapshot->epoch;
+    walk->capacity = MAX_PATH_LENGTH + 1;
+    walk->path = malloc(walk->capacity);
+    if (!walk->path) {
+        fatal("snapshot allocation failed");
+    }
+    memcpy(walk->path, path, length + 1);
+    snapshot_walk(walk, node, length);
+    free(walk->path);
+}
+
+// Stos zadań wykonywanych przez kilka wątków - kopiowanie i wczytywanie poddrzew. Wykonanie zadania może dodać na stos
+// kolejne, a wątki pomocnicze startują dopiero, gdy zadań zbierze się dużo, więc małe poddrzewa obsługuje sam wołający.
+typedef struct TaskStack TaskStack;
+
+struct TaskStack {
+    void (*run)(TaskStack *stack, void *task); // wykonuje zadanie, bez muteksu stosu
+    void *arg; // dane wspólne dla zadań
+    size_t task_size;
+    int threads; // liczba wątków (razem z wołającym)
+    size_t parallel_tasks; // po tylu zadaniach czekających na stosie startują wątki pomocnicze
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    char *tasks;
+    size_t count;
+    size_t capacity;
+    size_t busy; // liczba wątków, które wykonują właśnie jakieś zadanie
+    int helpers;
+    pthread_t *helper_threads;
+};
+
+void task_stack_lock(TaskStack *stack) {
+    int err;
+    if ((err = pthread_mutex_lock(&stack->mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+void task_stack_unlock(TaskStack *stack) {
+    int err;
+    if ((err = pthread_mutex_unlock(&stack->mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+void task_stack_init(TaskStack *stack, void (*run)(TaskStack *, void *), void *arg, size_t task_size, int threads,
+                     size_t parallel_tasks) {
+    *stack = (TaskStack) {.run = run, .arg = arg, .task_size = task_size, .threads = threads,
+                          .parallel_tasks = parallel_tasks, .tasks = NULL, .count = 0, .capacity = 0, .busy = 0,
+                          .helpers = 0, .helper_threads = NULL};
+    int err;
+    if ((err = pthread_mutex_init(&stack->mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    if ((err = pthread_cond_init(&stack->cond, 0)) != 0) {
+        syserr("cond init failed");
+    }
+}
+
+void *task_stack_helper(void *arg);
+
+void task_stack_push(TaskStack *stack, const void *tasks, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    task_stack_lock(stack);
+    if (stack->count + count > stack->capacity) {
+        stack->capacity = 2 * (stack->count + count);
+        stack->tasks = realloc(stack->tasks, stack->capacity * stack->task_size);
+        if (!stack->tasks) {
+            fatal("task stack allocation failed");
+        }
+    }
+    memcpy(stack->tasks + stack->count * stack->task_size, tasks, count * stack->task_size);
+    stack->count += count;
+
+    if (stack->helpers == 0 && stack->threads > 1 && stack->count >= stack->parallel_tasks) {
+        stack->helper_threads = malloc((stack->threads - 1) * sizeof(pthread_t));
+        if (!stack->helper_threads) {
+            fatal("task stack allocation failed");
+        }
+        for (int i = 1; i < stack->threads; i++) {
+            int err;
+            if ((err = pthread_create(&stack->helper_threads[stack->helpers++], NULL, task_stack_helper, stack)) != 0) {
+                syserr("thread create failed");
+            }
+        }
+    }
+    int err;
+    if ((err = pthread_cond_broadcast(&stack->cond)) != 0) {
+        syserr("cond broadcast failed");
+    }
+    task_stack_unlock(stack);
+}
+
+// Zdejmuje zadania ze stosu, dopóki są lub mogą się pojawić (ktoś jeszcze wykonuje zadanie).
+void task_stack_work(TaskStack *stack) {
+    char *task = malloc(stack->task_size);
+    if (!task) {
+        fatal("task stack allocation failed");
+    }
+    task_stack_lock(stack);
+    while (true) {
+        while (stack->count == 0 && stack->busy > 0) {
+            int err;
+            if ((err = pthread_cond_wait(&stack->cond, &stack->mutex)) != 0) {
+                syserr("cond wait failed");
+            }
+        }
+        if (stack->count == 0) {
+            break;
+        }
+        memcpy(task, stack->tasks + --stack->count * stack->task_size, stack->task_size);
+        stack->busy++;
+        task_stack_unlock(stack);
+
+        stack->run(stack, task);
+
+        task_stack_lock(stack);
+        stack->busy--;
+        if (stack->busy == 0 && stack->count == 0) {
+            int err;
+            if ((err = pthread_cond_broadcast(&stack->cond)) != 0) {
+                syserr("cond broadcast failed");
+            }
+        }
+    }
+    task_stack_unlock(stack);
+    free(task);
+}
+
+void *task_stack_helper(void *arg) {
+    task_stack_work(arg);
+    return NULL;
+}
+
+// Wykonuje wszystkie zadania (także dodane w trakcie) i zwalnia stos.
+void task_stack_run(TaskStack *stack) {
+    task_stack_work(stack);
+    int err;
+    for (int i = 0; i < stack->helpers; i++) {
+        if ((err = pthread_join(stack->helper_threads[i], NULL)) != 0) {
+            syserr("thread join failed");
+        }
+    }
+    free(stack->helper_threads);
+    free(stack->tasks);
+    if ((err = pthread_cond_destroy(&stack->cond)) != 0) {
+        syserr("cond destroy failed");
+    }
+    if ((err = pthread_mutex_destroy(&stack->mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+}
+
+// Kopiowanie poddrzewa (opis na początku pliku).
+
+typedef struct {
+    Node *source; // folder w migawce
+    Node *clone; // jego kopia, jeszcze bez dzieci
+} CopyTask;
+
+typedef struct {
+    Tree *tree;
+    uint64_t epoch;
+} SubtreeCopy;
+
+// Dodaje kopii task->clone kopie dzieci task->source (jeszcze bez ich dzieci) i dokłada je na stos jako nowe zadania.
+// Kopii nikt poza nami nie widzi, więc nie potrzebujemy blokad. Nazwy w migawce są posortowane, więc trafiają
+// do SortedSet jednym przejściem.
+void copy_children(TaskStack *stack, void *arg) {
+    SubtreeCopy *copy = stack->arg;
+    CopyTask *task = arg;
+    // Kopie dostają numer ostatniej zmiany dzieci (node_new) nie większy niż numer operacji, która je doda do drzewa.
+    modification_begin(copy->tree);
+
+    SnapshotFolder folder;
+    reclaim_enter();
+    snapshot_read(task->source, copy->epoch, &folder);
+    reclaim_leave();
+
+    if (folder.count > 0) {
+        CopyTask *children = malloc(folder.count * sizeof(CopyTask));
+        SortedSetKey *keys = malloc(folder.count * sizeof(SortedSetKey));
+        if (!children || !keys) {
+            fatal("copy allocation failed");
+        }
+        hmap_reserve(task->clone->children, folder.count);
+        for (size_t i = 0; i < folder.count; i++) {
+            const char *name = folder.entries[i].name;
+            Node *child = node_new(copy->tree->nodes);
+            child->parent = task->clone;
+            hmap_insert(task->clone->children, name, child);
+            keys[i] = (SortedSetKey) {.key = name, .length = strlen(name)};
+            children[i] = (CopyTask) {.source = folder.entries[i].child, .clone = child};
+        }
+        task->clone->names = sset_new();
+        sset_insert_sorted(task->clone->names, keys, folder.count);
+        free(keys);
+        task_stack_push(stack, children, folder.count);
+        free(children);
+    }
+    snapshot_folder_release(&folder);
+}
+
+// Buduje kopię poddrzewa folderu source w migawce. Kopia nie jest jeszcze w drzewie.
+Node *copy_subtree(TreeSnapshot *snapshot, Node *source) {
+    Tree *tree = snapshot->tree;
+    SubtreeCopy copy = {.tree = tree, .epoch = snapshot->epoch};
+    modification_begin(tree);
+    CopyTask root = {.source = source, .clone = node_new(tree->nodes)};
+
+    TaskStack stack;
+    task_stack_init(&stack, copy_children, &copy, sizeof(CopyTask), COPY_THREADS, COPY_PARALLEL_FOLDERS);
+    task_stack_push(&stack, &root, 1);
+    task_stack_run(&stack);
+    return root.clone;
+}
+
+// Kopia poddrzewa w rekordzie tree_copy: foldery w porządku preorder, każdy jako liczba jego dzieci (varint),
+// a przed każdym poza korzeniem kopii - jego nazwa.
+void journal_encode_subtree(Node *root, RecordBuffer *buffer) {
+    size_t capacity = 64;
+    size_t count = 0;
+    ChildEntry *stack = malloc(capacity * sizeof(ChildEntry));
+    if (!stack) {
+        fatal("journal record allocation failed");
+    }
+    stack[count++] = (ChildEntry) {.name = NULL, .child = root};
+
+    while (count > 0) {
+        ChildEntry entry = stack[--count];
+        if (entry.name) {
+            record_put_string(buffer, entry.name);
+        }
+        record_put_varint(buffer, hmap_size(entry.child->children));
+
+        const char *key = NULL;
+        void *value = NULL;
+        HashMapIterator it = hmap_iterator(entry.child->children);
+        while (hmap_next(entry.child->children, &it, &key, &value)) {
+            if (count == capacity) {
+                capacity *= 2;
+                stack = realloc(stack, capacity * sizeof(ChildEntry));
+                if (!stack) {
+                    fatal("journal record allocation failed");
+                }
+            }
+            stack[count++] = (ChildEntry) {.name = key, .child = value};
+        }
+    }
+    free(stack);
+}
+
+// Odczyt rekordu dziennika. Dane wychodzące poza rekord ustawiają malformed.
+typedef struct {
+    const char *data;
+    size_t length;
+    size_t offset;
+    bool malformed;
+} RecordReader;
+
+unsigned char record_get_byte(RecordReader *reader) {
+    if (reader->offset == reader->length) {
+        reader->malformed = true;
+        return 0;
+    }
+    return (unsigned char) reader->data[reader->offset++];
+}
+
+uint64_t record_get_varint(RecordReader *reader) {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        unsigned char byte = record_get_byte(reader);
+        value |= (uint64_t) (byte & 0x7F) << shift;
+        if (!(byte & 0x80)) {
+            return value;
+        }
+    }
+    reader->malformed = true;
+    return 0;
+}
+
+const char *record_get_string(RecordReader *reader) {
+    const char *string = reader->data + reader->offset;
+    const char *end = memchr(string, '\0', reader->length - reader->offset);
+    if (!end) {
+        reader->malformed = true;
+        return NULL;
+    }
+    reader->offset += end - string + 1;
+    return string;
+}
+
+// Zwraca wskaźnik na kolejne length bajtów albo NULL, jeśli wychodzą poza rekord.
+const char *record_get_bytes(RecordReader *reader, uint64_t length) {
+    if (length > reader->length - reader->offset) {
+        reader->malformed = true;
+        return NULL;
+    }
+    reader->offset += length;
+    return reader->data + reader->offset - length;
+}
+
+uint64_t record_get_u64(RecordReader *reader) {
+    uint64_t value = 0;
+    const char *data = record_get_bytes(reader, sizeof(value));
+    if (data) {
+        memcpy(&value, data, sizeof(value));
+    }
+    return value;
+}
+
+typedef struct {
+    Node *node;
+    uint64_t remaining; // liczba dzieci, których jeszcze nie odczytaliśmy
+} DecodedFolder;
+
+// Buduje z rekordu kopię poddrzewa zapisaną przez journal_encode_subtree - z boku drzewa, jak copy_subtree. Zwraca
+// NULL, jeśli rekord jest uszkodzony.
+Node *journal_decode_subtree(Tree *tree, RecordReader *reader) {
+    modification_begin(tree);
+    size_t capacity = 64;
+    size_t count = 0;
+    DecodedFolder *stack = malloc(capacity * sizeof(DecodedFolder));
+    if (!stack) {
+        fatal("journal replay allocation failed");
+    }
+    Node *root = node_new(tree->nodes);
+    stack[count++] = (DecodedFolder) {.node = root, .remaining = record_get_varint(reader)};
+
+    while (count > 0 && !reader->malformed) {
+        DecodedFolder *folder = &stack[count - 1];
+        if (folder->remaining == 0) {
+            count--;
+            continue;
+        }
+        folder->remaining--;
+        const char *name = record_get_string(reader);
+        uint64_t children = record_get_varint(reader);
+        if (reader->malformed) {
+            break;
+        }
+
+        Node *child = node_new(tree->nodes);
+        child->parent = folder->node;
+        if (!hmap_insert(folder->node->children, name, child)) {
+            node_unreference(child);
+            reader->malformed = true;
+            break;
+        }
+        if (!folder->node->names) {
+            folder->node->names = sset_new();
+        }
+        sset_insert(folder->node->names, name, strlen(name));
+
+        if (count == capacity) {
+            capacity *= 2;
+            stack = realloc(stack, capacity * sizeof(DecodedFolder));
+            if (!stack) {
+                fatal("journal replay allocation failed");
+            }
+        }
+        stack[count++] = (DecodedFolder) {.node = child, .remaining = children};
+    }
+    free(stack);
+
+    if (reader->malformed) {
+        node_unreference(root);
+        return NULL;
+    }
+    return root;
+}
+
+// Zrzut drzewa (opis na początku pliku). Zawartość pliku (dump.h) to pozycja dziennika, od której trzeba go odtwarzać
+// na wczytanym drzewie (0, jeśli drzewo nie ma dziennika), liczba wszystkich folderów (obie 64 bity, jak pozostałe
+// rozmiary), korzeń zapisany jako folder i uchwyty otwarte w chwili migawki. Folder to liczba jego dzieci (varint)
+// i, jeśli ją ma, rozmiar zapisu jego dzieci w bajtach, a za nim dzieci w kolejności nazw: długość prefiksu nazwy
+// wspólnego z poprzednim dzieckiem, długość reszty nazwy (obie varint), reszta nazwy i samo dziecko zapisane jako
+// folder. Uchwyty to ich liczba, a potem każdy z nich: numer w dzienniku, długość ścieżki jego folderu (0, jeśli
+// folder usunięto przed migawką) i sama ścieżka.
+
+// Uchwyt zapisywany w zrzucie (albo z niego wczytany).
+typedef struct {
+    Node *node;
+    uint32_t id;
+    char *path; // ścieżka folderu w migawce, NULL, jeśli go w niej nie ma
+} DumpedDir;
+
+typedef struct {
+    DumpedDir *dirs; // przy zapisywaniu posortowane po wierzchołkach
+    size_t count;
+} DumpedDirs;
+
+void dumped_dirs_free(DumpedDirs *dirs) {
+    for (size_t i = 0; i < dirs->count; i++) {
+        free(dirs->dirs[i].path);
+    }
+    free(dirs->dirs);
+}
+
+int compare_dumped_dirs(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t) ((const DumpedDir *) a)->node, y = (uintptr_t) ((const DumpedDir *) b)->node;
+    return x < y ? -1 : x > y;
+}
+
+// Folder zrzucany w porządku preorder - jego dzieci zapisujemy po kolei.
+typedef struct {
+    SnapshotFolder folder;
+    size_t next; // indeks następnego dziecka do zapisania
+    uint64_t size_offset; // miejsce rozmiaru zapisu dzieci - znamy go dopiero po ich zapisaniu
+} DumpedFolder;
+
+void dump_varint(DumpWriter *writer, uint64_t value) {
+    char buffer[VARINT_MAX_LENGTH];
+    dump_put(writer, buffer, encode_varint(value, buffer));
+}
+
+// Zapamiętuje ścieżkę folderu node w uchwytach, które go dotyczą. Na stosie są jego przodkowie, a ich ostatnio
+// zapisane dzieci prowadzą do niego.
+void dump_dir_paths(DumpedDirs *dirs, Node *node, const DumpedFolder *stack, size_t count) {
+    size_t begin = 0, end = dirs->count;
+    while (begin < end) {
+        size_t middle = (begin + end) / 2;
+        if ((uintptr_t) dirs->dirs[middle].node < (uintptr_t) node) {
+            begin = middle + 1;
+        }
+        else {
+            end = middle;
+        }
+    }
+    if (begin == dirs->count || dirs->dirs[begin].node != node) {
+        return;
+    }
+
+    size_t length = 1;
+    for (size_t i = 0; i < count; i++) {
+        length += strlen(stack[i].folder.entries[stack[i].next - 1].name) + 1;
+    }
+    for (; begin < dirs->count && dirs->dirs[begin].node == node; begin++) {
+        char *path = malloc(length + 1);
+        if (!path) {
+            fatal("dump allocation failed");
+        }
+        char *end_of_path = path;
+        *end_of_path++ = '/';
+        for (size_t i = 0; i < count; i++) {
+            const char *name = stack[i].folder.entries[stack[i].next - 1].name;
+            size_t name_length = strlen(name);
+            memcpy(end_of_path, name, name_length);
+            end_of_path += name_length;
+            *end_of_path++ = '/';
+        }
+        *end_of_path = '\0';
+        dirs->dirs[begin].path = path;
+    }
+}
+
+// Zapisuje poddrzewo wierzchołka root w migawce i zwraca liczbę jego folderów. Uchwytom z dirs (posortowanym po
+// wierzchołkach) ustawia ścieżki ich folderów, które są w poddrzewie.
+uint64_t dump_subtree(TreeSnapshot *snapshot, Node *root, DumpedDirs *dirs, DumpWriter *writer) {
+    size_t capacity = 64;
+    size_t count = 0;
+    DumpedFolder *stack = malloc(capacity * sizeof(DumpedFolder));
+    if (!stack) {
+        fatal("dump allocation failed");
+    }
+
+    uint64_t folders = 0;
+    Node *node = root; // następny folder do zapisania (jego nazwa jest już zapisana)
+    while (true) {
+        if (node) {
+            folders++;
+            if (dirs->count > 0) {
+                dump_dir_paths(dirs, node, stack, count);
+            }
+            DumpedFolder dumped = {.next = 0, .size_offset = 0};
+            reclaim_enter();
+            snapshot_read(node, snapshot->epoch, &dumped.folder);
+            reclaim_leave();
+            dump_varint(writer, dumped.folder.count);
+            if (dumped.folder.count == 0) {
+                snapshot_folder_release(&dumped.folder);
+            }
+            else {
+                uint64_t size = 0;
+                dumped.size_offset = dump_offset(writer);
+                dump_put(writer, &size, sizeof(size));
+                if (count == capacity) {
+                    capacity *= 2;
+                    stack = realloc(stack, capacity * sizeof(DumpedFolder));
+                    if (!stack) {
+                        fatal("dump allocation failed");
+                    }
+                }
+                stack[count++] = dumped;
+            }
+            node = NULL;
+        }
+        if (count == 0) {
+            break;
+        }
+
+        DumpedFolder *top = &stack[count - 1];
+        if (top->next == top->folder.count) {
+            uint64_t size = dump_offset(writer) - top->size_offset - sizeof(size);
+            dump_patch(writer, top->size_offset, &size, sizeof(size));
+            snapshot_folder_release(&top->folder);
+            count--;
+            continue;
+        }
+        // Nazwy w migawce są posortowane, więc sąsiednie mają zwykle wspólny prefiks.
+        const ChildEntry *entry = &top->folder.entries[top->next];
+        size_t length = strlen(entry->name);
+        size_t shared = 0;
+        if (top->next > 0) {
+            const char *previous = top->folder.entries[top->next - 1].name;
+            while (shared < length && previous[shared] == entry->name[shared]) {
+                shared++;
+            }
+        }
+        dump_varint(writer, shared);
+        dump_varint(writer, length - shared);
+        dump_put(writer, entry->name + shared, length - shared);
+        top->next++;
+        node = entry->child;
+    }
+    free(stack);
+    return folders;
+}
+
+void dump_dirs(DumpWriter *writer, const DumpedDirs *dirs) {
+    dump_varint(writer, dirs->count);
+    for (size_t i = 0; i < dirs->count; i++) {
+        const char *path = dirs->dirs[i].path;
+        size_t length = path ? strlen(path) : 0;
+        dump_varint(writer, dirs->dirs[i].id);
+        dump_varint(writer, length);
+        if (length > 0) {
+            dump_put(writer, path, length);
+        }
+    }
+}
+
+// Wczytywanie zrzutu: folder, któremu trzeba jeszcze dodać dzieci.
+typedef struct {
+    Node *node;
+    uint64_t count; // liczba jego dzieci
+    const char *data; // zapis jego dzieci
+    size_t size;
+} LoadTask;
+
+typedef struct {
+    Tree *tree;
+    atomic_bool malformed;
+    atomic_size_t folders; // wczytane foldery
+} TreeLoad;
+
+typedef struct {
+    LoadTask *tasks;
+    size_t count;
+    size_t capacity;
+} LoadTasks;
+
+void load_tasks_add(LoadTasks *tasks, const LoadTask *task) {
+    if (tasks->count == tasks->capacity) {
+        tasks->capacity = tasks->capacity ? 2 * tasks->capacity : 64;
+        tasks->tasks = realloc(tasks->tasks, tasks->capacity * sizeof(LoadTask));
+        if (!tasks->tasks) {
+            fatal("load allocation failed");
+        }
+    }
+    tasks->tasks[tasks->count++] = *task;
+}
+
+// Dodaje wierzchołkowi task->node jego dzieci (jeszcze bez ich dzieci), a te z nich, które mają dzieci, dokłada
+// do children. Hash-mapa dostaje od razu docelowy rozmiar, a posortowane nazwy trafiają do SortedSet jednym
+// przejściem. Zwraca false, jeśli zapis jest uszkodzony - dodane już dzieci zwolni wtedy korzeń.
+bool load_children(Tree *tree, const LoadTask *task, LoadTasks *children) {
+    RecordReader reader = {.data = task->data, .length = task->size, .offset = 0, .malformed = false};
+    // Każde dziecko zajmuje co najmniej cztery bajty, więc nie trzeba ufać liczbie dzieci przy rezerwowaniu pamięci.
+    if (task->count > task->size / 4) {
+        return false;
+    }
+    size_t count = task->count;
+    SortedSetKey *keys = malloc(count * sizeof(SortedSetKey));
+    size_t names_capacity = 16 * count;
+    size_t names_length = 0;
+    char *names = malloc(names_capacity);
+    if (!keys || !names) {
+        fatal("load allocation failed");
+    }
+    hmap_reserve(task->node->children, count);
+
+    char name[MAX_FOLDER_NAME_LENGTH + 1];
+    size_t length = 0;
+    size_t loaded = 0;
+    for (; loaded < count; loaded++) {
+        uint64_t shared = record_get_varint(&reader);
+        uint64_t suffix_length = record_get_varint(&reader);
+        const char *suffix = record_get_bytes(&reader, suffix_length);
+        // Nazwy muszą być poprawne i rosnąć, a wspólny prefiks - najdłuższy możliwy.
+        if (reader.malformed || shared > length || (loaded == 0 && shared > 0) || suffix_length == 0 ||
+            shared + suffix_length > MAX_FOLDER_NAME_LENGTH || (shared < length && suffix[0] <= name[shared])) {
+            break;
+        }
+        bool valid = true;
+        for (size_t i = 0; i < suffix_length && valid; i++) {
+            valid = suffix[i] >= 'a' && suffix[i] <= 'z';
+        }
+        if (!valid) {
+            break;
+        }
+        memcpy(name + shared, suffix, suffix_length);
+        length = shared + suffix_length;
+        name[length] = '\0';
+
+        uint64_t grandchildren = record_get_varint(&reader);
+        uint64_t size = 0;
+        if (grandchildren > 0) {
+            const char *size_data = record_get_bytes(&reader, sizeof(size));
+            if (size_data) {
+                memcpy(&size, size_data, sizeof(size));
+            }
+        }
+        const char *data = record_get_bytes(&reader, size);
+        if (reader.malformed) {
+            break;
+        }
+
+        Node *child = node_new(tree->nodes);
+        child->parent = task->node;
+        hmap_insert(task->node->children, name, child);
+        if (names_length + length + 1 > names_capacity) {
+            names_capacity = 2 * (names_length + length + 1);
+            names = realloc(names, names_capacity);
+            if (!names) {
+                fatal("load allocation failed");
+            }
+        }
+        memcpy(names + names_length, name, length + 1);
+        keys[loaded] = (SortedSetKey) {.key = NULL, .length = length};
+        names_length += length + 1;
+        if (grandchildren > 0) {
+            LoadTask child_task = {.node = child, .count = grandchildren, .data = data, .size = size};
+            load_tasks_add(children, &child_task);
+        }
+    }
+
+    bool valid = loaded == count && reader.offset == reader.length;
+    if (valid && count > 0) {
+        // Bufor nazw mógł się przenieść, więc wskaźniki na nazwy ustawiamy dopiero teraz.
+        for (size_t i = 0, offset = 0; i < count; offset += keys[i].length + 1, i++) {
+            keys[i].key = names + offset;
+        }
+        task->node->names = sset_new();
+        sset_insert_sorted(task->node->names, keys, count);
+    }
+    free(keys);
+    free(names);
+    return valid;
+}
+
+// Wczytuje poddrzewo z zadania. Dzieci z małymi poddrzewami wczytujemy sami, a duże poddrzewa oddajemy na stos,
+// gdzie mogą je wziąć inne wątki.
+void load_subtree(TaskStack *stack, void *arg) {
+    TreeLoad *load = stack->arg;
+    modification_begin(load->tree);
+    LoadTasks tasks = {.tasks = NULL, .count = 0, .capacity = 0};
+    load_tasks_add(&tasks, arg);
+    size_t folders = 0;
+    while (tasks.count > 0 && !atomic_load(&load->malformed)) {
+        LoadTask task = tasks.tasks[--tasks.count];
+        size_t first = tasks.count;
+        if (!load_children(load->tree, &task, &tasks)) {
+            atomic_store(&load->malformed, true);
+            break;
+        }
+        folders += task.count;
+
+        size_t kept = first;
+        for (size_t i = first; i < tasks.count; i++) {
+            if (tasks.tasks[i].size >= LOAD_TASK_BYTES) {
+                task_stack_push(stack, &tasks.tasks[i], 1);
+            }
+            else {
+                tasks.tasks[kept++] = tasks.tasks[i];
+            }
+        }
+        tasks.count = kept;
+    }
+    free(tasks.tasks);
+    atomic_fetch_add(&load->folders, folders);
+}
+
+// Wczytuje uchwyty zapisane w zrzucie.
+void load_dirs(RecordReader *reader, DumpedDirs *dirs) {
+    uint64_t count = record_get_varint(reader);
+    // Każdy uchwyt zajmuje co najmniej 2 bajty - tak nie zaalokujemy za dużo dla uszkodzonego zrzutu.
+    if (reader->malformed || count > (reader->length - reader->offset) / 2) {
+        reader->malformed = true;
+        return;
+    }
+    dirs->dirs = malloc((count + 1) * sizeof(DumpedDir));
+    if (!dirs->dirs) {
+        fatal("load allocation failed");
+    }
+    for (dirs->count = 0; dirs->count < count; dirs->count++) {
+        DumpedDir *dir = &dirs->dirs[dirs->count];
+        uint64_t id = record_get_varint(reader);
+        uint64_t length = record_get_varint(reader);
+        const char *path = record_get_bytes(reader, length);
+        if (reader->malformed || id == 0 || id > UINT32_MAX) {
+            reader->malformed = true;
+            return;
+        }
+        *dir = (DumpedDir) {.node = NULL, .id = id, .path = length > 0 ? strndup(path, length) : NULL};
+        if (length > 0 && !dir->path) {
+            fatal("load allocation failed");
+        }
+    }
+}
+
+// Buduje z boku drzewa poddrzewo zapisane w zrzucie (jako korzeń i jego dzieci). Zapisuje pozycję dziennika
+// i uchwyty ze zrzutu w *position i *dirs. Zwraca NULL, jeśli zrzut jest uszkodzony.
+Node *load_tree(Tree *tree, const char *data, size_t size, uint64_t *position, DumpedDirs *dirs) {
+    RecordReader reader = {.data = data, .length = size, .offset = 0, .malformed = false};
+    *position = record_get_u64(&reader);
+    uint64_t folders = record_get_u64(&reader);
+    LoadTask root = {.node = NULL, .count = record_get_varint(&reader), .data = NULL, .size = 0};
+    if (root.count > 0) {
+        root.size = record_get_u64(&reader);
+        root.data = record_get_bytes(&reader, root.size);
+    }
+    *dirs = (DumpedDirs) {.dirs = NULL, .count = 0};
+    load_dirs(&reader, dirs);
+    if (reader.malformed || reader.offset != reader.length) {
+        dumped_dirs_free(dirs);
+        return NULL;
+    }
+
+    modification_begin(tree);
+    root.node = node_new(tree->nodes);
+    TreeLoad load = {.tree = tree, .malformed = false, .folders = 1};
+    if (root.count > 0) {
+        TaskStack stack;
+        task_stack_init(&stack, load_subtree, &load, sizeof(LoadTask), LOAD_THREADS, LOAD_PARALLEL_TASKS);
+        task_stack_push(&stack, &root, 1);
+        task_stack_run(&stack);
+    }
+    if (atomic_load(&load.malformed) || atomic_load(&load.folders) != folders) {
+        node_unreference(root.node);
+        dumped_dirs_free(dirs);
+        return NULL;
+    }
+    return root.node;
+}
+
+// Przenosi dzieci wczytanego korzenia do korzenia drzewa, jeśli ten jest pusty. Optymistyczni czytelnicy mogą czytać
+// hash-mapę korzenia, więc dzieci do niej wstawiamy (jako pisarz), zamiast ją podmieniać.
+int load_attach(Tree *tree, Node *loaded) {
+    reclaim_enter();
+    Node *root = tree->root;
+    writer_beginning_protocol(root);
+    int err = ENOTEMPTY;
+    if (hmap_size(root->children) == 0) {
+        modification_begin(tree);
+        children_write_begin(root);
+        hmap_reserve(root->children, hmap_size(loaded->children));
+        const char *key = NULL;
+        void *value = NULL;
+        HashMapIterator it = hmap_iterator(loaded->children);
+        while (hmap_next(loaded->children, &it, &key, &value)) {
+            hmap_insert(root->children, key, value);
+            ((Node *) value)->parent = root;
+        }
+        // Nazwy czytamy tylko w czytelni, więc zbiór można podmienić.
+        SortedSet *names = root->names;
+        root->names = loaded->names;
+        loaded->names = names;
+        invalidate_listing(root);
+        version_write_end(&root->version);
+        err = 0;
+    }
+    writer_ending_protocol(root);
+    reclaim_leave();
+
+    if (err == 0) {
+        // Dzieci należą już do drzewa - wczytany korzeń zwalniamy bez nich.
+        hmap_free(loaded->children);
+        loaded->children = hmap_new();
+    }
+    node_unreference(loaded);
+    return err;
+}
+
+// Każda operacja jest w całości sekcją krytyczną reclaim.h - wierzchołki i pamięć hash-map, które widziała,
+// nie zostaną zwolnione przed jej końcem.
+
+char *tree_list(Tree *tree, const char *path) {
+    reclaim_enter();
+    char *result = tree_list_real(tree, tree->root, path);
+    reclaim_leave();
+    return result;
+}
+
+int tree_create(Tree *tree, const char *path) {
+    reclaim_enter();
+    int err = tree_create_real(tree, tree->root, path);
+    reclaim_leave();
+    journal_sync(tree);
+    return err;
+}
+
+int tree_remove(Tree *tree, const char *path) {
+    reclaim_enter();
+    int err = tree_remove_real(tree, tree->root, path);
+    reclaim_leave();
+    journal_sync(tree);
+    return err;
+}
+
+int tree_move(Tree *tree, const char *source, const char *target) {
+    reclaim_enter();
+    int err = tree_move_real(tree, tree->root, source, target);
+    reclaim_leave();
+    journal_sync(tree);
+    return err;
+}
+
+int tree_remove_recursive(Tree *tree, const char *path) {
+    Node *detached = NULL;
+    reclaim_enter();
+    int err = tree_remove_recursive_real(tree, tree->root, path, &detached);
+    reclaim_leave();
+    if (detached) {
+        free_subtree(tree, detached);
+    }
+    journal_sync(tree);
+    return err;
+}
+
+struct TreeDir {
+    Node *node;
+    uint32_t id; // numer uchwytu w dzienniku (0, jeśli drzewo nie ma dziennika)
+    TreeDir *prev, *next; // lista otwartych uchwytów drzewa z dziennikiem, chroniona jego muteksem
+};
+
+bool open_attempt(Tree *tree, const Path *path, TreeDir *dir) {
+    Attempt attempt = attempt_begin(tree, tree->root);
+    bool stale;
+    Node *node = get_node(tree, &attempt, tree->root, path, 0, path->depth, true, &stale);
+    if (!node) {
+        dir->node = NULL;
+        return !stale;
+    }
+
+    reader_beginning_protocol(node);
+    if (node != tree->root) {
+        reader_ending_protocol(node->parent);
+    }
+
+    journal_begin(tree);
+    bool valid = path_is_valid(tree, &attempt, node);
+    if (valid) {
+        atomic_fetch_add(&node->references, 1);
+        dir->node = node;
+        if (tree->journal) {
+            dir->id = ++tree->dir_ids;
+            journal_record(tree, RECORD_OPEN_DIR, dir->id, path->path, NULL, NULL, 0);
+            // Punkt kontrolny zapisuje uchwyty otwarte w chwili swojej migawki.
+            dir->prev = NULL;
+            dir->next = tree->dirs;
+            if (tree->dirs) {
+                tree->dirs->prev = dir;
+            }
+            tree->dirs = dir;
+        }
+    }
+    journal_end(tree);
+
+    reader_ending_protocol(node);
+    return valid;
+}
+
+TreeDir *tree_open_dir(Tree *tree, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return NULL;
+    }
+
+    TreeDir *dir = malloc(sizeof(TreeDir));
+    if (!dir) {
+        return NULL;
+    }
+
+    dir->id = 0;
+    reclaim_enter();
+    int attempts = 0;
+    while (!open_attempt(tree, &parsed, dir)) {
+        attempt_stale(tree, &attempts);
+    }
+    attempts_finished(tree, attempts);
+    reclaim_leave();
+    journal_sync(tree);
+
+    if (!dir->node) {
+        free(dir);
+        return NULL;
+    }
+    return dir;
+}
+
+void tree_close_dir(Tree *tree, TreeDir *dir) {
+    if (dir->id) {
+        journal_begin(tree);
+        journal_record(tree, RECORD_CLOSE_DIR, dir->id, NULL, NULL, NULL, 0);
+        if (dir->prev) {
+            dir->prev->next = dir->next;
+        }
+        else {
+            tree->dirs = dir->next;
+        }
+        if (dir->next) {
+            dir->next->prev = dir->prev;
+        }
+        journal_end(tree);
+        journal_sync(tree);
+    }
+    node_unreference(dir->node);
+    free(dir);
+}
+
+char *tree_list_at(Tree *tree, TreeDir *dir, const char *path) {
+    reclaim_enter();
+    char *result = tree_list_real(tree, dir->node, path);
+    reclaim_leave();
+    return result;
+}
+
+int tree_create_at(Tree *tree, TreeDir *dir, const char *path) {
+    journaled.dir = dir->id;
+    reclaim_enter();
+    int err = tree_create_real(tree, dir->node, path);
+    reclaim_leave();
+    journaled.dir = 0;
+    journal_sync(tree);
+    return err;
+}
+
+int tree_remove_at(Tree *tree, TreeDir *dir, const char *path) {
+    journaled.dir = dir->id;
+    reclaim_enter();
+    int err = tree_remove_real(tree, dir->node, path);
+    reclaim_leave();
+    journaled.dir = 0;
+    journal_sync(tree);
+    return err;
+}
+
+int tree_move_at(Tree *tree, TreeDir *dir, const char *source, const char *target) {
+    journaled.dir = dir->id;
+    reclaim_enter();
+    int err = tree_move_real(tree, dir->node, source, target);
+    reclaim_leave();
+    journaled.dir = 0;
+    journal_sync(tree);
+    return err;
+}
+
+void tree_create_batch(Tree *tree, const char *const *paths, size_t count, int *errors) {
+    tree_batch_real(tree, tree->root, BATCH_CREATE, paths, count, errors, NULL);
+}
+
+void tree_remove_batch(Tree *tree, const char *const *paths, size_t count, int *errors) {
+    tree_batch_real(tree, tree->root, BATCH_REMOVE, paths, count, errors, NULL);
+}
+
+void tree_list_batch(Tree *tree, const char *const *paths, size_t count, char **results) {
+    tree_batch_real(tree, tree->root, BATCH_LIST, paths, count, NULL, results);
+}
+
+void tree_get_stats(Tree *tree, TreeStats *stats) {
+    stats->retired_nodes_pending = atomic_load(&retired_nodes_pending);
+    stats->retired_pending = reclaim_pending();
+
+    stats->listing_cache_hits = 0;
+    stats->listing_cache_misses = 0;
+    stats->dentry_cache_hits = 0;
+    stats->dentry_cache_misses = 0;
+    stats->dentry_cache_invalidations = 0;
+    for (int i = 0; i < STATS_STRIPES; i++) {
+        stats->listing_cache_hits += atomic_load(&tree->stats[i].listing_hits);
+        stats->listing_cache_misses += atomic_load(&tree->stats[i].listing_misses);
+        stats->dentry_cache_hits += atomic_load(&tree->stats[i].dentry_hits);
+        stats->dentry_cache_misses += atomic_load(&tree->stats[i].dentry_misses);
+        stats->dentry_cache_invalidations += atomic_load(&tree->stats[i].dentry_invalidations);
+    }
+    stats->snapshot_copies = atomic_load(&tree->copies_count);
+    stats->snapshot_copy_bytes = atomic_load(&tree->copies_bytes);
+
+    JournalStats journal = {.records = 0, .bytes = 0, .syncs = 0};
+    if (tree->journal) {
+        journal_get_stats(tree->journal, &journal);
+    }
+    stats->journal_records = journal.records;
+    stats->journal_bytes = journal.bytes;
+    stats->journal_syncs = journal.syncs;
+    stats->checkpoints = atomic_load(&tree->checkpoints);
+    stats->checkpoint_failures = atomic_load(&tree->checkpoint_failures);
+    stats->checkpoint_bytes = atomic_load(&tree->checkpoint_bytes);
+    stats->checkpoint_nanoseconds = atomic_load(&tree->checkpoint_nanoseconds);
+    stats->checkpoint_stall_nanoseconds = atomic_load(&tree->checkpoint_stall_nanoseconds);
+}
+
+TreeTransaction *tree_transaction_new(void) {
+    TreeTransaction *transaction = malloc(sizeof(TreeTransaction));
+    if (!transaction) {
+        fatal("transaction allocation failed");
+    }
+    *transaction = (TreeTransaction) {.ops = NULL, .count = 0, .capacity = 0};
+    return transaction;
+}
+
+void tree_transaction_free(TreeTransaction *transaction) {
+    for (size_t i = 0; i < transaction->count; i++) {
+        free(transaction->ops[i].path);
+        free(transaction->ops[i].target);
+    }
+    free(transaction->ops);
+    free(transaction);
+}
+
+void transaction_append(TreeTransaction *transaction, TransactionKind kind, const char *path, const char *target) {
+    if (transaction->count == transaction->capacity) {
+        transaction->capacity = transaction->capacity ? 2 * transaction->capacity : 8;
+        transaction->ops = realloc(transaction->ops, transaction->capacity * sizeof(TransactionOp));
+        if (!transaction->ops) {
+            fatal("transaction allocation failed");
+        }
+    }
+    TransactionOp *op = &transaction->ops[transaction->count++];
+    op->kind = kind;
+    op->path = copy_path_prefix(path, strlen(path));
+    op->target = target ? copy_path_prefix(target, strlen(target)) : NULL;
+}
+
+void tree_transaction_create(TreeTransaction *transaction, const char *path) {
+    transaction_append(transaction, TRANSACTION_CREATE, path, NULL);
+}
+
+void tree_transaction_remove(TreeTransaction *transaction, const char *path) {
+    transaction_append(transaction, TRANSACTION_REMOVE, path, NULL);
+}
+
+void tree_transaction_move(TreeTransaction *transaction, const char *source, const char *target) {
+    transaction_append(transaction, TRANSACTION_MOVE, source, target);
+}
+
+int tree_transaction_commit(Tree *tree, TreeTransaction *transaction, size_t *failed) {
+    size_t index;
+    reclaim_enter();
+    int err = tree_transaction_commit_real(tree, transaction, &index);
+    reclaim_leave();
+    journal_sync(tree);
+    if (err && failed) {
+        *failed = index;
+    }
+    return err;
+}
+
+// Dodaje migawkę i nadaje jej numer. Należą do niej operacje, które odczytały poprzedni numer - zanim się ją
+// przeczyta, trzeba poczekać, aż skończą (reclaim_synchronize).
+TreeSnapshot *snapshot_register(Tree *tree) {
+    TreeSnapshot *snapshot = malloc(sizeof(TreeSnapshot));
+    if (!snapshot) {
+        fatal("snapshot allocation failed");
+    }
+    snapshot->tree = tree;
+
+    snapshot_lock(tree);
+    snapshot->prev = NULL;
+    snapshot->next = tree->snapshots;
+    if (tree->snapshots) {
+        tree->snapshots->prev = snapshot;
+    }
+    tree->snapshots = snapshot;
+    atomic_fetch_add(&tree->snapshots_live, 1);
+    snapshot->epoch = atomic_fetch_add(&tree->snapshot_epoch, 1) + 1;
+    snapshot_unlock(tree);
+    return snapshot;
+}
+
+TreeSnapshot *tree_snapshot(Tree *tree) {
+    TreeSnapshot *snapshot = snapshot_register(tree);
+    // Operacje, które odczytały poprzedni numer, należą do migawki - czekamy, aż skończą.
+    reclaim_synchronize();
+    return snapshot;
+}
+
+void tree_snapshot_free(TreeSnapshot *snapshot) {
+    Tree *tree = snapshot->tree;
+    snapshot_lock(tree);
+    if (snapshot->prev) {
+        snapshot->prev->next = snapshot->next;
+    }
+    else {
+        tree->snapshots = snapshot->next;
+    }
+    if (snapshot->next) {
+        snapshot->next->prev = snapshot->prev;
+    }
+    atomic_fetch_sub(&tree->snapshots_live, 1);
+    snapshot_prune(tree);
+    snapshot_unlock(tree);
+    free(snapshot);
+}
+
+char *tree_snapshot_list(TreeSnapshot *snapshot, const char *path) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return NULL;
+    }
+    Node *node = snapshot_find(snapshot, &parsed);
+    if (!node) {
+        return NULL;
+    }
+
+    SnapshotFolder folder;
+    reclaim_enter();
+    snapshot_read(node, snapshot->epoch, &folder);
+    reclaim_leave();
+
+    size_t length = 0;
+    for (size_t i = 0; i < folder.count; i++) {
+        length += strlen(folder.entries[i].name) + 1;
+    }
+    char *result = malloc(length ? length : 1);
+    if (result) {
+        char *position = result;
+        for (size_t i = 0; i < folder.count; i++) {
+            if (position != result) {
+                *position++ = ',';
+            }
+            size_t name_length = strlen(folder.entries[i].name);
+            memcpy(position, folder.entries[i].name, name_length);
+            position += name_length;
+        }
+        *position = '\0';
+    }
+    snapshot_folder_release(&folder);
+    return result;
+}
+
+int tree_snapshot_walk(TreeSnapshot *snapshot, const char *path, void (*visit)(const char *path, void *arg),
+                       void *arg) {
+    Path parsed;
+    if (!parse_path(path, &parsed)) {
+        return EINVAL;
+    }
+    Node *node = snapshot_find(snapshot, &parsed);
+    if (!node) {
+        return ENOENT;
+    }
+    SnapshotWalk walk = {.visit = visit, .arg = arg, .stats = NULL};
+    snapshot_walk_from(snapshot, node, path, &walk);
+    return 0;
+}
+
+void tree_snapshot_get_stats(TreeSnapshot *snapshot, TreeSnapshotStats *stats) {
+    *stats = (TreeSnapshotStats) {.folders = 0, .shared = 0, .copied = 0, .copy_bytes = 0};
+    SnapshotWalk walk = {.visit = NULL, .arg = NULL, .stats = stats};
+    snapshot_walk_from(snapshot, snapshot->tree->root, "/", &walk);
+}
+
+int tree_copy(Tree *tree, const char *source, const char *target) {
+    Path source_path, target_path;
+    if (!parse_path(source, &source_path) || !parse_path(target, &target_path)) {
+        return EINVAL;
+    }
+    if (target_path.depth == 0) {
+        return EEXIST;
+    }
+
+    TreeSnapshot *snapshot = tree_snapshot(tree);
+    Node *node = snapshot_find(snapshot, &source_path);
+    Node *clone = node ? copy_subtree(snapshot, node) : NULL;
+    tree_snapshot_free(snapshot);
+    if (!clone) {
+        return ENOENT;
+    }
+
+    // Kopię kodujemy do rekordu dziennika, zanim trafi do drzewa - potem mogą ją już zmieniać inne operacje.
+    RecordBuffer record = {.data = NULL, .length = 0, .capacity = 0};
+    if (tree->journal) {
+        journal_encode_subtree(clone, &record);
+        journaled.data = record.data;
+        journaled.data_length = record.length;
+    }
+
+    reclaim_enter();
+    int err = create_node_real(tree, tree->root, &target_path, clone);
+    reclaim_leave();
+    journaled.data = NULL;
+    free(record.data);
+    // Kopii nikt nie widział, więc zwalniamy ją od razu.
+    if (err != 0) {
+        node_unreference(clone);
+    }
+    journal_sync(tree);
+    return err;
+}
+
+// Odtwarzanie dziennika: uchwyty otwarte przez jego rekordy (albo zapisane w punkcie kontrolnym), według numerów.
+typedef struct {
+    TreeDir **dirs;
+    size_t capacity;
+} ReplayDirs;
+
+// Uchwyt z punktu kontrolnego, którego folder usunięto przed migawką - zostaje już tylko jego zamknięcie.
+static TreeDir removed_dir;
+
+TreeDir **replay_dir(ReplayDirs *dirs, uint64_t id) {
+    if (id >= dirs->capacity) {
+        size_t capacity = dirs->capacity ? dirs->capacity : 16;
+        while (capacity <= id) {
+            capacity *= 2;
+        }
+        dirs->dirs = realloc(dirs->dirs, capacity * sizeof(TreeDir *));
+        if (!dirs->dirs) {
+            fatal("journal replay allocation failed");
+        }
+        memset(dirs->dirs + dirs->capacity, 0, (capacity - dirs->capacity) * sizeof(TreeDir *));
+        dirs->capacity = capacity;
+    }
+    return &dirs->dirs[id];
+}
+
+int replay_transaction(Tree *tree, RecordReader *reader) {
+    TreeTransaction *transaction = tree_transaction_new();
+    uint64_t count = record_get_varint(reader);
+    for (uint64_t i = 0; i < count && !reader->malformed; i++) {
+        TransactionKind kind = record_get_byte(reader);
+        const char *path = record_get_string(reader);
+        if (kind > TRANSACTION_MOVE) {
+            reader->malformed = true;
+        }
+        if (reader->malformed) {
+            break;
+        }
+        if (kind == TRANSACTION_CREATE) {
+            tree_transaction_create(transaction, path);
+        }
+        else if (kind == TRANSACTION_REMOVE) {
+            tree_transaction_remove(transaction, path);
+        }
+        else {
+            const char *target = record_get_string(reader);
+            if (target) {
+                tree_transaction_move(transaction, path, target);
+            }
+        }
+    }
+    int err = reader->malformed ? EIO : tree_transaction_commit(tree, transaction, NULL);
+    tree_transaction_free(transaction);
+    return err;
+}
+
+int replay_copy(Tree *tree, Node *dir, const char *target, RecordReader *reader) {
+    Path target_path;
+    if (!parse_path(target, &target_path) || target_path.depth == 0) {
+        return EIO;
+    }
+    Node *clone = journal_decode_subtree(tree, reader);
+    if (!clone) {
+        return EIO;
+    }
+    int err = create_node_real(tree, dir, &target_path, clone);
+    if (err != 0) {
+        node_unreference(clone);
+    }
+    return err;
+}
+
+// Wykonuje operację z rekordu. Zwraca jej wynik albo EIO, jeśli rekord jest uszkodzony.
+int replay_record(Tree *tree, ReplayDirs *dirs, const char *data, size_t length) {
+    RecordReader reader = {.data = data, .length = length, .offset = 0, .malformed = false};
+    RecordKind kind = record_get_byte(&reader);
+    uint64_t id = record_get_varint(&reader);
+    if (reader.malformed || id > UINT32_MAX) {
+        return EIO;
+    }
+    TreeDir **dir = id > 0 ? replay_dir(dirs, id) : NULL;
+
+    if (kind == RECORD_OPEN_DIR) {
+        const char *path = record_get_string(&reader);
+        if (!path || !dir) {
+            return EIO;
+        }
+        // Numery uchwytów są nadawane od nowa po każdym tree_journal_open, a uchwytów otwartych przed awarią nikt
+        // nie zamknął.
+        if (*dir && *dir != &removed_dir) {
+            tree_close_dir(tree, *dir);
+        }
+        *dir = tree_open_dir(tree, path);
+        return *dir ? 0 : ENOENT;
+    }
+    if (kind == RECORD_CLOSE_DIR) {
+        if (!dir || !*dir) {
+            return EIO;
+        }
+        if (*dir != &removed_dir) {
+            tree_close_dir(tree, *dir);
+        }
+        *dir = NULL;
+        return 0;
+    }
+    if (kind == RECORD_TRANSACTION) {
+        return replay_transaction(tree, &reader);
+    }
+
+    // Operacje na uchwycie usuniętego folderu się nie udają, więc nie mają rekordów.
+    if (dir && (!*dir || *dir == &removed_dir)) {
+        return EIO;
+    }
+    Node *node = dir ? (*dir)->node : tree->root;
+    const char *path = record_get_string(&reader);
+    if (!path) {
+        return EIO;
+    }
+    const char *target;
+    Node *detached = NULL;
+    int err = EIO;
+    reclaim_enter();
+    switch (kind) {
+        case RECORD_CREATE:
+            err = tree_create_real(tree, node, path);
+            break;
+        case RECORD_REMOVE:
+            err = tree_remove_real(tree, node, path);
+            break;
+        case RECORD_MOVE:
+            if ((target = record_get_string(&reader))) {
+                err = tree_move_real(tree, node, path, target);
+            }
+            break;
+        case RECORD_REMOVE_RECURSIVE:
+            err = tree_remove_recursive_real(tree, node, path, &detached);
+            break;
+        case RECORD_COPY:
+            err = replay_copy(tree, node, path, &reader);
+            break;
+        default:
+            break;
+    }
+    reclaim_leave();
+    if (detached) {
+        free_subtree(tree, detached);
+    }
+    return err;
+}
+
+void replay_dirs_close(Tree *tree, ReplayDirs *dirs) {
+    for (size_t i = 0; i < dirs->capacity; i++) {
+        if (dirs->dirs[i] && dirs->dirs[i] != &removed_dir) {
+            tree_close_dir(tree, dirs->dirs[i]);
+        }
+    }
+    free(dirs->dirs);
+}
+
+// Wykonuje rekordy dziennika od pozycji position (0 - od pierwszego), zaczynając z uchwytami dirs, które na końcu
+// zamyka i zwalnia.
+int replay_journal(Tree *tree, const char *path, uint64_t position, ReplayDirs *dirs) {
+    int err;
+    JournalReader *reader = journal_reader_open(path, position, &err);
+    if (reader) {
+        const char *data;
+        size_t length;
+        while (journal_reader_next(reader, &data, &length)) {
+            // Rekordy opisują tylko udane operacje.
+            if (replay_record(tree, dirs, data, length) != 0) {
+                err = EIO;
+            }
+        }
+        journal_reader_close(reader);
+    }
+    replay_dirs_close(tree, dirs);
+    return err;
+}
+
+int tree_journal_replay(Tree *tree, const char *path) {
+    assert(!tree->journal);
+    ReplayDirs dirs = {.dirs = NULL, .capacity = 0};
+    return replay_journal(tree, path, 0, &dirs);
+}
+
+int tree_journal_open(Tree *tree, const char *path, TreeJournalMode mode) {
+    assert(!tree->journal);
+    int err;
+    tree->journal = journal_open(path, mode == TREE_JOURNAL_GROUP_COMMIT, &err);
+    return err;
+}
+
+uint64_t clock_nanoseconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Zapisuje zrzut drzewa (opis na początku pliku) razem z pozycją dziennika, od której trzeba go odtwarzać na
+// wczytanym drzewie, i ją zwraca w *position. W *bytes zapisuje rozmiar pliku, a w *stall czas, przez który
+// wstrzymywał zmiany drzewa.
+int dump_tree(Tree *tree, const char *path, uint64_t *position, uint64_t *bytes, uint64_t *stall) {
+    int err;
+    DumpWriter *writer = dump_writer_open(path, &err);
+    if (!writer) {
+        return err;
+    }
+    uint64_t header[2] = {0, 0}; // pozycja dziennika i liczba folderów
+    dump_put(writer, header, sizeof(header));
+
+    TreeSnapshot *snapshot;
+    DumpedDirs dirs = {.dirs = NULL, .count = 0};
+    *stall = 0;
+    if (tree->journal) {
+        // Pod muteksem dziennika żadna operacja nie dopisuje rekordu, więc rekordy przed pozycją to dokładnie
+        // operacje, które odczytały numer migawki sprzed tej (modification_begin jest w ich sekcji dziennika).
+        journal_lock(tree->journal);
+        uint64_t start = clock_nanoseconds();
+        header[0] = journal_position(tree->journal);
+        snapshot = snapshot_register(tree);
+        size_t count = 0;
+        for (TreeDir *dir = tree->dirs; dir; dir = dir->next) {
+            count++;
+        }
+        dirs.dirs = malloc((count + 1) * sizeof(DumpedDir));
+        if (!dirs.dirs) {
+            fatal("dump allocation failed");
+        }
+        for (TreeDir *dir = tree->dirs; dir; dir = dir->next) {
+            // Wierzchołek nie zostanie zwolniony i użyty ponownie, zanim porównamy go z wierzchołkami migawki.
+            atomic_fetch_add(&dir->node->references, 1);
+            dirs.dirs[dirs.count++] = (DumpedDir) {.node = dir->node, .id = dir->id, .path = NULL};
+        }
+        *stall = clock_nanoseconds() - start;
+        journal_unlock(tree->journal);
+        qsort(dirs.dirs, dirs.count, sizeof(DumpedDir), compare_dumped_dirs);
+    }
+    else {
+        snapshot = snapshot_register(tree);
+    }
+    reclaim_synchronize();
+
+    header[1] = dump_subtree(snapshot, tree->root, &dirs, writer);
+    tree_snapshot_free(snapshot);
+    dump_dirs(writer, &dirs);
+    for (size_t i = 0; i < dirs.count; i++) {
+        node_unreference(dirs.dirs[i].node);
+    }
+    dumped_dirs_free(&dirs);
+    dump_patch(writer, 0, header, sizeof(header));
+    *position = header[0];
+    *bytes = dump_writer_size(writer);
+
+    // Zrzut nie może wyprzedzić dziennika - po awarii odtwarzamy go od zapisanej pozycji.
+    if (tree->journal) {
+        journal_wait(tree->journal, *position);
+    }
+    return dump_writer_commit(writer);
+}
+
+int tree_dump(Tree *tree, const char *path) {
+    uint64_t position, bytes, stall;
+    return dump_tree(tree, path, &position, &bytes, &stall);
+}
+
+// Wczytuje zrzut do pustego drzewa. Uchwyty ze zrzutu otwiera w *dirs (albo pomija, jeśli dirs jest NULL), a pozycję
+// dziennika zapisuje w *position.
+int load_dump(Tree *tree, const char *path, uint64_t *position, ReplayDirs *dirs) {
+    DumpFile file;
+    int err = dump_map(path, &file);
+    if (err != 0) {
+        return err;
+    }
+    DumpedDirs dumped;
+    Node *loaded = load_tree(tree, file.data, file.size, position, &dumped);
+    dump_unmap(&file);
+    if (!loaded) {
+        return EINVAL;
+    }
+    err = load_attach(tree, loaded);
+    for (size_t i = 0; i < dumped.count && err == 0 && dirs; i++) {
+        TreeDir **dir = replay_dir(dirs, dumped.dirs[i].id);
+        if (*dir && *dir != &removed_dir) {
+            err = EINVAL;
+        }
+        else if (!dumped.dirs[i].path) {
+            *dir = &removed_dir;
+        }
+        else if (!(*dir = tree_open_dir(tree, dumped.dirs[i].path))) {
+            err = EINVAL;
+        }
+    }
+    dumped_dirs_free(&dumped);
+    return err;
+}
+
+int tree_load(Tree *tree, const char *path) {
+    assert(!tree->journal);
+    uint64_t position;
+    return load_dump(tree, path, &position, NULL);
+}
+
+// Punkty kontrolne (opis na początku pliku).
+
+// Robi punkt kontrolny. Wołający trzyma muteks punktów kontrolnych. Dziennik obcinamy dopiero wtedy, gdy nowy punkt
+// kontrolny jest trwale na swoim miejscu (dump_writer_commit synchronizuje też katalog) - inaczej awaria mogłaby
+// zostawić stary punkt kontrolny z dziennikiem bez potrzebnych mu rekordów.
+int checkpoint_write(Tree *tree, const char *path) {
+    uint64_t start = clock_nanoseconds();
+    uint64_t position, bytes, stall;
+    int err = dump_tree(tree, path, &position, &bytes, &stall);
+    if (err == 0) {
+        tree->checkpoint_position = position;
+        err = journal_truncate(tree->journal, position);
+    }
+    atomic_fetch_add(&tree->checkpoint_stall_nanoseconds, stall);
+    if (err != 0) {
+        atomic_fetch_add(&tree->checkpoint_failures, 1);
+        return err;
+    }
+    atomic_fetch_add(&tree->checkpoints, 1);
+    atomic_fetch_add(&tree->checkpoint_bytes, bytes);
+    atomic_fetch_add(&tree->checkpoint_nanoseconds, clock_nanoseconds() - start);
+    return 0;
+}
+
+void checkpoint_lock(Tree *tree) {
+    int err;
+    if ((err = pthread_mutex_lock(&tree->checkpoint_mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+void checkpoint_unlock(Tree *tree) {
+    int err;
+    if ((err = pthread_mutex_unlock(&tree->checkpoint_mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+// Wątek punktów kontrolnych: co CHECKPOINT_POLL_MS sprawdza, o ile urósł dziennik od ostatniego punktu kontrolnego.
+void *checkpoint_thread(void *arg) {
+    Tree *tree = arg;
+    checkpoint_lock(tree);
+    while (!tree->checkpoint_stop) {
+        journal_lock(tree->journal);
+        uint64_t position = journal_position(tree->journal);
+        journal_unlock(tree->journal);
+        if (position - tree->checkpoint_position >= tree->checkpoint_threshold) {
+            // Po nieudanym punkcie kontrolnym próbujemy ponownie dopiero po takim samym przyroście dziennika.
+            if (checkpoint_write(tree, tree->checkpoint_path) != 0) {
+                tree->checkpoint_position = position;
+            }
+            continue;
+        }
+
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_nsec += CHECKPOINT_POLL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        int err = pthread_cond_timedwait(&tree->checkpoint_wakeup, &tree->checkpoint_mutex, &deadline);
+        if (err != 0 && err != ETIMEDOUT) {
+            syserr("cond wait failed");
+        }
+    }
+    checkpoint_unlock(tree);
+    return NULL;
+}
+
+void checkpointer_stop(Tree *tree) {
+    int err;
+    checkpoint_lock(tree);
+    tree->checkpoint_stop = true;
+    if ((err = pthread_cond_signal(&tree->checkpoint_wakeup)) != 0) {
+        syserr("cond signal failed");
+    }
+    checkpoint_unlock(tree);
+    if ((err = pthread_join(tree->checkpointer, NULL)) != 0) {
+        syserr("thread join failed");
+    }
+    tree->checkpointing = false;
+    free(tree->checkpoint_path);
+}
+
+int tree_checkpoint(Tree *tree, const char *path) {
+    assert(tree->journal);
+    checkpoint_lock(tree);
+    int err = checkpoint_write(tree, path);
+    checkpoint_unlock(tree);
+    return err;
+}
+
+void tree_checkpoint_start(Tree *tree, const char *path, size_t journal_bytes) {
+    assert(tree->journal && !tree->checkpointing);
+    checkpoint_lock(tree);
+    tree->checkpoint_path = strdup(path);
+    if (!tree->checkpoint_path) {
+        fatal("checkpoint allocation failed");
+    }
+    tree->checkpoint_threshold = journal_bytes > 0 ? journal_bytes : 1;
+    journal_lock(tree->journal);
+    tree->checkpoint_position = journal_position(tree->journal);
+    journal_unlock(tree->journal);
+    tree->checkpoint_stop = false;
+    tree->checkpointing = true;
+    int err;
+    if ((err = pthread_create(&tree->checkpointer, NULL, checkpoint_thread, tree)) != 0) {
+        syserr("thread create failed");
+    }
+    checkpoint_unlock(tree);
+}
+
+int tree_recover(Tree *tree, const char *checkpoint, const char *journal) {
+    assert(!tree->journal);
+    uint64_t position = 0;
+    ReplayDirs dirs = {.dirs = NULL, .capacity = 0};
+    int err = load_dump(tree, checkpoint, &position, &dirs);
+    if (err != 0 && err != ENOENT) {
+        replay_dirs_close(tree, &dirs);
+        return err;
+    }
+    // Bez punktu kontrolnego odtwarzamy cały dziennik, a bez dziennika - zaczynamy od pustego drzewa.
+    err = replay_journal(tree, journal, position, &dirs);
+    return err == ENOENT && position == 0 ? 0 : err;
+}
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stddef.h>
+
 typedef struct Tree Tree; // Let "Tree" mean the same as "struct Tree".
 
 Tree *tree_new();
@@ -13,3 +15,174 @@ int tree_create(Tree *tree, const char *path);
 int tree_remove(Tree *tree, const char *path);
 
 int tree_move(Tree *tree, const char *source, const char *target);
+
+// Remove the folder at `path` together with everything in it, as one atomic step. Return 0, EINVAL if the path is
+// invalid, EBUSY for "/" or ENOENT if there is no such folder. The folder is unlinked from its parent in time which
+// does not depend on the size of its subtree. The calling thread then marks the subtree as removed and frees it itself,
+// holding no lock outside of it, so the call takes time proportional to the size of the subtree, but other operations
+// do not pay for it.
+int tree_remove_recursive(Tree *tree, const char *path);
+
+// Create the folder `target` as a copy of the folder `source` with its whole subtree, as it was at one moment during
+// the call (`target` may be inside the subtree). The copy is built aside, by several threads if it is large, and
+// appears in the tree at once. Return 0, EINVAL if a path is invalid, EEXIST if `target` exists or is "/", or ENOENT
+// if `source` or the parent of `target` does not exist.
+int tree_copy(Tree *tree, const char *source, const char *target);
+
+// A handle to a folder, which can be used as the starting point of paths instead of the root. The handle keeps the
+// folder's memory alive and follows the folder when it is moved.
+typedef struct TreeDir TreeDir;
+
+// Open a handle to the folder at `path`. Return NULL if the path is invalid or the folder does not exist.
+TreeDir *tree_open_dir(Tree *tree, const char *path);
+
+// Close a handle. All handles of a tree have to be closed before tree_free.
+void tree_close_dir(Tree *tree, TreeDir *dir);
+
+// Like the functions above, but paths are relative to the folder of `dir`: "/" is the folder itself, "/a/" its child.
+// Once the folder is removed, they behave as if none of the paths existed (NULL or ENOENT).
+char *tree_list_at(Tree *tree, TreeDir *dir, const char *path);
+
+int tree_create_at(Tree *tree, TreeDir *dir, const char *path);
+
+int tree_remove_at(Tree *tree, TreeDir *dir, const char *path);
+
+int tree_move_at(Tree *tree, TreeDir *dir, const char *source, const char *target);
+
+// Batch operations: handle each of `count` paths as the function without the _batch suffix would and store its
+// result at the same index of `errors` (or `results`, each to be freed by the caller). Paths with the same parent are
+// handled together - the parent is found and locked once for all of them. The batch is not atomic: it behaves as if
+// the paths were handled one at a time, grouped by parent path, in the order given within a group. Groups go in
+// lexicographic order of parent paths, reversed for tree_remove_batch, so a batch may create a folder together with
+// its children, or remove them.
+void tree_create_batch(Tree *tree, const char *const *paths, size_t count, int *errors);
+
+void tree_remove_batch(Tree *tree, const char *const *paths, size_t count, int *errors);
+
+void tree_list_batch(Tree *tree, const char *const *paths, size_t count, char **results);
+
+// A transaction: a sequence of creates, removes and moves to be applied together by tree_transaction_commit. Paths
+// are copied - nothing is checked and nothing happens to the tree until the commit.
+typedef struct TreeTransaction TreeTransaction;
+
+TreeTransaction *tree_transaction_new(void);
+
+void tree_transaction_free(TreeTransaction *transaction);
+
+void tree_transaction_create(TreeTransaction *transaction, const char *path);
+
+void tree_transaction_remove(TreeTransaction *transaction, const char *path);
+
+void tree_transaction_move(TreeTransaction *transaction, const char *source, const char *target);
+
+// Apply the operations of the transaction in order, each seeing the effects of the previous ones, as one atomic step -
+// no other operation sees the tree in between. Return 0 if all of them succeed. Otherwise the tree is left unchanged,
+// the result is the error the first failing operation would return on its own (as tree_create, tree_remove or
+// tree_move) and its index is stored in *failed (unless `failed` is NULL). The transaction itself is not changed, so
+// it can be committed again.
+int tree_transaction_commit(Tree *tree, TreeTransaction *transaction, size_t *failed);
+
+// A snapshot: an immutable view of the whole tree as it was when tree_snapshot returned. Taking one does not depend on
+// the size of the tree - afterwards, the first change of the children of each folder keeps a copy of them for the
+// snapshots which need it. Reading a snapshot takes none of the tree's locks, so it neither waits for operations on
+// the tree nor delays them.
+typedef struct TreeSnapshot TreeSnapshot;
+
+// Take a snapshot. Waits for the operations in progress to finish (operations started later do not wait).
+TreeSnapshot *tree_snapshot(Tree *tree);
+
+// Free a snapshot. All snapshots of a tree have to be freed before tree_free.
+void tree_snapshot_free(TreeSnapshot *snapshot);
+
+// Like tree_list, but in the snapshot.
+char *tree_snapshot_list(TreeSnapshot *snapshot, const char *path);
+
+// Call `visit` for the folder at `path` and every folder in its subtree, as they are in the snapshot: each folder
+// before its children, children in lexicographic order. The path passed to `visit` is valid only during the call.
+// Return 0, EINVAL if `path` is invalid or ENOENT if there is no such folder in the snapshot.
+int tree_snapshot_walk(TreeSnapshot *snapshot, const char *path, void (*visit)(const char *path, void *arg),
+                       void *arg);
+
+typedef struct TreeSnapshotStats {
+    size_t folders; // Folders in the snapshot.
+    size_t shared; // Folders whose children have not changed since the snapshot - read from the tree itself.
+    size_t copied; // Folders whose children have changed - read from the copy kept for the snapshot.
+    size_t copy_bytes; // Memory taken by the copies read by the snapshot.
+} TreeSnapshotStats;
+
+// Walk the whole snapshot and count its folders.
+void tree_snapshot_get_stats(TreeSnapshot *snapshot, TreeSnapshotStats *stats);
+
+// A write-ahead journal: once it is opened, every successful change of the tree (by any function above, including
+// opening and closing handles) is appended to the journal file as a compact binary record, and the function returns
+// only after its record is durable. Records are written in an order in which the changes could have happened one
+// after another, so replaying them rebuilds the tree.
+typedef enum TreeJournalMode {
+    TREE_JOURNAL_SYNC_EACH, // Every record is written out and synced on its own.
+    TREE_JOURNAL_GROUP_COMMIT, // One write and fdatasync covers the records of all operations waiting for it.
+} TreeJournalMode;
+
+// Open (or create) the journal file at `path` and append all later changes of the tree to it. Has to be called before
+// any other operation on the tree (except tree_load, tree_journal_replay and tree_recover) and at most once; the journal
+// is closed by tree_free.
+// Return 0 or an errno code (EINVAL if the file exists, but is not a journal).
+int tree_journal_open(Tree *tree, const char *path, TreeJournalMode mode);
+
+// Apply the changes recorded in the journal file at `path` to a tree without a journal - normally a new one, after
+// which the same file can be opened with tree_journal_open to continue it. A record torn by a crash at the end of
+// the file is ignored. Return 0, an errno code if the file cannot be read (EINVAL if it is not a journal or its start
+// was dropped by a checkpoint), or EIO if some record could not be replayed.
+int tree_journal_replay(Tree *tree, const char *path);
+
+// Write the whole tree, as it is in a snapshot taken at the start, to the file at `path` in a compact binary format -
+// names of siblings share their common prefixes. Operations on the tree continue meanwhile. The file is replaced only
+// once the new dump is complete and durable. With a journal, the dump also holds the position in the journal which
+// the snapshot corresponds to and the handles open at that moment, so it can be used by tree_recover. Return 0 or an
+// errno code.
+int tree_dump(Tree *tree, const char *path);
+
+// Build the tree written by tree_dump at `path` into an empty tree without a journal. The file is mapped into memory
+// and large subtrees are built by several threads in parallel. Return 0, an errno code if the file cannot be read
+// (EINVAL if it is not a valid dump) or ENOTEMPTY if the tree is not empty. The journal position and handles in the
+// dump are ignored.
+int tree_load(Tree *tree, const char *path);
+
+// Write a checkpoint of a tree with a journal: a dump (as tree_dump) to the file at `path`, after which the journal
+// records it covers are dropped from the journal file - recovery then only loads the checkpoint and replays the rest.
+// Operations on the tree continue meanwhile; they are held back only while the snapshot and the journal position are
+// taken together. Checkpoints are written one at a time. Return 0 or an errno code.
+int tree_checkpoint(Tree *tree, const char *path);
+
+// Start a background thread which writes a checkpoint to `path` (as tree_checkpoint) whenever the journal has grown
+// by `journal_bytes` since the last one. At most once per tree; the thread is stopped by tree_free.
+void tree_checkpoint_start(Tree *tree, const char *path, size_t journal_bytes);
+
+// Rebuild a tree after a crash: load the checkpoint at `checkpoint` into an empty tree without a journal and replay
+// the journal at `journal` from the checkpoint's position. Without a checkpoint file the whole journal is replayed,
+// and without either file the tree stays empty. Afterwards the journal can be opened with tree_journal_open to
+// continue it. Return 0, an errno code if a file cannot be read (EINVAL if it is not a valid checkpoint or journal,
+// or the journal lacks records the checkpoint needs - all of them without a checkpoint file), or EIO if some record
+// could not be replayed.
+int tree_recover(Tree *tree, const char *checkpoint, const char *journal);
+
+typedef struct TreeStats {
+    size_t retired_nodes_pending; // Removed folders not freed yet (counted over all trees).
+    size_t retired_pending; // All retired objects not freed yet, including hash map storage.
+    size_t listing_cache_hits; // tree_list calls answered from the remembered listing of a folder.
+    size_t listing_cache_misses; // tree_list calls which had to build the listing.
+    size_t dentry_cache_hits; // Lookups of a deep path which started below the root thanks to the path cache.
+    size_t dentry_cache_misses; // Lookups of a deep path which had to start from the root.
+    size_t dentry_cache_invalidations; // Path cache entries dropped because their folder was moved or removed.
+    size_t snapshot_copies; // Copies of folders' children kept for the snapshots of the tree.
+    size_t snapshot_copy_bytes; // Memory taken by these copies.
+    size_t journal_records; // Records appended to the journal since it was opened.
+    size_t journal_bytes; // Bytes taken by these records.
+    size_t journal_syncs; // Writes of the journal followed by fdatasync.
+    size_t checkpoints; // Checkpoints written by tree_checkpoint and the background thread.
+    size_t checkpoint_failures; // Checkpoints which failed (the journal then keeps its records).
+    size_t checkpoint_bytes; // Bytes written by the checkpoints, in total.
+    size_t checkpoint_nanoseconds; // Time the checkpoints took, in total.
+    size_t checkpoint_stall_nanoseconds; // Time during which checkpoints held back changes of the tree, in total.
+} TreeStats;
+
+void tree_get_stats(Tree *tree, TreeStats *stats);
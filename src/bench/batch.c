@@ -0,0 +1,111 @@
+// Porównuje tworzenie (a potem usuwanie) PATHS folderów-rodzeństwa w /dir/sub/ pojedynczymi wywołaniami tree_create
+// (tree_remove) z jednym wywołaniem tree_create_batch (tree_remove_batch) na tych samych ścieżkach, podzielonych na
+// wsady po batch ścieżek (liczby podane jako argumenty, domyślnie 100, 1000 i PATHS).
+// Wynik jest wypisywany jako CSV: op,mode,batch,paths,seconds,ops_per_sec.
+
+#define PATHS 100000
+#define MAX_BATCHES 16
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static char paths[PATHS][32];
+static const char *pointers[PATHS];
+static int errors[PATHS];
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void report(const char *op, const char *mode, int batch, double seconds) {
+	printf("%s,%s,%d,%d,%.3f,%.0f\n", op, mode, batch, PATHS, seconds, PATHS / seconds);
+}
+
+static void run_single() {
+	Tree *tree = tree_new();
+	tree_create(tree, "/dir/");
+	tree_create(tree, "/dir/sub/");
+
+	double start = now();
+	for (int i = 0; i < PATHS; ++i) {
+		int err = tree_create(tree, pointers[i]);
+		assert(err == 0);
+		(void) err;
+	}
+	report("create", "single", 1, now() - start);
+
+	start = now();
+	for (int i = 0; i < PATHS; ++i) {
+		int err = tree_remove(tree, pointers[i]);
+		assert(err == 0);
+		(void) err;
+	}
+	report("remove", "single", 1, now() - start);
+	tree_free(tree);
+}
+
+static void run_batch(int batch) {
+	Tree *tree = tree_new();
+	tree_create(tree, "/dir/");
+	tree_create(tree, "/dir/sub/");
+
+	double start = now();
+	for (int i = 0; i < PATHS; i += batch) {
+		tree_create_batch(tree, pointers + i, i + batch < PATHS ? batch : PATHS - i, errors + i);
+	}
+	report("create", "batch", batch, now() - start);
+	for (int i = 0; i < PATHS; ++i) {
+		assert(errors[i] == 0);
+	}
+
+	start = now();
+	for (int i = 0; i < PATHS; i += batch) {
+		tree_remove_batch(tree, pointers + i, i + batch < PATHS ? batch : PATHS - i, errors + i);
+	}
+	report("remove", "batch", batch, now() - start);
+	for (int i = 0; i < PATHS; ++i) {
+		assert(errors[i] == 0);
+	}
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int batches[MAX_BATCHES] = {100, 1000, PATHS};
+	int batch_count = 3;
+	if (argc > 1) {
+		batch_count = 0;
+		for (int i = 1; i < argc && batch_count < MAX_BATCHES; ++i) {
+			batches[batch_count] = atoi(argv[i]);
+			if (batches[batch_count] < 1 || batches[batch_count] > PATHS) {
+				fprintf(stderr, "usage: %s [batch size, 1..%d]...\n", argv[0], PATHS);
+				return 1;
+			}
+			batch_count++;
+		}
+	}
+
+	for (int i = 0; i < PATHS; ++i) {
+		char *s = paths[i] + sprintf(paths[i], "/dir/sub/");
+		int n = i;
+		do {
+			*s++ = 'a' + n % 26;
+			n /= 26;
+		} while (n > 0);
+		strcpy(s, "/");
+		pointers[i] = paths[i];
+	}
+
+	printf("op,mode,batch,paths,seconds,ops_per_sec\n");
+	run_single();
+	for (int i = 0; i < batch_count; ++i) {
+		run_batch(batches[i]);
+	}
+	return 0;
+}
@@ -0,0 +1,123 @@
+// Mierzy czas przeniesienia folderu, w którego poddrzewie cały czas trwają operacje: wątki robocze tworzą, usuwają
+// i listują foldery w /<korzeń>/d/d/d/<id>/, a jeden wątek MOVES razy przenosi /p/ na /s/ i z powrotem.
+// Liczba wątków roboczych rośnie od zera do wartości podanej jako argument (domyślnie MAX_THREADS).
+// Wynik jest wypisywany jako CSV: busy_threads,moves,p50_ns,p99_ns,max_ns.
+
+#define MAX_THREADS 16
+#define MOVES 2000
+#define MOVE_PAUSE_NS 20000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static atomic_bool moving_done;
+// Korzeń, pod którym poddrzewo jest w tej chwili ('p' albo 's'). Wątki robocze trafiają czasem pod stary korzeń -
+// wtedy operacja kończy się ENOENT, co nie przeszkadza w pomiarze.
+static atomic_char subtree_root;
+
+static void* run_busy(void *data) {
+	ThreadData *thread_data = data;
+	char path[] = "/?/d/d/d/?/x/";
+	path[9] = 'a' + thread_data->id;
+
+	for (int i = 0; !atomic_load(&moving_done); ++i) {
+		path[1] = atomic_load(&subtree_root);
+		switch (i % 3) {
+			case 0:
+				tree_create(thread_data->tree, path);
+				break;
+			case 1:
+				path[11] = '\0';
+				free(tree_list(thread_data->tree, path));
+				path[11] = '/';
+				break;
+			default:
+				tree_remove(thread_data->tree, path);
+		}
+	}
+	return NULL;
+}
+
+static long now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int compare_longs(const void *a, const void *b) {
+	long x = *(const long *) a, y = *(const long *) b;
+	return (x > y) - (x < y);
+}
+
+static void run_for_threads(int thread_count) {
+	Tree *tree = tree_new();
+	const char *folders[] = {"/p/", "/p/d/", "/p/d/d/", "/p/d/d/d/"};
+	for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); ++i) {
+		tree_create(tree, folders[i]);
+	}
+	char path[] = "/p/d/d/d/?/";
+	for (int id = 0; id < thread_count; ++id) {
+		path[9] = 'a' + id;
+		tree_create(tree, path);
+	}
+
+	atomic_store(&moving_done, false);
+	atomic_store(&subtree_root, 'p');
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_busy, &data[i]) == 0);
+	}
+
+	static long latencies[MOVES];
+	for (int i = 0; i < MOVES; ++i) {
+		bool forward = i % 2 == 0;
+		long start = now_ns();
+		int err = tree_move(tree, forward ? "/p/" : "/s/", forward ? "/s/" : "/p/");
+		latencies[i] = now_ns() - start;
+		assert(err == 0);
+		(void) err;
+		atomic_store(&subtree_root, forward ? 's' : 'p');
+		// Przerwa oddaje procesor wątkom roboczym, żeby kolejne przeniesienie trafiło na operacje w toku.
+		nanosleep(&(struct timespec) {.tv_nsec = MOVE_PAUSE_NS}, NULL);
+	}
+
+	atomic_store(&moving_done, true);
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	qsort(latencies, MOVES, sizeof(long), compare_longs);
+	printf("%d,%d,%ld,%ld,%ld\n", thread_count, MOVES, latencies[MOVES / 2], latencies[MOVES * 99 / 100],
+		   latencies[MOVES - 1]);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 0 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max busy threads, 0..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("busy_threads,moves,p50_ns,p99_ns,max_ns\n");
+	run_for_threads(0);
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run_for_threads(threads);
+	}
+	return 0;
+}
@@ -0,0 +1,148 @@
+// Mierzy, ile punkty kontrolne kosztują zmiany drzewa. Drzewo ma FOLDERS folderów (liczba podana jako pierwszy
+// argument), a wątki na przemian tworzą i usuwają folder we własnym folderze /w/<id>/ z dziennikiem z grupowym
+// zatwierdzaniem: bez punktów kontrolnych (none) i z wątkiem punktów kontrolnych, który robi je co THRESHOLD bajtów
+// dziennika (background). Oprócz przepustowości wypisuje najdłuższy czas pojedynczej operacji, liczbę punktów
+// kontrolnych, ich średni czas i rozmiar, łączny czas wstrzymania zmian drzewa przez nie i miejsce zajmowane na
+// dysku przez dziennik na końcu. Pliki są zapisywane z prefiksem podanym jako drugi argument (domyślnie FILE_PREFIX,
+// usuwane po każdym pomiarze).
+// Wynik jest wypisywany jako CSV: mode,threads,operations,ops_per_sec,max_latency_us,checkpoints,checkpoint_ms,
+// checkpoint_bytes,stall_us,journal_disk_bytes.
+
+#define FOLDERS 100000
+#define FANOUT 16
+#define MAX_THREADS 16
+#define OPERATIONS 20000
+#define THRESHOLD (1 << 18)
+#define FILE_PREFIX "/tmp/bench-checkpoint"
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	double max_latency;
+} ThreadData;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Ścieżka folderu o numerze i w kolejności BFS pod /f/ (folder 0 to /f/, dzieci folderu j to FANOUT * j + 1 ..
+// FANOUT * j + FANOUT).
+static void folder_path(long i, char *path) {
+	long indices[64];
+	int depth = 0;
+	for (; i > 0; i = (i - 1) / FANOUT) {
+		indices[depth++] = (i - 1) % FANOUT;
+	}
+	char *end = path + sprintf(path, "/f/");
+	while (depth > 0) {
+		end += sprintf(end, "%c/", 'a' + (char) indices[--depth]);
+	}
+}
+
+static void* run_thread(void *arg) {
+	ThreadData *data = arg;
+	char path[32];
+	sprintf(path, "/w/%c/x/", 'a' + data->id);
+	data->max_latency = 0;
+	for (int i = 0; i < OPERATIONS; ++i) {
+		double start = now();
+		int err = i % 2 == 0 ? tree_create(data->tree, path) : tree_remove(data->tree, path);
+		assert(err == 0);
+		(void) err;
+		double latency = now() - start;
+		if (latency > data->max_latency) {
+			data->max_latency = latency;
+		}
+	}
+	return NULL;
+}
+
+static void run(const char *prefix, long folders, bool background, int threads) {
+	char checkpoint[256], journal[256];
+	sprintf(checkpoint, "%s", prefix);
+	sprintf(journal, "%s-journal", prefix);
+	unlink(checkpoint);
+	unlink(journal);
+
+	Tree *tree = tree_new();
+	char path[1024];
+	for (long i = 0; i < folders; ++i) {
+		folder_path(i, path);
+		tree_create(tree, path);
+	}
+	if (tree_journal_open(tree, journal, TREE_JOURNAL_GROUP_COMMIT) != 0) {
+		fprintf(stderr, "cannot open journal %s\n", journal);
+		exit(1);
+	}
+	if (background) {
+		tree_checkpoint_start(tree, checkpoint, THRESHOLD);
+	}
+	tree_create(tree, "/w/");
+	ThreadData data[MAX_THREADS];
+	for (int i = 0; i < threads; ++i) {
+		data[i] = (ThreadData) {.tree = tree, .id = i};
+		sprintf(path, "/w/%c/", 'a' + i);
+		tree_create(tree, path);
+	}
+
+	pthread_t th[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_create(&th[i], NULL, run_thread, &data[i]) == 0);
+	}
+	double max_latency = 0;
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+		if (data[i].max_latency > max_latency) {
+			max_latency = data[i].max_latency;
+		}
+	}
+	double seconds = now() - start;
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	struct stat st;
+	assert(stat(journal, &st) == 0);
+
+	long operations = (long) threads * OPERATIONS;
+	size_t checkpoints = stats.checkpoints;
+	printf("%s,%d,%ld,%.0f,%.0f,%zu,%.2f,%zu,%.0f,%ld\n", background ? "background" : "none", threads, operations,
+		   operations / seconds, max_latency * 1e6, checkpoints,
+		   checkpoints ? stats.checkpoint_nanoseconds / 1e6 / checkpoints : 0.0,
+		   checkpoints ? stats.checkpoint_bytes / checkpoints : 0, stats.checkpoint_stall_nanoseconds / 1e3,
+		   (long) st.st_blocks * 512);
+	fflush(stdout);
+	tree_free(tree);
+	unlink(checkpoint);
+	unlink(journal);
+}
+
+int main(int argc, char **argv) {
+	long folders = argc > 1 ? atol(argv[1]) : FOLDERS;
+	const char *prefix = argc > 2 ? argv[2] : FILE_PREFIX;
+	if (folders < 1 || strlen(prefix) > 200) {
+		fprintf(stderr, "usage: %s [folders] [file prefix]\n", argv[0]);
+		return 1;
+	}
+
+	printf("mode,threads,operations,ops_per_sec,max_latency_us,checkpoints,checkpoint_ms,checkpoint_bytes,stall_us,"
+	       "journal_disk_bytes\n");
+	for (int threads = 1; threads <= MAX_THREADS; threads *= 4) {
+		run(prefix, folders, false, threads);
+		run(prefix, folders, true, threads);
+	}
+	return 0;
+}
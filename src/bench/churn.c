@@ -0,0 +1,128 @@
+// Mierzy przepustowość i liczbę alokacji na operację przy ciągłym tworzeniu i usuwaniu folderów: każdy wątek
+// w swoim folderze /<id>/ na przemian tworzy i usuwa CHURN_NAMES folderów.
+// Plik jest linkowany z -Wl,--wrap=malloc (oraz calloc i realloc), więc zliczane są wszystkie alokacje z bibliotek.
+// Wynik jest wypisywany jako CSV: threads,ops,seconds,ops_per_sec,allocs_per_op.
+
+#define MAX_THREADS 64
+#define ROUNDS_IN_THREAD 2000
+#define CHURN_NAMES 16
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static atomic_size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	atomic_fetch_add_explicit(&allocations, 1, memory_order_relaxed);
+	return __real_realloc(ptr, size);
+}
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+static char* write_own_path(char *s, int id) {
+	*s++ = '/';
+	s = write_name(s, id);
+	*s++ = '/';
+	*s = '\0';
+	return s;
+}
+
+static void* run_churn(void *data) {
+	ThreadData *thread_data = data;
+	char path[64];
+	char *end = write_own_path(path, thread_data->id);
+
+	for (int round = 0; round < ROUNDS_IN_THREAD; ++round) {
+		for (int remove = 0; remove < 2; ++remove) {
+			for (int i = 0; i < CHURN_NAMES; ++i) {
+				char *s = write_name(end, i);
+				*s++ = '/';
+				*s = '\0';
+				int err = remove ? tree_remove(thread_data->tree, path) : tree_create(thread_data->tree, path);
+				assert(err == 0);
+				(void) err;
+			}
+		}
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_for_threads(int thread_count) {
+	Tree *tree = tree_new();
+	char path[64];
+	for (int id = 0; id < thread_count; ++id) {
+		write_own_path(path, id);
+		tree_create(tree, path);
+	}
+
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	size_t allocations_before = atomic_load(&allocations);
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_churn, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+	size_t allocated = atomic_load(&allocations) - allocations_before;
+
+	long ops = (long) thread_count * ROUNDS_IN_THREAD * CHURN_NAMES * 2;
+	printf("%d,%ld,%.3f,%.0f,%.2f\n", thread_count, ops, seconds, ops / seconds, (double) allocated / ops);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("threads,ops,seconds,ops_per_sec,allocs_per_op\n");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run_for_threads(threads);
+	}
+	return 0;
+}
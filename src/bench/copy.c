@@ -0,0 +1,104 @@
+// Porównuje skopiowanie poddrzewa /template/ o rozgałęzieniu FANOUT i liczbie folderów rosnącej od 1000 do wartości
+// podanej jako argument (domyślnie MAX_FOLDERS) jednym tree_copy ze skopiowaniem go po stronie klienta - tree_list
+// każdego folderu i tree_create każdego dziecka. Ten sam kod jest budowany jako bench_copy (kopię budują wątki
+// pomocnicze) i bench_copy_serial (COPY_THREADS=1).
+// Wynik jest wypisywany jako CSV: folders,mode,seconds,folders_per_sec.
+
+#define FANOUT 10
+#define MAX_FOLDERS 100000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Foldery w kolejności BFS: dzieci folderu i to foldery FANOUT * i + 1 .. FANOUT * i + FANOUT.
+static void build(Tree *tree, int count) {
+	char (*path)[64] = malloc(count * sizeof(*path));
+	assert(path);
+	strcpy(path[0], "/template/");
+	int err = tree_create(tree, path[0]);
+	for (int i = 1; i < count; ++i) {
+		size_t length = strlen(path[(i - 1) / FANOUT]);
+		memcpy(path[i], path[(i - 1) / FANOUT], length);
+		path[i][length] = 'a' + (i - 1) % FANOUT;
+		strcpy(path[i] + length + 1, "/");
+		err |= tree_create(tree, path[i]);
+	}
+	assert(err == 0);
+	(void) err;
+	free(path);
+}
+
+// Kopiuje dzieci folderu source do target i ich poddrzewa, zwraca liczbę skopiowanych folderów.
+static int copy_by_client(Tree *tree, char *source, size_t source_length, char *target, size_t target_length) {
+	char *list = tree_list(tree, source);
+	assert(list);
+	int copied = 0;
+	for (char *name = list; *name;) {
+		char *end = strchr(name, ',');
+		size_t name_length = end ? (size_t) (end - name) : strlen(name);
+		memcpy(source + source_length, name, name_length);
+		strcpy(source + source_length + name_length, "/");
+		memcpy(target + target_length, name, name_length);
+		strcpy(target + target_length + name_length, "/");
+		int err = tree_create(tree, target);
+		assert(err == 0);
+		(void) err;
+		copied += 1 + copy_by_client(tree, source, source_length + name_length + 1, target,
+									 target_length + name_length + 1);
+		name += name_length + (end != NULL);
+	}
+	source[source_length] = '\0';
+	target[target_length] = '\0';
+	free(list);
+	return copied;
+}
+
+static void report(int count, const char *mode, double seconds) {
+	printf("%d,%s,%.3f,%.0f\n", count, mode, seconds, count / seconds);
+}
+
+static void run(int count) {
+	Tree *tree = tree_new();
+	build(tree, count);
+
+	double start = now();
+	int err = tree_copy(tree, "/template/", "/copy/");
+	report(count, "tree_copy", now() - start);
+	assert(err == 0);
+	(void) err;
+
+	char source[4096] = "/template/", target[4096] = "/client/";
+	start = now();
+	err = tree_create(tree, target);
+	int copied = 1 + copy_by_client(tree, source, strlen(source), target, strlen(target));
+	report(count, "client", now() - start);
+	assert(err == 0 && copied == count);
+	(void) copied;
+
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_folders = argc > 1 ? atoi(argv[1]) : MAX_FOLDERS;
+	if (max_folders < 1000) {
+		fprintf(stderr, "usage: %s [max folders, at least 1000]\n", argv[0]);
+		return 1;
+	}
+
+	printf("folders,mode,seconds,folders_per_sec\n");
+	for (int count = 1000; count <= max_folders; count *= 10) {
+		run(count);
+	}
+	return 0;
+}
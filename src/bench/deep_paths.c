@@ -0,0 +1,136 @@
+// Mierzy operacje na długich ścieżkach: każdy wątek w kółko tworzy CHURN_NAMES folderów w swoim folderze na
+// głębokości depth, listuje ten folder i je usuwa - zawsze podając pełne ścieżki od korzenia. Dodatkowo wypisuje, jaka
+// część wyszukiwań ścieżek zaczęła się od wpisu pamięci podręcznej ścieżek (dcache.h).
+// Wynik jest wypisywany jako CSV: depth,threads,ops,seconds,ops_per_sec,dentry_hit_rate.
+
+#define MAX_THREADS 64
+#define ROUNDS_IN_THREAD 4000
+#define CHURN_NAMES 16
+#define MAX_DEPTH 32
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	int depth;
+} ThreadData;
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+// Zapisuje ścieżkę folderu wątku: depth - 1 wspólnych składowych "deep", a na końcu id wątku.
+static char* write_own_path(char *s, int depth, int id) {
+	*s++ = '/';
+	for (int i = 1; i < depth; ++i) {
+		memcpy(s, "deep/", 5);
+		s += 5;
+	}
+	s = write_name(s, id);
+	*s++ = '/';
+	*s = '\0';
+	return s;
+}
+
+static void* run_churn(void *data) {
+	ThreadData *thread_data = data;
+	char folder[MAX_DEPTH * 8];
+	char path[MAX_DEPTH * 8];
+	char *end = write_own_path(folder, thread_data->depth, thread_data->id);
+	strcpy(path, folder);
+	end = path + (end - folder);
+
+	for (int round = 0; round < ROUNDS_IN_THREAD; ++round) {
+		for (int remove = 0; remove < 2; ++remove) {
+			for (int i = 0; i < CHURN_NAMES; ++i) {
+				char *s = write_name(end, i);
+				*s++ = '/';
+				*s = '\0';
+				int err = remove ? tree_remove(thread_data->tree, path) : tree_create(thread_data->tree, path);
+				assert(err == 0);
+				(void) err;
+			}
+			char *list = tree_list(thread_data->tree, folder);
+			assert(list);
+			free(list);
+		}
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(int depth, int thread_count) {
+	Tree *tree = tree_new();
+	char path[MAX_DEPTH * 8];
+	char *s = path;
+	*s++ = '/';
+	for (int i = 1; i < depth; ++i) {
+		memcpy(s, "deep/", 5);
+		s += 5;
+		*s = '\0';
+		tree_create(tree, path);
+	}
+	for (int id = 0; id < thread_count; ++id) {
+		write_own_path(path, depth, id);
+		tree_create(tree, path);
+	}
+
+	TreeStats before, after;
+	tree_get_stats(tree, &before);
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].depth = depth;
+		assert(pthread_create(&th[i], NULL, run_churn, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+	tree_get_stats(tree, &after);
+
+	size_t hits = after.dentry_cache_hits - before.dentry_cache_hits;
+	size_t lookups = hits + after.dentry_cache_misses - before.dentry_cache_misses;
+	long ops = (long) thread_count * ROUNDS_IN_THREAD * (CHURN_NAMES + 1) * 2;
+	printf("%d,%d,%ld,%.3f,%.0f,%.3f\n", depth, thread_count, ops, seconds, ops / seconds,
+		   lookups ? (double) hits / lookups : 0.0);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("depth,threads,ops,seconds,ops_per_sec,dentry_hit_rate\n");
+	const int depths[] = {1, 4, 16, 20, 32};
+	for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); ++d) {
+		for (int threads = 1; threads <= max_threads; threads *= 2) {
+			run(depths[d], threads);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,149 @@
+// Mierzy, ile daje uchwyt folderu przy wielu operacjach w głębokim folderze: każdy wątek w kółko tworzy i usuwa
+// CHURN_NAMES folderów w swoim folderze na głębokości depth, raz podając pełne ścieżki (tree_create, tree_remove),
+// a raz ścieżki względem uchwytu tego folderu (tree_create_at, tree_remove_at).
+// Wynik jest wypisywany jako CSV: depth,threads,mode,ops,seconds,ops_per_sec.
+
+#define MAX_THREADS 64
+#define ROUNDS_IN_THREAD 2000
+#define CHURN_NAMES 16
+#define MAX_DEPTH 32
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	int depth;
+	bool use_handle;
+} ThreadData;
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+// Zapisuje ścieżkę folderu wątku: depth - 1 wspólnych składowych "deep", a na końcu id wątku.
+static char* write_own_path(char *s, int depth, int id) {
+	*s++ = '/';
+	for (int i = 1; i < depth; ++i) {
+		memcpy(s, "deep/", 5);
+		s += 5;
+	}
+	s = write_name(s, id);
+	*s++ = '/';
+	*s = '\0';
+	return s;
+}
+
+static void* run_churn(void *data) {
+	ThreadData *thread_data = data;
+	char path[MAX_DEPTH * 8];
+	char *end = path;
+	TreeDir *dir = NULL;
+	if (thread_data->use_handle) {
+		write_own_path(path, thread_data->depth, thread_data->id);
+		dir = tree_open_dir(thread_data->tree, path);
+		assert(dir);
+		*end++ = '/';
+	}
+	else {
+		end = write_own_path(path, thread_data->depth, thread_data->id);
+	}
+
+	for (int round = 0; round < ROUNDS_IN_THREAD; ++round) {
+		for (int remove = 0; remove < 2; ++remove) {
+			for (int i = 0; i < CHURN_NAMES; ++i) {
+				char *s = write_name(end, i);
+				*s++ = '/';
+				*s = '\0';
+				int err;
+				if (dir) {
+					err = remove ? tree_remove_at(thread_data->tree, dir, path)
+								 : tree_create_at(thread_data->tree, dir, path);
+				}
+				else {
+					err = remove ? tree_remove(thread_data->tree, path) : tree_create(thread_data->tree, path);
+				}
+				assert(err == 0);
+				(void) err;
+			}
+		}
+	}
+
+	if (dir) {
+		tree_close_dir(thread_data->tree, dir);
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run(int depth, int thread_count, bool use_handle) {
+	Tree *tree = tree_new();
+	char path[MAX_DEPTH * 8];
+	char *s = path;
+	*s++ = '/';
+	for (int i = 1; i < depth; ++i) {
+		memcpy(s, "deep/", 5);
+		s += 5;
+		*s = '\0';
+		tree_create(tree, path);
+	}
+	for (int id = 0; id < thread_count; ++id) {
+		write_own_path(path, depth, id);
+		tree_create(tree, path);
+	}
+
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].depth = depth;
+		data[i].use_handle = use_handle;
+		assert(pthread_create(&th[i], NULL, run_churn, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	long ops = (long) thread_count * ROUNDS_IN_THREAD * CHURN_NAMES * 2;
+	printf("%d,%d,%s,%ld,%.3f,%.0f\n", depth, thread_count, use_handle ? "handle" : "path", ops, seconds,
+		   ops / seconds);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("depth,threads,mode,ops,seconds,ops_per_sec\n");
+	for (int depth = 1; depth <= MAX_DEPTH; depth *= 4) {
+		for (int threads = 1; threads <= max_threads; threads *= 2) {
+			run(depth, threads, false);
+			run(depth, threads, true);
+		}
+	}
+	return 0;
+}
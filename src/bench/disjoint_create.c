@@ -0,0 +1,108 @@
+// Mierzy przepustowość tree_create, gdy każdy wątek tworzy foldery we własnym, głębokim poddrzewie.
+// Operacje nie konkurują o żaden hash-mapę, więc jedynym wspólnym zasobem są wierzchołki na ścieżce od korzenia -
+// w idealnym przypadku przepustowość rośnie liniowo z liczbą wątków.
+// Wynik jest wypisywany jako CSV: threads,ops,seconds,ops_per_sec.
+
+#define MAX_THREADS 64
+#define CREATES_IN_THREAD 5000
+#define SUBTREE_DEPTH 4
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+// Ścieżka do poddrzewa wątku: /<id>/a/a/a/ (SUBTREE_DEPTH składowych).
+static char* write_subtree_path(char *s, int id, int depth) {
+	*s++ = '/';
+	s = write_name(s, id);
+	*s++ = '/';
+	for (int i = 1; i < depth; ++i) {
+		*s++ = 'a';
+		*s++ = '/';
+	}
+	*s = '\0';
+	return s;
+}
+
+static void* run_creates(void *data) {
+	ThreadData *thread_data = data;
+	char path[128];
+	char *end = write_subtree_path(path, thread_data->id, SUBTREE_DEPTH);
+
+	for (int i = 0; i < CREATES_IN_THREAD; ++i) {
+		char *s = write_name(end, i);
+		*s++ = '/';
+		*s = '\0';
+		int err = tree_create(thread_data->tree, path);
+		assert(err == 0);
+		(void) err;
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_for_threads(int thread_count) {
+	Tree *tree = tree_new();
+	char path[128];
+	for (int id = 0; id < thread_count; ++id) {
+		for (int depth = 1; depth <= SUBTREE_DEPTH; ++depth) {
+			write_subtree_path(path, id, depth);
+			tree_create(tree, path);
+		}
+	}
+
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_creates, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	long ops = (long) thread_count * CREATES_IN_THREAD;
+	printf("%d,%ld,%.3f,%.0f\n", thread_count, ops, seconds, ops / seconds);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("threads,ops,seconds,ops_per_sec\n");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run_for_threads(threads);
+	}
+	return 0;
+}
@@ -0,0 +1,115 @@
+// Microbenchmark of the HashMap.h interface. The same code is linked against both
+// implementations (bench_hashmap - HashMap.c, bench_hashmap_chained - HashMapChained.c).
+// For every size it measures inserting all keys, looking up present and missing keys,
+// iterating over the whole map and removing all keys.
+// Output is CSV: impl,keys,op,ops,ns_per_op.
+
+#ifndef HASHMAP_IMPL
+#define HASHMAP_IMPL "open_addressing"
+#endif
+
+// The chained table has a fixed number of buckets, so everything on it is linear in the size.
+#ifndef DEFAULT_MAX_KEYS
+#define DEFAULT_MAX_KEYS 1000000
+#endif
+
+#define MAX_LOOKUPS 1000000
+
+#include "../HashMap.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Keys look like folder names: lowercase letters, derived from n. `salt` gives a disjoint key set.
+static void make_key(char *s, long n, char salt) {
+	*s++ = salt;
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	*s = '\0';
+}
+
+static void report(long keys, const char *op, long ops, double seconds) {
+	printf("%s,%ld,%s,%ld,%.1f\n", HASHMAP_IMPL, keys, op, ops, seconds * 1e9 / ops);
+}
+
+static void run_for_size(long n) {
+	char (*keys)[16] = malloc(sizeof(*keys) * n);
+	for (long i = 0; i < n; ++i)
+		make_key(keys[i], i, 'k');
+	int dummy_value;
+	HashMap *map = hmap_new();
+
+	double start = now();
+	for (long i = 0; i < n; ++i) {
+		bool inserted = hmap_insert(map, keys[i], &dummy_value);
+		assert(inserted);
+		(void) inserted;
+	}
+	report(n, "insert", n, now() - start);
+
+	long lookups = n < MAX_LOOKUPS ? MAX_LOOKUPS : n;
+	unsigned int seed = 1;
+	start = now();
+	long found = 0;
+	for (long i = 0; i < lookups; ++i)
+		found += hmap_get(map, keys[rand_r(&seed) % n]) != NULL;
+	report(n, "get_hit", lookups, now() - start);
+	assert(found == lookups);
+
+	char missing[16];
+	start = now();
+	for (long i = 0; i < lookups; ++i) {
+		make_key(missing, rand_r(&seed) % n, 'm');
+		found += hmap_get(map, missing) != NULL;
+	}
+	report(n, "get_miss", lookups, now() - start);
+	assert(found == lookups);
+
+	long rounds = MAX_LOOKUPS / n + 1;
+	long visited = 0;
+	start = now();
+	for (long r = 0; r < rounds; ++r) {
+		const char *key;
+		void *value;
+		HashMapIterator it = hmap_iterator(map);
+		while (hmap_next(map, &it, &key, &value))
+			visited++;
+	}
+	report(n, "iterate", visited, now() - start);
+	assert(visited == rounds * n);
+
+	start = now();
+	for (long i = 0; i < n; ++i) {
+		bool removed = hmap_remove(map, keys[i]);
+		assert(removed);
+		(void) removed;
+	}
+	report(n, "remove", n, now() - start);
+	assert(hmap_size(map) == 0);
+
+	hmap_free(map);
+	free(keys);
+}
+
+int main(int argc, char **argv) {
+	long max_keys = argc > 1 ? atol(argv[1]) : DEFAULT_MAX_KEYS;
+
+	printf("impl,keys,op,ops,ns_per_op\n");
+	for (long n = 10; n <= max_keys; n *= (n < 1000 ? 100 : 10)) {
+		if (n == 10000)
+			continue; // 10, 1k, 100k, 1M
+		run_for_size(n);
+		fflush(stdout);
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+// Mierzy przepustowość zmian drzewa z dziennikiem: bez dziennika (none), z zapisem i fdatasync osobno dla każdej
+// operacji (sync_each) i z grupowym zatwierdzaniem (group_commit). Każdy wątek na przemian tworzy i usuwa folder we
+// własnym folderze /w/<id>/, więc wątki nie czekają na siebie w drzewie - tylko na dysk.
+// Liczba wątków rośnie od 1 do wartości podanej jako pierwszy argument (domyślnie MAX_THREADS), a dziennik jest
+// zapisywany do pliku podanego jako drugi argument (domyślnie JOURNAL_FILE, usuwany po każdym pomiarze).
+// Wynik jest wypisywany jako CSV: mode,threads,operations,seconds,ops_per_sec,ops_per_sync.
+
+#define MAX_THREADS 16
+#define OPERATIONS 1000
+#define JOURNAL_FILE "/tmp/bench-journal"
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum {
+	MODE_NONE,
+	MODE_SYNC_EACH,
+	MODE_GROUP_COMMIT,
+} Mode;
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void* run_thread(void *arg) {
+	ThreadData *data = arg;
+	char path[32];
+	sprintf(path, "/w/%c/x/", 'a' + data->id);
+	for (int i = 0; i < OPERATIONS; ++i) {
+		int err = i % 2 == 0 ? tree_create(data->tree, path) : tree_remove(data->tree, path);
+		assert(err == 0);
+		(void) err;
+	}
+	return NULL;
+}
+
+static void run(const char *file, Mode mode, int threads) {
+	unlink(file);
+	Tree *tree = tree_new();
+	if (mode != MODE_NONE) {
+		int err = tree_journal_open(tree, file, mode == MODE_SYNC_EACH ? TREE_JOURNAL_SYNC_EACH
+		                                                              : TREE_JOURNAL_GROUP_COMMIT);
+		if (err != 0) {
+			fprintf(stderr, "cannot open journal %s: error %d\n", file, err);
+			exit(1);
+		}
+	}
+	tree_create(tree, "/w/");
+	ThreadData data[MAX_THREADS];
+	for (int i = 0; i < threads; ++i) {
+		data[i] = (ThreadData) {.tree = tree, .id = i};
+		char path[32];
+		sprintf(path, "/w/%c/", 'a' + i);
+		tree_create(tree, path);
+	}
+
+	TreeStats before, after;
+	tree_get_stats(tree, &before);
+	pthread_t th[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_create(&th[i], NULL, run_thread, &data[i]) == 0);
+	}
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+	tree_get_stats(tree, &after);
+
+	const char *names[] = {"none", "sync_each", "group_commit"};
+	size_t syncs = after.journal_syncs - before.journal_syncs;
+	long operations = (long) threads * OPERATIONS;
+	printf("%s,%d,%ld,%.3f,%.0f,%.2f\n", names[mode], threads, operations, seconds, operations / seconds,
+		   syncs ? (double) operations / syncs : 0.0);
+	tree_free(tree);
+	unlink(file);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	const char *file = argc > 2 ? argv[2] : JOURNAL_FILE;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d] [journal file]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("mode,threads,operations,seconds,ops_per_sec,ops_per_sync\n");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		for (Mode mode = MODE_NONE; mode <= MODE_GROUP_COMMIT; ++mode) {
+			run(file, mode, threads);
+		}
+	}
+	return 0;
+}
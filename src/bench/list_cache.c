@@ -0,0 +1,75 @@
+// Mierzy koszt wielokrotnego listowania folderu z DIRECTORY_SIZE dziećmi, gdy co MODIFY_EVERY listowań jedno dziecko
+// jest tworzone albo usuwane (0 - folder się nie zmienia). Przy rzadkich zmianach prawie każde listowanie jest
+// kopią zapamiętanego wyniku, a przy zmianie co listowanie każde buduje wynik od nowa.
+// Wynik jest wypisywany jako CSV: modify_every,lists,seconds,us_per_list,hits,misses.
+
+#define DIRECTORY_SIZE 10000
+#define LISTS 2000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_for_modify_every(int modify_every) {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/a/") == 0);
+	char path[32] = "/a/";
+	for (int i = 0; i < DIRECTORY_SIZE; ++i) {
+		char *s = write_name(path + 3, i);
+		*s++ = '/';
+		*s = '\0';
+		assert(tree_create(tree, path) == 0);
+	}
+
+	TreeStats before;
+	tree_get_stats(tree, &before);
+	bool created = false;
+	double start = now();
+	for (int i = 0; i < LISTS; ++i) {
+		if (modify_every > 0 && i % modify_every == 0) {
+			int err = created ? tree_remove(tree, "/a/zzzz/") : tree_create(tree, "/a/zzzz/");
+			assert(err == 0);
+			(void) err;
+			created = !created;
+		}
+		char *list = tree_list(tree, "/a/");
+		assert(list);
+		free(list);
+	}
+	double seconds = now() - start;
+	TreeStats after;
+	tree_get_stats(tree, &after);
+
+	printf("%d,%d,%.3f,%.2f,%zu,%zu\n", modify_every, LISTS, seconds, seconds * 1e6 / LISTS,
+		   after.listing_cache_hits - before.listing_cache_hits,
+		   after.listing_cache_misses - before.listing_cache_misses);
+	tree_free(tree);
+}
+
+int main() {
+	printf("modify_every,lists,seconds,us_per_list,hits,misses\n");
+	int modify_every[] = {0, 100, 10, 1};
+	for (size_t i = 0; i < sizeof(modify_every) / sizeof(modify_every[0]); ++i) {
+		run_for_modify_every(modify_every[i]);
+	}
+	return 0;
+}
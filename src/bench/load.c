@@ -0,0 +1,90 @@
+// Mierzy czas startu z drzewem o liczbie folderów podanej jako pierwszy argument (domyślnie FOLDERS): zbudowanie go
+// przez tree_create każdego folderu (tak jak przy odtwarzaniu dziennika), zapisanie zrzutu (tree_dump) i wczytanie
+// go (tree_load). Drzewo ma rozgałęzienie FANOUT, a nazwy rodzeństwa mają wspólny prefiks (jak nazwy plików
+// w prawdziwych katalogach). Zrzut jest zapisywany do pliku podanego jako drugi argument (domyślnie DUMP_FILE,
+// usuwany na końcu).
+// Wynik jest wypisywany jako CSV: method,folders,seconds,folders_per_sec,bytes.
+
+#define FOLDERS 1000000
+#define FANOUT 16
+#define DUMP_FILE "/tmp/bench-load"
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Ścieżka folderu o numerze i w kolejności BFS (korzeń ma numer 0, dzieci folderu j to FANOUT * j + 1 ..
+// FANOUT * j + FANOUT).
+static void folder_path(long i, char *path) {
+	long indices[64];
+	int depth = 0;
+	for (; i > 0; i = (i - 1) / FANOUT) {
+		indices[depth++] = (i - 1) % FANOUT;
+	}
+	char *end = path;
+	*end++ = '/';
+	while (depth > 0) {
+		long index = indices[--depth];
+		end += sprintf(end, "folder%c%c/", 'a' + (char) (index / 26), 'a' + (char) (index % 26));
+	}
+	*end = '\0';
+}
+
+static void print(const char *method, long folders, double seconds, long bytes) {
+	printf("%s,%ld,%.3f,%.0f,%ld\n", method, folders, seconds, folders / seconds, bytes);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+	long folders = argc > 1 ? atol(argv[1]) : FOLDERS;
+	const char *file = argc > 2 ? argv[2] : DUMP_FILE;
+	if (folders < 1) {
+		fprintf(stderr, "usage: %s [folders] [dump file]\n", argv[0]);
+		return 1;
+	}
+
+	printf("method,folders,seconds,folders_per_sec,bytes\n");
+	Tree *tree = tree_new();
+	char path[1024];
+	double start = now();
+	for (long i = 1; i < folders; ++i) {
+		folder_path(i, path);
+		int err = tree_create(tree, path);
+		assert(err == 0);
+		(void) err;
+	}
+	print("create", folders, now() - start, 0);
+
+	start = now();
+	if (tree_dump(tree, file) != 0) {
+		fprintf(stderr, "cannot write dump %s\n", file);
+		return 1;
+	}
+	double seconds = now() - start;
+	struct stat st;
+	assert(stat(file, &st) == 0);
+	print("dump", folders, seconds, st.st_size);
+	tree_free(tree);
+
+	tree = tree_new();
+	start = now();
+	int err = tree_load(tree, file);
+	assert(err == 0);
+	(void) err;
+	print("load", folders, now() - start, st.st_size);
+	tree_free(tree);
+	unlink(file);
+	return 0;
+}
@@ -0,0 +1,123 @@
+// Mierzy operacje na nieistniejących ścieżkach w dużym folderze: /big/ ma children dzieci, a każdy wątek w kółko
+// listuje /big/<brak>/, tworzy /big/<brak>/x/ i usuwa /big/<brak>/ - wszystkie kończą się NULL albo ENOENT po
+// nieudanym wyszukaniu nazwy w hash-mapie /big/.
+// Wynik jest wypisywany jako CSV: children,threads,ops,seconds,ops_per_sec.
+
+#define MAX_THREADS 64
+#define OPS_IN_THREAD 300000
+#define MAX_CHILDREN 1000000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	int children;
+} ThreadData;
+
+// Zapisuje ścieżkę /big/<salt><n>/ z n zapisanym literami a-z, zwraca wskaźnik za ostatnim '/'.
+static char* write_path(char *s, char salt, int n) {
+	memcpy(s, "/big/", 5);
+	s += 5;
+	*s++ = salt;
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	*s++ = '/';
+	*s = '\0';
+	return s;
+}
+
+static void* run_misses(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[32];
+
+	for (int i = 0; i < OPS_IN_THREAD; ++i) {
+		char *end = write_path(path, 'm', rand_r(&seed) % thread_data->children);
+		switch (i % 3) {
+			case 0: {
+				char *list = tree_list(thread_data->tree, path);
+				assert(!list);
+				(void) list;
+				break;
+			}
+			case 1: {
+				memcpy(end, "x/", 3);
+				int err = tree_create(thread_data->tree, path);
+				assert(err == ENOENT);
+				(void) err;
+				break;
+			}
+			default: {
+				int err = tree_remove(thread_data->tree, path);
+				assert(err == ENOENT);
+				(void) err;
+			}
+		}
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Tree* big_tree(int children) {
+	Tree *tree = tree_new();
+	tree_create(tree, "/big/");
+	char path[32];
+	for (int i = 0; i < children; ++i) {
+		write_path(path, 'k', i);
+		tree_create(tree, path);
+	}
+	return tree;
+}
+
+static void run(Tree *tree, int children, int thread_count) {
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].children = children;
+		assert(pthread_create(&th[i], NULL, run_misses, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	long ops = (long) thread_count * OPS_IN_THREAD;
+	printf("%d,%d,%ld,%.3f,%.0f\n", children, thread_count, ops, seconds, ops / seconds);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("children,threads,ops,seconds,ops_per_sec\n");
+	for (int children = 10; children <= MAX_CHILDREN; children *= 100) {
+		Tree *tree = big_tree(children);
+		for (int threads = 1; threads <= max_threads; threads *= 2) {
+			run(tree, children, threads);
+		}
+		tree_free(tree);
+	}
+	return 0;
+}
@@ -0,0 +1,56 @@
+// Mierzy, ile pamięci sterty zajmuje jeden folder: tworzy w pustym drzewie FOLDERS folderów (dwa poziomy,
+// /<x>/<y>/) i porównuje zajętość sterty (mallinfo2) przed i po. Liczba folderów może być podana jako argument.
+// Wynik jest wypisywany jako CSV: folders,heap_bytes,bytes_per_folder.
+
+#define FOLDERS 1000000
+#define FANOUT 1000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+static size_t heap_in_use(void) {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+int main(int argc, char **argv) {
+	int folders = argc > 1 ? atoi(argv[1]) : FOLDERS;
+
+	size_t before = heap_in_use();
+	Tree *tree = tree_new();
+	char path[64];
+	for (int i = 0; i < folders; ++i) {
+		char *s = path;
+		*s++ = '/';
+		s = write_name(s, i / FANOUT);
+		*s++ = '/';
+		if (i % FANOUT != 0) {
+			s = write_name(s, i % FANOUT);
+			*s++ = '/';
+		}
+		*s = '\0';
+		int err = tree_create(tree, path);
+		assert(err == 0);
+		(void) err;
+	}
+	size_t bytes = heap_in_use() - before;
+
+	printf("folders,heap_bytes,bytes_per_folder\n");
+	printf("%d,%zu,%.1f\n", folders, bytes, (double) bytes / folders);
+
+	tree_free(tree);
+	return 0;
+}
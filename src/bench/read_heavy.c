@@ -0,0 +1,140 @@
+// Mierzy przepustowość mieszanki operacji zdominowanej przez tree_list: każdy wątek w READ_PERCENT% operacji
+// listuje losowy folder z drzewa o głębokości TREE_DEPTH, a w pozostałych tworzy albo usuwa folder we własnym liściu.
+// Wszystkie listowania przechodzą przez te same wierzchołki przy korzeniu, więc przy zwykłym protokole konkurują
+// o ich mutexy. Ten sam kod jest budowany jako bench_read_heavy (ścieżka optymistyczna) i bench_read_heavy_locking
+// (OPTIMISTIC_ATTEMPTS=0).
+// Wynik jest wypisywany jako CSV: threads,ops,seconds,ops_per_sec.
+
+#define MAX_THREADS 64
+#define OPS_IN_THREAD 200000
+#define READ_PERCENT 95
+#define TREE_DEPTH 3
+#define FANOUT 4
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Liczba folderów w pełnym drzewie o głębokości TREE_DEPTH (bez korzenia).
+#define DIRECTORIES (FANOUT + FANOUT * FANOUT + FANOUT * FANOUT * FANOUT)
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static char directories[DIRECTORIES][16];
+
+// Ścieżki wszystkich folderów: /a/, /a/a/, /a/a/a/, ... (składowe od 'a' do 'a' + FANOUT - 1).
+static void make_directories() {
+	int count = 0;
+	for (int first = 0; first < FANOUT; ++first) {
+		sprintf(directories[count++], "/%c/", 'a' + first);
+		for (int second = 0; second < FANOUT; ++second) {
+			sprintf(directories[count++], "/%c/%c/", 'a' + first, 'a' + second);
+			for (int third = 0; third < FANOUT; ++third) {
+				sprintf(directories[count++], "/%c/%c/%c/", 'a' + first, 'a' + second, 'a' + third);
+			}
+		}
+	}
+	assert(count == DIRECTORIES);
+}
+
+// Folder wątku, w którym wykonuje modyfikacje: liść drzewa wybrany według id.
+static const char* own_directory(int id) {
+	return directories[(id * (FANOUT + 1) + 2) % DIRECTORIES];
+}
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+static void* run_mix(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id + 1;
+	char path[64];
+	char *s = path + sprintf(path, "%sw", own_directory(thread_data->id));
+	s = write_name(s, thread_data->id);
+	*s++ = '/';
+	*s = '\0';
+	bool created = false;
+
+	for (int i = 0; i < OPS_IN_THREAD; ++i) {
+		if (rand_r(&seed) % 100 < READ_PERCENT) {
+			char *list = tree_list(thread_data->tree, directories[rand_r(&seed) % DIRECTORIES]);
+			assert(list);
+			free(list);
+		}
+		else if (created) {
+			int err = tree_remove(thread_data->tree, path);
+			assert(err == 0);
+			(void) err;
+			created = false;
+		}
+		else {
+			int err = tree_create(thread_data->tree, path);
+			assert(err == 0);
+			(void) err;
+			created = true;
+		}
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_for_threads(int thread_count) {
+	Tree *tree = tree_new();
+	for (int i = 0; i < DIRECTORIES; ++i) {
+		int err = tree_create(tree, directories[i]);
+		assert(err == 0);
+		(void) err;
+	}
+
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_mix, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	long ops = (long) thread_count * OPS_IN_THREAD;
+	printf("%d,%ld,%.3f,%.0f\n", thread_count, ops, seconds, ops / seconds);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	make_directories();
+	printf("threads,ops,seconds,ops_per_sec\n");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run_for_threads(threads);
+	}
+	return 0;
+}
@@ -0,0 +1,140 @@
+// Porównuje usuwanie poddrzewa /big/ o rozgałęzieniu FANOUT i liczbie folderów rosnącej od 1000 do wartości podanej
+// jako argument (domyślnie MAX_FOLDERS) jednym tree_remove_recursive z usuwaniem go od liści pojedynczymi tree_remove,
+// w czasie gdy WORKERS wątków tworzy, listuje i usuwa foldery we własnych folderach poza /big/. Dla wątków
+// pracujących obok podaje przepustowość i najdłuższą operację w czasie usuwania.
+// Wynik jest wypisywany jako CSV: folders,mode,remove_ms,worker_ops_per_sec,worker_max_us.
+
+#define FANOUT 10
+#define MAX_FOLDERS 1000000
+#define WORKERS 4
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	long ops;
+	double max_latency;
+} ThreadData;
+
+static char (*paths)[40];
+static atomic_bool measuring;
+static atomic_bool working;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Foldery w kolejności BFS: dzieci folderu i to foldery FANOUT * i + 1 .. FANOUT * i + FANOUT.
+static void build(Tree *tree, int count) {
+	strcpy(paths[0], "/big/");
+	int err = tree_create(tree, paths[0]);
+	for (int i = 1; i < count; ++i) {
+		size_t length = strlen(paths[(i - 1) / FANOUT]);
+		memcpy(paths[i], paths[(i - 1) / FANOUT], length);
+		paths[i][length] = 'a' + (i - 1) % FANOUT;
+		strcpy(paths[i] + length + 1, "/");
+		err |= tree_create(tree, paths[i]);
+	}
+	assert(err == 0);
+	(void) err;
+}
+
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	char dir[8], path[16];
+	sprintf(dir, "/w%c/", 'a' + thread_data->id);
+	sprintf(path, "%sx/", dir);
+	while (atomic_load(&working)) {
+		double start = now();
+		tree_create(thread_data->tree, path);
+		free(tree_list(thread_data->tree, dir));
+		tree_remove(thread_data->tree, path);
+		double latency = now() - start;
+		if (atomic_load(&measuring)) {
+			thread_data->ops += 3;
+			if (latency > thread_data->max_latency) {
+				thread_data->max_latency = latency;
+			}
+		}
+	}
+	return NULL;
+}
+
+static void run(int count, bool recursive) {
+	Tree *tree = tree_new();
+	build(tree, count);
+
+	atomic_store(&working, true);
+	pthread_t th[WORKERS];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		char dir[8];
+		sprintf(dir, "/w%c/", 'a' + i);
+		tree_create(tree, dir);
+		data[i] = (ThreadData) {.tree = tree, .id = i, .ops = 0, .max_latency = 0};
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+
+	atomic_store(&measuring, true);
+	double start = now();
+	if (recursive) {
+		int err = tree_remove_recursive(tree, "/big/");
+		assert(err == 0);
+		(void) err;
+	}
+	else {
+		// Dzieci są za ojcem, więc od końca usuwamy zawsze liść.
+		for (int i = count - 1; i >= 0; --i) {
+			int err = tree_remove(tree, paths[i]);
+			assert(err == 0);
+			(void) err;
+		}
+	}
+	double seconds = now() - start;
+	atomic_store(&measuring, false);
+
+	atomic_store(&working, false);
+	long ops = 0;
+	double max_latency = 0;
+	for (int i = 0; i < WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+		ops += data[i].ops;
+		if (data[i].max_latency > max_latency) {
+			max_latency = data[i].max_latency;
+		}
+	}
+
+	printf("%d,%s,%.3f,%.0f,%.0f\n", count, recursive ? "recursive" : "single", seconds * 1e3, ops / seconds,
+		   max_latency * 1e6);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_folders = argc > 1 ? atoi(argv[1]) : MAX_FOLDERS;
+	if (max_folders < 1000) {
+		fprintf(stderr, "usage: %s [max folders, at least 1000]\n", argv[0]);
+		return 1;
+	}
+	paths = malloc(max_folders * sizeof(*paths));
+	assert(paths);
+
+	printf("folders,mode,remove_ms,worker_ops_per_sec,worker_max_us\n");
+	for (int count = 1000; count <= max_folders; count *= 10) {
+		run(count, false);
+		run(count, true);
+	}
+	free(paths);
+	return 0;
+}
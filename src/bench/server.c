@@ -0,0 +1,208 @@
+// Mierzy przepustowość i opóźnienia operacji wykonywanych przez serwer drzewa (server.h) z punktu widzenia klientów
+// (client.h). Każdy wątek ma własne połączenie i trzyma w locie do depth żądań: 80% to listy losowych folderów z
+// FOLDERS folderów pod /d/, a reszta to na przemian tworzenie i usuwanie folderów we własnym folderze /w/<id>/.
+// Dla porównania te same operacje wykonują wątki bezpośrednio na drzewie (direct). Bez argumentów serwer z WORKERS
+// wątkami działa w tym samym procesie; podana jako argument ścieżka gniazda to już działający serwer (tree_server).
+// Wynik jest wypisywany jako CSV: mode,threads,depth,operations,seconds,ops_per_sec,p50_us,p99_us,max_us.
+
+#define FOLDERS 1000
+#define MAX_THREADS 16
+#define MAX_DEPTH 64
+#define OPERATIONS 20000
+#define WORKERS 4
+#define SOCKET_PREFIX "/tmp/bench-server"
+
+#include "../Tree.h"
+#include "../client.h"
+#include "../server.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree; // NULL dla klientów serwera
+	const char *socket;
+	int id;
+	int depth;
+	double *latencies; // OPERATIONS czasów operacji
+} ThreadData;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Operacja numer i wątku id: ścieżka i rodzaj.
+static TreeOperation operation(int id, int i, unsigned *seed, char *path) {
+	if (i % 5 != 4) {
+		int folder = rand_r(seed) % FOLDERS;
+		sprintf(path, "/d/%c%c/", 'a' + folder / 26 % 26, 'a' + folder % 26);
+		return TREE_OPERATION_LIST;
+	}
+	int k = i / 5;
+	sprintf(path, "/w/%c/%c%c/", 'a' + id, 'a' + k / 2 / 26 % 26, 'a' + k / 2 % 26);
+	return k % 2 == 0 ? TREE_OPERATION_CREATE : TREE_OPERATION_REMOVE;
+}
+
+static void *run_direct(void *arg) {
+	ThreadData *data = arg;
+	unsigned seed = data->id;
+	char path[32];
+	for (int i = 0; i < OPERATIONS; ++i) {
+		TreeOperation op = operation(data->id, i, &seed, path);
+		double start = now();
+		if (op == TREE_OPERATION_LIST) {
+			free(tree_list(data->tree, path));
+		}
+		else if (op == TREE_OPERATION_CREATE) {
+			tree_create(data->tree, path);
+		}
+		else {
+			tree_remove(data->tree, path);
+		}
+		data->latencies[i] = now() - start;
+	}
+	return NULL;
+}
+
+static void *run_client(void *arg) {
+	ThreadData *data = arg;
+	int err;
+	TreeClient *client = tree_client_connect(data->socket, &err);
+	if (!client) {
+		fprintf(stderr, "cannot connect to %s\n", data->socket);
+		exit(1);
+	}
+	// Id żądań są kolejnymi liczbami od 0, więc są też indeksami w sent.
+	double *sent = malloc(OPERATIONS * sizeof(double));
+	assert(sent);
+	unsigned seed = data->id;
+	char path[32];
+	int sent_count = 0;
+	for (int received = 0; received < OPERATIONS; ++received) {
+		for (; sent_count < OPERATIONS && sent_count - received < data->depth; ++sent_count) {
+			TreeOperation op = operation(data->id, sent_count, &seed, path);
+			sent[sent_count] = now();
+			uint64_t id = tree_client_send(client, op, path, NULL);
+			assert(id == (uint64_t) sent_count);
+			(void) id;
+		}
+		TreeClientResponse response;
+		if (tree_client_receive(client, &response) != 0) {
+			fprintf(stderr, "connection to %s failed\n", data->socket);
+			exit(1);
+		}
+		data->latencies[received] = now() - sent[response.id];
+		free(response.listing);
+	}
+	free(sent);
+	tree_client_close(client);
+	return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b) {
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+static void run(Tree *tree, const char *socket, int threads, int depth) {
+	ThreadData data[MAX_THREADS];
+	double *latencies = malloc((size_t) threads * OPERATIONS * sizeof(double));
+	assert(latencies);
+	for (int i = 0; i < threads; ++i) {
+		data[i] = (ThreadData) {.tree = socket ? NULL : tree, .socket = socket, .id = i, .depth = depth,
+		                        .latencies = latencies + (size_t) i * OPERATIONS};
+	}
+
+	pthread_t th[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_create(&th[i], NULL, socket ? run_client : run_direct, &data[i]) == 0);
+	}
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	size_t operations = (size_t) threads * OPERATIONS;
+	qsort(latencies, operations, sizeof(double), compare_doubles);
+	printf("%s,%d,%d,%zu,%.3f,%.0f,%.1f,%.1f,%.1f\n", socket ? "server" : "direct", threads, depth, operations,
+	       seconds, operations / seconds, latencies[operations / 2] * 1e6, latencies[operations * 99 / 100] * 1e6,
+	       latencies[operations - 1] * 1e6);
+	fflush(stdout);
+	free(latencies);
+}
+
+// Foldery /d/.. do list i /w/<id>/ wątków - przez serwer, jeśli działa poza procesem.
+static void populate(Tree *tree, TreeClient *client) {
+	char path[32];
+	for (int i = -2; i < FOLDERS + MAX_THREADS; ++i) {
+		if (i == -2) {
+			strcpy(path, "/d/");
+		}
+		else if (i == -1) {
+			strcpy(path, "/w/");
+		}
+		else if (i < FOLDERS) {
+			sprintf(path, "/d/%c%c/", 'a' + i / 26 % 26, 'a' + i % 26);
+		}
+		else {
+			sprintf(path, "/w/%c/", 'a' + i - FOLDERS);
+		}
+		if (client) {
+			tree_client_create(client, path);
+		}
+		else {
+			tree_create(tree, path);
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	const char *external = argc > 1 ? argv[1] : NULL;
+	char socket[64];
+	Tree *tree = NULL;
+	Server *server = NULL;
+	int err;
+	if (external) {
+		TreeClient *client = tree_client_connect(external, &err);
+		if (!client) {
+			fprintf(stderr, "usage: %s [socket of a running tree_server]\n", argv[0]);
+			return 1;
+		}
+		populate(NULL, client);
+		tree_client_close(client);
+	}
+	else {
+		sprintf(socket, "%s-%d", SOCKET_PREFIX, (int) getpid());
+		tree = tree_new();
+		populate(tree, NULL);
+		server = server_start(tree, socket, WORKERS, &err);
+		if (!server) {
+			fprintf(stderr, "cannot start server at %s\n", socket);
+			return 1;
+		}
+	}
+
+	printf("mode,threads,depth,operations,seconds,ops_per_sec,p50_us,p99_us,max_us\n");
+	for (int threads = 1; threads <= MAX_THREADS; threads *= 4) {
+		if (tree) {
+			run(tree, NULL, threads, 1);
+		}
+		for (int depth = 1; depth <= MAX_DEPTH; depth *= 8) {
+			run(NULL, external ? external : socket, threads, depth);
+		}
+	}
+
+	if (server) {
+		server_stop(server);
+		tree_free(tree);
+	}
+	return 0;
+}
@@ -0,0 +1,167 @@
+// Porównuje przepustowość drzewa we współdzielonej pamięci (SharedTree.h) używanego przez wiele procesów naraz
+// z przepustowością zwykłego drzewa używanego przez tyle samo wątków jednego procesu. Drzewo ma FOLDERS folderów
+// /d/<xx>/, każdy z CHILDREN dziećmi; operacje to listy losowych z nich, a podany procent operacji to na przemian
+// tworzenie i usuwanie folderu we własnym folderze /w/<id>/ procesu (wątku). Segment jest tworzony pod nazwą
+// SEGMENT_PREFIX-<pid> i usuwany na końcu.
+// Wynik jest wypisywany jako CSV: mode,workers,write_percent,operations,seconds,ops_per_sec.
+
+#define FOLDERS 676
+#define CHILDREN 8
+#define MAX_WORKERS 16
+#define OPERATIONS 200000
+#define SEGMENT_SIZE (64 << 20)
+#define SEGMENT_PREFIX "/bench-shared-tree"
+
+#include "../SharedTree.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree; // NULL dla procesów
+	const char *segment;
+	int id;
+	int write_percent;
+} WorkerData;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_operations(WorkerData *data, SharedTree *shared) {
+	unsigned seed = data->id + 1;
+	char path[32], own[32];
+	int writes = 0;
+	for (int i = 0; i < OPERATIONS; ++i) {
+		if ((int) (rand_r(&seed) % 100) < data->write_percent) {
+			sprintf(own, "/w/%c/x/", 'a' + data->id);
+			bool create = writes++ % 2 == 0;
+			if (shared) {
+				create ? shared_tree_create(shared, own) : shared_tree_remove(shared, own);
+			}
+			else {
+				create ? tree_create(data->tree, own) : tree_remove(data->tree, own);
+			}
+			continue;
+		}
+		int folder = rand_r(&seed) % FOLDERS;
+		sprintf(path, "/d/%c%c/", 'a' + folder / 26, 'a' + folder % 26);
+		char *list = shared ? shared_tree_list(shared, path) : tree_list(data->tree, path);
+		assert(list);
+		free(list);
+	}
+}
+
+static void *run_thread(void *arg) {
+	run_operations(arg, NULL);
+	return NULL;
+}
+
+static void populate(Tree *tree, SharedTree *shared) {
+	char path[32];
+	const char *top[] = {"/d/", "/w/"};
+	for (int i = 0; i < 2; ++i) {
+		shared ? shared_tree_create(shared, top[i]) : tree_create(tree, top[i]);
+	}
+	for (int i = 0; i < MAX_WORKERS; ++i) {
+		sprintf(path, "/w/%c/", 'a' + i);
+		shared ? shared_tree_create(shared, path) : tree_create(tree, path);
+	}
+	for (int i = 0; i < FOLDERS; ++i) {
+		for (int j = -1; j < CHILDREN; ++j) {
+			int length = sprintf(path, "/d/%c%c/", 'a' + i / 26, 'a' + i % 26);
+			if (j >= 0) {
+				sprintf(path + length, "%c/", 'a' + j);
+			}
+			shared ? shared_tree_create(shared, path) : tree_create(tree, path);
+		}
+	}
+}
+
+static void print_result(const char *mode, int workers, int write_percent, double seconds) {
+	long operations = (long) workers * OPERATIONS;
+	printf("%s,%d,%d,%ld,%.3f,%.0f\n", mode, workers, write_percent, operations, seconds, operations / seconds);
+	fflush(stdout);
+}
+
+static void run_threads(int workers, int write_percent) {
+	Tree *tree = tree_new();
+	populate(tree, NULL);
+	WorkerData data[MAX_WORKERS];
+	pthread_t th[MAX_WORKERS];
+	double start = now();
+	for (int i = 0; i < workers; ++i) {
+		data[i] = (WorkerData) {.tree = tree, .id = i, .write_percent = write_percent};
+		assert(pthread_create(&th[i], NULL, run_thread, &data[i]) == 0);
+	}
+	for (int i = 0; i < workers; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	print_result("tree", workers, write_percent, now() - start);
+	tree_free(tree);
+}
+
+static void run_processes(const char *segment, int workers, int write_percent) {
+	int err;
+	shared_tree_unlink(segment);
+	SharedTree *shared = shared_tree_new(segment, SEGMENT_SIZE, &err);
+	if (!shared) {
+		fprintf(stderr, "cannot create segment %s: %s\n", segment, strerror(err));
+		exit(1);
+	}
+	populate(NULL, shared);
+
+	// Procesy podłączają się do drzewa, a potem czekają, aż rodzic zamknie potok.
+	int start_pipe[2];
+	assert(pipe(start_pipe) == 0);
+	pid_t pids[MAX_WORKERS];
+	for (int i = 0; i < workers; ++i) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (pids[i] == 0) {
+			close(start_pipe[1]);
+			SharedTree *tree = shared_tree_open(segment, &err);
+			assert(tree);
+			char byte;
+			assert(read(start_pipe[0], &byte, 1) == 0);
+			WorkerData data = {.segment = segment, .id = i, .write_percent = write_percent};
+			run_operations(&data, tree);
+			shared_tree_close(tree);
+			_exit(0);
+		}
+	}
+	close(start_pipe[0]);
+	usleep(100000);
+	double start = now();
+	close(start_pipe[1]);
+	for (int i = 0; i < workers; ++i) {
+		int status;
+		assert(waitpid(pids[i], &status, 0) == pids[i] && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+	print_result("shared", workers, write_percent, now() - start);
+	shared_tree_close(shared);
+	shared_tree_unlink(segment);
+}
+
+int main() {
+	char segment[64];
+	sprintf(segment, "%s-%d", SEGMENT_PREFIX, (int) getpid());
+	printf("mode,workers,write_percent,operations,seconds,ops_per_sec\n");
+	for (int write_percent = 0; write_percent <= 10; write_percent += 10) {
+		for (int workers = 1; workers <= MAX_WORKERS; workers *= 4) {
+			run_threads(workers, write_percent);
+			run_processes(segment, workers, write_percent);
+		}
+	}
+	return 0;
+}
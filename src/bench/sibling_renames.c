@@ -0,0 +1,109 @@
+// Mierzy przepustowość zmian nazw w sąsiednich folderach: każdy wątek w swoim folderze /d/<id>/ w kółko zmienia nazwę
+// folderu (z zawartością) na kolejną z RENAME_NAMES nazw. Wszystkie foldery wątków mają wspólnego ojca /d/.
+// Wynik jest wypisywany jako CSV: threads,renames,seconds,renames_per_sec.
+
+#define MAX_THREADS 64
+#define RENAMES_IN_THREAD 100000
+#define RENAME_NAMES 4
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-z, zwraca wskaźnik za zapisaną nazwą.
+static char* write_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	return s;
+}
+
+// Zapisuje ścieżkę /d/<id>/<name>/ (lub /d/<id>/ dla name < 0).
+static void write_path(char *s, int id, int name) {
+	*s++ = '/';
+	*s++ = 'd';
+	*s++ = '/';
+	s = write_name(s, id);
+	*s++ = '/';
+	if (name >= 0) {
+		s = write_name(s, name);
+		*s++ = '/';
+	}
+	*s = '\0';
+}
+
+static void* run_renames(void *data) {
+	ThreadData *thread_data = data;
+	char source[64], target[64];
+
+	for (int i = 0; i < RENAMES_IN_THREAD; ++i) {
+		write_path(source, thread_data->id, i % RENAME_NAMES);
+		write_path(target, thread_data->id, (i + 1) % RENAME_NAMES);
+		int err = tree_move(thread_data->tree, source, target);
+		assert(err == 0);
+		(void) err;
+	}
+	return NULL;
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void run_for_threads(int thread_count) {
+	Tree *tree = tree_new();
+	char path[64];
+	tree_create(tree, "/d/");
+	for (int id = 0; id < thread_count; ++id) {
+		write_path(path, id, -1);
+		tree_create(tree, path);
+		write_path(path, id, 0);
+		tree_create(tree, path);
+		strcat(path, "x/");
+		tree_create(tree, path);
+	}
+
+	pthread_t th[MAX_THREADS];
+	ThreadData data[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < thread_count; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_renames, &data[i]) == 0);
+	}
+	for (int i = 0; i < thread_count; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	long renames = (long) thread_count * RENAMES_IN_THREAD;
+	printf("%d,%ld,%.3f,%.0f\n", thread_count, renames, seconds, renames / seconds);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("threads,renames,seconds,renames_per_sec\n");
+	for (int threads = 1; threads <= max_threads; threads *= 2) {
+		run_for_threads(threads);
+	}
+	return 0;
+}
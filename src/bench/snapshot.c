@@ -0,0 +1,169 @@
+// Mierzy koszt migawek w drzewie o rozgałęzieniu FANOUT i liczbie folderów rosnącej od 1000 do wartości podanej jako
+// argument (domyślnie MAX_FOLDERS), bez wątków piszących i z WRITERS wątkami, które w losowych folderach tworzą
+// i usuwają dziecko: średni czas tree_snapshot (z tree_snapshot_free), przejście po całej migawce (tree_snapshot_walk)
+// w porównaniu z przejściem po drzewie rekurencyjnym tree_list oraz pamięć kopii po CHANGES zmianach od migawki.
+// Wynik jest wypisywany jako CSV:
+// folders,writers,snapshot_us,walk_folders_per_sec,list_folders_per_sec,copied,shared,copy_bytes.
+
+#define FANOUT 10
+#define MAX_FOLDERS 100000
+#define WRITERS 4
+#define SNAPSHOTS 20
+#define CHANGES 10000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static char (*paths)[32];
+static int folders;
+static atomic_bool writing_done;
+static atomic_long changes;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Foldery w kolejności BFS: dzieci folderu i to foldery FANOUT * i + 1 .. FANOUT * i + FANOUT.
+static void build(Tree *tree, int count) {
+	strcpy(paths[0], "/");
+	for (int i = 1; i < count; ++i) {
+		size_t length = strlen(paths[(i - 1) / FANOUT]);
+		memcpy(paths[i], paths[(i - 1) / FANOUT], length);
+		paths[i][length] = 'a' + (i - 1) % FANOUT;
+		strcpy(paths[i] + length + 1, "/");
+		int err = tree_create(tree, paths[i]);
+		assert(err == 0);
+		(void) err;
+	}
+	folders = count;
+}
+
+static void* run_writer(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[48];
+	while (!atomic_load(&writing_done)) {
+		sprintf(path, "%sw%c/", paths[rand_r(&seed) % folders], 'a' + thread_data->id);
+		tree_create(thread_data->tree, path);
+		tree_remove(thread_data->tree, path);
+		atomic_fetch_add(&changes, 2);
+	}
+	return NULL;
+}
+
+static void count_visit(const char *path, void *arg) {
+	(void) path;
+	++*(long *) arg;
+}
+
+// Przejście po drzewie jak tree_snapshot_walk, ale kolejnymi tree_list.
+static long list_walk(Tree *tree, char *path, size_t length) {
+	char *list = tree_list(tree, path);
+	if (!list) {
+		return 0;
+	}
+	long visited = 1;
+	for (char *name = list; *name;) {
+		char *end = strchr(name, ',');
+		size_t name_length = end ? (size_t) (end - name) : strlen(name);
+		memcpy(path + length, name, name_length);
+		path[length + name_length] = '/';
+		path[length + name_length + 1] = '\0';
+		visited += list_walk(tree, path, length + name_length + 1);
+		name += name_length + (end != NULL);
+	}
+	path[length] = '\0';
+	free(list);
+	return visited;
+}
+
+static void run(int count, int writers) {
+	Tree *tree = tree_new();
+	build(tree, count);
+
+	atomic_store(&writing_done, false);
+	pthread_t th[WRITERS];
+	ThreadData data[WRITERS];
+	for (int i = 0; i < writers; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_writer, &data[i]) == 0);
+	}
+
+	double start = now();
+	for (int i = 0; i < SNAPSHOTS; ++i) {
+		tree_snapshot_free(tree_snapshot(tree));
+	}
+	double snapshot_us = (now() - start) / SNAPSHOTS * 1e6;
+
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+	long visited = 0;
+	start = now();
+	int err = tree_snapshot_walk(snapshot, "/", count_visit, &visited);
+	double walk_seconds = now() - start;
+	assert(err == 0);
+	(void) err;
+
+	char path[4096] = "/";
+	start = now();
+	long listed = list_walk(tree, path, 1);
+	double list_seconds = now() - start;
+
+	// Bez wątków piszących zmiany robi główny wątek.
+	long target = atomic_load(&changes) + CHANGES;
+	for (unsigned seed = 0; writers == 0 && atomic_load(&changes) < target;) {
+		char change[48];
+		sprintf(change, "%sw/", paths[rand_r(&seed) % folders]);
+		tree_create(tree, change);
+		tree_remove(tree, change);
+		atomic_fetch_add(&changes, 2);
+	}
+	while (atomic_load(&changes) < target) {
+		nanosleep(&(struct timespec) {.tv_nsec = 1000000}, NULL);
+	}
+	TreeSnapshotStats stats;
+	tree_snapshot_get_stats(snapshot, &stats);
+	tree_snapshot_free(snapshot);
+
+	atomic_store(&writing_done, true);
+	for (int i = 0; i < writers; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	printf("%d,%d,%.1f,%.0f,%.0f,%zu,%zu,%zu\n", count, writers, snapshot_us, visited / walk_seconds,
+		   listed / list_seconds, stats.copied, stats.shared, stats.copy_bytes);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_folders = argc > 1 ? atoi(argv[1]) : MAX_FOLDERS;
+	if (max_folders < 1000) {
+		fprintf(stderr, "usage: %s [max folders, at least 1000]\n", argv[0]);
+		return 1;
+	}
+	paths = malloc(max_folders * sizeof(*paths));
+	assert(paths);
+
+	printf("folders,writers,snapshot_us,walk_folders_per_sec,list_folders_per_sec,copied,shared,copy_bytes\n");
+	for (int count = 1000; count <= max_folders; count *= 10) {
+		run(count, 0);
+		run(count, WRITERS);
+	}
+	free(paths);
+	return 0;
+}
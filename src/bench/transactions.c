@@ -0,0 +1,169 @@
+// Mierzy przepustowość operacji złożonych z kilku zmian drzewa, wykonywanych atomowo: zamiany dwóch folderów (trzy
+// przeniesienia przez folder tymczasowy) i utworzenia (a potem usunięcia) małego drzewa folderów. Porównuje
+// transakcje (tree_transaction_commit) ze zwykłymi operacjami pod jednym globalnym muteksem - tak, jak klienci
+// zapewniali atomowość dotąd. Każdy wątek działa na swoich folderach: w swoim folderze /w/<id>/ (disjoint) albo we
+// wspólnym /s/ (shared - wszystkie transakcje zmieniają dzieci tego samego folderu).
+// Liczba wątków rośnie od 1 do wartości podanej jako argument (domyślnie MAX_THREADS).
+// Wynik jest wypisywany jako CSV: op,shape,mode,threads,transactions,seconds,tx_per_sec.
+
+#define MAX_THREADS 16
+#define TRANSACTIONS 20000
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	bool swap;
+	bool shared;
+	bool transaction;
+} ThreadData;
+
+static pthread_mutex_t global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Ścieżka folderu name wątku id (name kończy się '/').
+static void write_path(char *s, const ThreadData *data, const char *name) {
+	if (data->shared) {
+		sprintf(s, "/s/%c%s", 'a' + data->id, name);
+	}
+	else {
+		sprintf(s, "/w/%c/%s", 'a' + data->id, name);
+	}
+}
+
+static void check(int err) {
+	assert(err == 0);
+	(void) err;
+}
+
+static void run_swap(const ThreadData *data, const char *x, const char *y, const char *temp) {
+	if (data->transaction) {
+		TreeTransaction *transaction = tree_transaction_new();
+		tree_transaction_move(transaction, x, temp);
+		tree_transaction_move(transaction, y, x);
+		tree_transaction_move(transaction, temp, y);
+		check(tree_transaction_commit(data->tree, transaction, NULL));
+		tree_transaction_free(transaction);
+	}
+	else {
+		pthread_mutex_lock(&global_lock);
+		check(tree_move(data->tree, x, temp));
+		check(tree_move(data->tree, y, x));
+		check(tree_move(data->tree, temp, y));
+		pthread_mutex_unlock(&global_lock);
+	}
+}
+
+// Tworzy (create) albo usuwa drzewo o ścieżkach paths[0..count) (od korzenia drzewa).
+static void run_subtree(const ThreadData *data, char paths[][32], int count, bool create) {
+	if (data->transaction) {
+		TreeTransaction *transaction = tree_transaction_new();
+		for (int i = 0; i < count; ++i) {
+			if (create) {
+				tree_transaction_create(transaction, paths[i]);
+			}
+			else {
+				tree_transaction_remove(transaction, paths[count - 1 - i]);
+			}
+		}
+		check(tree_transaction_commit(data->tree, transaction, NULL));
+		tree_transaction_free(transaction);
+	}
+	else {
+		pthread_mutex_lock(&global_lock);
+		for (int i = 0; i < count; ++i) {
+			check(create ? tree_create(data->tree, paths[i]) : tree_remove(data->tree, paths[count - 1 - i]));
+		}
+		pthread_mutex_unlock(&global_lock);
+	}
+}
+
+static void* run_thread(void *arg) {
+	ThreadData *data = arg;
+	char x[32], y[32], temp[32];
+	write_path(x, data, "x/");
+	write_path(y, data, "y/");
+	write_path(temp, data, "t/");
+	char subtree[4][32];
+	const char *names[] = {"r/", "r/a/", "r/b/", "r/a/c/"};
+	for (int i = 0; i < 4; ++i) {
+		write_path(subtree[i], data, names[i]);
+	}
+
+	for (int i = 0; i < TRANSACTIONS; ++i) {
+		if (data->swap) {
+			run_swap(data, x, y, temp);
+		}
+		else {
+			run_subtree(data, subtree, 4, i % 2 == 0);
+		}
+	}
+	return NULL;
+}
+
+static void run(bool swap, bool shared, bool transaction, int threads) {
+	Tree *tree = tree_new();
+	tree_create(tree, "/w/");
+	tree_create(tree, "/s/");
+	ThreadData data[MAX_THREADS];
+	for (int i = 0; i < threads; ++i) {
+		data[i] = (ThreadData) {.tree = tree, .id = i, .swap = swap, .shared = shared, .transaction = transaction};
+		char path[32];
+		if (!shared) {
+			sprintf(path, "/w/%c/", 'a' + i);
+			tree_create(tree, path);
+		}
+		write_path(path, &data[i], "x/");
+		tree_create(tree, path);
+		write_path(path, &data[i], "y/");
+		tree_create(tree, path);
+	}
+
+	pthread_t th[MAX_THREADS];
+	double start = now();
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_create(&th[i], NULL, run_thread, &data[i]) == 0);
+	}
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = now() - start;
+
+	printf("%s,%s,%s,%d,%d,%.3f,%.0f\n", swap ? "swap" : "subtree", shared ? "shared" : "disjoint",
+		   transaction ? "transaction" : "global_lock", threads, threads * TRANSACTIONS, seconds,
+		   threads * TRANSACTIONS / seconds);
+	tree_free(tree);
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : MAX_THREADS;
+	if (max_threads < 1 || max_threads > MAX_THREADS) {
+		fprintf(stderr, "usage: %s [max threads, 1..%d]\n", argv[0], MAX_THREADS);
+		return 1;
+	}
+
+	printf("op,shape,mode,threads,transactions,seconds,tx_per_sec\n");
+	for (int swap = 1; swap >= 0; --swap) {
+		for (int shared = 0; shared <= 1; ++shared) {
+			for (int threads = 1; threads <= max_threads; threads *= 2) {
+				run(swap, shared, false, threads);
+				run(swap, shared, true, threads);
+			}
+		}
+	}
+	return 0;
+}
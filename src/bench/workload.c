@@ -0,0 +1,573 @@
+// Mierzy przepustowość i opóźnienia Tree dla konfigurowalnych mieszanek operacji. Dla każdej kombinacji kształtu
+// drzewa, rozkładu popularności folderów, mieszanki i liczby wątków buduje drzewo, a następnie każdy wątek wykonuje
+// --ops operacji na folderach wybieranych według rozkładu:
+//  - list: tree_list folderu,
+//  - create / remove: tworzy / usuwa w folderze jeden z POOL_NAMES folderów wątku,
+//  - move: przenosi folder wątku z jednego folderu do drugiego (obu wybranych według rozkładu).
+// Operacje kończące się błędem (np. tworzenie istniejącego folderu) też są liczone - przy losowych operacjach są
+// częścią realistycznego obciążenia. Folderów drzewa (kształtu) nic nie usuwa ani nie przenosi.
+//
+// Kształty: balanced (BALANCED_FANOUT^1 + ... + BALANCED_FANOUT^BALANCED_DEPTH folderów), chain (CHAINS łańcuchów
+// o głębokości CHAIN_DEPTH), wide (WIDE_FANOUT folderów w korzeniu).
+// Rozkłady: uniform, zipf (wykładnik ZIPF_THETA), hotspot (HOT_PERCENT% operacji trafia w HOT_FRACTION_PERCENT%
+// folderów). Ranking popularności jest losową permutacją folderów, więc najpopularniejsze leżą w różnych miejscach.
+//
+// Użycie: bench_workload [--threads=1,2,4] [--shapes=balanced,chain,wide] [--distributions=uniform,zipf,hotspot]
+//                        [--mixes=list/create/remove/move,...] [--ops=n]
+// Wynik jest wypisywany jako CSV: shape,distribution,mix,threads,op,count,ops_per_sec,p50_ns,p99_ns,p999_ns
+// (jeden wiersz na typ operacji i wiersz "all" dla wszystkich operacji razem).
+
+#define MAX_THREADS 64
+#define MAX_CONFIGS 16
+#define DEFAULT_OPS_IN_THREAD 50000
+
+#define BALANCED_FANOUT 8
+#define BALANCED_DEPTH 4
+#define CHAINS 4
+#define CHAIN_DEPTH 64
+#define WIDE_FANOUT 4096
+
+#define ZIPF_THETA 0.99
+#define HOT_PERCENT 90
+#define HOT_FRACTION_PERCENT 10
+
+#define POOL_NAMES 16
+
+#include "../Tree.h"
+
+#include <assert.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef enum {
+	SHAPE_BALANCED,
+	SHAPE_CHAIN,
+	SHAPE_WIDE,
+	SHAPES
+} Shape;
+
+static const char *shape_names[SHAPES] = {"balanced", "chain", "wide"};
+
+typedef enum {
+	DISTRIBUTION_UNIFORM,
+	DISTRIBUTION_ZIPF,
+	DISTRIBUTION_HOTSPOT,
+	DISTRIBUTIONS
+} Distribution;
+
+static const char *distribution_names[DISTRIBUTIONS] = {"uniform", "zipf", "hotspot"};
+
+typedef enum {
+	OP_LIST,
+	OP_CREATE,
+	OP_REMOVE,
+	OP_MOVE,
+	OP_TYPES
+} OpType;
+
+static const char *op_names[OP_TYPES] = {"list", "create", "remove", "move"};
+
+// Udziały procentowe typów operacji (sumują się do 100).
+typedef struct {
+	int percent[OP_TYPES];
+} Mix;
+
+typedef struct {
+	int threads[MAX_CONFIGS];
+	int thread_configs;
+	Shape shapes[SHAPES];
+	int shape_configs;
+	Distribution distributions[DISTRIBUTIONS];
+	int distribution_configs;
+	Mix mixes[MAX_CONFIGS];
+	int mix_configs;
+	int ops_in_thread;
+} Config;
+
+// Foldery aktualnego kształtu, w kolejności tworzenia (rodzic przed dziećmi).
+static char **directories;
+static int directory_count;
+
+// Folder o randze popularności i to directories[popularity[i]].
+static int *popularity;
+
+// Dystrybuanta rozkładu Zipfa po rangach (tylko dla DISTRIBUTION_ZIPF).
+static double *zipf_cdf;
+
+typedef struct {
+	Tree *tree;
+	int id;
+	int ops;
+	Distribution distribution;
+	Mix mix;
+	uint64_t *latencies[OP_TYPES]; // w nanosekundach
+	size_t counts[OP_TYPES];
+} Worker;
+
+static uint64_t next_random(uint64_t *state) {
+	// xorshift64*
+	uint64_t x = *state;
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	*state = x;
+	return x * UINT64_C(2685821657736338717);
+}
+
+static double next_uniform(uint64_t *state) {
+	return (next_random(state) >> 11) * (1.0 / (UINT64_C(1) << 53));
+}
+
+static uint64_t now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Zapisuje liczbę n jako nazwę folderu z liter a-y, zwraca wskaźnik za zapisaną nazwą. Litera z jest zarezerwowana
+// dla folderów tworzonych przez wątki, więc nie pomylą się one z folderami kształtu.
+static char* write_shape_name(char *s, int n) {
+	do {
+		*s++ = 'a' + n % 25;
+		n /= 25;
+	} while (n > 0);
+	return s;
+}
+
+static void add_directory(const char *path) {
+	directories[directory_count] = strdup(path);
+	assert(directories[directory_count]);
+	directory_count++;
+}
+
+static void add_balanced(char *path, char *end, int depth) {
+	if (depth == BALANCED_DEPTH) {
+		return;
+	}
+	for (int i = 0; i < BALANCED_FANOUT; ++i) {
+		char *s = write_shape_name(end, i);
+		*s++ = '/';
+		*s = '\0';
+		add_directory(path);
+		add_balanced(path, s, depth + 1);
+	}
+}
+
+static void make_directories(Shape shape) {
+	static char path[CHAIN_DEPTH * 2 + 2];
+	path[0] = '/';
+	directory_count = 0;
+
+	switch (shape) {
+		case SHAPE_BALANCED: {
+			int count = 0;
+			for (int level = 1, width = BALANCED_FANOUT; level <= BALANCED_DEPTH; ++level, width *= BALANCED_FANOUT) {
+				count += width;
+			}
+			directories = malloc(sizeof(char *) * count);
+			add_balanced(path, path + 1, 0);
+			assert(directory_count == count);
+			break;
+		}
+		case SHAPE_CHAIN:
+			directories = malloc(sizeof(char *) * CHAINS * CHAIN_DEPTH);
+			for (int chain = 0; chain < CHAINS; ++chain) {
+				char *s = path + 1;
+				for (int depth = 0; depth < CHAIN_DEPTH; ++depth) {
+					*s++ = depth == 0 ? 'a' + chain : 'a';
+					*s++ = '/';
+					*s = '\0';
+					add_directory(path);
+				}
+			}
+			break;
+		case SHAPE_WIDE:
+			directories = malloc(sizeof(char *) * WIDE_FANOUT);
+			for (int i = 0; i < WIDE_FANOUT; ++i) {
+				char *s = write_shape_name(path + 1, i);
+				*s++ = '/';
+				*s = '\0';
+				add_directory(path);
+			}
+			break;
+		default:
+			assert(0);
+	}
+}
+
+static void free_directories() {
+	for (int i = 0; i < directory_count; ++i) {
+		free(directories[i]);
+	}
+	free(directories);
+}
+
+static void make_popularity(Distribution distribution) {
+	uint64_t state = 42;
+	popularity = malloc(sizeof(int) * directory_count);
+	for (int i = 0; i < directory_count; ++i) {
+		popularity[i] = i;
+	}
+	for (int i = directory_count - 1; i > 0; --i) {
+		int j = next_random(&state) % (i + 1);
+		int tmp = popularity[i];
+		popularity[i] = popularity[j];
+		popularity[j] = tmp;
+	}
+
+	zipf_cdf = NULL;
+	if (distribution == DISTRIBUTION_ZIPF) {
+		zipf_cdf = malloc(sizeof(double) * directory_count);
+		double sum = 0;
+		for (int i = 0; i < directory_count; ++i) {
+			sum += 1.0 / pow(i + 1, ZIPF_THETA);
+			zipf_cdf[i] = sum;
+		}
+		for (int i = 0; i < directory_count; ++i) {
+			zipf_cdf[i] /= sum;
+		}
+	}
+}
+
+static const char* pick_directory(Distribution distribution, uint64_t *state) {
+	int rank;
+	switch (distribution) {
+		case DISTRIBUTION_ZIPF: {
+			double u = next_uniform(state);
+			int low = 0, high = directory_count - 1;
+			while (low < high) {
+				int middle = (low + high) / 2;
+				if (zipf_cdf[middle] < u) {
+					low = middle + 1;
+				}
+				else {
+					high = middle;
+				}
+			}
+			rank = low;
+			break;
+		}
+		case DISTRIBUTION_HOTSPOT: {
+			int hot = directory_count * HOT_FRACTION_PERCENT / 100;
+			if (hot < 1) {
+				hot = 1;
+			}
+			if (next_random(state) % 100 < HOT_PERCENT || hot == directory_count) {
+				rank = next_random(state) % hot;
+			}
+			else {
+				rank = hot + next_random(state) % (directory_count - hot);
+			}
+			break;
+		}
+		default:
+			rank = next_random(state) % directory_count;
+	}
+	return directories[popularity[rank]];
+}
+
+// Ścieżka folderu wątku o numerze name w folderze directory: <directory>z<nazwa>/.
+static void write_pool_path(char *path, const char *directory, int id, int name) {
+	size_t length = strlen(directory);
+	memcpy(path, directory, length);
+	char *s = path + length;
+	*s++ = 'z';
+	int n = id * POOL_NAMES + name;
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	*s++ = '/';
+	*s = '\0';
+}
+
+static OpType pick_op(const Mix *mix, uint64_t *state) {
+	int roll = next_random(state) % 100;
+	for (int op = 0; op < OP_TYPES; ++op) {
+		if (roll < mix->percent[op]) {
+			return op;
+		}
+		roll -= mix->percent[op];
+	}
+	return OP_LIST;
+}
+
+static void* run_worker(void *data) {
+	Worker *worker = data;
+	uint64_t state = 0x9E3779B97F4A7C15 * (worker->id + 1);
+	char source[CHAIN_DEPTH * 2 + 16];
+	char target[CHAIN_DEPTH * 2 + 16];
+
+	for (int i = 0; i < worker->ops; ++i) {
+		OpType op = pick_op(&worker->mix, &state);
+		const char *directory = pick_directory(worker->distribution, &state);
+		int name = next_random(&state) % POOL_NAMES;
+
+		uint64_t start;
+		switch (op) {
+			case OP_LIST: {
+				start = now_ns();
+				free(tree_list(worker->tree, directory));
+				break;
+			}
+			case OP_CREATE:
+				write_pool_path(source, directory, worker->id, name);
+				start = now_ns();
+				tree_create(worker->tree, source);
+				break;
+			case OP_REMOVE:
+				write_pool_path(source, directory, worker->id, name);
+				start = now_ns();
+				tree_remove(worker->tree, source);
+				break;
+			case OP_MOVE:
+				write_pool_path(source, directory, worker->id, name);
+				write_pool_path(target, pick_directory(worker->distribution, &state), worker->id, name);
+				start = now_ns();
+				tree_move(worker->tree, source, target);
+				break;
+			default:
+				assert(0);
+				start = 0;
+		}
+		worker->latencies[op][worker->counts[op]++] = now_ns() - start;
+	}
+	return NULL;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+	uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+	return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, size_t count, double fraction) {
+	size_t index = (size_t) (fraction * count);
+	return sorted[index < count ? index : count - 1];
+}
+
+static void print_row(const char *prefix, const char *op, uint64_t *latencies, size_t count, double seconds) {
+	qsort(latencies, count, sizeof(uint64_t), compare_latencies);
+	printf("%s,%s,%zu,%.0f,", prefix, op, count, count / seconds);
+	if (count == 0) {
+		printf(",,\n");
+		return;
+	}
+	printf("%llu,%llu,%llu\n", (unsigned long long) percentile(latencies, count, 0.5),
+		   (unsigned long long) percentile(latencies, count, 0.99),
+		   (unsigned long long) percentile(latencies, count, 0.999));
+}
+
+static void run_config(Shape shape, Distribution distribution, const Mix *mix, int threads, int ops_in_thread) {
+	Tree *tree = tree_new();
+	for (int i = 0; i < directory_count; ++i) {
+		int err = tree_create(tree, directories[i]);
+		assert(err == 0);
+		(void) err;
+	}
+
+	pthread_t th[MAX_THREADS];
+	Worker workers[MAX_THREADS];
+	for (int i = 0; i < threads; ++i) {
+		workers[i].tree = tree;
+		workers[i].id = i;
+		workers[i].ops = ops_in_thread;
+		workers[i].distribution = distribution;
+		workers[i].mix = *mix;
+		for (int op = 0; op < OP_TYPES; ++op) {
+			workers[i].latencies[op] = malloc(sizeof(uint64_t) * ops_in_thread);
+			assert(workers[i].latencies[op]);
+			workers[i].counts[op] = 0;
+		}
+	}
+
+	uint64_t start = now_ns();
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_create(&th[i], NULL, run_worker, &workers[i]) == 0);
+	}
+	for (int i = 0; i < threads; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	double seconds = (now_ns() - start) * 1e-9;
+
+	char prefix[128];
+	snprintf(prefix, sizeof(prefix), "%s,%s,%d/%d/%d/%d,%d", shape_names[shape], distribution_names[distribution],
+			 mix->percent[OP_LIST], mix->percent[OP_CREATE], mix->percent[OP_REMOVE], mix->percent[OP_MOVE], threads);
+
+	size_t total = (size_t) threads * ops_in_thread;
+	uint64_t *all = malloc(sizeof(uint64_t) * total);
+	assert(all);
+	size_t all_count = 0;
+	for (int op = 0; op < OP_TYPES; ++op) {
+		size_t count = 0;
+		for (int i = 0; i < threads; ++i) {
+			count += workers[i].counts[op];
+		}
+		uint64_t *latencies = malloc(sizeof(uint64_t) * (count ? count : 1));
+		assert(latencies);
+		size_t position = 0;
+		for (int i = 0; i < threads; ++i) {
+			memcpy(latencies + position, workers[i].latencies[op], sizeof(uint64_t) * workers[i].counts[op]);
+			position += workers[i].counts[op];
+		}
+		memcpy(all + all_count, latencies, sizeof(uint64_t) * count);
+		all_count += count;
+		if (mix->percent[op] > 0) {
+			print_row(prefix, op_names[op], latencies, count, seconds);
+		}
+		free(latencies);
+	}
+	assert(all_count == total);
+	print_row(prefix, "all", all, all_count, seconds);
+	fflush(stdout);
+
+	free(all);
+	for (int i = 0; i < threads; ++i) {
+		for (int op = 0; op < OP_TYPES; ++op) {
+			free(workers[i].latencies[op]);
+		}
+	}
+	tree_free(tree);
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "usage: %s [--threads=1,2,4] [--shapes=balanced,chain,wide] "
+					"[--distributions=uniform,zipf,hotspot] [--mixes=list/create/remove/move,...] [--ops=n]\n",
+			program);
+	exit(1);
+}
+
+static int find_name(const char *name, const char **names, int count) {
+	for (int i = 0; i < count; ++i) {
+		if (strcmp(name, names[i]) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+static void parse_args(int argc, char **argv, Config *config) {
+	config->thread_configs = 0;
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		config->threads[config->thread_configs++] = threads;
+	}
+	config->shape_configs = SHAPES;
+	for (int i = 0; i < SHAPES; ++i) {
+		config->shapes[i] = i;
+	}
+	config->distribution_configs = DISTRIBUTIONS;
+	for (int i = 0; i < DISTRIBUTIONS; ++i) {
+		config->distributions[i] = i;
+	}
+	config->mix_configs = 2;
+	config->mixes[0] = (Mix) {{90, 4, 4, 2}};
+	config->mixes[1] = (Mix) {{40, 25, 25, 10}};
+	config->ops_in_thread = DEFAULT_OPS_IN_THREAD;
+
+	for (int i = 1; i < argc; ++i) {
+		char *value = strchr(argv[i], '=');
+		if (!value) {
+			usage(argv[0]);
+		}
+		*value++ = '\0';
+		const char *option = argv[i];
+
+		if (strcmp(option, "--ops") == 0) {
+			config->ops_in_thread = atoi(value);
+			if (config->ops_in_thread < 1) {
+				usage(argv[0]);
+			}
+			continue;
+		}
+
+		int count = 0;
+		for (char *item = strtok(value, ","); item; item = strtok(NULL, ",")) {
+			if (strcmp(option, "--threads") == 0) {
+				int threads = atoi(item);
+				if (threads < 1 || threads > MAX_THREADS || count == MAX_CONFIGS) {
+					usage(argv[0]);
+				}
+				config->threads[count++] = threads;
+			}
+			else if (strcmp(option, "--shapes") == 0) {
+				int shape = find_name(item, shape_names, SHAPES);
+				if (shape < 0 || count == SHAPES) {
+					usage(argv[0]);
+				}
+				config->shapes[count++] = shape;
+			}
+			else if (strcmp(option, "--distributions") == 0) {
+				int distribution = find_name(item, distribution_names, DISTRIBUTIONS);
+				if (distribution < 0 || count == DISTRIBUTIONS) {
+					usage(argv[0]);
+				}
+				config->distributions[count++] = distribution;
+			}
+			else if (strcmp(option, "--mixes") == 0) {
+				Mix mix;
+				if (count == MAX_CONFIGS || sscanf(item, "%d/%d/%d/%d", &mix.percent[OP_LIST], &mix.percent[OP_CREATE],
+												   &mix.percent[OP_REMOVE], &mix.percent[OP_MOVE]) != OP_TYPES) {
+					usage(argv[0]);
+				}
+				int sum = 0;
+				for (int op = 0; op < OP_TYPES; ++op) {
+					if (mix.percent[op] < 0) {
+						usage(argv[0]);
+					}
+					sum += mix.percent[op];
+				}
+				if (sum != 100) {
+					usage(argv[0]);
+				}
+				config->mixes[count++] = mix;
+			}
+			else {
+				usage(argv[0]);
+			}
+		}
+		if (count == 0) {
+			usage(argv[0]);
+		}
+
+		if (strcmp(option, "--threads") == 0) {
+			config->thread_configs = count;
+		}
+		else if (strcmp(option, "--shapes") == 0) {
+			config->shape_configs = count;
+		}
+		else if (strcmp(option, "--distributions") == 0) {
+			config->distribution_configs = count;
+		}
+		else {
+			config->mix_configs = count;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	Config config;
+	parse_args(argc, argv, &config);
+
+	printf("shape,distribution,mix,threads,op,count,ops_per_sec,p50_ns,p99_ns,p999_ns\n");
+	for (int s = 0; s < config.shape_configs; ++s) {
+		Shape shape = config.shapes[s];
+		make_directories(shape);
+		for (int d = 0; d < config.distribution_configs; ++d) {
+			Distribution distribution = config.distributions[d];
+			make_popularity(distribution);
+			for (int m = 0; m < config.mix_configs; ++m) {
+				for (int t = 0; t < config.thread_configs; ++t) {
+					run_config(shape, distribution, &config.mixes[m], config.threads[t], config.ops_in_thread);
+				}
+			}
+			free(popularity);
+			free(zipf_cdf);
+		}
+		free_directories();
+	}
+	return 0;
+}
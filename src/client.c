@@ -0,0 +1,244 @@
+#include "client.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "err.h"
+
+#define READ_SIZE 65536
+
+struct TreeClient {
+    int fd; // non-blocking, so sending never stops it from reading
+    uint64_t next_id;
+    char *output; // requests not sent yet
+    size_t output_length, output_capacity;
+    char *input; // received bytes not made into responses yet
+    size_t input_start, input_length, input_capacity;
+};
+
+static void reserve(char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return;
+    }
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    char *resized = realloc(*buffer, new_capacity);
+    if (!resized) {
+        fatal("client allocation failed");
+    }
+    *buffer = resized;
+    *capacity = new_capacity;
+}
+
+TreeClient *tree_client_connect(const char *path, int *err) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        *err = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(address.sun_path, path);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        *err = errno;
+        return NULL;
+    }
+    if (connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0
+        || fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) != 0) {
+        *err = errno;
+        close(fd);
+        return NULL;
+    }
+
+    TreeClient *client = calloc(1, sizeof(TreeClient));
+    if (!client) {
+        fatal("client allocation failed");
+    }
+    client->fd = fd;
+    *err = 0;
+    return client;
+}
+
+void tree_client_close(TreeClient *client) {
+    close(client->fd);
+    free(client->output);
+    free(client->input);
+    free(client);
+}
+
+uint64_t tree_client_send(TreeClient *client, TreeOperation operation, const char *path, const char *target) {
+    size_t path_length = strnlen(path, MAX_REQUEST);
+    size_t target_length = operation == TREE_OPERATION_MOVE ? strnlen(target, MAX_REQUEST) : 0;
+    if (REQUEST_HEADER + path_length + target_length + 2 > MAX_REQUEST) {
+        path_length = target_length = 0;
+    }
+    uint32_t length = REQUEST_HEADER + path_length + 1 + (operation == TREE_OPERATION_MOVE ? target_length + 1 : 0);
+
+    reserve(&client->output, &client->output_capacity, client->output_length + FRAME_HEADER + length);
+    char *frame = client->output + client->output_length;
+    uint64_t id = client->next_id++;
+    memcpy(frame, &length, FRAME_HEADER);
+    memcpy(frame + FRAME_HEADER, &id, sizeof(id));
+    frame[FRAME_HEADER + sizeof(id)] = (char) operation;
+    char *paths = frame + FRAME_HEADER + REQUEST_HEADER;
+    memcpy(paths, path, path_length);
+    paths[path_length] = '\0';
+    if (operation == TREE_OPERATION_MOVE) {
+        memcpy(paths + path_length + 1, target, target_length);
+        paths[path_length + 1 + target_length] = '\0';
+    }
+    client->output_length += FRAME_HEADER + length;
+    return id;
+}
+
+// Read whatever the server has sent. Return 0 or an errno code.
+static int receive_some(TreeClient *client) {
+    if (client->input_start > 0) {
+        memmove(client->input, client->input + client->input_start, client->input_length - client->input_start);
+        client->input_length -= client->input_start;
+        client->input_start = 0;
+    }
+    while (true) {
+        reserve(&client->input, &client->input_capacity, client->input_length + READ_SIZE);
+        ssize_t length = recv(client->fd, client->input + client->input_length, READ_SIZE, 0);
+        if (length > 0) {
+            client->input_length += length;
+            return 0;
+        }
+        if (length == 0) {
+            return ECONNRESET;
+        }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return 0;
+        }
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+}
+
+// Wait until the socket can be read or, if `writing`, written.
+static int wait_for(TreeClient *client, bool writing, short *revents) {
+    struct pollfd pollfd = {.fd = client->fd, .events = POLLIN | (writing ? POLLOUT : 0)};
+    while (poll(&pollfd, 1, -1) < 0) {
+        if (errno != EINTR) {
+            return errno;
+        }
+    }
+    *revents = pollfd.revents;
+    return 0;
+}
+
+int tree_client_flush(TreeClient *client) {
+    size_t sent = 0;
+    int err = 0;
+    while (sent < client->output_length && err == 0) {
+        ssize_t written = send(client->fd, client->output + sent, client->output_length - sent, MSG_NOSIGNAL);
+        if (written >= 0) {
+            sent += written;
+            continue;
+        }
+        if (errno == EINTR) {
+            continue;
+        }
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            err = errno;
+            break;
+        }
+        // The server may be waiting for us to take responses before it reads more requests.
+        short revents;
+        if ((err = wait_for(client, true, &revents)) == 0 && (revents & (POLLIN | POLLHUP | POLLERR))) {
+            err = receive_some(client);
+        }
+    }
+    memmove(client->output, client->output + sent, client->output_length - sent);
+    client->output_length -= sent;
+    return err;
+}
+
+int tree_client_receive(TreeClient *client, TreeClientResponse *response) {
+    int err;
+    if ((err = tree_client_flush(client)) != 0) {
+        return err;
+    }
+    while (true) {
+        size_t available = client->input_length - client->input_start;
+        const char *frame = client->input + client->input_start;
+        uint32_t length;
+        if (available >= FRAME_HEADER) {
+            memcpy(&length, frame, FRAME_HEADER);
+            if (length < RESPONSE_HEADER) {
+                return EPROTO;
+            }
+        }
+        if (available >= FRAME_HEADER && available - FRAME_HEADER >= length) {
+            const char *body = frame + FRAME_HEADER;
+            int32_t result;
+            memcpy(&response->id, body, sizeof(response->id));
+            memcpy(&result, body + sizeof(response->id), sizeof(result));
+            response->result = result;
+            response->operation = (uint8_t) body[sizeof(response->id) + sizeof(result)];
+            response->listing = NULL;
+            if (response->operation == TREE_OPERATION_LIST && result == 0) {
+                size_t listing_length = length - RESPONSE_HEADER;
+                response->listing = malloc(listing_length + 1);
+                if (!response->listing) {
+                    fatal("client allocation failed");
+                }
+                memcpy(response->listing, body + RESPONSE_HEADER, listing_length);
+                response->listing[listing_length] = '\0';
+            }
+            client->input_start += FRAME_HEADER + length;
+            return 0;
+        }
+
+        short revents;
+        if ((err = wait_for(client, false, &revents)) != 0 || (err = receive_some(client)) != 0) {
+            return err;
+        }
+    }
+}
+
+static int call(TreeClient *client, TreeOperation operation, const char *path, const char *target,
+                char **listing) {
+    uint64_t id = tree_client_send(client, operation, path, target);
+    TreeClientResponse response;
+    int err;
+    if ((err = tree_client_receive(client, &response)) != 0) {
+        return err;
+    }
+    if (response.id != id) {
+        free(response.listing);
+        return EPROTO;
+    }
+    if (listing) {
+        *listing = response.listing;
+    }
+    return response.result;
+}
+
+char *tree_client_list(TreeClient *client, const char *path) {
+    char *listing = NULL;
+    call(client, TREE_OPERATION_LIST, path, NULL, &listing);
+    return listing;
+}
+
+int tree_client_create(TreeClient *client, const char *path) {
+    return call(client, TREE_OPERATION_CREATE, path, NULL, NULL);
+}
+
+int tree_client_remove(TreeClient *client, const char *path) {
+    return call(client, TREE_OPERATION_REMOVE, path, NULL, NULL);
+}
+
+int tree_client_move(TreeClient *client, const char *source, const char *target) {
+    return call(client, TREE_OPERATION_MOVE, source, target, NULL);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "protocol.h"
+
+// A client of the tree server (server.h). Requests can be pipelined: tree_client_send only
+// buffers a request, tree_client_flush sends the buffered ones and tree_client_receive waits for
+// the next response, in whatever order the server finishes them. The synchronous functions
+// below do all three for one request. A client is used by one thread at a time.
+typedef struct TreeClient TreeClient;
+
+typedef struct TreeClientResponse {
+    uint64_t id;
+    TreeOperation operation;
+    int result; // what the Tree.h function returned, ENOENT for a failed list
+    char *listing; // for a successful list, to be freed by the caller; NULL otherwise
+} TreeClientResponse;
+
+// Connect to the server at the socket `path`. Return NULL and store an errno code in *err on
+// failure.
+TreeClient *tree_client_connect(const char *path, int *err);
+
+// Close the connection; responses not received yet are lost.
+void tree_client_close(TreeClient *client);
+
+// Buffer a request and return its id (ids are consecutive, starting from 0). `target` is used
+// only by TREE_OPERATION_MOVE. A path too long to be valid is sent as "", so it fails on the
+// server like any other invalid path.
+uint64_t tree_client_send(TreeClient *client, TreeOperation operation, const char *path, const char *target);
+
+// Send all buffered requests. Responses coming meanwhile are buffered, so the server never
+// waits for this client to read them. Return 0 or an errno code.
+int tree_client_flush(TreeClient *client);
+
+// Send the buffered requests and wait for a response. Return 0 or an errno code (EPROTO for a
+// malformed response, ECONNRESET if the server closed the connection).
+int tree_client_receive(TreeClient *client, TreeClientResponse *response);
+
+// The Tree.h functions, run by the server. They may be used only when no sent requests wait for
+// responses. If the connection fails, they return NULL or its errno code.
+char *tree_client_list(TreeClient *client, const char *path);
+int tree_client_create(TreeClient *client, const char *path);
+int tree_client_remove(TreeClient *client, const char *path);
+int tree_client_move(TreeClient *client, const char *source, const char *target);
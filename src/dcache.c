@@ -0,0 +1,120 @@
+#include "dcache.h"
+
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "err.h"
+
+#define DCACHE_BITS 12
+#define DCACHE_SLOTS (1 << DCACHE_BITS)
+
+struct DentryCache {
+    _Atomic(DentryEntry *) *slots;
+};
+
+DentryCache *dcache_new(void) {
+    DentryCache *cache = malloc(sizeof(DentryCache));
+    if (!cache) {
+        fatal("dentry cache allocation failed");
+    }
+    cache->slots = calloc(DCACHE_SLOTS, sizeof(*cache->slots));
+    if (!cache->slots) {
+        fatal("dentry cache allocation failed");
+    }
+    return cache;
+}
+
+void dcache_free(DentryCache *cache) {
+    for (size_t i = 0; i < DCACHE_SLOTS; i++) {
+        free(atomic_load(&cache->slots[i]));
+    }
+    free(cache->slots);
+    free(cache);
+}
+
+// Hash of the prefix one component longer than the one hashed by `hash`. Component hashes come
+// from the path descriptor, so no name is hashed twice.
+static inline uint64_t extend_hash(uint64_t hash, const Path *path, size_t i) {
+    hash ^= path->hashes[i] | (uint64_t) path->lengths[i] << 32;
+    hash *= 0x9E3779B97F4A7C15ull;
+    return hash ^ hash >> 29;
+}
+
+static inline size_t prefix_length(const Path *path, size_t depth) {
+    return path->offsets[depth - 1] + path->lengths[depth - 1] + 1;
+}
+
+static inline _Atomic(DentryEntry *) *slot_of(DentryCache *cache, uint64_t hash) {
+    return &cache->slots[hash >> (64 - DCACHE_BITS)];
+}
+
+static bool entry_matches(const DentryEntry *entry, const Path *path, size_t depth, uint64_t hash) {
+    return entry->hash == hash && entry->depth == depth && entry->length == prefix_length(path, depth) &&
+           memcmp(entry->prefix, path->path, entry->length) == 0;
+}
+
+DentryEntry *dcache_lookup(DentryCache *cache, const Path *path, size_t max_depth) {
+    DentryEntry *found = NULL;
+    uint64_t hash = 0;
+    for (size_t depth = 1; depth <= max_depth; depth++) {
+        hash = extend_hash(hash, path, depth - 1);
+        if (depth < DCACHE_MIN_DEPTH) {
+            continue;
+        }
+        DentryEntry *entry = atomic_load_explicit(slot_of(cache, hash), memory_order_acquire);
+        if (entry && entry_matches(entry, path, depth, hash)) {
+            found = entry;
+        }
+    }
+    return found;
+}
+
+void dcache_insert(DentryCache *cache, const Path *path, size_t depth, void *node, uint64_t generation,
+                   uint64_t stamp) {
+    uint64_t hash = 0;
+    for (size_t i = 0; i < depth; i++) {
+        hash = extend_hash(hash, path, i);
+    }
+    _Atomic(DentryEntry *) *slot = slot_of(cache, hash);
+
+    DentryEntry *present = atomic_load_explicit(slot, memory_order_acquire);
+    if (present && present->node == node && present->generation == generation &&
+        entry_matches(present, path, depth, hash)) {
+        dcache_restamp(present, stamp);
+        return;
+    }
+
+    size_t length = prefix_length(path, depth);
+    DentryEntry *entry = malloc(sizeof(DentryEntry) + length);
+    if (!entry) {
+        return;
+    }
+    entry->node = node;
+    entry->generation = generation;
+    atomic_init(&entry->stamp, stamp);
+    entry->hash = hash;
+    entry->depth = depth;
+    entry->length = length;
+    memcpy(entry->prefix, path->path, length);
+
+    DentryEntry *old = atomic_exchange_explicit(slot, entry, memory_order_acq_rel);
+    if (old) {
+        reclaim_free_block(old);
+    }
+}
+
+bool dcache_invalidate(DentryCache *cache, DentryEntry *entry) {
+    DentryEntry *expected = entry;
+    if (!atomic_compare_exchange_strong(slot_of(cache, entry->hash), &expected, NULL)) {
+        return false;
+    }
+    reclaim_free_block(entry);
+    return true;
+}
+
+void dcache_restamp(DentryEntry *entry, uint64_t stamp) {
+    uint64_t current = atomic_load(&entry->stamp);
+    while (current < stamp && !atomic_compare_exchange_weak(&entry->stamp, &current, stamp)) {
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "path_utils.h"
+#include "reclaim.h"
+
+// A cache of resolved path prefixes ("dentry cache"): maps a prefix of a path, e.g. /a/b/c/,
+// to the node it led to, so that resolving a long path can start from the deepest cached
+// ancestor instead of the root.
+//
+// The cache never pins nodes and never decides whether an entry is still right - an entry only
+// records the node, the node's generation (bumped whenever its memory is reused for another
+// folder) and a stamp chosen by the caller, which the caller validates after locking the node.
+//
+// The table is direct-mapped: every prefix has one slot, a new entry replaces whatever was
+// there. Entries are immutable apart from the stamp and are freed through reclaim.h, so lookups
+// have to be done inside a critical section.
+typedef struct DentryCache DentryCache;
+
+// Prefixes shallower than this are never cached - walking them from the root is cheap anyway.
+#define DCACHE_MIN_DEPTH 3
+
+typedef struct DentryEntry DentryEntry;
+
+struct DentryEntry {
+    Retired retired;
+    void *node;
+    uint64_t generation;
+    _Atomic uint64_t stamp;
+    uint64_t hash;
+    uint32_t depth;
+    uint32_t length;
+    char prefix[]; // Not null-terminated.
+};
+
+DentryCache *dcache_new(void);
+
+// Free the cache. No other thread may use it any more.
+void dcache_free(DentryCache *cache);
+
+// Return the entry of the deepest prefix of `path` of depth from DCACHE_MIN_DEPTH to
+// `max_depth` (inclusive), or NULL if none of them is cached.
+DentryEntry *dcache_lookup(DentryCache *cache, const Path *path, size_t max_depth);
+
+// Cache the prefix of `path` of `depth` components as leading to `node`. Allocates only if the
+// slot does not hold an entry for the same prefix, node and generation already (that one just
+// gets the new stamp). Allocation failure is ignored.
+void dcache_insert(DentryCache *cache, const Path *path, size_t depth, void *node, uint64_t generation,
+                   uint64_t stamp);
+
+// Remove the entry from the cache. Return false if it had been replaced or removed already.
+bool dcache_invalidate(DentryCache *cache, DentryEntry *entry);
+
+// Raise the stamp of the entry to `stamp` (a lower one is kept).
+void dcache_restamp(DentryEntry *entry, uint64_t stamp);
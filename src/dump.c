@@ -0,0 +1,184 @@
+#define _GNU_SOURCE // mkostemp
+
+#include "dump.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "file_utils.h"
+
+// The file starts with MAGIC, followed by the contents.
+#define MAGIC "PWFSDMP2"
+#define MAGIC_LENGTH 8
+
+#define BUFFER_SIZE (1 << 20)
+
+struct DumpWriter {
+    int fd;
+    char *path;
+    char *temporary;
+    int error; // the first failure, 0 if none
+
+    char buffer[BUFFER_SIZE];
+    size_t length;
+    uint64_t flushed; // contents before the buffer, already written to the file
+};
+
+// Write at `position` in the file (not in the contents).
+static void write_all(DumpWriter *writer, const char *data, size_t length, uint64_t position) {
+    while (length > 0 && writer->error == 0) {
+        ssize_t written = pwrite(writer->fd, data, length, position);
+        if (written < 0) {
+            if (errno != EINTR) {
+                writer->error = errno;
+            }
+            continue;
+        }
+        data += written;
+        length -= written;
+        position += written;
+    }
+}
+
+static void flush(DumpWriter *writer) {
+    write_all(writer, writer->buffer, writer->length, MAGIC_LENGTH + writer->flushed);
+    writer->flushed += writer->length;
+    writer->length = 0;
+}
+
+DumpWriter *dump_writer_open(const char *path, int *err) {
+    DumpWriter *writer = malloc(sizeof(DumpWriter));
+    size_t length = strlen(path);
+    char *temporary = malloc(length + 8);
+    char *copy = strdup(path);
+    if (!writer || !temporary || !copy) {
+        fatal("dump allocation failed");
+    }
+    // Every writer gets its own file, so concurrent dumps to one path never mix their data.
+    sprintf(temporary, "%s.XXXXXX", path);
+
+    int fd = mkostemp(temporary, O_CLOEXEC);
+    if (fd < 0) {
+        *err = errno;
+        free(writer);
+        free(temporary);
+        free(copy);
+        return NULL;
+    }
+    writer->fd = fd;
+    writer->path = copy;
+    writer->temporary = temporary;
+    writer->error = 0;
+    writer->length = 0;
+    writer->flushed = 0;
+    write_all(writer, MAGIC, MAGIC_LENGTH, 0);
+    *err = 0;
+    return writer;
+}
+
+void dump_put(DumpWriter *writer, const void *data, size_t length) {
+    if (writer->length + length > BUFFER_SIZE) {
+        flush(writer);
+        if (length > BUFFER_SIZE) {
+            write_all(writer, data, length, MAGIC_LENGTH + writer->flushed);
+            writer->flushed += length;
+            return;
+        }
+    }
+    memcpy(writer->buffer + writer->length, data, length);
+    writer->length += length;
+}
+
+uint64_t dump_offset(DumpWriter *writer) {
+    return writer->flushed + writer->length;
+}
+
+uint64_t dump_writer_size(DumpWriter *writer) {
+    return MAGIC_LENGTH + dump_offset(writer);
+}
+
+void dump_patch(DumpWriter *writer, uint64_t offset, const void *data, size_t length) {
+    // The patched bytes may be partly written out and partly still in the buffer.
+    if (offset < writer->flushed) {
+        size_t written = offset + length <= writer->flushed ? length : writer->flushed - offset;
+        write_all(writer, data, written, MAGIC_LENGTH + offset);
+        offset += written;
+        data = (const char *) data + written;
+        length -= written;
+    }
+    memcpy(writer->buffer + (offset - writer->flushed), data, length);
+}
+
+int dump_writer_commit(DumpWriter *writer) {
+    flush(writer);
+    if (writer->error == 0 && fdatasync(writer->fd) != 0) {
+        writer->error = errno;
+    }
+    if (close(writer->fd) != 0 && writer->error == 0) {
+        writer->error = errno;
+    }
+    if (writer->error == 0 && rename(writer->temporary, writer->path) != 0) {
+        writer->error = errno;
+    }
+    // Only now the new dump is durable - the rename is lost in a crash until the directory is synced.
+    bool renamed = writer->error == 0;
+    if (renamed) {
+        writer->error = sync_parent_directory(writer->path);
+    }
+    int err = writer->error;
+    if (err != 0 && !renamed) {
+        unlink(writer->temporary);
+    }
+    free(writer->path);
+    free(writer->temporary);
+    free(writer);
+    return err;
+}
+
+int dump_map(const char *path, DumpFile *file) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int err = errno;
+        close(fd);
+        return err;
+    }
+    size_t size = st.st_size;
+    if (size < MAGIC_LENGTH) {
+        close(fd);
+        return EINVAL;
+    }
+    void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    int err = mapped == MAP_FAILED ? errno : 0;
+    close(fd);
+    if (err != 0) {
+        return err;
+    }
+    if (memcmp(mapped, MAGIC, MAGIC_LENGTH) != 0) {
+        munmap(mapped, size);
+        return EINVAL;
+    }
+    // The loader reads subtrees in parallel, so the whole file is needed soon, not just its start.
+    madvise(mapped, size, MADV_WILLNEED);
+
+    file->data = (const char *) mapped + MAGIC_LENGTH;
+    file->size = size - MAGIC_LENGTH;
+    file->mapped = mapped;
+    file->mapped_size = size;
+    return 0;
+}
+
+void dump_unmap(DumpFile *file) {
+    munmap(file->mapped, file->mapped_size);
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A dump file: a whole tree written out at once, for loading instead of re-creating it folder by
+// folder. This module only handles the file - the header, buffered writing with back-patching and
+// replacing the old dump atomically. What the contents mean is up to the caller.
+typedef struct DumpWriter DumpWriter;
+
+// Start writing a dump which will replace the file at `path`. The data goes to a new temporary file
+// next to it (a unique one for each writer) until dump_writer_commit. Return NULL and store an
+// errno code in *err on failure.
+DumpWriter *dump_writer_open(const char *path, int *err);
+
+// Append `length` bytes. A write error is remembered and reported by dump_writer_commit.
+void dump_put(DumpWriter *writer, const void *data, size_t length);
+
+// Offset (from the start of the contents) of the next byte dump_put will append.
+uint64_t dump_offset(DumpWriter *writer);
+
+// Size the file will have once the dump is committed.
+uint64_t dump_writer_size(DumpWriter *writer);
+
+// Overwrite `length` bytes already appended at `offset` - for sizes only known after what they
+// describe was written.
+void dump_patch(DumpWriter *writer, uint64_t offset, const void *data, size_t length);
+
+// Write everything out, sync it, move the temporary file to the dump's path and sync the directory
+// holding it. Return 0, or an errno code of the first failure (the old dump, if any, is then left
+// in place, unless only the directory sync failed). Frees the writer.
+int dump_writer_commit(DumpWriter *writer);
+
+// A dump mapped into memory for reading.
+typedef struct DumpFile {
+    const char *data; // the contents, after the header
+    size_t size;
+    void *mapped;
+    size_t mapped_size;
+} DumpFile;
+
+// Return 0, or an errno code (EINVAL if the file is not a dump) on failure.
+int dump_map(const char *path, DumpFile *file);
+
+void dump_unmap(DumpFile *file);
@@ -0,0 +1,29 @@
+#include "file_utils.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "err.h"
+
+int sync_parent_directory(const char *path) {
+    const char *slash = strrchr(path, '/');
+    size_t length = slash ? (slash == path ? 1 : (size_t) (slash - path)) : 1;
+    char *directory = malloc(length + 1);
+    if (!directory) {
+        fatal("directory path allocation failed");
+    }
+    memcpy(directory, slash ? path : ".", length);
+    directory[length] = '\0';
+
+    int fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    free(directory);
+    if (fd < 0) {
+        return errno;
+    }
+    int err = fsync(fd) != 0 ? errno : 0;
+    close(fd);
+    return err;
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// Make the directory entry of the file at `path` durable by syncing the directory holding it,
+// after the file was created or renamed into place - fdatasync of the file alone does not. Return
+// 0 or an errno code.
+int sync_parent_directory(const char *path);
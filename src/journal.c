@@ -0,0 +1,441 @@
+#define _GNU_SOURCE // fallocate
+
+#include "journal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "file_utils.h"
+
+// The file header is MAGIC and the position of the first record still in the file (64-bit, in
+// host byte order like all the numbers) - records before it were dropped by journal_truncate.
+// Every record is a header - the length of its payload and the CRC-32C of the payload, both
+// 32-bit - followed by the payload.
+#define MAGIC "PWFSJNL2"
+#define MAGIC_LENGTH 8
+#define FILE_HEADER 16
+#define RECORD_HEADER 8
+
+#define INITIAL_BUFFER 4096
+
+struct Journal {
+    int fd;
+    bool group_commit;
+    pthread_mutex_t mutex;
+    pthread_cond_t flushed;
+
+    // Records appended but not taken by a flush yet; they end at position `appended`. Positions
+    // are offsets in the file.
+    char *buffer;
+    size_t length;
+    size_t capacity;
+    uint64_t appended;
+
+    // The records being written by the flushing thread - it owns this buffer while `flushing`.
+    char *spare;
+    size_t spare_capacity;
+    bool flushing;
+    uint64_t durable; // Everything before this position is written and synced.
+
+    JournalStats stats;
+};
+
+struct JournalReader {
+    char *data;
+    size_t mapped;
+    size_t size; // Only the intact records are read.
+    size_t offset;
+};
+
+// The sizes of blocks given back to the file system by journal_truncate.
+#define PUNCH_ALIGNMENT 4096
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+static uint32_t crc_table[256];
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82F63B78 : crc >> 1;
+        }
+        crc_table[i] = crc;
+    }
+}
+
+static uint32_t crc_update(uint32_t crc, const void *data, size_t length) {
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < length; i++) {
+        crc = crc_table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static void write_all(int fd, const char *data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syserr("journal write failed");
+        }
+        data += written;
+        length -= written;
+    }
+}
+
+// Length of the prefix of a journal file made of the header and complete, intact records.
+static size_t valid_length(const char *data, size_t size) {
+    uint64_t offset;
+    memcpy(&offset, data + MAGIC_LENGTH, sizeof(offset));
+    while (size - offset >= RECORD_HEADER) {
+        uint32_t length, crc;
+        memcpy(&length, data + offset, sizeof(length));
+        memcpy(&crc, data + offset + sizeof(length), sizeof(crc));
+        if (size - offset - RECORD_HEADER < length ||
+            ~crc_update(~0u, data + offset + RECORD_HEADER, length) != crc) {
+            break;
+        }
+        offset += RECORD_HEADER + length;
+    }
+    return offset;
+}
+
+// Map a whole file for reading. An empty file is mapped as NULL.
+static int map_file(int fd, char **data, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return errno;
+    }
+    *size = st.st_size;
+    *data = NULL;
+    if (*size > 0) {
+        *data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (*data == MAP_FAILED) {
+            return errno;
+        }
+    }
+    return 0;
+}
+
+// Whether the file has a valid header.
+static bool has_header(const char *data, size_t size) {
+    if (size < FILE_HEADER || memcmp(data, MAGIC, MAGIC_LENGTH) != 0) {
+        return false;
+    }
+    uint64_t start;
+    memcpy(&start, data + MAGIC_LENGTH, sizeof(start));
+    return start >= FILE_HEADER && start <= size;
+}
+
+// Prepare an opened journal file for appending: write the header of a new file, or check the
+// header of an existing one and cut off its torn tail. Store the length of the file in *end.
+static int prepare_file(int fd, const char *path, uint64_t *end) {
+    char *data;
+    size_t size;
+    int err = map_file(fd, &data, &size);
+    if (err != 0) {
+        return err;
+    }
+
+    // A file shorter than the header was left by a crash while it was being created.
+    if (size < FILE_HEADER && (size == 0 || memcmp(data, MAGIC, size < MAGIC_LENGTH ? size : MAGIC_LENGTH) == 0)) {
+        if (size > 0) {
+            munmap(data, size);
+        }
+        if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+            return errno;
+        }
+        char header[FILE_HEADER];
+        uint64_t start = FILE_HEADER;
+        memcpy(header, MAGIC, MAGIC_LENGTH);
+        memcpy(header + MAGIC_LENGTH, &start, sizeof(start));
+        write_all(fd, header, FILE_HEADER);
+        *end = FILE_HEADER;
+        if (fdatasync(fd) != 0) {
+            return errno;
+        }
+        // The file may have just been created - without its directory entry its records are lost.
+        return sync_parent_directory(path);
+    }
+    if (!has_header(data, size)) {
+        munmap(data, size);
+        return EINVAL;
+    }
+
+    size_t valid = valid_length(data, size);
+    munmap(data, size);
+    if (valid < size && (ftruncate(fd, valid) != 0 || fdatasync(fd) != 0)) {
+        return errno;
+    }
+    *end = valid;
+    return lseek(fd, valid, SEEK_SET) < 0 ? errno : 0;
+}
+
+Journal *journal_open(const char *path, bool group_commit, int *err) {
+    pthread_once(&crc_once, crc_init);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        *err = errno;
+        return NULL;
+    }
+    uint64_t end;
+    if ((*err = prepare_file(fd, path, &end)) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    Journal *journal = malloc(sizeof(Journal));
+    if (!journal) {
+        fatal("journal allocation failed");
+    }
+    journal->fd = fd;
+    journal->group_commit = group_commit;
+    if ((*err = pthread_mutex_init(&journal->mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    if ((*err = pthread_cond_init(&journal->flushed, 0)) != 0) {
+        syserr("cond init failed");
+    }
+    journal->buffer = malloc(INITIAL_BUFFER);
+    journal->spare = malloc(INITIAL_BUFFER);
+    if (!journal->buffer || !journal->spare) {
+        fatal("journal allocation failed");
+    }
+    journal->length = 0;
+    journal->capacity = journal->spare_capacity = INITIAL_BUFFER;
+    journal->appended = journal->durable = end;
+    journal->flushing = false;
+    journal->stats = (JournalStats) {.records = 0, .bytes = 0, .syncs = 0};
+    *err = 0;
+    return journal;
+}
+
+void journal_close(Journal *journal) {
+    journal_lock(journal);
+    uint64_t appended = journal->appended;
+    journal_unlock(journal);
+    journal_wait(journal, appended);
+
+    if (close(journal->fd) != 0) {
+        syserr("journal close failed");
+    }
+    int err;
+    if ((err = pthread_mutex_destroy(&journal->mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    if ((err = pthread_cond_destroy(&journal->flushed)) != 0) {
+        syserr("cond destroy failed");
+    }
+    free(journal->buffer);
+    free(journal->spare);
+    free(journal);
+}
+
+void journal_lock(Journal *journal) {
+    int err;
+    if ((err = pthread_mutex_lock(&journal->mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+void journal_unlock(Journal *journal) {
+    int err;
+    if ((err = pthread_mutex_unlock(&journal->mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+static void reserve(char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return;
+    }
+    while (*capacity < needed) {
+        *capacity *= 2;
+    }
+    *buffer = realloc(*buffer, *capacity);
+    if (!*buffer) {
+        fatal("journal allocation failed");
+    }
+}
+
+uint64_t journal_append(Journal *journal, const JournalPart *parts, size_t count) {
+    uint32_t length = 0;
+    uint32_t crc = ~0u;
+    for (size_t i = 0; i < count; i++) {
+        length += parts[i].length;
+        crc = crc_update(crc, parts[i].data, parts[i].length);
+    }
+    crc = ~crc;
+
+    reserve(&journal->buffer, &journal->capacity, journal->length + RECORD_HEADER + length);
+    char *record = journal->buffer + journal->length;
+    memcpy(record, &length, sizeof(length));
+    memcpy(record + sizeof(length), &crc, sizeof(crc));
+    record += RECORD_HEADER;
+    for (size_t i = 0; i < count; i++) {
+        memcpy(record, parts[i].data, parts[i].length);
+        record += parts[i].length;
+    }
+
+    journal->length += RECORD_HEADER + length;
+    journal->appended += RECORD_HEADER + length;
+    journal->stats.records++;
+    journal->stats.bytes += RECORD_HEADER + length;
+    return journal->appended;
+}
+
+void journal_wait(Journal *journal, uint64_t position) {
+    journal_lock(journal);
+    while (journal->durable < position) {
+        if (journal->flushing) {
+            int err;
+            if ((err = pthread_cond_wait(&journal->flushed, &journal->mutex)) != 0) {
+                syserr("cond wait failed");
+            }
+            continue;
+        }
+
+        // Everything before the buffer is durable, so the buffer starts at `durable`. With group
+        // commit we take all of it - the records of threads which have not started waiting yet
+        // ride along - otherwise only its first record, so that every record gets its own sync.
+        journal->flushing = true;
+        uint64_t start = journal->durable;
+        size_t length = journal->length;
+        if (!journal->group_commit) {
+            uint32_t first;
+            memcpy(&first, journal->buffer, sizeof(first));
+            length = RECORD_HEADER + first;
+        }
+        if (length == journal->length) {
+            char *buffer = journal->buffer;
+            size_t capacity = journal->capacity;
+            journal->buffer = journal->spare;
+            journal->capacity = journal->spare_capacity;
+            journal->spare = buffer;
+            journal->spare_capacity = capacity;
+            journal->length = 0;
+        }
+        else {
+            reserve(&journal->spare, &journal->spare_capacity, length);
+            memcpy(journal->spare, journal->buffer, length);
+            memmove(journal->buffer, journal->buffer + length, journal->length - length);
+            journal->length -= length;
+        }
+        journal_unlock(journal);
+
+        write_all(journal->fd, journal->spare, length);
+        if (fdatasync(journal->fd) != 0) {
+            syserr("journal sync failed");
+        }
+
+        journal_lock(journal);
+        journal->durable = start + length;
+        journal->flushing = false;
+        journal->stats.syncs++;
+        int err;
+        if ((err = pthread_cond_broadcast(&journal->flushed)) != 0) {
+            syserr("cond broadcast failed");
+        }
+    }
+    journal_unlock(journal);
+}
+
+uint64_t journal_position(Journal *journal) {
+    return journal->appended;
+}
+
+int journal_truncate(Journal *journal, uint64_t position) {
+    journal_wait(journal, position);
+
+    uint64_t start = position;
+    if (pwrite(journal->fd, &start, sizeof(start), MAGIC_LENGTH) != sizeof(start)) {
+        return errno;
+    }
+    if (fdatasync(journal->fd) != 0) {
+        return errno;
+    }
+    // Only whole blocks are freed. A file system which cannot punch holes keeps the dropped
+    // records on disk, but they are skipped all the same.
+    uint64_t begin = (FILE_HEADER + PUNCH_ALIGNMENT - 1) / PUNCH_ALIGNMENT * PUNCH_ALIGNMENT;
+    uint64_t end = position / PUNCH_ALIGNMENT * PUNCH_ALIGNMENT;
+    if (begin < end && fallocate(journal->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, begin, end - begin) != 0 &&
+        errno != EOPNOTSUPP) {
+        return errno;
+    }
+    return 0;
+}
+
+void journal_get_stats(Journal *journal, JournalStats *stats) {
+    journal_lock(journal);
+    *stats = journal->stats;
+    journal_unlock(journal);
+}
+
+JournalReader *journal_reader_open(const char *path, uint64_t position, int *err) {
+    pthread_once(&crc_once, crc_init);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *err = errno;
+        return NULL;
+    }
+    char *data;
+    size_t size;
+    *err = map_file(fd, &data, &size);
+    close(fd);
+    if (*err != 0) {
+        return NULL;
+    }
+    uint64_t start = 0;
+    if (has_header(data, size)) {
+        memcpy(&start, data + MAGIC_LENGTH, sizeof(start));
+    }
+    size_t valid = start > 0 ? valid_length(data, size) : 0;
+    // Reading from the beginning needs the records journal_truncate dropped.
+    bool missing = position == 0 ? start != FILE_HEADER : position < start || position > valid;
+    if (start == 0 || missing) {
+        if (size > 0) {
+            munmap(data, size);
+        }
+        *err = EINVAL;
+        return NULL;
+    }
+
+    JournalReader *reader = malloc(sizeof(JournalReader));
+    if (!reader) {
+        fatal("journal allocation failed");
+    }
+    reader->data = data;
+    reader->mapped = size;
+    reader->size = valid;
+    reader->offset = position > 0 ? position : FILE_HEADER;
+    *err = 0;
+    return reader;
+}
+
+bool journal_reader_next(JournalReader *reader, const char **data, size_t *length) {
+    if (reader->offset == reader->size) {
+        return false;
+    }
+    uint32_t record_length;
+    memcpy(&record_length, reader->data + reader->offset, sizeof(record_length));
+    *data = reader->data + reader->offset + RECORD_HEADER;
+    *length = record_length;
+    reader->offset += RECORD_HEADER + record_length;
+    return true;
+}
+
+void journal_reader_close(JournalReader *reader) {
+    munmap(reader->data, reader->mapped);
+    free(reader);
+}
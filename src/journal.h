@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A write-ahead journal: an append-only file of checksummed records.
+//
+// Appending a record only copies it to a memory buffer, under the journal's mutex - the caller
+// holds the mutex for as long as the order of its records has to match the order of whatever
+// they describe. Making records durable is a separate step, journal_wait, done after the mutex
+// is released. With group commit the first waiting thread writes out and syncs every record
+// appended so far, and the threads which come meanwhile wait for it and then share the next
+// sync - so concurrent writers pay for one fsync per group rather than one each.
+typedef struct Journal Journal;
+
+// One piece of a record; a record is the concatenation of its parts.
+typedef struct JournalPart {
+    const void *data;
+    size_t length;
+} JournalPart;
+
+typedef struct JournalStats {
+    size_t records; // Records appended since the journal was opened.
+    size_t bytes; // Bytes appended, including record headers.
+    size_t syncs; // Writes followed by fdatasync.
+} JournalStats;
+
+// Open the journal file at `path` for appending, creating it if needed. A torn record at the end
+// of an existing file (left by a crash during a write) is cut off. With `group_commit` false,
+// records are written out and synced one at a time - the cost of a sync per change, for
+// comparison. Return NULL and store an errno code in *err (EINVAL if the file is not a journal)
+// on failure.
+Journal *journal_open(const char *path, bool group_commit, int *err);
+
+// Make all appended records durable and close the file.
+void journal_close(Journal *journal);
+
+void journal_lock(Journal *journal);
+
+void journal_unlock(Journal *journal);
+
+// Append a record made of `count` parts. The caller holds the journal's mutex. Return the
+// position (offset in the file) just after the record, to be passed to journal_wait.
+uint64_t journal_append(Journal *journal, const JournalPart *parts, size_t count);
+
+// Wait until all records up to `position` are durable. Must be called without the mutex.
+void journal_wait(Journal *journal, uint64_t position);
+
+// Position at which the next record will be appended. The caller holds the journal's mutex.
+uint64_t journal_position(Journal *journal);
+
+// Drop the records before `position` (a position returned by journal_position), once whatever
+// they describe is saved elsewhere: make them durable, mark the position in the file header as
+// the new start of the journal and give the disk space before it back to the file system.
+// Appending goes on meanwhile. Must be called without the mutex. Return 0 or an errno code.
+int journal_truncate(Journal *journal, uint64_t position);
+
+void journal_get_stats(Journal *journal, JournalStats *stats);
+
+// Reading a journal file, record by record, for recovery.
+typedef struct JournalReader JournalReader;
+
+// Start reading at `position` (a position returned by journal_position when the file was
+// appended to) or, if it is 0, at the first record ever appended. Return NULL and store an errno
+// code in *err on failure - EINVAL if the file is not a journal or does not have all the records
+// after `position` (they were dropped by journal_truncate, or are not durable).
+JournalReader *journal_reader_open(const char *path, uint64_t position, int *err);
+
+// Store the next record in *data and *length (valid until the reader is closed) and return true,
+// or return false at the end of the journal - including a torn or corrupted record.
+bool journal_reader_next(JournalReader *reader, const char **data, size_t *length);
+
+void journal_reader_close(JournalReader *reader);
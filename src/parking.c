@@ -0,0 +1,69 @@
+#include "parking.h"
+
+#include <stdint.h>
+
+#include "err.h"
+
+#define CACHE_LINE 64
+
+struct ParkingBucket {
+    _Alignas(CACHE_LINE) pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+static ParkingBucket buckets[PARKING_BUCKETS];
+static pthread_once_t buckets_once = PTHREAD_ONCE_INIT;
+
+static void init_buckets(void) {
+    int err;
+    for (int i = 0; i < PARKING_BUCKETS; i++) {
+        if ((err = pthread_mutex_init(&buckets[i].mutex, 0)) != 0) {
+            syserr("mutex init failed");
+        }
+        if ((err = pthread_cond_init(&buckets[i].cond, 0)) != 0) {
+            syserr("cond init failed");
+        }
+    }
+}
+
+static size_t bucket_index(const void *address) {
+    // Fibonacci hashing; the low bits of an address are mostly zero due to alignment.
+    uint64_t hash = ((uint64_t) (uintptr_t) address >> 4) * UINT64_C(0x9E3779B97F4A7C15);
+    return hash >> 54; // 64 - log2(PARKING_BUCKETS)
+}
+
+_Static_assert(PARKING_BUCKETS == 1 << 10, "bucket_index assumes 1024 buckets");
+
+ParkingBucket *parking_lock(const void *address) {
+    int err;
+    if ((err = pthread_once(&buckets_once, init_buckets)) != 0) {
+        syserr("pthread_once failed");
+    }
+
+    ParkingBucket *bucket = &buckets[bucket_index(address)];
+    if ((err = pthread_mutex_lock(&bucket->mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+    return bucket;
+}
+
+void parking_unlock(ParkingBucket *bucket) {
+    int err;
+    if ((err = pthread_mutex_unlock(&bucket->mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+void parking_wait(ParkingBucket *bucket) {
+    int err;
+    if ((err = pthread_cond_wait(&bucket->cond, &bucket->mutex)) != 0) {
+        syserr("cond wait failed");
+    }
+}
+
+void parking_wake_all(ParkingBucket *bucket) {
+    int err;
+    if ((err = pthread_cond_broadcast(&bucket->cond)) != 0) {
+        syserr("cond broadcast failed");
+    }
+}
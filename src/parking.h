@@ -0,0 +1,27 @@
+#pragma once
+
+#include <pthread.h>
+
+// A parking lot (in the spirit of WebKit's WTF::ParkingLot and Linux futex hashing).
+//
+// Instead of every object embedding its own mutex and condition variables, threads which have
+// to wait for an object park in one of PARKING_BUCKETS global buckets chosen by hashing the
+// object's address. A bucket's mutex also guards the state of all objects hashing to it, so an
+// object needs no synchronization state of its own beyond the words the mutex protects.
+//
+// Unrelated objects may share a bucket: a wakeup is always a broadcast and a woken thread has to
+// re-check its condition.
+typedef struct ParkingBucket ParkingBucket;
+
+#define PARKING_BUCKETS 1024
+
+// Lock and return the bucket of `address`.
+ParkingBucket *parking_lock(const void *address);
+
+void parking_unlock(ParkingBucket *bucket);
+
+// Atomically unlock the bucket and sleep until woken (or spuriously), then lock it again.
+void parking_wait(ParkingBucket *bucket);
+
+// Wake every thread parked in the bucket. The caller holds its lock.
+void parking_wake_all(ParkingBucket *bucket);
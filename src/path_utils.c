@@ -25,43 +25,55 @@ bool is_path_valid(const char* path)
     return true;
 }
 
-const char* split_path(const char* path, char* component)
+bool parse_path(const char* path, Path* result)
 {
-    const char* subpath = strchr(path + 1, '/'); // Pointer to second '/' character.
-    if (!subpath) // Path is "/".
-        return NULL;
-    if (component) {
-        int len = subpath - (path + 1);
-        assert(len >= 1 && len <= MAX_FOLDER_NAME_LENGTH);
-        strncpy(component, path + 1, len);
-        component[len] = '\0';
+    if (path[0] != '/')
+        return false;
+    result->path = path;
+    result->depth = 0;
+
+    const char* name_start = path + 1; // Start of current path component, just after '/'.
+    while (*name_start) {
+        const char* p = name_start;
+        while (*p >= 'a' && *p <= 'z')
+            p++;
+        size_t len = p - name_start;
+        if (*p != '/' || len == 0 || len > MAX_FOLDER_NAME_LENGTH)
+            return false;
+        if (p - path + 1 > MAX_PATH_LENGTH)
+            return false;
+
+        result->offsets[result->depth] = name_start - path;
+        result->lengths[result->depth] = len;
+        result->hashes[result->depth] = hmap_hash(name_start, len);
+        result->depth++;
+        name_start = p + 1;
     }
-    return subpath;
+    result->length = name_start - path;
+    return true;
 }
 
-char* make_path_to_parent(const char* path, char* component)
+void copy_path_component(const Path* path, size_t i, char* component)
 {
-    size_t len = strlen(path);
-    if (len == 1) // Path is "/".
-        return NULL;
-    const char* p = path + len - 2; // Point before final '/' character.
-    // Move p to last-but-one '/' character.
-    while (*p != '/')
-        p--;
-
-    size_t subpath_len = p - path + 1; // Include '/' at p.
-    char* result = malloc(subpath_len + 1); // Include terminating null character.
-    strncpy(result, path, subpath_len);
-    result[subpath_len] = '\0';
+    assert(i < path->depth);
+    memcpy(component, path_component(path, i), path->lengths[i]);
+    component[path->lengths[i]] = '\0';
+}
 
-    if (component) {
-        size_t component_len = len - subpath_len - 1; // Skip final '/' as well.
-        assert(component_len >= 1 && component_len <= MAX_FOLDER_NAME_LENGTH);
-        strncpy(component, p + 1, component_len);
-        component[component_len] = '\0';
-    }
+size_t path_lca_depth(const Path* a, const Path* b)
+{
+    assert(a->depth >= 1 && b->depth >= 1);
+    size_t depth = 0;
+    while (depth < a->depth - 1 && depth < b->depth - 1 && a->lengths[depth] == b->lengths[depth]
+        && a->hashes[depth] == b->hashes[depth]
+        && memcmp(path_component(a, depth), path_component(b, depth), a->lengths[depth]) == 0)
+        depth++;
+    return depth;
+}
 
-    return result;
+bool is_proper_ancestor(const Path* a, const Path* b)
+{
+    return a->length < b->length && memcmp(a->path, b->path, a->length) == 0;
 }
 
 // A wrapper for using strcmp in qsort.
@@ -119,45 +131,3 @@ char* make_map_contents_string(HashMap* map)
     return result;
 }
 
-bool is_substring(const char *a, const char *b) {
-    if (strlen(a) >= strlen(b)) {
-        return false;
-    }
-
-    size_t size_a = strlen(a);
-    for (size_t i = 0; i < size_a; i++) {
-        if (a[i] != b[i]) {
-            return false;
-        }
-    }
-
-    return true;
-}
-
-char *make_path_to_lca(const char *a, const char *b) {
-    char *path = malloc(sizeof(char) * MAX_PATH_LENGTH);
-
-    char *path_to_a_parent = make_path_to_parent(a, NULL);
-    char *path_to_b_parent = make_path_to_parent(b, NULL);
-
-    size_t size_a = strlen(path_to_a_parent);
-    size_t size_b = strlen(path_to_b_parent);
-    for (size_t i = 0; i < size_a && i < size_b; i++) {
-        if (a[i] == b[i]) {
-            path[i] = a[i];
-        }
-        else {
-            path[i] = '\0';
-            free(path_to_a_parent);
-            free(path_to_b_parent);
-            return path;
-        }
-    }
-    path[size_a > size_b ? size_b : size_a] = '\0';
-    free(path_to_a_parent);
-    free(path_to_b_parent);
-//    printf("xdddd\n");
-//    printf("%s\n", path);
-
-    return path;
-}
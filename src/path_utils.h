@@ -1,4 +1,7 @@
+#pragma once
+
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "HashMap.h"
 
@@ -14,30 +17,46 @@
 // sequences of 'a'-'z' ASCII characters, of length from 1 to MAX_FOLDER_NAME_LENGTH.
 bool is_path_valid(const char* path);
 
-// Return the subpath obtained by removing the first component.
-// Args:
-// - `path`: should be a valid path (see `is_path_valid`).
-// - `component`: if not NULL, should be a buffer of size at least MAX_FOLDER_NAME_LENGTH + 1.
-//    Then the first component will be copied there (without any '/' characters).
-// If path is "/", returns NULL and leaves `component` unchanged.
-// Otherwise the returns a pointer into `path`, representing a valid subpath.
-//
-// This can be used to iterate over all components of a path:
-//     char component[MAX_FOLDER_NAME_LENGTH + 1];
-//     const char* subpath = path;
-//     while (subpath = split_path(subpath, component))
-//         printf("%s", component);
-const char* split_path(const char* path, char* component);
-
-// Return a copy of the subpath obtained by removing the last component.
-// The caller should free the result, unless it is NULL.
-// Args:
-// - `path`: should be a valid path (see `is_path_valid`).
-// - `component`: if not NULL, should be a buffer of size at least MAX_FOLDER_NAME_LENGTH + 1.
-//    Then the last component will be copied there (without any '/' characters).
-// If path is "/", returns NULL and leaves `component` unchanged.
-// Otherwise the result is a valid path.
-char* make_path_to_parent(const char* path, char* component);
+// Max number of components of a valid path.
+#define MAX_PATH_DEPTH (MAX_PATH_LENGTH / 2)
+
+// A valid path split into components (see `parse_path`).
+// Components are not copied - they are given by offsets and lengths into `path`, which has to
+// outlive the descriptor. Hashes (`hmap_hash`) of all components are computed once, so a
+// lookup along the path never rehashes a name. The descriptor lives on the stack, so resolving
+// a path needs no heap allocation.
+typedef struct Path Path;
+
+struct Path {
+    const char* path;
+    size_t length;
+    size_t depth; // Number of components, 0 for "/".
+    uint16_t offsets[MAX_PATH_DEPTH];
+    uint8_t lengths[MAX_PATH_DEPTH];
+    uint32_t hashes[MAX_PATH_DEPTH];
+};
+
+// Validate `path` (as `is_path_valid`) and split it into `result` in the same pass.
+// Return false (leaving `result` unspecified) if the path is not valid.
+bool parse_path(const char* path, Path* result);
+
+// Return the `i`-th component (counting from 0) of a parsed path. It is not null-terminated,
+// its length is `path->lengths[i]`.
+static inline const char* path_component(const Path* path, size_t i)
+{
+    return path->path + path->offsets[i];
+}
+
+// Copy the `i`-th component of a parsed path to `component`, which should be a buffer of size at
+// least MAX_FOLDER_NAME_LENGTH + 1.
+void copy_path_component(const Path* path, size_t i, char* component);
+
+// Return the depth of the lowest common ancestor of the parents of `a` and `b` (both of depth at
+// least 1), i.e. the number of leading components the parents share.
+size_t path_lca_depth(const Path* a, const Path* b);
+
+// Return whether `a` is a proper ancestor of `b`.
+bool is_proper_ancestor(const Path* a, const Path* b);
 
 // Return an array containing all keys, lexicographically sorted.
 // The result is null-terminated.
@@ -50,6 +69,3 @@ const char** make_map_contents_array(HashMap* map);
 // The caller should free the result.
 char* make_map_contents_string(HashMap* map);
 
-bool is_substring(const char *a, const char *b);
-
-char *make_path_to_lca(const char *a, const char *b);
@@ -0,0 +1,33 @@
+#pragma once
+
+// The protocol between the tree server (server.h) and its clients (client.h), over a Unix domain
+// socket. Both ends are on one host, so numbers are in host byte order.
+//
+// Each message is a frame: its length (32-bit, not counting the length itself) followed by the
+// body. A client may send any number of requests without waiting for responses (pipelining).
+// The server handles them concurrently and sends each response as soon as it is ready, so
+// responses may come in a different order than the requests - a response carries the id of its
+// request, chosen by the client.
+//
+// Request body: id (64-bit), operation (one byte, TreeOperation) and the paths of the operation,
+// each terminated by '\0' - two for TREE_OPERATION_MOVE, one for the others.
+// Response body: id (64-bit), result (32-bit signed), the operation of the request and, only for
+// a successful TREE_OPERATION_LIST, the listing (without the terminating '\0').
+//
+// The result is what the Tree.h function returns; tree_list returning NULL is sent as ENOENT.
+// A malformed request makes the server close the connection.
+
+typedef enum TreeOperation {
+    TREE_OPERATION_LIST,
+    TREE_OPERATION_CREATE,
+    TREE_OPERATION_REMOVE,
+    TREE_OPERATION_MOVE,
+} TreeOperation;
+
+#define FRAME_HEADER 4
+#define REQUEST_HEADER 9 // id and operation
+#define RESPONSE_HEADER 13 // id, result and operation
+
+// Longest request body: two paths of at most MAX_PATH_LENGTH (path_utils.h) characters, with the
+// terminators. Longer requests are malformed.
+#define MAX_REQUEST (REQUEST_HEADER + 2 * 4096)
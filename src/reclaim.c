@@ -0,0 +1,293 @@
+#include "reclaim.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "err.h"
+
+// Classic three-epoch scheme (Fraser, "Practical lock-freedom", 2004).
+//
+// A thread inside a critical section announces the global epoch it has seen. The global
+// epoch can be advanced from e to e + 1 only when every thread inside a critical section has
+// announced e, so once it reaches e + 2 nobody can still be in a section which started before
+// the epoch was e + 1 - in particular nobody can hold a pointer to an object retired while the
+// epoch was e.
+//
+// Retired objects wait on per-thread limbo lists, one for each of the last three epochs, so
+// retiring never takes a lock nor allocates. A thread frees its own lists as the epoch moves
+// on. When a thread exits, its lists are handed over to a global orphan list, which is freed
+// by reclaim_collect().
+//
+// Thread records live in thread-local storage (so that registration does not allocate either)
+// and are linked into a global registry guarded by a mutex. The registry is only traversed
+// when trying to advance the epoch, which happens once per ADVANCE_INTERVAL retirements.
+
+#define EPOCHS 3
+#define ADVANCE_INTERVAL 64
+
+// Announced epoch of a thread outside of a critical section.
+#define QUIESCENT UINT64_MAX
+
+typedef struct ThreadRecord ThreadRecord;
+
+struct ThreadRecord {
+    _Atomic uint64_t announced;
+    int nesting;
+    bool registered;
+
+    Retired *limbo[EPOCHS];
+    uint64_t limbo_epoch[EPOCHS];
+    size_t retired_since_advance;
+
+    ThreadRecord *prev, *next;
+};
+
+static _Atomic uint64_t global_epoch = 0;
+static atomic_size_t pending = 0;
+
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+static ThreadRecord *registry = NULL;
+static Retired *orphans = NULL; // Guarded by registry_mutex.
+static uint64_t orphans_epoch = 0;
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t record_key;
+
+static _Thread_local ThreadRecord record;
+
+static void registry_lock(void) {
+    int err;
+    if ((err = pthread_mutex_lock(&registry_mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+static void registry_unlock(void) {
+    int err;
+    if ((err = pthread_mutex_unlock(&registry_mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+static void destroy_list(Retired *list) {
+    size_t destroyed = 0;
+    while (list) {
+        Retired *next = list->next;
+        list->destroy(list);
+        list = next;
+        destroyed++;
+    }
+    atomic_fetch_sub(&pending, destroyed);
+}
+
+static Retired *list_last(Retired *list) {
+    while (list->next) {
+        list = list->next;
+    }
+    return list;
+}
+
+// Free the orphans if they are old enough. Called with the registry mutex held.
+static Retired *take_old_orphans(uint64_t epoch) {
+    if (!orphans || orphans_epoch + 2 > epoch) {
+        return NULL;
+    }
+    Retired *list = orphans;
+    orphans = NULL;
+    return list;
+}
+
+static void thread_exit(void *arg) {
+    ThreadRecord *rec = arg;
+    assert(rec->nesting == 0);
+
+    registry_lock();
+    for (int i = 0; i < EPOCHS; i++) {
+        if (rec->limbo[i]) {
+            list_last(rec->limbo[i])->next = orphans;
+            orphans = rec->limbo[i];
+            if (rec->limbo_epoch[i] > orphans_epoch) {
+                orphans_epoch = rec->limbo_epoch[i];
+            }
+            rec->limbo[i] = NULL;
+        }
+    }
+    if (rec->prev) {
+        rec->prev->next = rec->next;
+    }
+    else {
+        registry = rec->next;
+    }
+    if (rec->next) {
+        rec->next->prev = rec->prev;
+    }
+    rec->registered = false;
+    registry_unlock();
+}
+
+static void create_key(void) {
+    int err;
+    if ((err = pthread_key_create(&record_key, thread_exit)) != 0) {
+        syserr("pthread_key_create failed");
+    }
+}
+
+static ThreadRecord *get_record(void) {
+    ThreadRecord *rec = &record;
+    if (rec->registered) {
+        return rec;
+    }
+
+    int err;
+    if ((err = pthread_once(&key_once, create_key)) != 0) {
+        syserr("pthread_once failed");
+    }
+    if ((err = pthread_setspecific(record_key, rec)) != 0) {
+        syserr("pthread_setspecific failed");
+    }
+
+    atomic_init(&rec->announced, QUIESCENT);
+    rec->nesting = 0;
+    for (int i = 0; i < EPOCHS; i++) {
+        rec->limbo[i] = NULL;
+        rec->limbo_epoch[i] = 0;
+    }
+    rec->retired_since_advance = 0;
+
+    registry_lock();
+    rec->prev = NULL;
+    rec->next = registry;
+    if (registry) {
+        registry->prev = rec;
+    }
+    registry = rec;
+    rec->registered = true;
+    registry_unlock();
+
+    return rec;
+}
+
+// Destroy the limbo lists of the calling thread which are old enough.
+static void collect_own(ThreadRecord *rec) {
+    uint64_t epoch = atomic_load(&global_epoch);
+    for (int i = 0; i < EPOCHS; i++) {
+        if (rec->limbo[i] && rec->limbo_epoch[i] + 2 <= epoch) {
+            Retired *list = rec->limbo[i];
+            rec->limbo[i] = NULL;
+            destroy_list(list);
+        }
+    }
+}
+
+// Advance the global epoch if every thread inside a critical section has seen it.
+static void try_advance(void) {
+    uint64_t epoch = atomic_load(&global_epoch);
+
+    registry_lock();
+    bool all_seen = true;
+    for (ThreadRecord *rec = registry; rec && all_seen; rec = rec->next) {
+        uint64_t announced = atomic_load(&rec->announced);
+        all_seen = announced == QUIESCENT || announced == epoch;
+    }
+    if (all_seen) {
+        atomic_compare_exchange_strong(&global_epoch, &epoch, epoch + 1);
+    }
+    Retired *old_orphans = take_old_orphans(atomic_load(&global_epoch));
+    registry_unlock();
+
+    destroy_list(old_orphans);
+}
+
+void reclaim_enter(void) {
+    ThreadRecord *rec = get_record();
+    if (rec->nesting++ > 0) {
+        return;
+    }
+    atomic_store(&rec->announced, atomic_load(&global_epoch));
+    // Pairs with the fence in reclaim_retire: either the thread advancing the epoch sees our
+    // announcement, or we see the unlinking of everything retired before the advance.
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void reclaim_leave(void) {
+    ThreadRecord *rec = &record;
+    assert(rec->registered && rec->nesting > 0);
+    if (--rec->nesting > 0) {
+        return;
+    }
+    atomic_store_explicit(&rec->announced, QUIESCENT, memory_order_release);
+}
+
+void reclaim_retire(Retired *object) {
+    ThreadRecord *rec = get_record();
+    atomic_fetch_add(&pending, 1);
+
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t epoch = atomic_load(&global_epoch);
+    int i = epoch % EPOCHS;
+    if (rec->limbo_epoch[i] != epoch) {
+        // The list holds objects retired at least EPOCHS epochs ago.
+        Retired *list = rec->limbo[i];
+        rec->limbo[i] = NULL;
+        rec->limbo_epoch[i] = epoch;
+        destroy_list(list);
+    }
+    object->next = rec->limbo[i];
+    rec->limbo[i] = object;
+
+    if (++rec->retired_since_advance >= ADVANCE_INTERVAL) {
+        rec->retired_since_advance = 0;
+        try_advance();
+        collect_own(rec);
+    }
+}
+
+static void free_block(Retired *block) {
+    free(block);
+}
+
+void reclaim_free_block(void *block) {
+    Retired *object = block;
+    object->destroy = free_block;
+    reclaim_retire(object);
+}
+
+bool reclaim_collect(void) {
+    ThreadRecord *rec = get_record();
+    assert(rec->nesting == 0);
+
+    // Two advances make everything retired so far old enough, unless another thread stays in
+    // a critical section the whole time.
+    for (int i = 0; i < EPOCHS; i++) {
+        try_advance();
+    }
+    collect_own(rec);
+    return atomic_load(&pending) == 0;
+}
+
+void reclaim_synchronize(void) {
+    ThreadRecord *rec = get_record();
+    assert(rec->nesting == 0);
+    (void) rec;
+
+    // Pairs with the fence in reclaim_enter: a section which has not announced its epoch yet
+    // sees everything the caller did before this call. Any other one has announced at most
+    // the current epoch, so the epoch cannot get two further while it lasts.
+    atomic_thread_fence(memory_order_seq_cst);
+    uint64_t target = atomic_load(&global_epoch) + 2;
+    while (true) {
+        try_advance();
+        if (atomic_load(&global_epoch) >= target) {
+            break;
+        }
+        sched_yield();
+    }
+}
+
+size_t reclaim_pending(void) {
+    return atomic_load(&pending);
+}
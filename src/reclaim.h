@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Epoch-based reclamation of memory read outside of locks.
+//
+// A thread brackets every access to shared memory which may be freed concurrently with
+// reclaim_enter() / reclaim_leave(). A thread which unlinks an object (so that no new reader
+// can reach it) retires it instead of freeing it; the object is destroyed once every thread
+// which was inside a critical section at that moment has left it.
+
+typedef struct Retired Retired;
+
+// Link embedded in every retirable object.
+struct Retired {
+    Retired *next;
+    void (*destroy)(Retired *object);
+};
+
+// Start a critical section. Sections may be nested; only the outermost one counts.
+void reclaim_enter(void);
+
+// End the critical section started by the matching reclaim_enter().
+void reclaim_leave(void);
+
+// Destroy `object` (by calling object->destroy, which the caller sets) once it is safe.
+// The object has to be unreachable for critical sections which start after this call.
+// Never allocates memory.
+void reclaim_retire(Retired *object);
+
+// Free a malloc'ed block which starts with a Retired header once it is safe.
+// Suitable for hmap_set_deferred_free(sizeof(Retired), reclaim_free_block).
+void reclaim_free_block(void *block);
+
+// Try to destroy everything retired so far, including objects left behind by exited threads.
+// Must be called outside of a critical section. Return whether nothing is left waiting.
+bool reclaim_collect(void);
+
+// Wait until every critical section which had started before this call has ended. Must be
+// called outside of a critical section.
+void reclaim_synchronize(void);
+
+// Return the number of objects retired but not destroyed yet.
+size_t reclaim_pending(void);
@@ -0,0 +1,588 @@
+#define _GNU_SOURCE // accept4
+
+#include "server.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "err.h"
+#include "protocol.h"
+
+// A connection is not read from while it has this many requests in flight, or this many bytes
+// of responses its client has not taken yet.
+#define MAX_IN_FLIGHT 256
+#define MAX_OUTPUT (1 << 20)
+
+#define READ_SIZE 65536
+#define MAX_EVENTS 64
+
+typedef struct Connection Connection;
+
+struct Connection {
+    int fd;
+    pthread_mutex_t mutex; // everything below
+    Connection *prev, *next; // all open connections, used only by the event loop
+
+    char *input; // received bytes not made into requests yet
+    size_t input_length, input_capacity;
+    char *output; // responses not sent yet
+    size_t output_length, output_capacity;
+
+    size_t in_flight; // requests queued or being run
+    bool reading; // registered for EPOLLIN
+    bool writing; // registered for EPOLLOUT
+    bool finished; // the client shut down its side - it is closed once its responses are sent
+    bool broken; // a send failed - responses are dropped until the event loop closes it
+    bool closed;
+    int references; // the event loop's, until it closes the connection, and one per request
+};
+
+typedef struct Request Request;
+
+struct Request {
+    Request *next;
+    Connection *connection;
+    uint64_t id;
+    TreeOperation operation;
+    char paths[]; // the path and, for a move, the target, each terminated by '\0'
+};
+
+struct Server {
+    Tree *tree;
+    char *path;
+    int listener;
+    int wakeup; // eventfd - stops the event loop
+    int epoll;
+    pthread_t loop;
+    Connection *connections;
+
+    pthread_t *workers;
+    int worker_count;
+    pthread_mutex_t mutex; // the queue
+    pthread_cond_t queued;
+    Request *first, *last;
+    bool stopping;
+};
+
+static void lock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_lock(mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+static void unlock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_unlock(mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+static void reserve(char **buffer, size_t *capacity, size_t needed) {
+    if (needed <= *capacity) {
+        return;
+    }
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    char *resized = realloc(*buffer, new_capacity);
+    if (!resized) {
+        fatal("server allocation failed");
+    }
+    *buffer = resized;
+    *capacity = new_capacity;
+}
+
+// Register the connection for the events it waits for. The caller holds its mutex.
+static void update_events(Server *server, Connection *connection) {
+    struct epoll_event event = {
+        .events = (connection->reading ? EPOLLIN : 0) | (connection->writing ? EPOLLOUT : 0),
+        .data.ptr = connection,
+    };
+    if (epoll_ctl(server->epoll, EPOLL_CTL_MOD, connection->fd, &event) != 0) {
+        syserr("epoll_ctl failed");
+    }
+}
+
+static bool throttled(const Connection *connection) {
+    return connection->in_flight >= MAX_IN_FLIGHT || connection->output_length >= MAX_OUTPUT;
+}
+
+// Whether a finished connection has sent all its responses.
+static bool done(const Connection *connection) {
+    return connection->finished && connection->in_flight == 0 && connection->output_length == 0;
+}
+
+// Check a request body and make a request of it. Return NULL if it is malformed.
+static Request *parse_request(Connection *connection, const char *body, size_t length) {
+    if (length < REQUEST_HEADER + 1 || length > MAX_REQUEST || body[length - 1] != '\0') {
+        return NULL;
+    }
+    uint8_t operation = body[sizeof(uint64_t)];
+    size_t paths = 0;
+    for (size_t i = REQUEST_HEADER; i < length; i++) {
+        paths += body[i] == '\0';
+    }
+    if (operation > TREE_OPERATION_MOVE || paths != (operation == TREE_OPERATION_MOVE ? 2 : 1)) {
+        return NULL;
+    }
+
+    Request *request = malloc(sizeof(Request) + length - REQUEST_HEADER);
+    if (!request) {
+        fatal("server allocation failed");
+    }
+    request->next = NULL;
+    request->connection = connection;
+    memcpy(&request->id, body, sizeof(request->id));
+    request->operation = operation;
+    memcpy(request->paths, body + REQUEST_HEADER, length - REQUEST_HEADER);
+    return request;
+}
+
+// Make requests of the complete frames received on the connection and queue them, until the
+// connection is throttled. The caller holds its mutex. Return false if a request is malformed.
+static bool dispatch(Server *server, Connection *connection) {
+    Request *first = NULL, *last = NULL;
+    size_t offset = 0;
+    bool valid = true;
+    while (!throttled(connection) && connection->input_length - offset >= FRAME_HEADER) {
+        uint32_t length;
+        memcpy(&length, connection->input + offset, FRAME_HEADER);
+        if (length > MAX_REQUEST) {
+            valid = false;
+            break;
+        }
+        if (connection->input_length - offset - FRAME_HEADER < length) {
+            break;
+        }
+        Request *request = parse_request(connection, connection->input + offset + FRAME_HEADER, length);
+        if (!request) {
+            valid = false;
+            break;
+        }
+        offset += FRAME_HEADER + length;
+        connection->in_flight++;
+        connection->references++;
+        if (last) {
+            last->next = request;
+        }
+        else {
+            first = request;
+        }
+        last = request;
+    }
+    memmove(connection->input, connection->input + offset, connection->input_length - offset);
+    connection->input_length -= offset;
+
+    // The whole batch goes to the queue at once.
+    if (first) {
+        lock(&server->mutex);
+        if (server->last) {
+            server->last->next = first;
+        }
+        else {
+            server->first = first;
+        }
+        server->last = last;
+        int err;
+        if ((err = pthread_cond_broadcast(&server->queued)) != 0) {
+            syserr("cond broadcast failed");
+        }
+        unlock(&server->mutex);
+    }
+    return valid;
+}
+
+// Send as much of the pending responses as the socket takes. The caller holds the mutex.
+static void flush(Server *server, Connection *connection) {
+    size_t sent = 0;
+    while (sent < connection->output_length && !connection->broken) {
+        ssize_t written = send(connection->fd, connection->output + sent, connection->output_length - sent,
+                               MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written >= 0) {
+            sent += written;
+        }
+        else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        }
+        else if (errno != EINTR) {
+            // The client is gone - the event loop sees it too (EPOLLERR or EPOLLHUP) and closes it.
+            connection->broken = true;
+            sent = connection->output_length;
+        }
+    }
+    memmove(connection->output, connection->output + sent, connection->output_length - sent);
+    connection->output_length -= sent;
+
+    bool writing = connection->output_length > 0;
+    if (writing != connection->writing) {
+        connection->writing = writing;
+        update_events(server, connection);
+    }
+}
+
+// Start reading the connection again if it is no longer throttled (a finished one only gets its
+// remaining requests queued). The caller holds the mutex. Return false if a request is malformed.
+static bool resume(Server *server, Connection *connection) {
+    if (connection->reading || throttled(connection)) {
+        return true;
+    }
+    // Requests received before the connection was throttled are handled first.
+    if (!dispatch(server, connection)) {
+        return false;
+    }
+    if (!connection->finished && !throttled(connection)) {
+        connection->reading = true;
+        update_events(server, connection);
+    }
+    return true;
+}
+
+static void connection_release(Connection *connection) {
+    int err;
+    if ((err = pthread_mutex_destroy(&connection->mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    free(connection->input);
+    free(connection->output);
+    free(connection);
+}
+
+// Close a connection; only the event loop does it, so it never sees a connection freed by a
+// worker. The connection is freed once the requests in flight finish.
+static void connection_close(Server *server, Connection *connection) {
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    }
+    else {
+        server->connections = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+
+    lock(&connection->mutex);
+    connection->closed = true;
+    if (epoll_ctl(server->epoll, EPOLL_CTL_DEL, connection->fd, NULL) != 0) {
+        syserr("epoll_ctl failed");
+    }
+    close(connection->fd);
+    bool last = --connection->references == 0;
+    unlock(&connection->mutex);
+    if (last) {
+        connection_release(connection);
+    }
+}
+
+static void accept_connections(Server *server) {
+    while (true) {
+        int fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EAGAIN, or out of descriptors - the connection waits in the backlog.
+            return;
+        }
+        Connection *connection = calloc(1, sizeof(Connection));
+        if (!connection) {
+            fatal("server allocation failed");
+        }
+        int err;
+        if ((err = pthread_mutex_init(&connection->mutex, 0)) != 0) {
+            syserr("mutex init failed");
+        }
+        connection->fd = fd;
+        connection->reading = true;
+        connection->references = 1;
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+        if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &event) != 0) {
+            syserr("epoll_ctl failed");
+        }
+        connection->prev = NULL;
+        connection->next = server->connections;
+        if (server->connections) {
+            server->connections->prev = connection;
+        }
+        server->connections = connection;
+    }
+}
+
+// Handle the events of a connection. Return false if it has to be closed.
+static bool connection_event(Server *server, Connection *connection, uint32_t events) {
+    uint32_t hangup = events & EPOLLHUP;
+    lock(&connection->mutex);
+    bool open = !connection->broken;
+    if (open && (events & EPOLLOUT)) {
+        flush(server, connection);
+        open = resume(server, connection);
+    }
+    // EPOLLHUP and EPOLLERR come even when the connection is not read - the read reports them.
+    while (open && (connection->reading || (events & (EPOLLHUP | EPOLLERR)))) {
+        reserve(&connection->input, &connection->input_capacity, connection->input_length + READ_SIZE);
+        ssize_t length = recv(connection->fd, connection->input + connection->input_length, READ_SIZE,
+                              MSG_DONTWAIT);
+        if (length < 0 && errno == EINTR) {
+            continue;
+        }
+        if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        if (length == 0) {
+            // The client may only have shut down writing - it still gets the responses.
+            connection->finished = true;
+            connection->reading = false;
+            update_events(server, connection);
+            break;
+        }
+        if (length < 0) {
+            open = false;
+            break;
+        }
+        connection->input_length += length;
+        if (!dispatch(server, connection)) {
+            open = false;
+        }
+        else if (throttled(connection)) {
+            connection->reading = false;
+            update_events(server, connection);
+        }
+        events &= ~(EPOLLHUP | EPOLLERR);
+    }
+    // EPOLLHUP after the end of input means the client closed the connection and takes nothing more.
+    open = open && !connection->broken && !(connection->finished && hangup) && !done(connection);
+    unlock(&connection->mutex);
+    return open;
+}
+
+static void *event_loop(void *arg) {
+    Server *server = arg;
+    struct epoll_event events[MAX_EVENTS];
+    while (true) {
+        int count = epoll_wait(server->epoll, events, MAX_EVENTS, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            syserr("epoll_wait failed");
+        }
+        for (int i = 0; i < count; i++) {
+            if (events[i].data.ptr == &server->wakeup) {
+                while (server->connections) {
+                    connection_close(server, server->connections);
+                }
+                return NULL;
+            }
+            if (events[i].data.ptr == &server->listener) {
+                accept_connections(server);
+            }
+            else if (!connection_event(server, events[i].data.ptr, events[i].events)) {
+                connection_close(server, events[i].data.ptr);
+            }
+        }
+    }
+}
+
+// Run a request on the tree and append its response to the output of its connection.
+static void run_request(Server *server, Request *request) {
+    const char *path = request->paths;
+    int result;
+    char *listing = NULL;
+    switch (request->operation) {
+        case TREE_OPERATION_LIST:
+            listing = tree_list(server->tree, path);
+            result = listing ? 0 : ENOENT;
+            break;
+        case TREE_OPERATION_CREATE:
+            result = tree_create(server->tree, path);
+            break;
+        case TREE_OPERATION_REMOVE:
+            result = tree_remove(server->tree, path);
+            break;
+        default:
+            result = tree_move(server->tree, path, path + strlen(path) + 1);
+            break;
+    }
+
+    Connection *connection = request->connection;
+    size_t listing_length = listing ? strlen(listing) : 0;
+    uint32_t length = RESPONSE_HEADER + listing_length;
+    int32_t result32 = result;
+    uint8_t operation = request->operation;
+
+    lock(&connection->mutex);
+    if (!connection->closed && !connection->broken) {
+        reserve(&connection->output, &connection->output_capacity,
+                connection->output_length + FRAME_HEADER + length);
+        char *frame = connection->output + connection->output_length;
+        memcpy(frame, &length, FRAME_HEADER);
+        memcpy(frame + FRAME_HEADER, &request->id, sizeof(request->id));
+        memcpy(frame + FRAME_HEADER + sizeof(request->id), &result32, sizeof(result32));
+        frame[FRAME_HEADER + sizeof(request->id) + sizeof(result32)] = (char) operation;
+        if (listing_length > 0) {
+            memcpy(frame + FRAME_HEADER + RESPONSE_HEADER, listing, listing_length);
+        }
+        connection->output_length += FRAME_HEADER + length;
+    }
+    connection->in_flight--;
+    if (!connection->closed) {
+        // Responses finished meanwhile by other workers go out together with this one.
+        flush(server, connection);
+        if (!resume(server, connection)) {
+            // The event loop closes it on the next error or hang-up, or in server_stop.
+            connection->broken = true;
+            shutdown(connection->fd, SHUT_RDWR);
+        }
+        else if (done(connection) && !connection->writing) {
+            // Only the event loop closes connections - EPOLLOUT comes at once and wakes it up.
+            connection->writing = true;
+            update_events(server, connection);
+        }
+    }
+    bool last = --connection->references == 0;
+    unlock(&connection->mutex);
+    if (last) {
+        connection_release(connection);
+    }
+    free(listing);
+}
+
+static void *worker(void *arg) {
+    Server *server = arg;
+    while (true) {
+        lock(&server->mutex);
+        while (!server->first && !server->stopping) {
+            int err;
+            if ((err = pthread_cond_wait(&server->queued, &server->mutex)) != 0) {
+                syserr("cond wait failed");
+            }
+        }
+        Request *request = server->first;
+        if (request) {
+            server->first = request->next;
+            if (!server->first) {
+                server->last = NULL;
+            }
+        }
+        unlock(&server->mutex);
+        if (!request) {
+            return NULL;
+        }
+        run_request(server, request);
+        free(request);
+    }
+}
+
+Server *server_start(Tree *tree, const char *path, int workers, int *err) {
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        *err = ENAMETOOLONG;
+        return NULL;
+    }
+    strcpy(address.sun_path, path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        *err = errno;
+        return NULL;
+    }
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0) {
+        *err = errno;
+        close(listener);
+        return NULL;
+    }
+
+    Server *server = malloc(sizeof(Server));
+    char *copy = strdup(path);
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    if (!server || !copy || !threads) {
+        fatal("server allocation failed");
+    }
+    server->tree = tree;
+    server->path = copy;
+    server->listener = listener;
+    server->connections = NULL;
+    server->workers = threads;
+    server->worker_count = workers;
+    server->first = server->last = NULL;
+    server->stopping = false;
+    server->wakeup = eventfd(0, EFD_CLOEXEC);
+    server->epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (server->wakeup < 0 || server->epoll < 0) {
+        syserr("server setup failed");
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = &server->listener};
+    if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, listener, &event) != 0) {
+        syserr("epoll_ctl failed");
+    }
+    event.data.ptr = &server->wakeup;
+    if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, server->wakeup, &event) != 0) {
+        syserr("epoll_ctl failed");
+    }
+
+    if ((*err = pthread_mutex_init(&server->mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    if ((*err = pthread_cond_init(&server->queued, 0)) != 0) {
+        syserr("cond init failed");
+    }
+    for (int i = 0; i < workers; i++) {
+        if ((*err = pthread_create(&server->workers[i], NULL, worker, server)) != 0) {
+            syserr("thread create failed");
+        }
+    }
+    if ((*err = pthread_create(&server->loop, NULL, event_loop, server)) != 0) {
+        syserr("thread create failed");
+    }
+    *err = 0;
+    return server;
+}
+
+void server_stop(Server *server) {
+    uint64_t one = 1;
+    if (write(server->wakeup, &one, sizeof(one)) != sizeof(one)) {
+        syserr("eventfd write failed");
+    }
+    int err;
+    if ((err = pthread_join(server->loop, NULL)) != 0) {
+        syserr("thread join failed");
+    }
+
+    // The queued requests are still run (their connections are closed, so nobody gets the results).
+    lock(&server->mutex);
+    server->stopping = true;
+    if ((err = pthread_cond_broadcast(&server->queued)) != 0) {
+        syserr("cond broadcast failed");
+    }
+    unlock(&server->mutex);
+    for (int i = 0; i < server->worker_count; i++) {
+        if ((err = pthread_join(server->workers[i], NULL)) != 0) {
+            syserr("thread join failed");
+        }
+    }
+
+    close(server->listener);
+    close(server->wakeup);
+    close(server->epoll);
+    unlink(server->path);
+    if ((err = pthread_mutex_destroy(&server->mutex)) != 0) {
+        syserr("mutex destroy failed");
+    }
+    if ((err = pthread_cond_destroy(&server->queued)) != 0) {
+        syserr("cond destroy failed");
+    }
+    free(server->path);
+    free(server->workers);
+    free(server);
+}
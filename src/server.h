@@ -0,0 +1,20 @@
+#pragma once
+
+#include "Tree.h"
+
+// A server giving processes on the same host access to one tree over a Unix domain socket, with
+// the protocol of protocol.h. One thread waits on all connections with epoll, reads requests
+// and queues them; a fixed pool of worker threads runs them on the tree with the Tree.h
+// functions and sends each response as soon as its request is done. A connection whose client
+// has too many requests in flight, or does not read its responses, is not read from until that
+// changes. A client which shuts down its side of the connection still gets the responses to all
+// the requests it sent; the connection is closed after the last one.
+typedef struct Server Server;
+
+// Start serving `tree` at the socket `path` (replacing a socket file left there) with `workers`
+// worker threads. Return NULL and store an errno code in *err on failure.
+Server *server_start(Tree *tree, const char *path, int workers, int *err);
+
+// Close the socket and all connections, wait for the requests being run and free the server.
+// The tree is left to the caller.
+void server_stop(Server *server);
@@ -0,0 +1,235 @@
+#include "slab.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "err.h"
+
+#define CACHE_LINE 64
+
+// Number of objects moved between a magazine and the depot at once. A magazine holding more
+// than twice as many gives a batch back.
+#define MAGAZINE_SIZE 32
+
+#define CHUNK_SLOTS 64
+
+// Every object is preceded by a header holding the free list link, so that linking a free
+// object does not overwrite its constructed state. 16 bytes keep objects aligned as by malloc.
+#define SLOT_HEADER 16
+
+typedef struct Slot Slot;
+
+struct Slot {
+    Slot *next;
+};
+
+typedef struct Chunk Chunk;
+
+struct Chunk {
+    Chunk *next;
+    char padding[SLOT_HEADER - sizeof(Chunk *)];
+};
+
+typedef struct {
+    _Alignas(CACHE_LINE) pthread_mutex_t mutex;
+    Slot *free;
+    size_t count;
+} Stripe;
+
+struct Slab {
+    Stripe stripes[SLAB_STRIPES];
+
+    _Alignas(CACHE_LINE) pthread_mutex_t depot_mutex;
+    Slot *depot;
+    Chunk *chunks;
+
+    size_t object_size;
+    size_t slot_size;
+    void (*construct)(void *object);
+    void (*destruct)(void *object);
+
+    // Allocated objects plus one for the owner; the memory goes away when it drops to zero.
+    atomic_size_t references;
+};
+
+static _Thread_local int thread_stripe = -1;
+static atomic_int next_thread_stripe = 0;
+
+static void lock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_lock(mutex)) != 0) {
+        syserr("mutex lock failed");
+    }
+}
+
+static void unlock(pthread_mutex_t *mutex) {
+    int err;
+    if ((err = pthread_mutex_unlock(mutex)) != 0) {
+        syserr("mutex unlock failed");
+    }
+}
+
+static inline void *slot_object(Slot *slot) {
+    return (char *) slot + SLOT_HEADER;
+}
+
+static inline Slot *object_slot(void *object) {
+    return (Slot *) ((char *) object - SLOT_HEADER);
+}
+
+Slab *slab_new(size_t object_size, void (*construct)(void *object), void (*destruct)(void *object)) {
+    Slab *slab = aligned_alloc(CACHE_LINE, sizeof(Slab));
+    if (!slab) {
+        return NULL;
+    }
+
+    int err;
+    for (int i = 0; i < SLAB_STRIPES; i++) {
+        if ((err = pthread_mutex_init(&slab->stripes[i].mutex, 0)) != 0) {
+            syserr("mutex init failed");
+        }
+        slab->stripes[i].free = NULL;
+        slab->stripes[i].count = 0;
+    }
+    if ((err = pthread_mutex_init(&slab->depot_mutex, 0)) != 0) {
+        syserr("mutex init failed");
+    }
+    slab->depot = NULL;
+    slab->chunks = NULL;
+
+    slab->object_size = object_size;
+    slab->slot_size = (SLOT_HEADER + object_size + SLOT_HEADER - 1) / SLOT_HEADER * SLOT_HEADER;
+    slab->construct = construct;
+    slab->destruct = destruct;
+    atomic_init(&slab->references, 1);
+    return slab;
+}
+
+static void slab_release_memory(Slab *slab) {
+    Chunk *chunk = slab->chunks;
+    while (chunk) {
+        Chunk *next = chunk->next;
+        if (slab->destruct) {
+            char *slots = (char *) (chunk + 1);
+            for (size_t i = 0; i < CHUNK_SLOTS; i++) {
+                slab->destruct(slot_object((Slot *) (slots + i * slab->slot_size)));
+            }
+        }
+        free(chunk);
+        chunk = next;
+    }
+
+    for (int i = 0; i < SLAB_STRIPES; i++) {
+        pthread_mutex_destroy(&slab->stripes[i].mutex);
+    }
+    pthread_mutex_destroy(&slab->depot_mutex);
+    free(slab);
+}
+
+static void slab_unreference(Slab *slab) {
+    if (atomic_fetch_sub(&slab->references, 1) == 1) {
+        slab_release_memory(slab);
+    }
+}
+
+void slab_destroy(Slab *slab) {
+    slab_unreference(slab);
+}
+
+static Stripe *get_stripe(Slab *slab) {
+    if (thread_stripe < 0) {
+        thread_stripe = atomic_fetch_add(&next_thread_stripe, 1) % SLAB_STRIPES;
+    }
+    return &slab->stripes[thread_stripe];
+}
+
+// Carve a new chunk into the depot. Called with the depot mutex held.
+static void carve_chunk(Slab *slab) {
+    Chunk *chunk = malloc(sizeof(Chunk) + CHUNK_SLOTS * slab->slot_size);
+    if (!chunk) {
+        return;
+    }
+    chunk->next = slab->chunks;
+    slab->chunks = chunk;
+
+    char *slots = (char *) (chunk + 1);
+    for (size_t i = CHUNK_SLOTS; i-- > 0; ) {
+        Slot *slot = (Slot *) (slots + i * slab->slot_size);
+        if (slab->construct) {
+            slab->construct(slot_object(slot));
+        }
+        slot->next = slab->depot;
+        slab->depot = slot;
+    }
+}
+
+// Move a batch of objects from the depot to an empty magazine. Called with its mutex held.
+static void refill(Slab *slab, Stripe *stripe) {
+    lock(&slab->depot_mutex);
+    if (!slab->depot) {
+        carve_chunk(slab);
+    }
+    while (slab->depot && stripe->count < MAGAZINE_SIZE) {
+        Slot *slot = slab->depot;
+        slab->depot = slot->next;
+        slot->next = stripe->free;
+        stripe->free = slot;
+        stripe->count++;
+    }
+    unlock(&slab->depot_mutex);
+}
+
+// Move a batch of objects from an overfull magazine to the depot. Called with its mutex held.
+static void drain(Slab *slab, Stripe *stripe) {
+    Slot *first = stripe->free;
+    Slot *last = first;
+    for (size_t i = 1; i < MAGAZINE_SIZE; i++) {
+        last = last->next;
+    }
+    stripe->free = last->next;
+    stripe->count -= MAGAZINE_SIZE;
+
+    lock(&slab->depot_mutex);
+    last->next = slab->depot;
+    slab->depot = first;
+    unlock(&slab->depot_mutex);
+}
+
+void *slab_alloc(Slab *slab) {
+    atomic_fetch_add(&slab->references, 1);
+    Stripe *stripe = get_stripe(slab);
+
+    lock(&stripe->mutex);
+    if (!stripe->free) {
+        refill(slab, stripe);
+    }
+    Slot *slot = stripe->free;
+    if (slot) {
+        stripe->free = slot->next;
+        stripe->count--;
+    }
+    unlock(&stripe->mutex);
+
+    if (!slot) {
+        slab_unreference(slab);
+        return NULL;
+    }
+    return slot_object(slot);
+}
+
+void slab_free(Slab *slab, void *object) {
+    Slot *slot = object_slot(object);
+    Stripe *stripe = get_stripe(slab);
+
+    lock(&stripe->mutex);
+    slot->next = stripe->free;
+    stripe->free = slot;
+    stripe->count++;
+    if (stripe->count > 2 * MAGAZINE_SIZE) {
+        drain(slab, stripe);
+    }
+    unlock(&stripe->mutex);
+
+    slab_unreference(slab);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stddef.h>
+
+// An object cache in the spirit of Bonwick's slab allocator.
+//
+// Objects of one size are carved out of large chunks and recycled without going back to the
+// system allocator. An object is constructed once, when its chunk is carved, and destructed
+// only when the whole cache goes away - so state which is expensive to set up (mutexes,
+// condition variables) survives being freed and allocated again.
+//
+// Free objects are kept in SLAB_STRIPES magazines, each with its own mutex; a thread always
+// uses the same magazine, so concurrent allocations from different threads rarely contend.
+// Magazines exchange objects in batches with a shared depot.
+typedef struct Slab Slab;
+
+#define SLAB_STRIPES 8
+
+// Create a cache of objects of `object_size` bytes. `construct` and `destruct` (both may be
+// NULL) are called for every object when its chunk is carved and freed respectively.
+Slab *slab_new(size_t object_size, void (*construct)(void *object), void (*destruct)(void *object));
+
+// Give up the cache. Its memory is freed as soon as every allocated object has been returned,
+// possibly right away.
+void slab_destroy(Slab *slab);
+
+// Return a constructed object, or NULL if memory is exhausted.
+void *slab_alloc(Slab *slab);
+
+// Return an object to the cache. The object has to be in its constructed state. Never allocates.
+void slab_free(Slab *slab, void *object);
@@ -0,0 +1,169 @@
+// Test operacji wsadowych (tree_create_batch, tree_remove_batch, tree_list_batch).
+//
+// Najpierw bez współbieżności sprawdza kody błędów poszczególnych ścieżek: ścieżki niepoprawne i "/", powtórzenia,
+// brakujących ojców oraz tworzenie i usuwanie folderu razem z jego dziećmi w jednym wsadzie. Potem wątki wsadowo
+// tworzą i usuwają po BATCH folderów - każdy w swoim folderze i we wspólnym - a jeden wątek w tym czasie przenosi
+// ich wspólnego przodka tam i z powrotem.
+
+#define WORKERS 4
+#define BATCH 64
+#define ROUNDS 300
+
+#include "batch_ops.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static atomic_bool moving_done;
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static void check_errors(const int *errors, const int *expected, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		assert(errors[i] == expected[i]);
+	}
+}
+
+static void batch_ops_sequential() {
+	Tree *tree = tree_new();
+	int errors[16];
+
+	const char *create[] = {"/a/b/", "/a/", "/", "a", "/x/y/", "/a/c/", "/a/b/", "/a/b/d/", "/e/"};
+	const int create_expected[] = {0, 0, EEXIST, EINVAL, ENOENT, 0, EEXIST, 0, 0};
+	tree_create_batch(tree, create, 9, errors);
+	check_errors(errors, create_expected, 9);
+	check_list(tree_list(tree, "/"), "a,e");
+	check_list(tree_list(tree, "/a/"), "b,c");
+	check_list(tree_list(tree, "/a/b/"), "d");
+
+	char *results[16];
+	const char *list[] = {"/a/", "/", "/a/b/", "/x/", "a/", "/a/b/d/", "/a/"};
+	const char *list_expected[] = {"b,c", "a,e", "d", NULL, NULL, "", "b,c"};
+	tree_list_batch(tree, list, 7, results);
+	for (int i = 0; i < 7; ++i) {
+		check_list(results[i], list_expected[i]);
+	}
+
+	const char *remove[] = {"/a/", "/a/b/", "/", "/e/", "/a/c/", "/a/b/d/", "/a/b/d/", "/x/y/"};
+	const int remove_expected[] = {0, 0, EBUSY, 0, 0, 0, ENOENT, ENOENT};
+	tree_remove_batch(tree, remove, 8, errors);
+	check_errors(errors, remove_expected, 8);
+	check_list(tree_list(tree, "/"), "");
+
+	// Usunięcie wsadowe nie może usunąć niepustego folderu.
+	assert(tree_create(tree, "/f/") == 0);
+	assert(tree_create(tree, "/f/g/") == 0);
+	const char *remove_nonempty[] = {"/f/"};
+	tree_remove_batch(tree, remove_nonempty, 1, errors);
+	assert(errors[0] == ENOTEMPTY);
+	tree_create_batch(tree, NULL, 0, NULL);
+
+	// Nazwy wsadu przeplatają się z istniejącymi, a wynik listowania nadal jest posortowany.
+	const char *existing[] = {"/f/b/", "/f/d/", "/f/dd/", "/f/x/"};
+	tree_create_batch(tree, existing, 4, errors);
+	const char *interleaved[] = {"/f/y/", "/f/a/", "/f/da/", "/f/c/", "/f/d/", "/f/a/", "/f/ddd/"};
+	const int interleaved_expected[] = {0, 0, 0, 0, EEXIST, EEXIST, 0};
+	tree_create_batch(tree, interleaved, 7, errors);
+	check_errors(errors, interleaved_expected, 7);
+	check_list(tree_list(tree, "/f/"), "a,b,c,d,da,dd,ddd,g,x,y");
+	const char *remove_interleaved[] = {"/f/x/", "/f/d/", "/f/c/", "/f/dd/", "/f/e/", "/f/x/"};
+	const int remove_interleaved_expected[] = {0, 0, 0, 0, ENOENT, ENOENT};
+	tree_remove_batch(tree, remove_interleaved, 6, errors);
+	check_errors(errors, remove_interleaved_expected, 6);
+	check_list(tree_list(tree, "/f/"), "a,b,da,ddd,g,y");
+
+	tree_free(tree);
+}
+
+// Zapisuje ścieżkę /p/<folder>/<n>/ z n zapisanym literami a-z.
+static void write_path(char *s, const char *folder, int n) {
+	s += sprintf(s, "/p/%s/", folder);
+	do {
+		*s++ = 'a' + n % 26;
+		n /= 26;
+	} while (n > 0);
+	strcpy(s, "/");
+}
+
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	char own[] = "?";
+	own[0] = 'a' + thread_data->id;
+	char paths[2 * BATCH][32];
+	const char *pointers[2 * BATCH];
+	for (int i = 0; i < BATCH; ++i) {
+		write_path(paths[i], own, i);
+		write_path(paths[BATCH + i], "shared", thread_data->id * BATCH + i);
+		pointers[i] = paths[i];
+		pointers[BATCH + i] = paths[BATCH + i];
+	}
+
+	int errors[2 * BATCH];
+	char *results[2 * BATCH];
+	for (int round = 0; round < ROUNDS || !atomic_load(&moving_done); ++round) {
+		tree_create_batch(thread_data->tree, pointers, 2 * BATCH, errors);
+		for (int i = 0; i < 2 * BATCH; ++i) {
+			assert(errors[i] == 0);
+		}
+		tree_list_batch(thread_data->tree, pointers, 2 * BATCH, results);
+		for (int i = 0; i < 2 * BATCH; ++i) {
+			check_list(results[i], "");
+		}
+		tree_remove_batch(thread_data->tree, pointers, 2 * BATCH, errors);
+		for (int i = 0; i < 2 * BATCH; ++i) {
+			assert(errors[i] == 0);
+		}
+	}
+	return NULL;
+}
+
+void batch_ops() {
+	batch_ops_sequential();
+
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/q/") == 0);
+	assert(tree_create(tree, "/q/p/") == 0);
+	assert(tree_create(tree, "/p/") == 0);
+	assert(tree_create(tree, "/p/shared/") == 0);
+	char own[] = "/p/?/";
+	for (int i = 0; i < WORKERS; ++i) {
+		own[3] = 'a' + i;
+		assert(tree_create(tree, own) == 0);
+	}
+
+	atomic_store(&moving_done, false);
+	pthread_t th[WORKERS];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+
+	// Przenosimy sąsiada /p/ w tę i z powrotem - ścieżki wątków się nie zmieniają, ale ich próby bywają unieważniane.
+	for (int i = 0; i < ROUNDS; ++i) {
+		assert(tree_move(tree, i % 2 ? "/r/" : "/q/p/", i % 2 ? "/q/p/" : "/r/") == 0);
+	}
+	atomic_store(&moving_done, true);
+
+	for (int i = 0; i < WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	check_list(tree_list(tree, "/p/shared/"), "");
+	tree_free(tree);
+}
@@ -0,0 +1,266 @@
+// Test punktów kontrolnych (tree_checkpoint, tree_checkpoint_start, tree_recover).
+//
+// Najpierw bez współbieżności sprawdza odtwarzanie bez plików, z samym dziennikiem i z punktem kontrolnym, po którym
+// dziennik ma nowy początek, a odtworzenie używa uchwytów otwartych w chwili punktu kontrolnego (także uchwytu
+// usuniętego folderu). "Awaria" między zapisaniem punktu kontrolnego a obcięciem dziennika też musi dać to samo
+// drzewo, a stary punkt kontrolny z obciętym dziennikiem, tak jak sam obcięty dziennik bez punktu kontrolnego - zostać
+// odrzucony. Potem WRITERS wątków zmienia drzewo (jeden z nich przez uchwyty), a główny wątek robi punkty kontrolne,
+// razem z wątkiem punktów kontrolnych - drzewo odtworzone z ostatniego punktu kontrolnego i dziennika musi być takie
+// samo jak oryginał.
+
+#define WRITERS 4
+#define CHECKPOINTS 10
+#define THRESHOLD 4096
+
+#include "checkpoint.h"
+#include "utils.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Ścieżki odwiedzone przez tree_snapshot_walk, oddzielone przecinkami.
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Visited;
+
+static void visit(const char *path, void *arg) {
+	Visited *visited = arg;
+	size_t length = strlen(path);
+	if (visited->length + length + 2 > visited->capacity) {
+		visited->capacity = 2 * (visited->length + length + 2);
+		visited->data = realloc(visited->data, visited->capacity);
+		assert(visited->data);
+	}
+	if (visited->length > 0) {
+		visited->data[visited->length++] = ',';
+	}
+	memcpy(visited->data + visited->length, path, length + 1);
+	visited->length += length;
+}
+
+static char *walk(Tree *tree) {
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+	Visited visited = {.data = NULL, .length = 0, .capacity = 0};
+	assert(tree_snapshot_walk(snapshot, "/", visit, &visited) == 0);
+	tree_snapshot_free(snapshot);
+	return visited.data;
+}
+
+// Odtwarza drzewo z punktu kontrolnego i dziennika i sprawdza, że wyszło drzewo o przejściu expected.
+static void check_recover(const char *checkpoint, const char *journal, const char *expected) {
+	Tree *tree = tree_new();
+	assert(tree_recover(tree, checkpoint, journal) == 0);
+	char *recovered = walk(tree);
+	assert(!strcmp(recovered, expected));
+	free(recovered);
+	tree_free(tree);
+}
+
+static void copy_file(const char *source, const char *target) {
+	FILE *in = fopen(source, "rb");
+	FILE *out = fopen(target, "wb");
+	assert(in && out);
+	char buffer[4096];
+	size_t read;
+	while ((read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		assert(fwrite(buffer, 1, read, out) == read);
+	}
+	fclose(in);
+	fclose(out);
+}
+
+// Początek dziennika zapisany w nagłówku pliku (za 8 bajtami magicznej liczby).
+static uint64_t journal_start(const char *journal) {
+	FILE *in = fopen(journal, "rb");
+	assert(in);
+	uint64_t start;
+	assert(fseek(in, 8, SEEK_SET) == 0 && fread(&start, sizeof(start), 1, in) == 1);
+	fclose(in);
+	return start;
+}
+
+static void checkpoint_sequential(const char *checkpoint, const char *journal, const char *old_checkpoint,
+                                  const char *old_journal) {
+	unlink(checkpoint);
+	unlink(journal);
+	// Bez plików drzewo zostaje puste.
+	check_recover(checkpoint, journal, "/");
+
+	Tree *tree = tree_new();
+	assert(tree_journal_open(tree, journal, TREE_JOURNAL_GROUP_COMMIT) == 0);
+	const char *initial[] = {"/a/", "/a/b/", "/a/c/", "/d/", "/d/e/", "/x/"};
+	for (int i = 0; i < 6; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+	// Sam dziennik.
+	char *expected = walk(tree);
+	check_recover(checkpoint, journal, expected);
+	free(expected);
+
+	TreeDir *dir = tree_open_dir(tree, "/a/");
+	TreeDir *removed = tree_open_dir(tree, "/x/");
+	assert(dir && removed);
+	assert(tree_remove(tree, "/x/") == 0);
+	uint64_t start = journal_start(journal);
+	assert(tree_checkpoint(tree, checkpoint) == 0);
+	assert(journal_start(journal) > start);
+
+	// Rekordy po punkcie kontrolnym odwołują się do uchwytów otwartych przed nim.
+	assert(tree_move(tree, "/a/", "/d/a/") == 0);
+	assert(tree_create_at(tree, dir, "/f/") == 0);
+	assert(tree_move_at(tree, dir, "/b/", "/f/b/") == 0);
+	assert(tree_create_at(tree, removed, "/y/") == ENOENT);
+	tree_close_dir(tree, removed);
+	expected = walk(tree);
+	check_recover(checkpoint, journal, expected);
+	free(expected);
+
+	// "Awaria" po zapisaniu punktu kontrolnego, przed obcięciem dziennika.
+	copy_file(checkpoint, old_checkpoint);
+	assert(tree_create(tree, "/g/") == 0);
+	copy_file(journal, old_journal);
+	expected = walk(tree);
+	assert(tree_checkpoint(tree, checkpoint) == 0);
+	check_recover(checkpoint, old_journal, expected);
+	free(expected);
+	assert(tree_create_at(tree, dir, "/h/") == 0);
+	expected = walk(tree);
+	check_recover(checkpoint, journal, expected);
+	free(expected);
+
+	// Stary punkt kontrolny potrzebuje rekordów, których obcięty dziennik już nie ma.
+	Tree *stale = tree_new();
+	assert(tree_recover(stale, old_checkpoint, journal) == EINVAL);
+	tree_free(stale);
+	// Bez punktu kontrolnego nie da się odtworzyć drzewa z samego obciętego dziennika.
+	copy_file(checkpoint, old_checkpoint);
+	assert(unlink(checkpoint) == 0);
+	stale = tree_new();
+	assert(tree_recover(stale, checkpoint, journal) == EINVAL);
+	tree_free(stale);
+	stale = tree_new();
+	assert(tree_journal_replay(stale, journal) == EINVAL);
+	tree_free(stale);
+	assert(rename(old_checkpoint, checkpoint) == 0);
+	tree_close_dir(tree, dir);
+
+	// Po odtworzeniu ten sam dziennik dostaje kolejną sesję.
+	expected = walk(tree);
+	tree_free(tree);
+	tree = tree_new();
+	assert(tree_recover(tree, checkpoint, journal) == 0);
+	assert(tree_journal_open(tree, journal, TREE_JOURNAL_SYNC_EACH) == 0);
+	char *recovered = walk(tree);
+	assert(!strcmp(recovered, expected));
+	free(recovered);
+	free(expected);
+	dir = tree_open_dir(tree, "/d/a/");
+	assert(dir);
+	assert(tree_checkpoint(tree, checkpoint) == 0);
+	assert(tree_remove_recursive(tree, "/d/a/f/") == 0);
+	assert(tree_create_at(tree, dir, "/i/") == 0);
+	expected = walk(tree);
+	tree_close_dir(tree, dir);
+
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	assert(stats.checkpoints == 1 && stats.checkpoint_failures == 0 && stats.checkpoint_bytes > 0);
+	tree_free(tree);
+	check_recover(checkpoint, journal, expected);
+	free(expected);
+}
+
+static atomic_bool writing;
+
+static void* run_writer(void *data) {
+	ThreadData *thread_data = data;
+	int seed = thread_data->id + 1;
+	while (atomic_load(&writing)) {
+		Operation *operation = get_random_operation(&seed, MASK_CREATE | MASK_REMOVE | MASK_MOVE);
+		run_operation(thread_data->tree, operation);
+		free_operation(operation);
+	}
+	return NULL;
+}
+
+static void* run_handles(void *data) {
+	ThreadData *thread_data = data;
+	Tree *tree = thread_data->tree;
+	assert(tree_create(tree, "/h/") == 0);
+	while (atomic_load(&writing)) {
+		TreeDir *dir = tree_open_dir(tree, "/h/");
+		assert(dir);
+		assert(tree_create_at(tree, dir, "/a/") == 0);
+		assert(tree_move_at(tree, dir, "/a/", "/b/") == 0);
+		assert(tree_remove_at(tree, dir, "/b/") == 0);
+		tree_close_dir(tree, dir);
+	}
+	return NULL;
+}
+
+static void checkpoint_concurrent(const char *checkpoint, const char *journal) {
+	unlink(checkpoint);
+	unlink(journal);
+	Tree *tree = tree_new();
+	assert(tree_journal_open(tree, journal, TREE_JOURNAL_GROUP_COMMIT) == 0);
+	tree_checkpoint_start(tree, checkpoint, THRESHOLD);
+
+	atomic_store(&writing, true);
+	pthread_t th[WRITERS];
+	ThreadData data[WRITERS];
+	for (int i = 0; i < WRITERS; ++i) {
+		data[i] = (ThreadData) {.tree = tree, .id = i};
+		assert(pthread_create(&th[i], NULL, i > 0 ? run_writer : run_handles, &data[i]) == 0);
+	}
+	for (int i = 0; i < CHECKPOINTS; ++i) {
+		assert(tree_checkpoint(tree, checkpoint) == 0);
+	}
+	// Czekamy także na punkt kontrolny wątku punktów kontrolnych.
+	TreeStats stats;
+	do {
+		usleep(10000);
+		tree_get_stats(tree, &stats);
+	} while (stats.checkpoints <= CHECKPOINTS);
+	atomic_store(&writing, false);
+	for (int i = 0; i < WRITERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	tree_get_stats(tree, &stats);
+	assert(stats.checkpoint_failures == 0 && stats.checkpoint_bytes > 0);
+	assert(stats.checkpoint_stall_nanoseconds <= stats.checkpoint_nanoseconds);
+	char *expected = walk(tree);
+	tree_free(tree);
+	check_recover(checkpoint, journal, expected);
+	free(expected);
+}
+
+void checkpoint() {
+	char checkpoint[64], journal[64], old_checkpoint[64], old_journal[64];
+	sprintf(checkpoint, "/tmp/pwfs-checkpoint-%d", (int) getpid());
+	sprintf(journal, "/tmp/pwfs-checkpoint-%d-journal", (int) getpid());
+	sprintf(old_checkpoint, "/tmp/pwfs-checkpoint-%d-old", (int) getpid());
+	sprintf(old_journal, "/tmp/pwfs-checkpoint-%d-old-journal", (int) getpid());
+	checkpoint_sequential(checkpoint, journal, old_checkpoint, old_journal);
+	checkpoint_concurrent(checkpoint, journal);
+	unlink(checkpoint);
+	unlink(journal);
+	unlink(old_checkpoint);
+	unlink(old_journal);
+}
@@ -0,0 +1,132 @@
+// Test zmian nazw (tree_move w obrębie jednego folderu).
+//
+// Każdy pisarz ma w każdym z folderów PARENTS jeden folder (litera pisarza i numer), który w kółko przemianowuje
+// na kolejny numer. Czytelnicy w tym czasie listują foldery PARENTS - zmiana nazwy jest atomowa, więc na każdej liście
+// każdy pisarz musi występować dokładnie raz - oraz przemianowywane foldery, które mają zawsze tę samą zawartość.
+
+#define WRITERS 4
+#define READERS 2
+#define ITERATIONS 20000
+#define PARENTS "ab"
+#define NAMES_PER_WRITER 4
+
+#include "concurrent_renames.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static void make_path(char *path, char parent, int writer, int number) {
+	sprintf(path, "/%c/%c%c/", parent, 'e' + writer, 'a' + number);
+}
+
+static void* run_writer(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	int numbers[sizeof(PARENTS) - 1] = {0};
+	char source[16], target[16];
+
+	for (int i = 0; i < ITERATIONS; ++i) {
+		int parent = rand_r(&seed) % strlen(PARENTS);
+		int next = (numbers[parent] + 1) % NAMES_PER_WRITER;
+		make_path(source, PARENTS[parent], thread_data->id, numbers[parent]);
+		make_path(target, PARENTS[parent], thread_data->id, next);
+		assert(tree_move(thread_data->tree, source, target) == 0);
+		numbers[parent] = next;
+	}
+	return NULL;
+}
+
+static void* run_reader(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[16];
+
+	for (int i = 0; i < ITERATIONS; ++i) {
+		char parent = PARENTS[rand_r(&seed) % strlen(PARENTS)];
+		if (rand_r(&seed) % 2) {
+			sprintf(path, "/%c/", parent);
+			char *list = tree_list(thread_data->tree, path);
+			assert(list);
+			int seen[WRITERS] = {0};
+			for (const char *name = list; *name; name += name[2] ? 3 : 2) {
+				assert(name[0] >= 'e' && name[0] < 'e' + WRITERS);
+				assert(name[1] >= 'a' && name[1] < 'a' + NAMES_PER_WRITER);
+				seen[name[0] - 'e']++;
+			}
+			for (int writer = 0; writer < WRITERS; ++writer) {
+				assert(seen[writer] == 1);
+			}
+			free(list);
+		}
+		else {
+			make_path(path, parent, rand_r(&seed) % WRITERS, rand_r(&seed) % NAMES_PER_WRITER);
+			char *list = tree_list(thread_data->tree, path);
+			assert(!list || !strcmp(list, "x"));
+			free(list);
+		}
+	}
+	return NULL;
+}
+
+// Przypadki brzegowe wykonywane bez współbieżności.
+static void renames_sequential() {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/a/") == 0);
+	assert(tree_create(tree, "/a/b/") == 0);
+	assert(tree_create(tree, "/a/c/") == 0);
+	assert(tree_create(tree, "/a/b/d/") == 0);
+
+	assert(tree_move(tree, "/a/b/", "/a/c/") == EEXIST);
+	assert(tree_move(tree, "/a/x/", "/a/y/") == ENOENT);
+	assert(tree_move(tree, "/x/b/", "/x/c/") == ENOENT);
+	assert(tree_move(tree, "/a/b/", "/a/e/") == 0);
+
+	char *list = tree_list(tree, "/a/");
+	assert(!strcmp(list, "c,e"));
+	free(list);
+	list = tree_list(tree, "/a/e/");
+	assert(!strcmp(list, "d"));
+	free(list);
+	assert(tree_list(tree, "/a/b/") == NULL);
+	tree_free(tree);
+}
+
+void concurrent_renames() {
+	renames_sequential();
+
+	Tree *tree = tree_new();
+	char path[16];
+	for (const char *parent = PARENTS; *parent; ++parent) {
+		sprintf(path, "/%c/", *parent);
+		assert(tree_create(tree, path) == 0);
+		for (int writer = 0; writer < WRITERS; ++writer) {
+			make_path(path, *parent, writer, 0);
+			assert(tree_create(tree, path) == 0);
+			strcat(path, "x/");
+			assert(tree_create(tree, path) == 0);
+		}
+	}
+
+	pthread_t th[WRITERS + READERS];
+	ThreadData data[WRITERS + READERS];
+	for (int i = 0; i < WRITERS + READERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i < WRITERS ? i : i - WRITERS;
+		assert(pthread_create(&th[i], NULL, i < WRITERS ? run_writer : run_reader, &data[i]) == 0);
+	}
+	for (int i = 0; i < WRITERS + READERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	tree_free(tree);
+}
@@ -0,0 +1,3 @@
+#pragma once
+
+void concurrent_renames();
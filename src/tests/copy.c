@@ -0,0 +1,223 @@
+// Test kopiowania poddrzewa (tree_copy).
+//
+// Najpierw bez współbieżności sprawdza kody błędów, kopiowanie do poddrzewa źródła, niezależność kopii od źródła
+// i dużą kopię (budowaną przez wątki pomocnicze), porównując przejścia migawek po źródle i kopii. Potem wątki
+// przenoszą swoje elementy między folderami /src/, a główny wątek kopiuje /src/ i sprawdza, że w każdej kopii jest
+// każdy element dokładnie raz (kopia jest stanem źródła z jednej chwili).
+
+#define MOVERS 4
+#define ITEMS 8
+#define FOLDERS 4
+#define FANOUT 6
+#define BIG 6000
+#define COPIES 40
+
+#include "copy.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Ścieżki odwiedzone przez tree_snapshot_walk (bez prefiksu długości skip), oddzielone przecinkami.
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+	size_t skip;
+} Visited;
+
+static void visit(const char *path, void *arg) {
+	Visited *visited = arg;
+	path += visited->skip;
+	size_t length = strlen(path);
+	if (visited->length + length + 2 > visited->capacity) {
+		visited->capacity = 2 * (visited->length + length + 2);
+		visited->data = realloc(visited->data, visited->capacity);
+		assert(visited->data);
+	}
+	if (visited->length > 0) {
+		visited->data[visited->length++] = ',';
+	}
+	memcpy(visited->data + visited->length, path, length + 1);
+	visited->length += length;
+}
+
+// Poddrzewo folderu path, ze ścieżkami względem niego.
+static char *walk(Tree *tree, const char *path) {
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+	Visited visited = {.data = NULL, .length = 0, .capacity = 0, .skip = strlen(path) - 1};
+	assert(tree_snapshot_walk(snapshot, path, visit, &visited) == 0);
+	tree_snapshot_free(snapshot);
+	return visited.data;
+}
+
+static void check_same(Tree *tree, const char *source, const char *target) {
+	char *source_walk = walk(tree, source);
+	char *target_walk = walk(tree, target);
+	assert(!strcmp(source_walk, target_walk));
+	free(source_walk);
+	free(target_walk);
+}
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static void copy_sequential() {
+	Tree *tree = tree_new();
+	const char *initial[] = {"/a/", "/a/b/", "/a/b/c/", "/a/d/", "/e/"};
+	for (int i = 0; i < 5; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+
+	assert(tree_copy(tree, "a", "/x/") == EINVAL);
+	assert(tree_copy(tree, "/a/", "x") == EINVAL);
+	assert(tree_copy(tree, "/a/", "/") == EEXIST);
+	assert(tree_copy(tree, "/a/", "/e/") == EEXIST);
+	assert(tree_copy(tree, "/a/", "/a/") == EEXIST);
+	assert(tree_copy(tree, "/q/", "/x/") == ENOENT);
+	assert(tree_copy(tree, "/a/", "/q/x/") == ENOENT);
+	check_list(tree_list(tree, "/"), "a,e");
+
+	assert(tree_copy(tree, "/a/", "/e/f/") == 0);
+	check_same(tree, "/a/", "/e/f/");
+	check_list(tree_list(tree, "/e/f/"), "b,d");
+
+	// Kopia jest niezależna od źródła.
+	assert(tree_create(tree, "/e/f/b/g/") == 0);
+	assert(tree_remove(tree, "/a/d/") == 0);
+	check_list(tree_list(tree, "/a/"), "b");
+	check_list(tree_list(tree, "/a/b/"), "c");
+	check_list(tree_list(tree, "/e/f/"), "b,d");
+	check_list(tree_list(tree, "/e/f/b/"), "c,g");
+
+	// Kopia do poddrzewa źródła to stan źródła sprzed kopiowania.
+	assert(tree_copy(tree, "/a/", "/a/b/c/h/") == 0);
+	char *copied = walk(tree, "/a/b/c/h/");
+	assert(!strcmp(copied, "/,/b/,/b/c/"));
+	free(copied);
+	assert(tree_copy(tree, "/", "/e/r/") == 0);
+	check_list(tree_list(tree, "/e/r/"), "a,e");
+	check_list(tree_list(tree, "/e/r/e/"), "f");
+	check_list(tree_list(tree, "/e/r/a/b/c/h/b/"), "c");
+
+	// Duża kopia budowana przez kilka wątków.
+	assert(tree_create(tree, "/big/") == 0);
+	static char paths[BIG][32];
+	strcpy(paths[0], "/big/");
+	for (int i = 1; i < BIG; ++i) {
+		size_t length = strlen(paths[(i - 1) / FANOUT]);
+		memcpy(paths[i], paths[(i - 1) / FANOUT], length);
+		paths[i][length] = 'a' + (i - 1) % FANOUT;
+		strcpy(paths[i] + length + 1, "/");
+		assert(tree_create(tree, paths[i]) == 0);
+	}
+	assert(tree_copy(tree, "/big/", "/e/big/") == 0);
+	check_same(tree, "/big/", "/e/big/");
+	assert(tree_remove_recursive(tree, "/big/") == 0);
+	check_list(tree_list(tree, "/e/big/a/a/"), "a,b,c,d,e,f");
+
+	tree_free(tree);
+}
+
+static atomic_bool moving;
+
+static void item_path(char *s, int folder, int mover, int item) {
+	sprintf(s, "/src/%c/i%c%c/", 'a' + folder, 'a' + mover, 'a' + item);
+}
+
+static void* run_mover(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	int where[ITEMS];
+	for (int item = 0; item < ITEMS; ++item) {
+		where[item] = item % FOLDERS;
+	}
+	while (atomic_load(&moving)) {
+		char source[32], target[32];
+		int item = rand_r(&seed) % ITEMS, folder = rand_r(&seed) % FOLDERS;
+		item_path(source, where[item], thread_data->id, item);
+		item_path(target, folder, thread_data->id, item);
+		int err = tree_move(thread_data->tree, source, target);
+		assert(err == 0 || (err == EEXIST && folder == where[item]));
+		where[item] = folder;
+	}
+	return NULL;
+}
+
+// Każdy element jest w kopii dokładnie raz.
+static void check_items(Tree *tree, const char *copy) {
+	int seen[MOVERS][ITEMS] = {0};
+	for (int folder = 0; folder < FOLDERS; ++folder) {
+		char path[32];
+		sprintf(path, "%s%c/", copy, 'a' + folder);
+		char *list = tree_list(tree, path);
+		assert(list);
+		for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+			assert(strlen(name) == 3 && name[0] == 'i');
+			seen[name[1] - 'a'][name[2] - 'a']++;
+		}
+		free(list);
+	}
+	for (int mover = 0; mover < MOVERS; ++mover) {
+		for (int item = 0; item < ITEMS; ++item) {
+			assert(seen[mover][item] == 1);
+		}
+	}
+}
+
+static void copy_concurrent() {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/src/") == 0);
+	for (int folder = 0; folder < FOLDERS; ++folder) {
+		char path[32];
+		sprintf(path, "/src/%c/", 'a' + folder);
+		assert(tree_create(tree, path) == 0);
+	}
+	for (int mover = 0; mover < MOVERS; ++mover) {
+		for (int item = 0; item < ITEMS; ++item) {
+			char path[32];
+			item_path(path, item % FOLDERS, mover, item);
+			assert(tree_create(tree, path) == 0);
+		}
+	}
+
+	atomic_store(&moving, true);
+	pthread_t th[MOVERS];
+	ThreadData data[MOVERS];
+	for (int i = 0; i < MOVERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_mover, &data[i]) == 0);
+	}
+
+	for (int i = 0; i < COPIES; ++i) {
+		assert(tree_copy(tree, "/src/", "/copy/") == 0);
+		check_items(tree, "/copy/");
+		assert(tree_remove_recursive(tree, "/copy/") == 0);
+	}
+
+	atomic_store(&moving, false);
+	for (int i = 0; i < MOVERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	check_items(tree, "/src/");
+	tree_free(tree);
+}
+
+void copy() {
+	copy_sequential();
+	copy_concurrent();
+}
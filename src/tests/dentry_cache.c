@@ -0,0 +1,158 @@
+// Test pamięci podręcznej ścieżek (dcache.h).
+//
+// Najpierw bez współbieżności sprawdza, że wpisy są używane (liczniki z tree_get_stats) i że operacja nie trafia przez
+// wpis do złego wierzchołka, gdy folder z prefiksu został przeniesiony, albo usunięty i utworzony od nowa. Potem wątki
+// tworzą, usuwają i listują swoje foldery na głębokiej ścieżce, a jeden wątek w tym czasie przenosi sąsiednie
+// poddrzewo oraz usuwa i tworzy od nowa inną głęboką ścieżkę (żeby pamięć usuniętych wierzchołków była używana
+// ponownie). Ścieżki wątków się nie zmieniają, więc wyniki ich operacji muszą się zgadzać ze stanem, który znają.
+
+#define WORKERS 4
+#define ITERATIONS 20000
+#define MOVES 2000
+
+#include "dentry_cache.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	bool exists;
+} ThreadData;
+
+static atomic_bool moving_done;
+
+static void check_list(char *list, const char *expected) {
+	assert(list && !strcmp(list, expected));
+	free(list);
+}
+
+static void create_all(Tree *tree, const char **paths, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		assert(tree_create(tree, paths[i]) == 0);
+	}
+}
+
+static void dentry_cache_sequential() {
+	Tree *tree = tree_new();
+	const char *folders[] = {"/a/", "/a/b/", "/a/b/c/", "/a/b/c/d/"};
+	create_all(tree, folders, 4);
+
+	TreeStats before, after;
+	tree_get_stats(tree, &before);
+	assert(tree_create(tree, "/a/b/c/d/e/") == 0);
+	assert(tree_create(tree, "/a/b/c/d/f/") == 0);
+	check_list(tree_list(tree, "/a/b/c/d/"), "e,f");
+	tree_get_stats(tree, &after);
+	assert(after.dentry_cache_misses > before.dentry_cache_misses);
+	assert(after.dentry_cache_hits >= before.dentry_cache_hits + 2);
+
+	// Zapamiętane /a/b/c/ prowadzi teraz do /x/c/.
+	tree_get_stats(tree, &before);
+	assert(tree_move(tree, "/a/b/", "/x/") == 0);
+	assert(tree_list(tree, "/a/b/c/d/") == NULL);
+	assert(tree_create(tree, "/a/b/c/d/g/") == ENOENT);
+	check_list(tree_list(tree, "/x/c/d/"), "e,f");
+	create_all(tree, folders + 1, 3);
+	assert(tree_create(tree, "/a/b/c/d/g/") == 0);
+	check_list(tree_list(tree, "/a/b/c/d/"), "g");
+	check_list(tree_list(tree, "/x/c/d/"), "e,f");
+	assert(tree_remove(tree, "/a/b/c/d/e/") == ENOENT);
+	tree_get_stats(tree, &after);
+	assert(after.dentry_cache_invalidations > before.dentry_cache_invalidations);
+
+	// Zapamiętane /a/b/c/ zostaje usunięte, a jego pamięć może zostać użyta na nowe foldery.
+	assert(tree_remove(tree, "/a/b/c/d/g/") == 0);
+	assert(tree_remove(tree, "/a/b/c/d/") == 0);
+	assert(tree_remove(tree, "/a/b/c/") == 0);
+	assert(tree_create(tree, "/a/b/c/d/h/") == ENOENT);
+	create_all(tree, folders + 2, 2);
+	assert(tree_create(tree, "/a/b/c/d/h/") == 0);
+	check_list(tree_list(tree, "/a/b/c/d/"), "h");
+	check_list(tree_list(tree, "/x/c/d/"), "e,f");
+
+	tree_free(tree);
+}
+
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[] = "/a/b/c/d/?/x/";
+	char parent[] = "/a/b/c/d/?/";
+	path[9] = parent[9] = 'e' + thread_data->id;
+
+	for (int i = 0; i < ITERATIONS || !atomic_load(&moving_done); ++i) {
+		int op = rand_r(&seed) % 3;
+		if (op == 0) {
+			int err = tree_create(thread_data->tree, path);
+			assert(err == (thread_data->exists ? EEXIST : 0));
+			thread_data->exists = true;
+		}
+		else if (op == 1) {
+			int err = tree_remove(thread_data->tree, path);
+			assert(err == (thread_data->exists ? 0 : ENOENT));
+			thread_data->exists = false;
+		}
+		else {
+			check_list(tree_list(thread_data->tree, parent), thread_data->exists ? "x" : "");
+		}
+	}
+	return NULL;
+}
+
+void dentry_cache() {
+	dentry_cache_sequential();
+
+	Tree *tree = tree_new();
+	const char *folders[] = {"/a/", "/a/b/", "/a/b/c/", "/a/b/c/d/", "/a/b/s/", "/a/b/s/t/"};
+	create_all(tree, folders, 6);
+	char path[] = "/a/b/c/d/?/";
+	for (int i = 0; i < WORKERS; ++i) {
+		path[9] = 'e' + i;
+		assert(tree_create(tree, path) == 0);
+	}
+
+	atomic_store(&moving_done, false);
+	pthread_t th[WORKERS];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].exists = false;
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+
+	const char *deep[] = {"/r/", "/r/s/", "/r/s/t/", "/r/s/t/u/", "/r/s/t/u/v/"};
+	for (int i = 0; i < MOVES; ++i) {
+		assert(tree_move(tree, i % 2 ? "/a/t/" : "/a/b/s/t/", i % 2 ? "/a/b/s/t/" : "/a/t/") == 0);
+		if (i % 4 == 0) {
+			create_all(tree, deep, 5);
+			check_list(tree_list(tree, "/r/s/t/u/"), "v");
+			assert(tree_remove(tree, "/r/s/t/u/v/") == 0);
+			assert(tree_remove(tree, "/r/s/t/u/") == 0);
+			assert(tree_remove(tree, "/r/s/t/") == 0);
+			assert(tree_list(tree, "/r/s/t/u/") == NULL);
+			assert(tree_remove(tree, "/r/s/") == 0);
+			assert(tree_remove(tree, "/r/") == 0);
+		}
+	}
+	atomic_store(&moving_done, true);
+
+	for (int i = 0; i < WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	for (int i = 0; i < WORKERS; ++i) {
+		path[9] = 'e' + i;
+		check_list(tree_list(tree, path), data[i].exists ? "x" : "");
+	}
+
+	tree_free(tree);
+}
@@ -0,0 +1,148 @@
+// Test uchwytów folderów (tree_open_dir i operacje *_at).
+//
+// Najpierw sprawdza przypadki brzegowe bez współbieżności: operacje względem uchwytu, przeniesienie folderu uchwytu
+// i jego usunięcie. Potem wątki tworzą, usuwają i listują swoje foldery przez wspólny uchwyt folderu /a/b/, a jeden
+// wątek w tym czasie przenosi /a/ na /x/ i z powrotem. Przeniesienia nie zmieniają ścieżek względem uchwytu, więc
+// wyniki operacji muszą się zgadzać ze stanem, który zna wątek.
+
+#define WORKERS 4
+#define ITERATIONS 20000
+#define MOVES 2000
+
+#include "dir_handles.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	TreeDir *dir;
+	int id;
+	bool exists;
+} ThreadData;
+
+static atomic_bool moving_done;
+
+static void check_list(char *list, const char *expected) {
+	assert(list && !strcmp(list, expected));
+	free(list);
+}
+
+static void dir_handles_sequential() {
+	Tree *tree = tree_new();
+	assert(tree_open_dir(tree, "/a/") == NULL);
+	assert(tree_open_dir(tree, "a") == NULL);
+	assert(tree_create(tree, "/a/") == 0);
+	assert(tree_create(tree, "/a/b/") == 0);
+
+	TreeDir *dir = tree_open_dir(tree, "/a/b/");
+	assert(dir);
+	assert(tree_create_at(tree, dir, "/c/") == 0);
+	assert(tree_create_at(tree, dir, "/c/") == EEXIST);
+	assert(tree_create_at(tree, dir, "/") == EEXIST);
+	check_list(tree_list(tree, "/a/b/"), "c");
+	check_list(tree_list_at(tree, dir, "/"), "c");
+
+	// Uchwyt idzie za przeniesionym folderem.
+	assert(tree_move(tree, "/a/", "/x/") == 0);
+	assert(tree_create_at(tree, dir, "/c/d/") == 0);
+	check_list(tree_list(tree, "/x/b/c/"), "d");
+	assert(tree_move_at(tree, dir, "/c/", "/e/") == 0);
+	assert(tree_move_at(tree, dir, "/e/d/", "/d/") == 0);
+	assert(tree_move_at(tree, dir, "/", "/f/") == EBUSY);
+	assert(tree_move_at(tree, dir, "/d/", "/d/g/") == -1);
+	check_list(tree_list_at(tree, dir, "/"), "d,e");
+	assert(tree_remove_at(tree, dir, "/d/") == 0);
+	assert(tree_remove_at(tree, dir, "/e/") == 0);
+
+	// Po usunięciu folderu uchwyt jest nadal ważny, ale folder już nie istnieje.
+	assert(tree_remove(tree, "/x/b/") == 0);
+	assert(tree_list_at(tree, dir, "/") == NULL);
+	assert(tree_create_at(tree, dir, "/f/") == ENOENT);
+	assert(tree_remove_at(tree, dir, "/f/") == ENOENT);
+	assert(tree_move_at(tree, dir, "/f/", "/g/") == ENOENT);
+	assert(tree_create(tree, "/x/b/") == 0);
+	assert(tree_list_at(tree, dir, "/") == NULL);
+	tree_close_dir(tree, dir);
+
+	dir = tree_open_dir(tree, "/");
+	check_list(tree_list_at(tree, dir, "/"), "x");
+	tree_close_dir(tree, dir);
+	tree_free(tree);
+}
+
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[] = "/?/";
+	path[1] = 'e' + thread_data->id;
+
+	for (int i = 0; i < ITERATIONS || !atomic_load(&moving_done); ++i) {
+		int op = rand_r(&seed) % 3;
+		if (op == 0) {
+			int err = tree_create_at(thread_data->tree, thread_data->dir, path);
+			assert(err == (thread_data->exists ? EEXIST : 0));
+			thread_data->exists = true;
+		}
+		else if (op == 1) {
+			int err = tree_remove_at(thread_data->tree, thread_data->dir, path);
+			assert(err == (thread_data->exists ? 0 : ENOENT));
+			thread_data->exists = false;
+		}
+		else {
+			char *list = tree_list_at(thread_data->tree, thread_data->dir, "/");
+			assert(list);
+			assert((strchr(list, path[1]) != NULL) == thread_data->exists);
+			free(list);
+		}
+	}
+	return NULL;
+}
+
+void dir_handles() {
+	dir_handles_sequential();
+
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/a/") == 0);
+	assert(tree_create(tree, "/a/b/") == 0);
+	TreeDir *dir = tree_open_dir(tree, "/a/b/");
+	assert(dir);
+
+	atomic_store(&moving_done, false);
+	pthread_t th[WORKERS];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		data[i].tree = tree;
+		data[i].dir = dir;
+		data[i].id = i;
+		data[i].exists = false;
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+
+	for (int i = 0; i < MOVES; ++i) {
+		assert(tree_move(tree, i % 2 ? "/x/" : "/a/", i % 2 ? "/a/" : "/x/") == 0);
+	}
+	atomic_store(&moving_done, true);
+
+	for (int i = 0; i < WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	char *list = tree_list(tree, "/a/b/");
+	char *list_at = tree_list_at(tree, dir, "/");
+	assert(list && list_at && !strcmp(list, list_at));
+	for (int i = 0; i < WORKERS; ++i) {
+		assert((strchr(list, 'e' + i) != NULL) == data[i].exists);
+	}
+	free(list);
+	free(list_at);
+
+	tree_close_dir(tree, dir);
+	tree_free(tree);
+}
@@ -0,0 +1,285 @@
+// Test zrzutu i wczytywania drzewa (tree_dump, tree_load).
+//
+// Najpierw bez współbieżności sprawdza kody błędów, puste drzewo, drzewo z różnymi nazwami i duże drzewo (wczytywane
+// przez kilka wątków), porównując przejścia migawek po oryginale i wczytanym drzewie. Każdy ucięty zrzut musi zostać
+// odrzucony, a zrzut z dowolnym zmienionym bajtem - odrzucony albo wczytany bez błędów pamięci. Potem wątki
+// przenoszą swoje elementy między folderami /src/, a główny wątek zrzuca drzewo i sprawdza, że w każdym wczytanym
+// zrzucie jest każdy element dokładnie raz (zrzut jest stanem drzewa z jednej chwili). W tym czasie inny wątek zrzuca
+// drzewo do tego samego pliku - zrzuty nie mogą się wymieszać.
+
+#define MOVERS 4
+#define ITEMS 8
+#define FOLDERS 4
+#define FANOUT 6
+#define BIG 6000
+#define DUMPS 20
+
+#include "dump.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	const char *file;
+} ThreadData;
+
+// Ścieżki odwiedzone przez tree_snapshot_walk, oddzielone przecinkami.
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Visited;
+
+static void visit(const char *path, void *arg) {
+	Visited *visited = arg;
+	size_t length = strlen(path);
+	if (visited->length + length + 2 > visited->capacity) {
+		visited->capacity = 2 * (visited->length + length + 2);
+		visited->data = realloc(visited->data, visited->capacity);
+		assert(visited->data);
+	}
+	if (visited->length > 0) {
+		visited->data[visited->length++] = ',';
+	}
+	memcpy(visited->data + visited->length, path, length + 1);
+	visited->length += length;
+}
+
+static char *walk(Tree *tree) {
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+	Visited visited = {.data = NULL, .length = 0, .capacity = 0};
+	assert(tree_snapshot_walk(snapshot, "/", visit, &visited) == 0);
+	tree_snapshot_free(snapshot);
+	return visited.data;
+}
+
+// Zrzuca drzewo, wczytuje zrzut do nowego drzewa i sprawdza, że wyszło to samo drzewo.
+static void check_round_trip(Tree *tree, const char *file) {
+	assert(tree_dump(tree, file) == 0);
+	Tree *loaded = tree_new();
+	assert(tree_load(loaded, file) == 0);
+	char *expected = walk(tree);
+	char *result = walk(loaded);
+	assert(!strcmp(expected, result));
+	free(expected);
+	free(result);
+	tree_free(loaded);
+}
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static char *read_file(const char *file, long *size) {
+	FILE *in = fopen(file, "rb");
+	assert(in);
+	fseek(in, 0, SEEK_END);
+	*size = ftell(in);
+	fseek(in, 0, SEEK_SET);
+	char *data = malloc(*size);
+	assert(data && fread(data, 1, *size, in) == (size_t) *size);
+	fclose(in);
+	return data;
+}
+
+static void write_file(const char *file, const char *data, long size) {
+	FILE *out = fopen(file, "wb");
+	assert(out && fwrite(data, 1, size, out) == (size_t) size);
+	fclose(out);
+}
+
+// Wczytuje zrzut zapisany w data i zwraca kod błędu tree_load.
+static int load_data(const char *file, const char *data, long size) {
+	write_file(file, data, size);
+	Tree *tree = tree_new();
+	int err = tree_load(tree, file);
+	if (err == 0) {
+		free(walk(tree));
+	}
+	tree_free(tree);
+	return err;
+}
+
+static void dump_sequential(const char *file, const char *broken) {
+	Tree *tree = tree_new();
+	assert(tree_load(tree, file) == ENOENT);
+	write_file(file, "not a dump", 10);
+	assert(tree_load(tree, file) == EINVAL);
+	assert(tree_dump(tree, "/nonexistent/dir/dump") == ENOENT);
+
+	// Puste drzewo.
+	check_round_trip(tree, file);
+
+	const char *initial[] = {"/a/", "/a/b/", "/a/b/c/", "/a/ab/", "/a/abc/", "/a/abd/", "/a/b/c/zz/", "/ab/",
+	                         "/ab/a/"};
+	for (int i = 0; i < 9; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+	assert(tree_dump(tree, file) == 0);
+	Tree *loaded = tree_new();
+	assert(tree_load(loaded, file) == 0);
+	check_list(tree_list(loaded, "/"), "a,ab");
+	check_list(tree_list(loaded, "/a/"), "ab,abc,abd,b");
+	check_list(tree_list(loaded, "/a/b/c/"), "zz");
+	// Wczytane drzewo jest zwykłym drzewem, a do niepustego nie da się wczytać zrzutu.
+	assert(tree_move(loaded, "/a/b/", "/ab/a/b/") == 0);
+	check_list(tree_list(loaded, "/ab/a/b/"), "c");
+	assert(tree_load(loaded, file) == ENOTEMPTY);
+	check_list(tree_list(loaded, "/a/"), "ab,abc,abd");
+	tree_free(loaded);
+
+	// Ucięty zrzut zawsze jest odrzucany, a zmieniony - odrzucany albo wczytywany jako jakieś drzewo.
+	long size;
+	char *data = read_file(file, &size);
+	for (long length = 0; length < size; ++length) {
+		assert(load_data(broken, data, length) == EINVAL);
+	}
+	for (long i = 0; i < size; ++i) {
+		for (int bit = 0; bit < 8; ++bit) {
+			data[i] ^= 1 << bit;
+			int err = load_data(broken, data, size);
+			assert(err == 0 || err == EINVAL);
+			data[i] ^= 1 << bit;
+		}
+	}
+	assert(load_data(broken, data, size) == 0);
+	free(data);
+
+	// Duże drzewo, wczytywane przez kilka wątków.
+	assert(tree_create(tree, "/big/") == 0);
+	static char paths[BIG][32];
+	strcpy(paths[0], "/big/");
+	for (int i = 1; i < BIG; ++i) {
+		size_t length = strlen(paths[(i - 1) / FANOUT]);
+		memcpy(paths[i], paths[(i - 1) / FANOUT], length);
+		paths[i][length] = 'a' + (i - 1) % FANOUT;
+		strcpy(paths[i] + length + 1, "/");
+		assert(tree_create(tree, paths[i]) == 0);
+	}
+	check_round_trip(tree, file);
+	tree_free(tree);
+}
+
+static atomic_bool moving;
+
+static void item_path(char *s, int folder, int mover, int item) {
+	sprintf(s, "/src/%c/i%c%c/", 'a' + folder, 'a' + mover, 'a' + item);
+}
+
+static void* run_mover(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	int where[ITEMS];
+	for (int item = 0; item < ITEMS; ++item) {
+		where[item] = item % FOLDERS;
+	}
+	while (atomic_load(&moving)) {
+		char source[32], target[32];
+		int item = rand_r(&seed) % ITEMS, folder = rand_r(&seed) % FOLDERS;
+		item_path(source, where[item], thread_data->id, item);
+		item_path(target, folder, thread_data->id, item);
+		int err = tree_move(thread_data->tree, source, target);
+		assert(err == 0 || (err == EEXIST && folder == where[item]));
+		where[item] = folder;
+	}
+	return NULL;
+}
+
+// Każdy element jest w drzewie dokładnie raz.
+static void* run_dumper(void *data) {
+	ThreadData *thread_data = data;
+	while (atomic_load(&moving)) {
+		assert(tree_dump(thread_data->tree, thread_data->file) == 0);
+	}
+	return NULL;
+}
+
+static void check_items(Tree *tree) {
+	int seen[MOVERS][ITEMS] = {0};
+	for (int folder = 0; folder < FOLDERS; ++folder) {
+		char path[32];
+		sprintf(path, "/src/%c/", 'a' + folder);
+		char *list = tree_list(tree, path);
+		assert(list);
+		for (char *name = strtok(list, ","); name; name = strtok(NULL, ",")) {
+			assert(strlen(name) == 3 && name[0] == 'i');
+			seen[name[1] - 'a'][name[2] - 'a']++;
+		}
+		free(list);
+	}
+	for (int mover = 0; mover < MOVERS; ++mover) {
+		for (int item = 0; item < ITEMS; ++item) {
+			assert(seen[mover][item] == 1);
+		}
+	}
+}
+
+static void dump_concurrent(const char *file) {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/src/") == 0);
+	for (int folder = 0; folder < FOLDERS; ++folder) {
+		char path[32];
+		sprintf(path, "/src/%c/", 'a' + folder);
+		assert(tree_create(tree, path) == 0);
+	}
+	for (int mover = 0; mover < MOVERS; ++mover) {
+		for (int item = 0; item < ITEMS; ++item) {
+			char path[32];
+			item_path(path, item % FOLDERS, mover, item);
+			assert(tree_create(tree, path) == 0);
+		}
+	}
+
+	// Drzewa na wczytane zrzuty tworzymy, zanim ruszą wątki - tree_new ustawia globalne parametry hash-map.
+	Tree *loaded[DUMPS];
+	for (int i = 0; i < DUMPS; ++i) {
+		loaded[i] = tree_new();
+	}
+
+	atomic_store(&moving, true);
+	pthread_t th[MOVERS + 1];
+	ThreadData data[MOVERS + 1];
+	for (int i = 0; i <= MOVERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].file = file;
+		assert(pthread_create(&th[i], NULL, i < MOVERS ? run_mover : run_dumper, &data[i]) == 0);
+	}
+
+	for (int i = 0; i < DUMPS; ++i) {
+		assert(tree_dump(tree, file) == 0);
+		assert(tree_load(loaded[i], file) == 0);
+		check_items(loaded[i]);
+	}
+
+	atomic_store(&moving, false);
+	for (int i = 0; i <= MOVERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	check_items(tree);
+	for (int i = 0; i < DUMPS; ++i) {
+		tree_free(loaded[i]);
+	}
+	tree_free(tree);
+}
+
+void dump() {
+	char file[64], broken[64];
+	sprintf(file, "/tmp/pwfs-dump-%d", (int) getpid());
+	sprintf(broken, "/tmp/pwfs-dump-%d-broken", (int) getpid());
+	dump_sequential(file, broken);
+	dump_concurrent(file);
+	unlink(file);
+	unlink(broken);
+}
@@ -0,0 +1,81 @@
+// Test filtrów Blooma w HashMap.c: filtr może tylko przepuścić brakujący klucz, nigdy odrzucić obecnego.
+//
+// Wstawia i usuwa klucze tak, żeby przejść przez powiększanie i zmniejszanie tablic (w tym w trakcie migracji między
+// nimi) oraz przez przebudowę filtra w miejscu po wielu usunięciach przy stałym rozmiarze, i po każdym etapie sprawdza
+// wszystkie klucze - obecne i usunięte.
+
+#define KEYS 20000
+#define CHURN_ROUNDS 8
+
+#include "hashmap_misses.h"
+#include "../HashMap.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+static int values[KEYS];
+static bool present[KEYS];
+
+static void make_key(char *s, int n) {
+	sprintf(s, "k%d", n);
+}
+
+static void check_all(HashMap *map) {
+	size_t count = 0;
+	for (int i = 0; i < KEYS; ++i) {
+		char key[16];
+		make_key(key, i);
+		assert(hmap_get(map, key) == (present[i] ? &values[i] : NULL));
+		count += present[i];
+	}
+	assert(hmap_size(map) == count);
+}
+
+static void set(HashMap *map, int i, bool value) {
+	char key[16];
+	make_key(key, i);
+	bool changed = value ? hmap_insert(map, key, &values[i]) : hmap_remove(map, key);
+	assert(changed == (present[i] != value));
+	(void) changed;
+	present[i] = value;
+}
+
+void hashmap_misses() {
+	HashMap *map = hmap_new();
+	check_all(map);
+
+	for (int i = 0; i < KEYS; ++i) {
+		set(map, i, true);
+		// Sprawdzamy też w trakcie migracji do większej tablicy.
+		if (i == KEYS / 3) {
+			check_all(map);
+		}
+	}
+	check_all(map);
+
+	// Stały rozmiar, ale klucze się wymieniają - filtr musi być przebudowywany w miejscu.
+	for (int round = 0; round < CHURN_ROUNDS; ++round) {
+		for (int i = round % 2; i < KEYS; i += 2) {
+			set(map, i, false);
+			set(map, i, true);
+		}
+		for (int i = 0; i < KEYS; i += 4) {
+			set(map, i + round % 4, false);
+		}
+		check_all(map);
+		for (int i = 0; i < KEYS; i += 4) {
+			set(map, i + round % 4, true);
+		}
+	}
+	check_all(map);
+
+	for (int i = 0; i < KEYS; ++i) {
+		set(map, i, false);
+		if (i == KEYS / 2 || i == KEYS - 10) {
+			check_all(map);
+		}
+	}
+	check_all(map);
+	hmap_free(map);
+}
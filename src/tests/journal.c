@@ -0,0 +1,249 @@
+// Test dziennika (tree_journal_open, tree_journal_replay).
+//
+// Najpierw bez współbieżności wykonuje wszystkie rodzaje zmian (także nieudane i przez uchwyty) i sprawdza, że
+// odtworzenie dziennika na nowym drzewie daje to samo drzewo (porównując przejścia migawek), także po urwaniu
+// ostatniego rekordu, po "awarii" z otwartym uchwytem i po dopisaniu kolejnej sesji do tego samego pliku. Potem
+// WRITERS wątków zmienia drzewo losowymi operacjami (z grupowym zatwierdzaniem), a jeden wątek dodatkowo kopiuje,
+// usuwa poddrzewa, wykonuje transakcje i używa uchwytów - odtworzone drzewo musi być takie samo jak oryginał.
+
+#define WRITERS 4
+#define OPERATIONS 150
+#define MIXED_ROUNDS 40
+
+#include "journal.h"
+#include "utils.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Ścieżki odwiedzone przez tree_snapshot_walk, oddzielone przecinkami.
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Visited;
+
+static void visit(const char *path, void *arg) {
+	Visited *visited = arg;
+	size_t length = strlen(path);
+	if (visited->length + length + 2 > visited->capacity) {
+		visited->capacity = 2 * (visited->length + length + 2);
+		visited->data = realloc(visited->data, visited->capacity);
+		assert(visited->data);
+	}
+	if (visited->length > 0) {
+		visited->data[visited->length++] = ',';
+	}
+	memcpy(visited->data + visited->length, path, length + 1);
+	visited->length += length;
+}
+
+static char *walk(Tree *tree) {
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+	Visited visited = {.data = NULL, .length = 0, .capacity = 0};
+	assert(tree_snapshot_walk(snapshot, "/", visit, &visited) == 0);
+	tree_snapshot_free(snapshot);
+	return visited.data;
+}
+
+// Odtwarza dziennik na nowym drzewie i sprawdza, że wyszło drzewo o przejściu expected.
+static void check_replay(const char *file, const char *expected) {
+	Tree *tree = tree_new();
+	assert(tree_journal_replay(tree, file) == 0);
+	char *replayed = walk(tree);
+	assert(!strcmp(replayed, expected));
+	free(replayed);
+	tree_free(tree);
+}
+
+// Kopiuje pierwsze length bajtów pliku (całość, jeśli length < 0).
+static void copy_file(const char *source, const char *target, long length) {
+	FILE *in = fopen(source, "rb");
+	FILE *out = fopen(target, "wb");
+	assert(in && out);
+	char buffer[4096];
+	size_t read;
+	while ((length < 0 || length > 0) && (read = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+		if (length >= 0 && (long) read > length) {
+			read = length;
+		}
+		assert(fwrite(buffer, 1, read, out) == read);
+		if (length >= 0) {
+			length -= read;
+		}
+	}
+	fclose(in);
+	fclose(out);
+}
+
+static long file_size(const char *file) {
+	FILE *in = fopen(file, "rb");
+	assert(in);
+	fseek(in, 0, SEEK_END);
+	long size = ftell(in);
+	fclose(in);
+	return size;
+}
+
+static void journal_sequential(const char *file, const char *crash) {
+	Tree *tree = tree_new();
+	assert(tree_journal_replay(tree, file) == ENOENT);
+	FILE *out = fopen(file, "wb");
+	assert(out && fputs("not a journal", out) >= 0);
+	fclose(out);
+	assert(tree_journal_replay(tree, file) == EINVAL);
+	assert(tree_journal_open(tree, file, TREE_JOURNAL_SYNC_EACH) == EINVAL);
+	unlink(file);
+
+	assert(tree_journal_open(tree, file, TREE_JOURNAL_SYNC_EACH) == 0);
+	const char *initial[] = {"/a/", "/a/b/", "/a/b/c/", "/a/d/", "/e/"};
+	for (int i = 0; i < 5; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+	assert(tree_create(tree, "/a/") == EEXIST);
+	assert(tree_remove(tree, "/a/") == ENOTEMPTY);
+	assert(tree_move(tree, "/a/", "/a/b/x/") != 0);
+	assert(tree_move(tree, "/a/d/", "/e/d/") == 0);
+	assert(tree_move(tree, "/e/", "/f/") == 0);
+	assert(tree_copy(tree, "/a/", "/f/g/") == 0);
+	assert(tree_remove_recursive(tree, "/a/b/") == 0);
+	assert(tree_remove(tree, "/f/d/") == 0);
+
+	const char *batch[] = {"/h/", "/h/i/", "/f/j/", "/f/"};
+	int errors[4];
+	tree_create_batch(tree, batch, 4, errors);
+	assert(errors[0] == 0 && errors[1] == 0 && errors[2] == 0 && errors[3] == EEXIST);
+	const char *removed[] = {"/h/i/", "/h/i/", "/f/g/"};
+	tree_remove_batch(tree, removed, 3, errors);
+	assert(errors[0] == 0 && errors[1] == ENOENT && errors[2] == ENOTEMPTY);
+
+	TreeTransaction *transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/k/");
+	tree_transaction_move(transaction, "/f/j/", "/k/j/");
+	assert(tree_transaction_commit(tree, transaction, NULL) == 0);
+	assert(tree_transaction_commit(tree, transaction, NULL) == EEXIST);
+	tree_transaction_free(transaction);
+
+	// Uchwyt idzie za folderem, więc jego ścieżki liczą się od nowego miejsca.
+	TreeDir *dir = tree_open_dir(tree, "/k/");
+	assert(dir);
+	assert(tree_move(tree, "/k/", "/h/k/") == 0);
+	assert(tree_create_at(tree, dir, "/l/") == 0);
+	assert(tree_move_at(tree, dir, "/l/", "/j/l/") == 0);
+	assert(tree_remove_at(tree, dir, "/x/") == ENOENT);
+	tree_close_dir(tree, dir);
+
+	// Ostatni rekord urwany w połowie zapisu jest pomijany.
+	char *expected = walk(tree);
+	long size = file_size(file);
+	assert(tree_create(tree, "/m/") == 0);
+	copy_file(file, crash, size + 5);
+	check_replay(crash, expected);
+	free(expected);
+
+	// "Awaria" z otwartym uchwytem, po której ten sam plik dostaje kolejną sesję z nowymi numerami uchwytów.
+	dir = tree_open_dir(tree, "/h/k/");
+	assert(tree_create_at(tree, dir, "/n/") == 0);
+	copy_file(file, crash, -1);
+	tree_close_dir(tree, dir);
+
+	expected = walk(tree);
+	tree_free(tree);
+	check_replay(file, expected);
+	free(expected);
+
+	tree = tree_new();
+	assert(tree_journal_replay(tree, crash) == 0);
+	assert(tree_journal_open(tree, crash, TREE_JOURNAL_GROUP_COMMIT) == 0);
+	dir = tree_open_dir(tree, "/f/");
+	TreeDir *second = tree_open_dir(tree, "/h/");
+	assert(dir && second);
+	assert(tree_create_at(tree, dir, "/o/") == 0);
+	assert(tree_create_at(tree, second, "/p/") == 0);
+	assert(tree_remove_recursive(tree, "/h/k/") == 0);
+	expected = walk(tree);
+	tree_close_dir(tree, dir);
+	tree_close_dir(tree, second);
+	tree_free(tree);
+	check_replay(crash, expected);
+	free(expected);
+}
+
+static void* run_writer(void *data) {
+	ThreadData *thread_data = data;
+	int seed = thread_data->id + 1;
+	for (int i = 0; i < OPERATIONS; ++i) {
+		Operation *operation = get_random_operation(&seed, MASK_CREATE | MASK_REMOVE | MASK_MOVE);
+		run_operation(thread_data->tree, operation);
+		free_operation(operation);
+	}
+	return NULL;
+}
+
+static void* run_mixed(void *data) {
+	ThreadData *thread_data = data;
+	Tree *tree = thread_data->tree;
+	for (int i = 0; i < MIXED_ROUNDS; ++i) {
+		tree_copy(tree, "/a/", "/b/c/");
+		tree_remove_recursive(tree, "/c/");
+
+		TreeTransaction *transaction = tree_transaction_new();
+		tree_transaction_create(transaction, "/a/b/");
+		tree_transaction_move(transaction, "/a/b/", "/b/a/");
+		tree_transaction_commit(tree, transaction, NULL);
+		tree_transaction_free(transaction);
+
+		TreeDir *dir = tree_open_dir(tree, "/b/");
+		if (dir) {
+			tree_create_at(tree, dir, "/c/");
+			tree_move_at(tree, dir, "/c/", "/a/c/");
+			tree_close_dir(tree, dir);
+		}
+	}
+	return NULL;
+}
+
+static void journal_concurrent(const char *file) {
+	unlink(file);
+	Tree *tree = tree_new();
+	assert(tree_journal_open(tree, file, TREE_JOURNAL_GROUP_COMMIT) == 0);
+
+	pthread_t th[WRITERS + 1];
+	ThreadData data[WRITERS + 1];
+	for (int i = 0; i <= WRITERS; ++i) {
+		data[i] = (ThreadData) {.tree = tree, .id = i};
+		assert(pthread_create(&th[i], NULL, i < WRITERS ? run_writer : run_mixed, &data[i]) == 0);
+	}
+	for (int i = 0; i <= WRITERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	assert(stats.journal_records > 0 && stats.journal_syncs <= stats.journal_records);
+	char *expected = walk(tree);
+	tree_free(tree);
+	check_replay(file, expected);
+	free(expected);
+}
+
+void journal() {
+	char file[64], crash[64];
+	sprintf(file, "/tmp/pwfs-journal-%d", (int) getpid());
+	sprintf(crash, "/tmp/pwfs-journal-%d-crash", (int) getpid());
+	journal_sequential(file, crash);
+	journal_concurrent(file);
+	unlink(file);
+	unlink(crash);
+}
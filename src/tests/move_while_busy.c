@@ -0,0 +1,143 @@
+// Test przenoszenia folderu, w którego poddrzewie cały czas trwają inne operacje.
+//
+// Jeden wątek w kółko przenosi /a/ na /x/ i z powrotem, a robotnicy w tym czasie tworzą, usuwają i listują swoje
+// foldery w głębi przenoszonego poddrzewa (/a/b/c/ albo /x/b/c/, zależnie od tego, gdzie ich zdaniem jest). Przed
+// i po każdym przeniesieniu wątek przenoszący zwiększa licznik faz, więc robotnik wie, czy jego operacja mogła
+// zachodzić na przeniesienie. Operacja, która na żadne nie zachodziła, musi trafić w istniejącą ścieżkę; każda
+// operacja musi się zgadzać z tym, co robotnik wie o swoim folderze. Na końcu zawartość /a/b/c/ musi się zgadzać
+// ze stanem folderów wszystkich robotników.
+
+#define WORKERS 4
+#define ITERATIONS 20000
+#define MOVES 2000
+
+#include "move_while_busy.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+	bool exists; // czy folder robotnika istnieje (po zakończeniu wątku)
+} ThreadData;
+
+// Parzysta faza 2k: wykonano k przeniesień i żadne nie trwa; nieparzysta: trwa przeniesienie.
+static atomic_int phase;
+static atomic_bool moving_done;
+
+static char root_for_phase(int p) {
+	return (p / 2) % 2 == 0 ? 'a' : 'x';
+}
+
+static void* run_mover(void *data) {
+	Tree *tree = data;
+	for (int i = 0; i < MOVES; ++i) {
+		atomic_fetch_add(&phase, 1);
+		int err = i % 2 == 0 ? tree_move(tree, "/a/", "/x/") : tree_move(tree, "/x/", "/a/");
+		assert(err == 0);
+		(void) err;
+		atomic_fetch_add(&phase, 1);
+	}
+	atomic_store(&moving_done, true);
+	return NULL;
+}
+
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[16], parent[16];
+
+	for (int i = 0; i < ITERATIONS || !atomic_load(&moving_done); ++i) {
+		int before = atomic_load(&phase);
+		char root = root_for_phase(before);
+		sprintf(parent, "/%c/b/c/", root);
+		sprintf(path, "/%c/b/c/%c/", root, 'e' + thread_data->id);
+
+		int op = rand_r(&seed) % 3;
+		int err = 0;
+		char *list = NULL;
+		if (op == 0) {
+			err = tree_create(thread_data->tree, path);
+		}
+		else if (op == 1) {
+			err = tree_remove(thread_data->tree, path);
+		}
+		else {
+			list = tree_list(thread_data->tree, parent);
+		}
+
+		bool overlapped = before % 2 == 1 || atomic_load(&phase) != before;
+		if (op == 2) {
+			assert(list || overlapped);
+			if (list) {
+				bool listed = false;
+				for (const char *name = list; *name; name += name[1] ? 2 : 1) {
+					listed |= name[0] == 'e' + thread_data->id;
+				}
+				assert(listed == thread_data->exists);
+			}
+			free(list);
+			continue;
+		}
+
+		if (op == 0) {
+			// ENOENT: poddrzewo zostało przeniesione, zanim operacja do niego doszła.
+			if (err == ENOENT) {
+				assert(overlapped);
+				continue;
+			}
+			assert(err == (thread_data->exists ? EEXIST : 0));
+			thread_data->exists = true;
+		}
+		else {
+			if (!thread_data->exists) {
+				assert(err == ENOENT);
+				continue;
+			}
+			assert(err == 0 || (err == ENOENT && overlapped));
+			if (err == 0) {
+				thread_data->exists = false;
+			}
+		}
+	}
+	return NULL;
+}
+
+void move_while_busy() {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/a/") == 0);
+	assert(tree_create(tree, "/a/b/") == 0);
+	assert(tree_create(tree, "/a/b/c/") == 0);
+	atomic_store(&phase, 0);
+	atomic_store(&moving_done, false);
+
+	pthread_t th[WORKERS + 1];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		data[i].exists = false;
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+	assert(pthread_create(&th[WORKERS], NULL, run_mover, tree) == 0);
+	for (int i = 0; i <= WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	// MOVES jest parzyste, więc poddrzewo wróciło na miejsce.
+	char *list = tree_list(tree, "/a/b/c/");
+	assert(list);
+	for (int i = 0; i < WORKERS; ++i) {
+		assert((strchr(list, 'e' + i) != NULL) == data[i].exists);
+	}
+	free(list);
+	tree_free(tree);
+}
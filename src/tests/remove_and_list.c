@@ -0,0 +1,119 @@
+// Test odroczonego zwalniania usuniętych wierzchołków.
+//
+// Pisarze w kółko tworzą i usuwają foldery /p/x/ (każdy pisarz ma własne nazwy x), a czytelnicy w tym czasie
+// listują zarówno rodziców p, jak i same usuwane foldery - czyli czytają wierzchołki i hash-mapy, które właśnie są
+// zwalniane. Listowania muszą zwracać tylko nazwy, które mogły istnieć. Po zakończeniu wątków i tree_free
+// wszystkie usunięte wierzchołki i zwolniona pamięć hash-map muszą zostać faktycznie zwolnione.
+
+#define WRITERS 4
+#define READERS 4
+#define ITERATIONS 20000
+#define PARENTS "abcd"
+#define NAMES_PER_WRITER 4
+
+#include "remove_and_list.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Nazwa folderu: litera pisarza (od 'e') i litera numeru.
+static void make_path(char *path, char parent, int writer, int number) {
+	sprintf(path, "/%c/%c%c/", parent, 'e' + writer, 'a' + number);
+}
+
+static void* run_writer(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[16];
+
+	for (int i = 0; i < ITERATIONS; ++i) {
+		make_path(path, PARENTS[rand_r(&seed) % strlen(PARENTS)], thread_data->id,
+				  rand_r(&seed) % NAMES_PER_WRITER);
+		int err = tree_create(thread_data->tree, path);
+		if (err == EEXIST) {
+			err = tree_remove(thread_data->tree, path);
+		}
+		assert(err == 0);
+	}
+	return NULL;
+}
+
+// Sprawdza, że każda nazwa na liście jest nazwą, którą tworzy któryś z pisarzy.
+static void check_list(const char *list) {
+	for (const char *name = list; *name; ) {
+		const char *end = strchr(name, ',');
+		size_t length = end ? (size_t) (end - name) : strlen(name);
+		assert(length == 2);
+		assert(name[0] >= 'e' && name[0] < 'e' + WRITERS);
+		assert(name[1] >= 'a' && name[1] < 'a' + NAMES_PER_WRITER);
+		name += end ? length + 1 : length;
+	}
+}
+
+static void* run_reader(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	char path[16];
+
+	for (int i = 0; i < ITERATIONS; ++i) {
+		char parent = PARENTS[rand_r(&seed) % strlen(PARENTS)];
+		if (rand_r(&seed) % 2) {
+			sprintf(path, "/%c/", parent);
+		}
+		else {
+			make_path(path, parent, rand_r(&seed) % WRITERS, rand_r(&seed) % NAMES_PER_WRITER);
+		}
+
+		char *list = tree_list(thread_data->tree, path);
+		if (strlen(path) == 3) {
+			assert(list);
+			check_list(list);
+		}
+		else {
+			assert(!list || !strcmp(list, ""));
+		}
+		free(list);
+	}
+	return NULL;
+}
+
+void remove_and_list() {
+	Tree *tree = tree_new();
+	char path[4];
+	for (const char *parent = PARENTS; *parent; ++parent) {
+		sprintf(path, "/%c/", *parent);
+		assert(tree_create(tree, path) == 0);
+	}
+
+	pthread_t th[WRITERS + READERS];
+	ThreadData data[WRITERS + READERS];
+	for (int i = 0; i < WRITERS + READERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i < WRITERS ? i : i - WRITERS;
+		assert(pthread_create(&th[i], NULL, i < WRITERS ? run_writer : run_reader, &data[i]) == 0);
+	}
+	for (int i = 0; i < WRITERS + READERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	assert(stats.retired_nodes_pending <= stats.retired_pending);
+	tree_free(tree);
+
+	// Wątki skończyły, więc nic nie może już blokować zwolnienia pamięci.
+	tree = tree_new();
+	tree_get_stats(tree, &stats);
+	assert(stats.retired_nodes_pending == 0 && stats.retired_pending == 0);
+	tree_free(tree);
+}
@@ -0,0 +1,192 @@
+// Test usuwania poddrzewa (tree_remove_recursive).
+//
+// Najpierw bez współbieżności sprawdza kody błędów, że usunięte poddrzewo znika w całości (także dla uchwytów
+// i zapamiętanych w dcache.h ścieżek wewnątrz niego), a migawka sprzed usunięcia nadal je widzi. Potem główny wątek
+// wielokrotnie buduje poddrzewo /r/ i je usuwa, a w tym czasie wątki przenoszą swoje elementy między /r/ a /s/,
+// tworzą foldery w /r/ i przez uchwyty do /r/x/. Sprawdza, że usunięcie nie rusza niczego poza poddrzewem, że po
+// jego zakończeniu nic z poddrzewa nie trafia do nowego /r/ i że uchwyt do usuniętego folderu pozostaje pusty.
+
+#define WORKERS 4
+#define ITEMS 4
+#define SUBTREE 32
+#define ROUNDS 8
+
+#include "remove_recursive.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static void visit(const char *path, void *arg) {
+	(void) path;
+	++*(int *) arg;
+}
+
+static void remove_recursive_sequential() {
+	Tree *tree = tree_new();
+	assert(tree_remove_recursive(tree, "a") == EINVAL);
+	assert(tree_remove_recursive(tree, "/") == EBUSY);
+	assert(tree_remove_recursive(tree, "/a/") == ENOENT);
+
+	const char *initial[] = {"/a/", "/a/b/", "/a/b/c/", "/a/b/d/", "/a/e/", "/f/"};
+	for (int i = 0; i < 6; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+	// Głęboka ścieżka, żeby jej prefiks trafił do dcache.h.
+	char deep[64] = "/a/e/";
+	for (int i = 0; i < 8; ++i) {
+		strcat(deep, "g/");
+		assert(tree_create(tree, deep) == 0);
+	}
+	check_list(tree_list(tree, deep), "");
+	TreeDir *dir = tree_open_dir(tree, "/a/b/");
+	assert(dir);
+	TreeSnapshot *snapshot = tree_snapshot(tree);
+
+	// Pusty folder też można usunąć.
+	assert(tree_remove_recursive(tree, "/a/b/c/") == 0);
+	assert(tree_remove_recursive(tree, "/a/") == 0);
+	assert(tree_remove_recursive(tree, "/a/") == ENOENT);
+	assert(tree_remove_recursive(tree, "/a/b/") == ENOENT);
+	check_list(tree_list(tree, "/"), "f");
+	check_list(tree_list(tree, "/a/"), NULL);
+	check_list(tree_list(tree, deep), NULL);
+	check_list(tree_list_at(tree, dir, "/"), NULL);
+	assert(tree_create_at(tree, dir, "/x/") == ENOENT);
+	assert(tree_move(tree, "/a/e/", "/f/e/") == ENOENT);
+
+	// Migawka widzi całe poddrzewo.
+	int visited = 0;
+	assert(tree_snapshot_walk(snapshot, "/", visit, &visited) == 0);
+	assert(visited == 15);
+	check_list(tree_snapshot_list(snapshot, "/a/b/"), "c,d");
+	check_list(tree_snapshot_list(snapshot, deep), "");
+	tree_snapshot_free(snapshot);
+	tree_close_dir(tree, dir);
+
+	// Ścieżki w nowym folderze o tej samej nazwie nie prowadzą do starego poddrzewa.
+	assert(tree_create(tree, "/a/") == 0);
+	check_list(tree_list(tree, "/a/"), "");
+	assert(tree_create(tree, "/a/e/") == 0);
+	check_list(tree_list(tree, "/a/e/"), "");
+	assert(tree_remove_recursive(tree, "/f/") == 0);
+	check_list(tree_list(tree, "/"), "a");
+
+	tree_free(tree);
+}
+
+static atomic_bool working;
+
+// Przenosi swoje elementy między /r/x/, /s/ i /r/y/. Element w /s/ nie może zniknąć, a element w /r/ może zostać
+// usunięty razem z poddrzewem - wtedy tworzy go od nowa w /r/x/, gdy ten znów istnieje.
+static void* run_worker(void *data) {
+	ThreadData *thread_data = data;
+	Tree *tree = thread_data->tree;
+	bool outside[ITEMS] = {false};
+	unsigned seed = thread_data->id;
+	while (atomic_load(&working)) {
+		int item = rand_r(&seed) % ITEMS;
+		char inside_x[32], inside_y[32], in_s[32];
+		sprintf(inside_x, "/r/x/i%c%c/", 'a' + thread_data->id, 'a' + item);
+		sprintf(inside_y, "/r/y/i%c%c/", 'a' + thread_data->id, 'a' + item);
+		sprintf(in_s, "/s/i%c%c/", 'a' + thread_data->id, 'a' + item);
+		if (outside[item]) {
+			int err = tree_move(tree, in_s, rand_r(&seed) % 2 ? inside_x : inside_y);
+			assert(err == 0 || err == ENOENT);
+			if (err == ENOENT) {
+				assert(tree_move(tree, in_s, in_s) == 0);
+			}
+			outside[item] = err == ENOENT;
+			continue;
+		}
+
+		int err = tree_move(tree, inside_x, in_s);
+		if (err == ENOENT) {
+			err = tree_move(tree, inside_y, in_s);
+		}
+		if (err == ENOENT) {
+			err = tree_create(tree, inside_x);
+			assert(err == 0 || err == ENOENT);
+		}
+		else {
+			assert(err == 0);
+			outside[item] = true;
+		}
+
+		TreeDir *dir = tree_open_dir(tree, "/r/x/");
+		if (dir) {
+			char name[32];
+			sprintf(name, "/h%c/", 'a' + thread_data->id);
+			err = tree_create_at(tree, dir, name);
+			assert(err == 0 || err == EEXIST || err == ENOENT);
+			if (err == ENOENT) {
+				// Usunięty folder uchwytu pozostaje usunięty.
+				check_list(tree_list_at(tree, dir, "/"), NULL);
+				assert(tree_create_at(tree, dir, name) == ENOENT);
+			}
+			tree_close_dir(tree, dir);
+		}
+	}
+	return NULL;
+}
+
+static void remove_recursive_concurrent() {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/s/") == 0);
+	atomic_store(&working, true);
+	pthread_t th[WORKERS];
+	ThreadData data[WORKERS];
+	for (int i = 0; i < WORKERS; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, run_worker, &data[i]) == 0);
+	}
+
+	for (int round = 0; round < ROUNDS; ++round) {
+		assert(tree_create(tree, "/r/") == 0);
+		// Nic ze starego poddrzewa nie trafiło do nowego.
+		check_list(tree_list(tree, "/r/"), "");
+		assert(tree_create(tree, "/r/y/") == 0);
+		for (int i = 0; i < SUBTREE; ++i) {
+			char path[32];
+			sprintf(path, "/r/y/f%c/", 'a' + i % 8);
+			if (i >= 8) {
+				sprintf(path + strlen(path), "f%c/", 'a' + i / 8);
+			}
+			assert(tree_create(tree, path) == 0);
+		}
+		assert(tree_create(tree, "/r/x/") == 0);
+		sched_yield();
+		assert(tree_remove_recursive(tree, "/r/") == 0);
+		check_list(tree_list(tree, "/r/"), NULL);
+		assert(tree_remove_recursive(tree, "/r/") == ENOENT);
+	}
+
+	atomic_store(&working, false);
+	for (int i = 0; i < WORKERS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	tree_free(tree);
+}
+
+void remove_recursive() {
+	remove_recursive_sequential();
+	remove_recursive_concurrent();
+}
@@ -0,0 +1,376 @@
+// Test serwera drzewa (server.h) i jego klienta (client.h).
+//
+// Sprawdza wyniki wszystkich operacji wykonanych przez serwer, w tym błędnych ścieżek. Potem wysyła REQUESTS żądań
+// naraz (więcej, niż serwer przyjmuje jednocześnie od jednego klienta, a odpowiedzi z listami dzieci przekraczają
+// limit nieodebranych odpowiedzi) - każde musi dostać dokładnie jedną, poprawną odpowiedź. Błędna ramka ma zamknąć
+// połączenie, a klient rozłączający się z żądaniami w trakcie nie może zepsuć serwera. Klient, który wysyła
+// naraz wiele żądań (mniej i więcej, niż serwer przyjmuje jednocześnie) i zamyka swoją stronę połączenia (shutdown),
+// ma dostać odpowiedzi na wszystkie, a potem koniec połączenia. Na koniec CLIENTS klientów
+// naraz tworzy i usuwa foldery z DEPTH żądaniami w locie, a drzewo ma na końcu oczekiwaną zawartość.
+
+#define REQUESTS 3000
+#define CHILDREN 300
+#define CLIENTS 4
+#define CLIENT_REQUESTS 2000
+#define DEPTH 32
+#define HALF_CLOSE_REQUESTS 1000
+#define HALF_CLOSE_SMALL 200
+#define HALF_CLOSE_ROUNDS 10
+#define WORKERS 4
+
+#include "server.h"
+#include "../client.h"
+#include "../server.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef struct {
+	const char *socket;
+	int id;
+} ThreadData;
+
+// Nazwa folderu z liter odpowiadających cyfrom i w systemie o podstawie 26.
+static void name(int i, char *out) {
+	char digits[16];
+	int length = 0;
+	do {
+		digits[length++] = 'a' + i % 26;
+		i /= 26;
+	} while (i > 0);
+	while (length > 0) {
+		*out++ = digits[--length];
+	}
+	*out = '\0';
+}
+
+static void check_list(TreeClient *client, const char *path, const char *expected) {
+	char *list = tree_client_list(client, path);
+	assert(list && !strcmp(list, expected));
+	free(list);
+}
+
+static void server_operations(const char *socket) {
+	int err;
+	TreeClient *client = tree_client_connect(socket, &err);
+	assert(client && err == 0);
+	check_list(client, "/", "");
+	assert(tree_client_create(client, "/a/") == 0);
+	assert(tree_client_create(client, "/a/b/") == 0);
+	assert(tree_client_create(client, "/a/") == EEXIST);
+	assert(tree_client_create(client, "/x/y/") == ENOENT);
+	assert(tree_client_create(client, "/A/") == EINVAL);
+	assert(tree_client_list(client, "/x/") == NULL);
+	assert(tree_client_list(client, "a") == NULL);
+	check_list(client, "/a/", "b");
+	assert(tree_client_move(client, "/a/b/", "/c/") == 0);
+	assert(tree_client_move(client, "/a/", "/a/d/") < 0); // Własny kod błędu przeniesienia do poddrzewa.
+	check_list(client, "/", "a,c");
+	assert(tree_client_remove(client, "/") == EBUSY);
+	assert(tree_client_remove(client, "/c/") == 0);
+	assert(tree_client_remove(client, "/c/") == ENOENT);
+
+	// Za długa ścieżka nie jest wysyłana.
+	char *long_path = malloc(2 * 4096 + 2);
+	assert(long_path);
+	memset(long_path, 'a', 2 * 4096 + 1);
+	long_path[0] = '/';
+	long_path[2 * 4096 + 1] = '\0';
+	assert(tree_client_create(client, long_path) == EINVAL);
+	assert(tree_client_move(client, "/a/", long_path) == EINVAL);
+	free(long_path);
+	assert(tree_client_remove(client, "/a/") == 0);
+	tree_client_close(client);
+}
+
+static void server_pipelining(const char *socket) {
+	int err;
+	TreeClient *client = tree_client_connect(socket, &err);
+	assert(client);
+	assert(tree_client_create(client, "/p/") == 0);
+	char path[64];
+	for (int i = 0; i < CHILDREN; ++i) {
+		name(i, path + sprintf(path, "/p/"));
+		strcat(path, "/");
+		tree_client_send(client, TREE_OPERATION_CREATE, path, NULL);
+	}
+	for (int i = 0; i < CHILDREN; ++i) {
+		TreeClientResponse response;
+		assert(tree_client_receive(client, &response) == 0);
+		assert(response.operation == TREE_OPERATION_CREATE && response.result == 0);
+	}
+	char *expected = tree_client_list(client, "/p/");
+	assert(expected);
+	int commas = 0;
+	for (char *c = expected; *c; ++c) {
+		commas += *c == ',';
+	}
+	assert(commas == CHILDREN - 1);
+
+	// Na przemian listy, nieudane tworzenia i przeniesienia.
+	bool *answered = calloc(REQUESTS, sizeof(bool));
+	assert(answered);
+	uint64_t first = tree_client_send(client, TREE_OPERATION_LIST, "/p/", NULL);
+	for (int i = 1; i < REQUESTS; ++i) {
+		if (i % 3 == 0) {
+			tree_client_send(client, TREE_OPERATION_LIST, "/p/", NULL);
+		}
+		else if (i % 3 == 1) {
+			tree_client_send(client, TREE_OPERATION_CREATE, "/p/a/", NULL);
+		}
+		else {
+			tree_client_send(client, TREE_OPERATION_MOVE, "/q/", "/r/");
+		}
+	}
+	for (int i = 0; i < REQUESTS; ++i) {
+		TreeClientResponse response;
+		assert(tree_client_receive(client, &response) == 0);
+		assert(response.id >= first && response.id < first + REQUESTS);
+		int index = response.id - first;
+		assert(!answered[index]);
+		answered[index] = true;
+		if (index % 3 == 0) {
+			assert(response.operation == TREE_OPERATION_LIST && response.result == 0);
+			assert(!strcmp(response.listing, expected));
+		}
+		else if (index % 3 == 1) {
+			assert(response.operation == TREE_OPERATION_CREATE && response.result == EEXIST);
+			assert(!response.listing);
+		}
+		else {
+			assert(response.operation == TREE_OPERATION_MOVE && response.result == ENOENT);
+		}
+		free(response.listing);
+	}
+	free(answered);
+	free(expected);
+	tree_client_close(client);
+}
+
+static int raw_connect(const char *socket_path) {
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strcpy(address.sun_path, socket_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	assert(fd >= 0);
+	assert(connect(fd, (struct sockaddr *) &address, sizeof(address)) == 0);
+	return fd;
+}
+
+// Wysyła ramkę i sprawdza, że serwer zamknął połączenie bez odpowiedzi.
+static void check_rejected(const char *socket, const char *frame, size_t length) {
+	int fd = raw_connect(socket);
+	assert(write(fd, frame, length) == (ssize_t) length);
+	char buffer[64];
+	ssize_t received;
+	while ((received = read(fd, buffer, sizeof(buffer))) < 0 && errno == EINTR) {
+	}
+	assert(received <= 0);
+	close(fd);
+}
+
+static void server_malformed(const char *socket) {
+	// Długość, id, operacja, ścieżki.
+	char frame[32] = {0};
+	uint32_t length = 9 + 4;
+	memcpy(frame, &length, 4);
+	frame[12] = 7; // Nieznana operacja.
+	memcpy(frame + 13, "/a/", 4);
+	check_rejected(socket, frame, 4 + length);
+
+	frame[12] = TREE_OPERATION_MOVE; // Brak drugiej ścieżki.
+	check_rejected(socket, frame, 4 + length);
+
+	frame[12] = TREE_OPERATION_LIST;
+	frame[16] = 'x'; // Brak '\0' na końcu.
+	check_rejected(socket, frame, 4 + length);
+
+	length = 1 << 30; // Za długa.
+	memcpy(frame, &length, 4);
+	check_rejected(socket, frame, 4);
+}
+
+static void server_disconnect(const char *socket) {
+	for (int round = 0; round < 10; ++round) {
+		int err;
+		TreeClient *client = tree_client_connect(socket, &err);
+		assert(client);
+		for (int i = 0; i < 500; ++i) {
+			tree_client_send(client, i % 2 == 0 ? TREE_OPERATION_CREATE : TREE_OPERATION_REMOVE, "/gone/", NULL);
+			tree_client_send(client, TREE_OPERATION_LIST, "/", NULL);
+		}
+		assert(tree_client_flush(client) == 0);
+		tree_client_close(client);
+	}
+	// Serwer dalej działa.
+	int err;
+	TreeClient *client = tree_client_connect(socket, &err);
+	assert(client);
+	char *list = tree_client_list(client, "/");
+	assert(list);
+	free(list);
+	tree_client_close(client);
+}
+
+// Wysyła count żądań utworzenia folderów <base><i>/, zamyka swoją stronę i sprawdza, że dostaje count odpowiedzi.
+static void check_half_close(const char *socket, const char *base, int count) {
+	// Długość, id, operacja, ścieżka. Wszystkie żądania idą jednym write, więc serwer zwykle dostaje koniec danych,
+	// zanim wykona pierwsze.
+	char *requests = malloc(count * 48);
+	assert(requests);
+	size_t requests_length = 0;
+	for (int i = 0; i < count; ++i) {
+		char *frame = requests + requests_length;
+		uint64_t id = i;
+		char *path = frame + 13;
+		name(i, path + sprintf(path, "%s", base));
+		strcat(path, "/");
+		uint32_t length = 9 + strlen(path) + 1;
+		memcpy(frame, &length, 4);
+		memcpy(frame + 4, &id, 8);
+		frame[12] = TREE_OPERATION_CREATE;
+		requests_length += 4 + length;
+	}
+	int fd = raw_connect(socket);
+	assert(write(fd, requests, requests_length) == (ssize_t) requests_length);
+	assert(shutdown(fd, SHUT_WR) == 0);
+	free(requests);
+
+	size_t capacity = 1 << 16, received = 0;
+	char *buffer = malloc(capacity);
+	assert(buffer);
+	ssize_t length;
+	while ((length = read(fd, buffer + received, capacity - received)) != 0) {
+		if (length < 0) {
+			assert(errno == EINTR);
+			continue;
+		}
+		received += length;
+		if (received == capacity) {
+			capacity *= 2;
+			buffer = realloc(buffer, capacity);
+			assert(buffer);
+		}
+	}
+	close(fd);
+
+	bool *answered = calloc(count, sizeof(bool));
+	assert(answered);
+	size_t offset = 0;
+	int responses = 0;
+	while (offset < received) {
+		uint32_t frame_length;
+		uint64_t id;
+		int32_t result;
+		assert(received - offset >= 4 + 13);
+		memcpy(&frame_length, buffer + offset, 4);
+		assert(frame_length == 13 && received - offset >= 4 + frame_length);
+		memcpy(&id, buffer + offset + 4, 8);
+		memcpy(&result, buffer + offset + 12, 4);
+		assert(id < (uint64_t) count && !answered[id] && result == 0);
+		assert(buffer[offset + 16] == TREE_OPERATION_CREATE);
+		answered[id] = true;
+		responses++;
+		offset += 4 + frame_length;
+	}
+	assert(responses == count);
+	free(answered);
+	free(buffer);
+}
+
+static void server_half_close(const char *socket, Tree *tree) {
+	assert(tree_create(tree, "/h/") == 0);
+	char base[16];
+	// Mniej żądań, niż serwer przyjmuje naraz - czyta je wszystkie i koniec danych od razu.
+	for (int round = 0; round < HALF_CLOSE_ROUNDS; ++round) {
+		sprintf(base, "/h/%c/", 'a' + round);
+		assert(tree_create(tree, base) == 0);
+		check_half_close(socket, base, HALF_CLOSE_SMALL);
+	}
+	assert(tree_create(tree, "/h/z/") == 0);
+	check_half_close(socket, "/h/z/", HALF_CLOSE_REQUESTS);
+}
+
+static void receive_all(TreeClient *client, TreeOperation operation) {
+	for (int i = 0; i < DEPTH; ++i) {
+		TreeClientResponse response;
+		assert(tree_client_receive(client, &response) == 0);
+		assert(response.operation == operation && response.result == 0);
+		free(response.listing);
+	}
+}
+
+static void *run_client(void *arg) {
+	ThreadData *data = arg;
+	int err;
+	TreeClient *client = tree_client_connect(data->socket, &err);
+	assert(client);
+	char base[16], path[64];
+	sprintf(base, "/c/%c/", 'a' + data->id);
+	assert(tree_client_create(client, base) == 0);
+
+	// W locie jest naraz DEPTH żądań dotyczących różnych folderów, więc wynik nie zależy od kolejności ich wykonania.
+	for (int round = 0; round < CLIENT_REQUESTS / DEPTH / 2; ++round) {
+		for (int i = 0; i < DEPTH; ++i) {
+			name(round * DEPTH + i, path + sprintf(path, "%s", base));
+			strcat(path, "/");
+			tree_client_send(client, TREE_OPERATION_CREATE, path, NULL);
+		}
+		receive_all(client, TREE_OPERATION_CREATE);
+		for (int i = 0; i < DEPTH; ++i) {
+			name(round * DEPTH + i, path + sprintf(path, "%s", base));
+			strcat(path, "/");
+			tree_client_send(client, TREE_OPERATION_REMOVE, path, NULL);
+		}
+		receive_all(client, TREE_OPERATION_REMOVE);
+	}
+	tree_client_close(client);
+	return NULL;
+}
+
+static void server_concurrent(const char *socket, Tree *tree) {
+	assert(tree_create(tree, "/c/") == 0);
+	pthread_t th[CLIENTS];
+	ThreadData data[CLIENTS];
+	for (int i = 0; i < CLIENTS; ++i) {
+		data[i] = (ThreadData) {.socket = socket, .id = i};
+		assert(pthread_create(&th[i], NULL, run_client, &data[i]) == 0);
+	}
+	for (int i = 0; i < CLIENTS; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	char path[16];
+	for (int i = 0; i < CLIENTS; ++i) {
+		sprintf(path, "/c/%c/", 'a' + i);
+		char *list = tree_list(tree, path);
+		assert(list && !strcmp(list, ""));
+		free(list);
+	}
+}
+
+void server() {
+	char socket[64];
+	sprintf(socket, "/tmp/pwfs-server-%d", (int) getpid());
+	Tree *tree = tree_new();
+	int err;
+	Server *server = server_start(tree, socket, WORKERS, &err);
+	assert(server && err == 0);
+	server_operations(socket);
+	server_pipelining(socket);
+	server_malformed(socket);
+	server_disconnect(socket);
+	server_half_close(socket, tree);
+	server_concurrent(socket, tree);
+	server_stop(server);
+	assert(access(socket, F_OK) != 0);
+	tree_free(tree);
+}
@@ -0,0 +1,212 @@
+// Test drzewa we współdzielonej pamięci (SharedTree.h).
+//
+// Najpierw losowe operacje na małych ścieżkach wykonywane jednocześnie na SharedTree i na zwykłym drzewie muszą dać
+// te same wyniki i te same listy. Potem sprawdza błędy przy tworzeniu i otwieraniu segmentu oraz ENOSPC w za małym
+// segmencie. Na koniec PROCESSES procesów podłącza się do jednego drzewa i każdy ROUNDS razy tworzy, przenosi i usuwa
+// folder we własnym folderze /p/<id>/, a drugie tyle procesów w tym czasie listuje te foldery - każda lista musi być
+// jednym ze stanów, przez które przechodzi folder.
+
+#define OPERATIONS 20000
+#define SEGMENT_SIZE (1 << 22)
+#define SMALL_SEGMENT_SIZE 4096
+#define PROCESSES 4
+#define ROUNDS 2000
+
+#include "shared_tree.h"
+#include "utils.h"
+#include "../SharedTree.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static void shared_tree_same_as_tree(const char *name) {
+	int err;
+	SharedTree *shared = shared_tree_new(name, SEGMENT_SIZE, &err);
+	assert(shared && err == 0);
+	Tree *tree = tree_new();
+	int seed = 42;
+	for (int i = 0; i < OPERATIONS; ++i) {
+		char *path = get_random_small_path(&seed);
+		int type = rd(&seed, 0, 3);
+		if (type == 0) {
+			char *expected = tree_list(tree, path);
+			char *list = shared_tree_list(shared, path);
+			assert(expected ? list && !strcmp(list, expected) : !list);
+			free(expected);
+			free(list);
+		}
+		else if (type == 1) {
+			assert(shared_tree_create(shared, path) == tree_create(tree, path));
+		}
+		else if (type == 2) {
+			assert(shared_tree_remove(shared, path) == tree_remove(tree, path));
+		}
+		else {
+			char *target = get_random_small_path(&seed);
+			assert(shared_tree_move(shared, path, target) == tree_move(tree, path, target));
+			free(target);
+		}
+		free(path);
+	}
+	assert(shared_tree_list(shared, "a") == NULL);
+	assert(shared_tree_create(shared, "/B/") == EINVAL);
+	tree_free(tree);
+
+	// Drugie podłączenie widzi to samo drzewo.
+	SharedTree *other = shared_tree_open(name, &err);
+	assert(other && err == 0);
+	char *list = shared_tree_list(shared, "/");
+	char *other_list = shared_tree_list(other, "/");
+	assert(list && other_list && !strcmp(list, other_list));
+	free(list);
+	free(other_list);
+	shared_tree_close(other);
+	shared_tree_close(shared);
+	assert(shared_tree_unlink(name) == 0);
+}
+
+static void shared_tree_errors(const char *name) {
+	int err;
+	assert(!shared_tree_open(name, &err) && err == ENOENT);
+	SharedTree *tree = shared_tree_new(name, SMALL_SEGMENT_SIZE, &err);
+	assert(tree);
+	assert(!shared_tree_new(name, SMALL_SEGMENT_SIZE, &err) && err == EEXIST);
+
+	// Mały segment w końcu się zapełnia, a zwolnione bloki wracają do użytku.
+	char path[16];
+	int created = 0;
+	for (; created < SMALL_SEGMENT_SIZE; ++created) {
+		sprintf(path, "/%c%c/", 'a' + created / 26, 'a' + created % 26);
+		if ((err = shared_tree_create(tree, path)) != 0) {
+			break;
+		}
+	}
+	assert(err == ENOSPC && created > 10);
+	// Folder /aa/b/b/.../ zajmuje resztę miejsca.
+	char deep[256] = "/aa/";
+	int depth = 0;
+	while (shared_tree_create(tree, strcat(deep, "b/")) == 0) {
+		++depth;
+	}
+	assert(shared_tree_move(tree, "/ab/", "/ac/zz/") == ENOSPC);
+	for (; depth > 0; --depth) {
+		deep[4 + 2 * depth] = '\0';
+		assert(shared_tree_remove(tree, deep) == 0);
+	}
+	sprintf(path, "/%c%c/", 'a' + created / 26, 'a' + created % 26);
+	for (int i = 0; i < created; ++i) {
+		char removed[16];
+		sprintf(removed, "/%c%c/", 'a' + i / 26, 'a' + i % 26);
+		assert(shared_tree_remove(tree, removed) == 0);
+	}
+	assert(shared_tree_create(tree, path) == 0);
+	assert(shared_tree_move(tree, path, "/a/") == 0);
+	char *list = shared_tree_list(tree, "/");
+	assert(list && !strcmp(list, "a"));
+	free(list);
+	shared_tree_close(tree);
+	assert(shared_tree_unlink(name) == 0);
+
+	// Segment, który nie jest drzewem.
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	assert(fd >= 0 && ftruncate(fd, SMALL_SEGMENT_SIZE) == 0);
+	close(fd);
+	assert(!shared_tree_open(name, &err) && err == EINVAL);
+	assert(shared_tree_unlink(name) == 0);
+}
+
+static void run_writer(const char *name, int id) {
+	int err;
+	SharedTree *tree = shared_tree_open(name, &err);
+	assert(tree);
+	char base[8], a[16], b[16];
+	sprintf(base, "/p/%c/", 'a' + id);
+	sprintf(a, "%sa/", base);
+	sprintf(b, "%sb/", base);
+	for (int i = 0; i < ROUNDS; ++i) {
+		assert(shared_tree_create(tree, a) == 0);
+		assert(shared_tree_move(tree, a, b) == 0);
+		char *list = shared_tree_list(tree, base);
+		assert(list && !strcmp(list, "b"));
+		free(list);
+		assert(shared_tree_remove(tree, b) == 0);
+	}
+	assert(shared_tree_create(tree, a) == 0);
+	shared_tree_close(tree);
+}
+
+static void run_reader(const char *name, int id) {
+	int err;
+	SharedTree *tree = shared_tree_open(name, &err);
+	assert(tree);
+	char base[16];
+	sprintf(base, "/p/%c/", 'a' + id);
+	for (int i = 0; i < ROUNDS; ++i) {
+		char *list = shared_tree_list(tree, base);
+		assert(list && (!strcmp(list, "") || !strcmp(list, "a") || !strcmp(list, "b")));
+		free(list);
+		list = shared_tree_list(tree, "/p/");
+		assert(list && !strcmp(list, "a,b,c,d"));
+		free(list);
+	}
+	shared_tree_close(tree);
+}
+
+static void shared_tree_processes(const char *name) {
+	int err;
+	SharedTree *tree = shared_tree_new(name, SEGMENT_SIZE, &err);
+	assert(tree);
+	assert(shared_tree_create(tree, "/p/") == 0);
+	char path[16];
+	for (int i = 0; i < PROCESSES; ++i) {
+		sprintf(path, "/p/%c/", 'a' + i);
+		assert(shared_tree_create(tree, path) == 0);
+	}
+
+	pid_t pids[2 * PROCESSES];
+	for (int i = 0; i < 2 * PROCESSES; ++i) {
+		pids[i] = fork();
+		assert(pids[i] >= 0);
+		if (pids[i] == 0) {
+			if (i < PROCESSES) {
+				run_writer(name, i);
+			}
+			else {
+				run_reader(name, i - PROCESSES);
+			}
+			_exit(0);
+		}
+	}
+	for (int i = 0; i < 2 * PROCESSES; ++i) {
+		int status;
+		assert(waitpid(pids[i], &status, 0) == pids[i]);
+		assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+	}
+
+	for (int i = 0; i < PROCESSES; ++i) {
+		sprintf(path, "/p/%c/", 'a' + i);
+		char *list = shared_tree_list(tree, path);
+		assert(list && !strcmp(list, "a"));
+		free(list);
+	}
+	shared_tree_close(tree);
+	assert(shared_tree_unlink(name) == 0);
+}
+
+void shared_tree() {
+	char name[64];
+	sprintf(name, "/pwfs-shared-tree-%d", (int) getpid());
+	shared_tree_unlink(name);
+	shared_tree_same_as_tree(name);
+	shared_tree_errors(name);
+	shared_tree_processes(name);
+}
@@ -0,0 +1,311 @@
+// Test migawek (tree_snapshot_*).
+//
+// Najpierw bez współbieżności sprawdza, że migawka nie widzi późniejszych zmian (pojedynczych operacji, operacji
+// wsadowych i transakcji), że kilka migawek naraz widzi każda swój stan, liczniki kopii i współdzielonych folderów
+// oraz że zwolnienie ostatniej migawki zwalnia wszystkie kopie. Potem wątki przenoszą swoje elementy między
+// folderami (pojedynczo i transakcjami po dwa), a jeden zmienia nazwę folderu tam i z powrotem. W tym czasie
+// główny wątek robi migawki i sprawdza, że w każdej jest każdy element dokładnie raz, a przejście po poprzedniej
+// migawce daje to samo co zaraz po jej zrobieniu.
+
+#define MOVERS 4
+#define ITEMS 8
+#define FOLDERS 4
+#define ROUNDS 20000
+
+#include "snapshots.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+// Ścieżki odwiedzone przez tree_snapshot_walk, oddzielone przecinkami.
+typedef struct {
+	char *data;
+	size_t length;
+	size_t capacity;
+} Visited;
+
+static void visit(const char *path, void *arg) {
+	Visited *visited = arg;
+	size_t length = strlen(path);
+	if (visited->length + length + 2 > visited->capacity) {
+		visited->capacity = 2 * (visited->length + length + 2);
+		visited->data = realloc(visited->data, visited->capacity);
+		assert(visited->data);
+	}
+	if (visited->length > 0) {
+		visited->data[visited->length++] = ',';
+	}
+	memcpy(visited->data + visited->length, path, length + 1);
+	visited->length += length;
+}
+
+static char *walk(TreeSnapshot *snapshot, const char *path) {
+	Visited visited = {.data = NULL, .length = 0, .capacity = 0};
+	assert(tree_snapshot_walk(snapshot, path, visit, &visited) == 0);
+	return visited.data;
+}
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static void check_walk(TreeSnapshot *snapshot, const char *path, const char *expected) {
+	char *visited = walk(snapshot, path);
+	assert(!strcmp(visited, expected));
+	free(visited);
+}
+
+static void snapshots_sequential() {
+	Tree *tree = tree_new();
+	const char *initial[] = {"/a/", "/a/b/", "/c/", "/e/", "/e/f/", "/e/g/"};
+	for (int i = 0; i < 6; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+
+	TreeSnapshot *first = tree_snapshot(tree);
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == 0);
+
+	assert(tree_create(tree, "/d/") == 0);
+	assert(tree_remove(tree, "/a/b/") == 0);
+	assert(tree_move(tree, "/c/", "/a/c/") == 0);
+	assert(tree_create(tree, "/a/c/x/") == 0);
+	assert(tree_move(tree, "/e/f/", "/e/h/") == 0);
+
+	check_list(tree_list(tree, "/"), "a,d,e");
+	check_list(tree_list(tree, "/a/"), "c");
+	check_list(tree_snapshot_list(first, "/"), "a,c,e");
+	check_list(tree_snapshot_list(first, "/a/"), "b");
+	check_list(tree_snapshot_list(first, "/a/b/"), "");
+	check_list(tree_snapshot_list(first, "/c/"), "");
+	check_list(tree_snapshot_list(first, "/e/"), "f,g");
+	check_list(tree_snapshot_list(first, "/d/"), NULL);
+	check_list(tree_snapshot_list(first, "/a/c/"), NULL);
+	check_list(tree_snapshot_list(first, "bad"), NULL);
+	check_walk(first, "/", "/,/a/,/a/b/,/c/,/e/,/e/f/,/e/g/");
+	check_walk(first, "/e/", "/e/,/e/f/,/e/g/");
+	assert(tree_snapshot_walk(first, "/d/", visit, NULL) == ENOENT);
+	assert(tree_snapshot_walk(first, "/a", visit, NULL) == EINVAL);
+
+	// Zmienione są dzieci /, /a/, /e/ (nazwa f) i /c/ (po przeniesieniu dostał dziecko).
+	TreeSnapshotStats snapshot_stats;
+	tree_snapshot_get_stats(first, &snapshot_stats);
+	assert(snapshot_stats.folders == 7);
+	assert(snapshot_stats.copied == 4 && snapshot_stats.shared == 3);
+	assert(snapshot_stats.copy_bytes > 0);
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == 4 && stats.snapshot_copy_bytes == snapshot_stats.copy_bytes);
+
+	// Druga migawka widzi stan z chwili zrobienia, a pierwsza nadal swój.
+	TreeSnapshot *second = tree_snapshot(tree);
+	const char *batch[] = {"/d/p/", "/d/q/", "/e/r/"};
+	int errors[3];
+	tree_create_batch(tree, batch, 3, errors);
+	assert(errors[0] == 0 && errors[1] == 0 && errors[2] == 0);
+	TreeTransaction *transaction = tree_transaction_new();
+	tree_transaction_move(transaction, "/a/", "/t/");
+	tree_transaction_move(transaction, "/d/", "/a/");
+	tree_transaction_move(transaction, "/t/", "/d/");
+	tree_transaction_remove(transaction, "/e/g/");
+	assert(tree_transaction_commit(tree, transaction, NULL) == 0);
+	tree_transaction_free(transaction);
+
+	check_list(tree_list(tree, "/a/"), "p,q");
+	check_walk(second, "/", "/,/a/,/a/c/,/a/c/x/,/d/,/e/,/e/g/,/e/h/");
+	check_walk(first, "/", "/,/a/,/a/b/,/c/,/e/,/e/f/,/e/g/");
+
+	// Kolejna zmiana tego samego folderu nie kopiuje go ponownie.
+	tree_get_stats(tree, &stats);
+	size_t copies = stats.snapshot_copies;
+	assert(tree_create(tree, "/e/s/") == 0);
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == copies);
+
+	// Po zwolnieniu pierwszej migawki zostają tylko kopie potrzebne drugiej.
+	tree_snapshot_free(first);
+	tree_snapshot_get_stats(second, &snapshot_stats);
+	assert(snapshot_stats.folders == 8);
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == snapshot_stats.copied);
+	assert(stats.snapshot_copy_bytes == snapshot_stats.copy_bytes);
+	check_walk(second, "/", "/,/a/,/a/c/,/a/c/x/,/d/,/e/,/e/g/,/e/h/");
+
+	tree_snapshot_free(second);
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == 0 && stats.snapshot_copy_bytes == 0);
+
+	// Bez migawek zmiany niczego nie kopiują.
+	assert(tree_create(tree, "/z/") == 0);
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == 0);
+	TreeSnapshot *third = tree_snapshot(tree);
+	check_walk(third, "/a/", "/a/,/a/p/,/a/q/");
+	tree_snapshot_free(third);
+
+	tree_free(tree);
+}
+
+static atomic_int movers_done;
+// Obecna nazwa folderu 0 (zmieniana przez wątek zmieniający nazwę).
+static atomic_char first_folder;
+
+static void folder_path(char *s, int folder) {
+	sprintf(s, "/d/%c/", folder == 0 ? atomic_load(&first_folder) : 'a' + folder);
+}
+
+static void item_path(char *s, int folder, int mover, int item) {
+	folder_path(s, folder);
+	sprintf(s + strlen(s), "i%c%c/", 'a' + mover, 'a' + item);
+}
+
+// Przenosi swoje elementy do losowych folderów - co drugi raz dwa naraz w jednej transakcji.
+static void* run_mover(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	int where[ITEMS];
+	for (int item = 0; item < ITEMS; ++item) {
+		where[item] = item % FOLDERS;
+	}
+	for (int round = 0; round < ROUNDS; ++round) {
+		char source[32], target[32];
+		int item = rand_r(&seed) % ITEMS, folder = rand_r(&seed) % FOLDERS;
+		item_path(source, where[item], thread_data->id, item);
+		item_path(target, folder, thread_data->id, item);
+		if (round % 2 == 0) {
+			// Folder 0 mógł właśnie zmienić nazwę - wtedy element zostaje na miejscu.
+			int err = tree_move(thread_data->tree, source, target);
+			assert(err == 0 || err == ENOENT);
+			if (err == 0) {
+				where[item] = folder;
+			}
+			continue;
+		}
+
+		int other = (item + 1) % ITEMS, other_folder = rand_r(&seed) % FOLDERS;
+		char other_source[32], other_target[32];
+		item_path(other_source, where[other], thread_data->id, other);
+		item_path(other_target, other_folder, thread_data->id, other);
+		TreeTransaction *transaction = tree_transaction_new();
+		tree_transaction_move(transaction, source, target);
+		tree_transaction_move(transaction, other_source, other_target);
+		int err = tree_transaction_commit(thread_data->tree, transaction, NULL);
+		tree_transaction_free(transaction);
+		assert(err == 0 || err == ENOENT);
+		if (err == 0) {
+			where[item] = folder;
+			where[other] = other_folder;
+		}
+	}
+	atomic_fetch_add(&movers_done, 1);
+	return NULL;
+}
+
+static void* run_renamer(void *data) {
+	ThreadData *thread_data = data;
+	while (atomic_load(&movers_done) < MOVERS) {
+		bool forward = atomic_load(&first_folder) == 'a';
+		assert(tree_move(thread_data->tree, forward ? "/d/a/" : "/d/z/", forward ? "/d/z/" : "/d/a/") == 0);
+		atomic_store(&first_folder, forward ? 'z' : 'a');
+	}
+	return NULL;
+}
+
+// Sprawdza, że w migawce są wszystkie foldery i każdy element dokładnie raz (w jakimś folderze).
+static void check_items(const char *visited) {
+	bool seen[MOVERS][ITEMS] = {{false}};
+	int folders = 0, items = 0;
+	// Ścieżki elementów mają postać /d/?/i??/, a folderów /d/?/.
+	for (const char *path = visited; path; path = strchr(path, ',') ? strchr(path, ',') + 1 : NULL) {
+		if (strncmp(path, "/d/", 3) != 0 || path[3] == ',' || path[3] == '\0') {
+			continue;
+		}
+		assert(path[4] == '/');
+		if (path[5] == 'i') {
+			assert(path[8] == '/');
+			int mover = path[6] - 'a', item = path[7] - 'a';
+			assert(mover >= 0 && mover < MOVERS && item >= 0 && item < ITEMS && !seen[mover][item]);
+			seen[mover][item] = true;
+			items++;
+		}
+		else {
+			folders++;
+		}
+	}
+	assert(folders == FOLDERS && items == MOVERS * ITEMS);
+}
+
+void snapshots() {
+	snapshots_sequential();
+
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/d/") == 0);
+	atomic_store(&first_folder, 'a');
+	for (int folder = 0; folder < FOLDERS; ++folder) {
+		char path[32];
+		folder_path(path, folder);
+		assert(tree_create(tree, path) == 0);
+	}
+	for (int mover = 0; mover < MOVERS; ++mover) {
+		for (int item = 0; item < ITEMS; ++item) {
+			char path[32];
+			item_path(path, item % FOLDERS, mover, item);
+			assert(tree_create(tree, path) == 0);
+		}
+	}
+
+	atomic_store(&movers_done, 0);
+	pthread_t th[MOVERS + 1];
+	ThreadData data[MOVERS + 1];
+	for (int i = 0; i < MOVERS + 1; ++i) {
+		data[i].tree = tree;
+		data[i].id = i;
+		assert(pthread_create(&th[i], NULL, i < MOVERS ? run_mover : run_renamer, &data[i]) == 0);
+	}
+
+	TreeSnapshot *previous = NULL;
+	char *previous_walk = NULL;
+	int taken = 0;
+	while (atomic_load(&movers_done) < MOVERS) {
+		TreeSnapshot *snapshot = tree_snapshot(tree);
+		char *visited = walk(snapshot, "/");
+		check_items(visited);
+		taken++;
+
+		if (previous) {
+			char *again = walk(previous, "/");
+			assert(!strcmp(again, previous_walk));
+			free(again);
+			tree_snapshot_free(previous);
+			free(previous_walk);
+		}
+		previous = snapshot;
+		previous_walk = visited;
+	}
+	tree_snapshot_free(previous);
+	free(previous_walk);
+
+	for (int i = 0; i < MOVERS + 1; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+	// Przynajmniej jedna migawka powstała w trakcie przenoszenia.
+	assert(taken > 0);
+
+	TreeStats stats;
+	tree_get_stats(tree, &stats);
+	assert(stats.snapshot_copies == 0 && stats.snapshot_copy_bytes == 0);
+	tree_free(tree);
+}
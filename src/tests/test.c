@@ -5,6 +5,23 @@
 #include "concurrent_same_as_some_sequential.h"
 #include "liveness.h"
 #include "move_and_remove.h"
+#include "zero_alloc.h"
+#include "remove_and_list.h"
+#include "move_while_busy.h"
+#include "concurrent_renames.h"
+#include "dir_handles.h"
+#include "dentry_cache.h"
+#include "hashmap_misses.h"
+#include "batch_ops.h"
+#include "transactions.h"
+#include "snapshots.h"
+#include "remove_recursive.h"
+#include "copy.h"
+#include "journal.h"
+#include "dump.h"
+#include "checkpoint.h"
+#include "server.h"
+#include "shared_tree.h"
 
 #include <stdio.h>
 
@@ -16,6 +33,23 @@ int main() {
 	fprintf(stderr, "Each test/subtest should run in less than 1 second.\n");
 	RUN_TEST(sequential_small);
 	RUN_TEST(sequential_big_random);
+	RUN_TEST(zero_alloc);
+	RUN_TEST(hashmap_misses);
+	RUN_TEST(remove_and_list);
+	RUN_TEST(move_while_busy);
+	RUN_TEST(concurrent_renames);
+	RUN_TEST(dir_handles);
+	RUN_TEST(dentry_cache);
+	RUN_TEST(batch_ops);
+	RUN_TEST(transactions);
+	RUN_TEST(snapshots);
+	RUN_TEST(remove_recursive);
+	RUN_TEST(copy);
+	RUN_TEST(journal);
+	RUN_TEST(dump);
+	RUN_TEST(checkpoint);
+	RUN_TEST(server);
+	RUN_TEST(shared_tree);
 //	RUN_TEST(valid_path);
 	RUN_TEST(deadlock);
 //    RUN_TEST(move_and_remove);
@@ -0,0 +1,356 @@
+// Test transakcji (tree_transaction_*).
+//
+// Najpierw bez współbieżności sprawdza zamianę folderów, tworzenie drzewa w jednej transakcji, wycofywanie po błędzie
+// dowolnej operacji (także błędu niezależnego od drzewa), operacje widzące skutki wcześniejszych i operacje w folderze
+// przeniesionym przez tę samą transakcję. Potem wątki w pętli zamieniają foldery, przełączają pary folderów
+// (tworzą jeden i usuwają drugi) i przenoszą elementy między folderami na różnych głębokościach, a czytelnicy
+// sprawdzają, że nie widać stanów pośrednich. W tym czasie jeden wątek przenosi korzeń całej struktury tam
+// i z powrotem, więc transakcje są unieważniane, a część z nich trafia w brakujące ścieżki.
+
+#define SWAPPERS 2
+#define TOGGLERS 2
+#define SHUFFLERS 4
+#define ITEMS 16
+#define ROUNDS 400
+
+#include "transactions.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+	Tree *tree;
+	int id;
+} ThreadData;
+
+static atomic_int workers_done;
+// Korzeń, pod którym jest w tej chwili struktura ('m' albo 'n').
+static atomic_char root_name;
+
+// Foldery, między którymi przenoszone są elementy (ścieżki bez korzenia).
+static const char *shuffle_folders[] = {"/d/", "/d/a/", "/d/b/", "/d/a/c/", "/d/b/e/f/", "/g/"};
+#define SHUFFLE_FOLDERS (sizeof(shuffle_folders) / sizeof(shuffle_folders[0]))
+
+static void check_list(char *list, const char *expected) {
+	assert(expected ? list && !strcmp(list, expected) : !list);
+	free(list);
+}
+
+static int commit_one(Tree *tree, TreeTransaction *transaction, size_t *failed) {
+	int err = tree_transaction_commit(tree, transaction, failed);
+	tree_transaction_free(transaction);
+	return err;
+}
+
+static void transactions_sequential() {
+	Tree *tree = tree_new();
+	size_t failed;
+	const char *initial[] = {"/a/", "/a/x/", "/b/", "/b/y/"};
+	for (int i = 0; i < 4; ++i) {
+		assert(tree_create(tree, initial[i]) == 0);
+	}
+
+	TreeTransaction *transaction = tree_transaction_new();
+	assert(tree_transaction_commit(tree, transaction, &failed) == 0);
+	tree_transaction_free(transaction);
+
+	// Zamiana folderów przez folder tymczasowy.
+	transaction = tree_transaction_new();
+	tree_transaction_move(transaction, "/a/", "/t/");
+	tree_transaction_move(transaction, "/b/", "/a/");
+	tree_transaction_move(transaction, "/t/", "/b/");
+	assert(commit_one(tree, transaction, &failed) == 0);
+	check_list(tree_list(tree, "/"), "a,b");
+	check_list(tree_list(tree, "/a/"), "y");
+	check_list(tree_list(tree, "/b/"), "x");
+
+	// Drzewo tworzone w całości.
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/n/");
+	tree_transaction_create(transaction, "/n/a/");
+	tree_transaction_create(transaction, "/n/a/b/");
+	tree_transaction_create(transaction, "/n/c/");
+	assert(commit_one(tree, transaction, &failed) == 0);
+	check_list(tree_list(tree, "/n/"), "a,c");
+	check_list(tree_list(tree, "/n/a/"), "b");
+
+	// ... albo wcale: każda z operacji po kolei zawodzi, a drzewo się nie zmienia.
+	const char *paths[] = {"/m/", "/m/a/", "/m/a/b/", "/zz/q/"};
+	for (int fail_at = 0; fail_at < 4; ++fail_at) {
+		transaction = tree_transaction_new();
+		for (int i = 0; i < 4; ++i) {
+			tree_transaction_create(transaction, paths[i == fail_at ? 3 : i]);
+		}
+		failed = 100;
+		assert(commit_one(tree, transaction, &failed) == ENOENT);
+		assert(failed == (size_t) fail_at);
+		check_list(tree_list(tree, "/"), "a,b,n");
+	}
+
+	// Błędy niezależne od drzewa też wycofują wcześniejsze operacje.
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/p/");
+	tree_transaction_move(transaction, "/a/", "/p/a/");
+	tree_transaction_create(transaction, "bad");
+	assert(commit_one(tree, transaction, &failed) == EINVAL && failed == 2);
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/p/");
+	tree_transaction_remove(transaction, "/");
+	assert(commit_one(tree, transaction, &failed) == EBUSY && failed == 1);
+	transaction = tree_transaction_new();
+	tree_transaction_move(transaction, "/a/", "/b/a/");
+	tree_transaction_move(transaction, "/b/", "/b/a/b/");
+	assert(commit_one(tree, transaction, &failed) == -1 && failed == 1);
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/p/");
+	tree_transaction_create(transaction, "/");
+	assert(commit_one(tree, transaction, &failed) == EEXIST && failed == 1);
+	check_list(tree_list(tree, "/"), "a,b,n");
+	check_list(tree_list(tree, "/b/"), "x");
+
+	// Operacje widzą skutki wcześniejszych.
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/d/");
+	tree_transaction_create(transaction, "/d/");
+	assert(commit_one(tree, transaction, &failed) == EEXIST && failed == 1);
+	transaction = tree_transaction_new();
+	tree_transaction_remove(transaction, "/n/a/b/");
+	tree_transaction_remove(transaction, "/n/a/");
+	tree_transaction_remove(transaction, "/n/c/");
+	tree_transaction_remove(transaction, "/n/");
+	tree_transaction_remove(transaction, "/n/");
+	assert(commit_one(tree, transaction, &failed) == ENOENT && failed == 4);
+	check_list(tree_list(tree, "/n/a/"), "b");
+	transaction = tree_transaction_new();
+	tree_transaction_remove(transaction, "/a/y/");
+	tree_transaction_remove(transaction, "/b/");
+	assert(commit_one(tree, transaction, &failed) == ENOTEMPTY && failed == 1);
+	check_list(tree_list(tree, "/a/"), "y");
+	transaction = tree_transaction_new();
+	tree_transaction_remove(transaction, "/n/a/b/");
+	tree_transaction_remove(transaction, "/n/a/");
+	tree_transaction_remove(transaction, "/n/c/");
+	tree_transaction_remove(transaction, "/n/");
+	assert(commit_one(tree, transaction, &failed) == 0);
+	check_list(tree_list(tree, "/"), "a,b");
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/a/k/");
+	tree_transaction_create(transaction, "/a/k/l/");
+	tree_transaction_remove(transaction, "/a/k/l/");
+	tree_transaction_remove(transaction, "/a/k/");
+	tree_transaction_remove(transaction, "/a/y/");
+	tree_transaction_create(transaction, "/a/y/");
+	assert(commit_one(tree, transaction, &failed) == 0);
+	check_list(tree_list(tree, "/a/"), "y");
+
+	// Operacje w folderze przeniesionym przez tę samą transakcję i na jego starym miejscu.
+	transaction = tree_transaction_new();
+	tree_transaction_move(transaction, "/a/", "/c/");
+	tree_transaction_create(transaction, "/c/y/z/");
+	tree_transaction_create(transaction, "/a/");
+	tree_transaction_move(transaction, "/b/x/", "/c/y/z/x/");
+	tree_transaction_move(transaction, "/c/", "/a/c/");
+	tree_transaction_remove(transaction, "/b/");
+	assert(commit_one(tree, transaction, &failed) == 0);
+	check_list(tree_list(tree, "/"), "a");
+	check_list(tree_list(tree, "/a/c/y/z/"), "x");
+	transaction = tree_transaction_new();
+	tree_transaction_move(transaction, "/a/c/", "/c/");
+	tree_transaction_remove(transaction, "/c/y/z/x/");
+	tree_transaction_remove(transaction, "/a/c/y/z/");
+	assert(commit_one(tree, transaction, &failed) == ENOENT && failed == 2);
+	check_list(tree_list(tree, "/a/c/y/z/"), "x");
+
+	// Ojciec ścieżki nie istnieje i nie jest tworzony przez transakcję.
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/q/r/s/");
+	assert(commit_one(tree, transaction, &failed) == ENOENT && failed == 0);
+
+	// Transakcję można zatwierdzić ponownie.
+	transaction = tree_transaction_new();
+	tree_transaction_create(transaction, "/w/");
+	assert(tree_transaction_commit(tree, transaction, NULL) == 0);
+	assert(tree_transaction_commit(tree, transaction, &failed) == EEXIST && failed == 0);
+	tree_transaction_free(transaction);
+	check_list(tree_list(tree, "/"), "a,w");
+
+	tree_free(tree);
+}
+
+static void root_path(char *s, const char *rest) {
+	s[0] = '/';
+	s[1] = atomic_load(&root_name);
+	strcpy(s + 2, rest);
+}
+
+// Zamienia foldery /s/x/ i /s/y/ (w /s/x/ jest zawsze a, w /s/y/ - b albo odwrotnie).
+static void* run_swapper(void *data) {
+	ThreadData *thread_data = data;
+	char source[16], temp[16], target[16];
+	for (int round = 0; round < ROUNDS; ++round) {
+		TreeTransaction *transaction = tree_transaction_new();
+		root_path(source, "/s/x/");
+		root_path(temp, "/s/t/");
+		root_path(target, "/s/y/");
+		tree_transaction_move(transaction, source, temp);
+		tree_transaction_move(transaction, target, source);
+		tree_transaction_move(transaction, temp, target);
+		int err = commit_one(thread_data->tree, transaction, NULL);
+		assert(err == 0 || err == ENOENT);
+		(void) err;
+	}
+	atomic_fetch_add(&workers_done, 1);
+	return NULL;
+}
+
+// Przełącza swoją parę folderów w /f/: tworzy jeden i usuwa drugi.
+static void* run_toggler(void *data) {
+	ThreadData *thread_data = data;
+	char on[] = "/m/f/xx/", off[] = "/m/f/xx/";
+	on[5] = off[5] = 'a' + thread_data->id;
+	on[6] = 'a';
+	off[6] = 'b';
+	for (int round = 0; round < ROUNDS; ++round) {
+		TreeTransaction *transaction = tree_transaction_new();
+		on[1] = off[1] = atomic_load(&root_name);
+		tree_transaction_create(transaction, round % 2 ? off : on);
+		tree_transaction_remove(transaction, round % 2 ? on : off);
+		int err = commit_one(thread_data->tree, transaction, NULL);
+		// Po nieudanej transakcji (spod starego korzenia) para jest w poprzednim stanie - ponawiamy przełączenie.
+		if (err) {
+			assert(err == ENOENT);
+			round--;
+		}
+	}
+	atomic_fetch_add(&workers_done, 1);
+	return NULL;
+}
+
+static void write_item(char *s, const char *folder, int item) {
+	root_path(s, folder);
+	sprintf(s + strlen(s), "i%c/", 'a' + item);
+}
+
+// Przenosi po dwa elementy do losowych folderów. Element może być już gdzie indziej - wtedy transakcja się nie udaje.
+static void* run_shuffler(void *data) {
+	ThreadData *thread_data = data;
+	unsigned seed = thread_data->id;
+	for (int round = 0; round < ROUNDS; ++round) {
+		TreeTransaction *transaction = tree_transaction_new();
+		for (int i = 0; i < 2; ++i) {
+			char source[64], target[64];
+			int item = rand_r(&seed) % ITEMS;
+			write_item(source, shuffle_folders[rand_r(&seed) % SHUFFLE_FOLDERS], item);
+			write_item(target, shuffle_folders[rand_r(&seed) % SHUFFLE_FOLDERS], item);
+			tree_transaction_move(transaction, source, target);
+		}
+		int err = commit_one(thread_data->tree, transaction, NULL);
+		assert(err == 0 || err == ENOENT || err == EEXIST);
+		(void) err;
+	}
+	atomic_fetch_add(&workers_done, 1);
+	return NULL;
+}
+
+// Liczy elementy (nazwy zaczynające się od 'i') w liście folderu.
+static int count_items(const char *list) {
+	int count = 0;
+	for (const char *c = list; *c; ++c) {
+		count += c[0] == 'i' && (c == list || c[-1] == ',');
+	}
+	return count;
+}
+
+static void* run_reader(void *data) {
+	ThreadData *thread_data = data;
+	char path[16];
+	while (atomic_load(&workers_done) < SWAPPERS + TOGGLERS + SHUFFLERS) {
+		root_path(path, "/s/");
+		char *list = tree_list(thread_data->tree, path);
+		assert(!list || !strcmp(list, "x,y"));
+		free(list);
+
+		root_path(path, "/f/");
+		list = tree_list(thread_data->tree, path);
+		if (list) {
+			// Z każdej pary widać dokładnie jeden folder.
+			assert(strlen(list) == 3 * TOGGLERS - 1);
+			for (int i = 0; i < TOGGLERS; ++i) {
+				assert(list[3 * i] == 'a' + i && (list[3 * i + 1] == 'a' || list[3 * i + 1] == 'b'));
+			}
+		}
+		free(list);
+	}
+	return NULL;
+}
+
+void transactions() {
+	transactions_sequential();
+
+	Tree *tree = tree_new();
+	const char *folders[] = {"/m/", "/m/s/", "/m/s/x/", "/m/s/x/a/", "/m/s/y/", "/m/s/y/b/", "/m/f/", "/m/d/",
+							 "/m/d/a/", "/m/d/b/", "/m/d/a/c/", "/m/d/b/e/", "/m/d/b/e/f/", "/m/g/"};
+	for (size_t i = 0; i < sizeof(folders) / sizeof(folders[0]); ++i) {
+		assert(tree_create(tree, folders[i]) == 0);
+	}
+	atomic_store(&root_name, 'm');
+	char path[64];
+	for (int i = 0; i < TOGGLERS; ++i) {
+		sprintf(path, "/m/f/%cb/", 'a' + i);
+		assert(tree_create(tree, path) == 0);
+	}
+	for (int i = 0; i < ITEMS; ++i) {
+		write_item(path, shuffle_folders[i % SHUFFLE_FOLDERS], i);
+		assert(tree_create(tree, path) == 0);
+	}
+
+	atomic_store(&workers_done, 0);
+	pthread_t th[SWAPPERS + TOGGLERS + SHUFFLERS + 1];
+	ThreadData data[SWAPPERS + TOGGLERS + SHUFFLERS + 1];
+	for (int i = 0; i < SWAPPERS + TOGGLERS + SHUFFLERS + 1; ++i) {
+		data[i].tree = tree;
+		data[i].id = i < SWAPPERS ? i : i < SWAPPERS + TOGGLERS ? i - SWAPPERS : i;
+		void *(*run)(void *) = i < SWAPPERS ? run_swapper
+							 : i < SWAPPERS + TOGGLERS ? run_toggler
+							 : i < SWAPPERS + TOGGLERS + SHUFFLERS ? run_shuffler : run_reader;
+		assert(pthread_create(&th[i], NULL, run, &data[i]) == 0);
+	}
+
+	// Przenosimy korzeń struktury tam i z powrotem, dopóki pracują wątki.
+	for (int i = 0; atomic_load(&workers_done) < SWAPPERS + TOGGLERS + SHUFFLERS; ++i) {
+		bool forward = i % 2 == 0;
+		assert(tree_move(tree, forward ? "/m/" : "/n/", forward ? "/n/" : "/m/") == 0);
+		atomic_store(&root_name, forward ? 'n' : 'm');
+	}
+
+	for (int i = 0; i < SWAPPERS + TOGGLERS + SHUFFLERS + 1; ++i) {
+		assert(pthread_join(th[i], NULL) == 0);
+	}
+
+	// Każdy element jest w dokładnie jednym folderze.
+	int items = 0;
+	for (size_t i = 0; i < SHUFFLE_FOLDERS; ++i) {
+		root_path(path, shuffle_folders[i]);
+		char *list = tree_list(tree, path);
+		assert(list);
+		items += count_items(list);
+		free(list);
+	}
+	assert(items == ITEMS);
+	// Liczba przełączeń jest parzysta, więc każda para wróciła do stanu początkowego.
+	root_path(path, "/f/");
+	char *list = tree_list(tree, path);
+	assert(list && strlen(list) == 3 * TOGGLERS - 1);
+	for (int i = 0; i < TOGGLERS; ++i) {
+		assert(list[3 * i] == 'a' + i && list[3 * i + 1] == 'b');
+	}
+	free(list);
+	tree_free(tree);
+}
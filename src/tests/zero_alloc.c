@@ -0,0 +1,83 @@
+// Sprawdza, że znalezienie wierzchołka na ścieżce nie alokuje pamięci na stercie.
+//
+// Plik wykonywalny z testami jest linkowany z -Wl,--wrap=malloc (oraz calloc i realloc),
+// więc każde wywołanie tych funkcji z bibliotek przechodzi przez poniższe opakowania
+// i jest zliczane. Operacje, które kończą się błędem po przejściu ścieżki, nie powinny
+// zaalokować niczego; udane tree_create alokuje tylko nowy wierzchołek (wraz z jego
+// hash-mapą i kopią nazwy w hash-mapie rodzica).
+
+#include "zero_alloc.h"
+#include "../Tree.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static atomic_size_t allocations;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+	atomic_fetch_add(&allocations, 1);
+	return __real_realloc(ptr, size);
+}
+
+// Zwraca liczbę alokacji wykonanych od poprzedniego wywołania.
+static size_t allocations_since_last_call() {
+	static size_t last;
+	size_t now = atomic_load(&allocations);
+	size_t result = now - last;
+	last = now;
+	return result;
+}
+
+void zero_alloc() {
+	Tree *tree = tree_new();
+	assert(tree_create(tree, "/a/") == 0);
+	assert(tree_create(tree, "/a/b/") == 0);
+	assert(tree_create(tree, "/a/b/c/") == 0);
+	assert(tree_create(tree, "/a/b/c/d/") == 0);
+	assert(tree_create(tree, "/e/") == 0);
+
+	allocations_since_last_call();
+
+	assert(tree_list(tree, "/a/b/c/x/") == NULL);
+	assert(tree_list(tree, "/a/b//") == NULL);
+	assert(tree_create(tree, "/a/b/c/") == EEXIST);
+	assert(tree_create(tree, "/a/b/x/y/") == ENOENT);
+	assert(tree_create(tree, "/") == EEXIST);
+	assert(tree_remove(tree, "/a/b/c/x/") == ENOENT);
+	assert(tree_remove(tree, "/a/b/c/") == ENOTEMPTY);
+	assert(tree_remove(tree, "/") == EBUSY);
+	assert(tree_move(tree, "/a/b/x/", "/e/x/") == ENOENT);
+	assert(tree_move(tree, "/a/b/c/", "/e/x/y/") == ENOENT);
+	assert(tree_move(tree, "/a/b/", "/e/") == EEXIST);
+	assert(tree_move(tree, "/a/", "/a/b/c/d/e/") < 0);
+	assert(tree_move(tree, "/a/b/c/", "/a/b/c/") == 0);
+	assert(allocations_since_last_call() == 0);
+
+	// Usunięcie tylko zwalnia pamięć.
+	assert(tree_remove(tree, "/a/b/c/d/") == 0);
+	assert(allocations_since_last_call() == 0);
+
+	// Upewniamy się, że alokacje w ogóle są zliczane.
+	assert(tree_create(tree, "/a/b/c/d/") == 0);
+	assert(allocations_since_last_call() > 0);
+
+	tree_free(tree);
+}
@@ -0,0 +1,69 @@
+// The tree server daemon: tree_server <socket> [workers] [journal]
+// Serves one tree at the Unix domain socket until SIGINT or SIGTERM. With a journal, the tree is
+// recovered from it (and from its checkpoint, <journal>.checkpoint) at start, all changes are
+// journaled with group commit, and checkpoints are made in the background.
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Tree.h"
+#include "err.h"
+#include "server.h"
+
+#define DEFAULT_WORKERS 4
+#define MAX_WORKERS 256
+#define CHECKPOINT_JOURNAL_BYTES (64 << 20)
+
+int main(int argc, char **argv) {
+    int workers = argc > 2 ? atoi(argv[2]) : DEFAULT_WORKERS;
+    if (argc < 2 || argc > 4 || workers < 1 || workers > MAX_WORKERS) {
+        fprintf(stderr, "usage: %s <socket> [workers] [journal]\n", argv[0]);
+        return 1;
+    }
+
+    // The signals are taken by sigwait below, so every thread started later has them blocked.
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    int err;
+    if ((err = pthread_sigmask(SIG_BLOCK, &signals, NULL)) != 0) {
+        syserr("sigmask failed");
+    }
+
+    Tree *tree = tree_new();
+    if (argc > 3) {
+        const char *journal = argv[3];
+        char *checkpoint = malloc(strlen(journal) + sizeof(".checkpoint"));
+        if (!checkpoint) {
+            fatal("allocation failed");
+        }
+        sprintf(checkpoint, "%s.checkpoint", journal);
+        if ((err = tree_recover(tree, checkpoint, journal)) != 0) {
+            fprintf(stderr, "cannot recover from %s: %s\n", journal, strerror(err));
+            return 1;
+        }
+        if ((err = tree_journal_open(tree, journal, TREE_JOURNAL_GROUP_COMMIT)) != 0) {
+            fprintf(stderr, "cannot open journal %s: %s\n", journal, strerror(err));
+            return 1;
+        }
+        tree_checkpoint_start(tree, checkpoint, CHECKPOINT_JOURNAL_BYTES);
+        free(checkpoint);
+    }
+
+    Server *server = server_start(tree, argv[1], workers, &err);
+    if (!server) {
+        fprintf(stderr, "cannot listen at %s: %s\n", argv[1], strerror(err));
+        return 1;
+    }
+    int signal;
+    if ((err = sigwait(&signals, &signal)) != 0) {
+        syserr("sigwait failed");
+    }
+    server_stop(server);
+    tree_free(tree);
+    return 0;
+}